@@ -0,0 +1,580 @@
+// Microbenchmarks for libvsf
+//
+// This is a small, self-contained harness modelled after Google Benchmark
+// (benchmarks are registered with a name & a sweep of arguments, the number
+// of iterations is scaled until a minimum runtime is reached, and results can
+// be written as JSON that follows Google Benchmark's schema). We avoid the
+// actual dependency to keep the build simple.
+//
+// Build and run with ``make bench``. The executable accepts:
+//   --filter=<substring>  only run benchmarks whose names contain substring
+//   --min_time=<seconds>  minimum measurement time per benchmark (default 0.2)
+//   --out=<path>          write JSON results to path (default: stdout)
+//   --quick               use a reduced sweep of arguments
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vsf.hpp"
+#include "accumulators.hpp"
+#include "compound_accumulator.hpp"
+#include "accum_col_variant.hpp"
+#include "partition.hpp"
+#include "spatial_sort.hpp"
+#include "thread_pool.hpp"
+
+namespace{
+
+  // ----------------------------------------------------------------------
+  // Harness
+  // ----------------------------------------------------------------------
+
+  template<typename T>
+  inline void do_not_optimize(T const& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const T* sink;
+    sink = &value;
+#endif
+  }
+
+  /// Controls the timed loop of a benchmark (analogous to
+  /// benchmark::State)
+  class BenchState{
+  public:
+    BenchState(std::uint64_t max_iterations)
+      : max_iterations_(max_iterations), iterations_(0), started_(false),
+        items_per_iteration_(0), counters_()
+    { }
+
+    /// Returns true until the requested number of iterations are complete.
+    /// Timing starts at the first call (so setup before the loop is
+    /// excluded).
+    bool keep_running() noexcept {
+      if (!started_) {
+        started_ = true;
+        real_start_ = std::chrono::steady_clock::now();
+        cpu_start_ = std::clock();
+      }
+      if (iterations_ < max_iterations_) {
+        iterations_++;
+        return true;
+      }
+      real_stop_ = std::chrono::steady_clock::now();
+      cpu_stop_ = std::clock();
+      return false;
+    }
+
+    /// Set the number of items (e.g. pairs of points) processed per iteration
+    void set_items_per_iteration(double val) noexcept
+    { items_per_iteration_ = val; }
+
+    /// Record an extra value that is included in the output
+    void set_counter(const std::string& key, double val)
+    { counters_[key] = val; }
+
+    std::uint64_t iterations() const noexcept { return iterations_; }
+    double real_seconds() const noexcept
+    { return std::chrono::duration<double>(real_stop_ - real_start_).count(); }
+    double cpu_seconds() const noexcept
+    { return double(cpu_stop_ - cpu_start_) / CLOCKS_PER_SEC; }
+    double items_per_iteration() const noexcept
+    { return items_per_iteration_; }
+    const std::map<std::string, double>& counters() const noexcept
+    { return counters_; }
+
+  private:
+    std::uint64_t max_iterations_;
+    std::uint64_t iterations_;
+    bool started_;
+    std::chrono::steady_clock::time_point real_start_, real_stop_;
+    std::clock_t cpu_start_, cpu_stop_;
+    double items_per_iteration_;
+    std::map<std::string, double> counters_;
+  };
+
+  struct BenchCase{
+    std::string name;
+    std::function<void(BenchState&)> func;
+  };
+
+  std::vector<BenchCase>& registry(){
+    static std::vector<BenchCase> out;
+    return out;
+  }
+
+  void register_bench(std::string name, std::function<void(BenchState&)> f)
+  { registry().push_back({name, f}); }
+
+  struct BenchRslt{
+    std::string name;
+    std::uint64_t iterations;
+    double real_ns, cpu_ns, items_per_second;
+    std::map<std::string, double> counters;
+  };
+
+  /// Runs a benchmark, growing the number of iterations until the runtime
+  /// exceeds min_time (this mirrors Google Benchmark's strategy)
+  BenchRslt run_bench(const BenchCase& bench, double min_time){
+    std::uint64_t iterations = 1;
+    while (true) {
+      BenchState state(iterations);
+      bench.func(state);
+      const double elapsed = state.real_seconds();
+      const bool done = ((elapsed >= min_time) || (iterations >= 1000000000));
+      if (done) {
+        const double n = static_cast<double>(state.iterations());
+        BenchRslt out{bench.name, state.iterations(), 1e9 * elapsed / n,
+                      1e9 * state.cpu_seconds() / n, 0.0, state.counters()};
+        if (elapsed > 0) {
+          out.items_per_second = state.items_per_iteration() * n / elapsed;
+        }
+        return out;
+      }
+      // estimate the number of iterations needed (with some padding)
+      double multiplier = (elapsed > 0) ? 1.4 * min_time / elapsed : 10.0;
+      multiplier = std::min(10.0, std::max(2.0, multiplier));
+      iterations = static_cast<std::uint64_t>(iterations * multiplier);
+    }
+  }
+
+  void write_json(std::FILE* fp, const std::vector<BenchRslt>& rslts){
+    char date[64];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S",
+                  std::localtime(&now));
+
+    std::fprintf(fp, "{\n  \"context\": {\n");
+    std::fprintf(fp, "    \"date\": \"%s\",\n", date);
+    std::fprintf(fp, "    \"num_cpus\": %u,\n",
+                 std::thread::hardware_concurrency());
+    std::fprintf(fp, "    \"library_build_type\": \"%s\"\n",
+#ifdef NDEBUG
+                 "release"
+#else
+                 "debug"
+#endif
+                 );
+    std::fprintf(fp, "  },\n  \"benchmarks\": [\n");
+    for (std::size_t i = 0; i < rslts.size(); i++){
+      const BenchRslt& r = rslts[i];
+      std::fprintf(fp, "    {\n");
+      std::fprintf(fp, "      \"name\": \"%s\",\n", r.name.c_str());
+      std::fprintf(fp, "      \"run_type\": \"iteration\",\n");
+      std::fprintf(fp, "      \"iterations\": %" PRIu64 ",\n", r.iterations);
+      std::fprintf(fp, "      \"real_time\": %.6e,\n", r.real_ns);
+      std::fprintf(fp, "      \"cpu_time\": %.6e,\n", r.cpu_ns);
+      std::fprintf(fp, "      \"time_unit\": \"ns\"");
+      if (r.items_per_second > 0) {
+        std::fprintf(fp, ",\n      \"items_per_second\": %.6e",
+                     r.items_per_second);
+      }
+      for (const auto& kv : r.counters){
+        std::fprintf(fp, ",\n      \"%s\": %.17g", kv.first.c_str(),
+                     kv.second);
+      }
+      std::fprintf(fp, "\n    }%s\n", (i + 1 < rslts.size()) ? "," : "");
+    }
+    std::fprintf(fp, "  ]\n}\n");
+  }
+
+  // ----------------------------------------------------------------------
+  // Input generation
+  // ----------------------------------------------------------------------
+
+  /// Positions & velocities laid out as expected by PointProps
+  struct PointData{
+    std::vector<double> pos, vel;
+    PointProps props() const noexcept {
+      return {pos.data(), vel.data(), pos.size() / 3, 3, pos.size() / 3};
+    }
+  };
+
+  PointData make_points(std::size_t n, std::uint64_t seed){
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    PointData out{std::vector<double>(3*n), std::vector<double>(3*n)};
+    for (std::size_t i = 0; i < 3*n; i++){
+      out.pos[i] = uniform(rng);
+      out.vel[i] = 2.0*uniform(rng) - 1.0;
+    }
+    return out;
+  }
+
+  std::vector<double> make_bin_edges(std::size_t nbins, double max_val){
+    // logarithmically spaced (this is typical for structure functions)
+    std::vector<double> out(nbins+1);
+    const double min_val = max_val * 1e-3;
+    for (std::size_t i = 0; i <= nbins; i++){
+      out[i] = min_val * std::pow(max_val / min_val, double(i) / nbins);
+    }
+    return out;
+  }
+
+  /// Holds the StatListItems (and the objects that they point to) for one of
+  /// the supported statistic choices
+  struct StatChoice{
+    std::string name;
+    std::vector<double> val_bin_edges;
+    BinSpecification val_bins;
+    std::vector<StatListItem> stat_list;
+
+    explicit StatChoice(const std::string& choice)
+      : name(choice), val_bin_edges(), val_bins(), stat_list()
+    {
+      val_bin_edges = make_bin_edges(64, 2.0*std::sqrt(3.0));
+      val_bin_edges[0] = 0.0;
+      val_bins = {val_bin_edges.data(), val_bin_edges.size() - 1};
+      if (choice == "histogram+variance") {
+        stat_list = {{"histogram", &val_bins}, {"variance", nullptr}};
+      } else if (choice == "histogram") {
+        stat_list = {{"histogram", &val_bins}};
+      } else {
+        stat_list = {{name_ptr_(choice), nullptr}};
+      }
+    }
+
+    StatChoice(const StatChoice&) = delete;
+
+  private:
+    static const char* name_ptr_(const std::string& choice){
+      if (choice == "mean") { return "mean"; }
+      if (choice == "variance") { return "variance"; }
+      error("unknown stat choice: " + choice);
+    }
+  };
+
+  /// Allocates output buffers large enough for any supported statistic
+  struct OutputBuffers{
+    std::vector<double> flt_vals;
+    std::vector<std::int64_t> i64_vals;
+    OutputBuffers(std::size_t nbins)
+      : flt_vals(nbins*(2 + 64) + 16), i64_vals(nbins*(1 + 64) + 16)
+    { }
+  };
+
+  // ----------------------------------------------------------------------
+  // Benchmarks
+  // ----------------------------------------------------------------------
+
+  /// Full calc_vsf_props call (dominated by process_data) for 1 statistic
+  void bm_calc_vsf_props(BenchState& state, const std::string& stat,
+                         std::size_t n_points, std::size_t nbins,
+                         bool cross, std::size_t nproc,
+                         bool instrumented = false, void* pool = nullptr){
+    const PointData points_a = make_points(n_points, 1);
+    const PointData points_b = make_points(n_points, 2);
+    const PointProps null_props = {nullptr, nullptr, 0, 0, 0};
+    const std::vector<double> bin_edges = make_bin_edges(nbins, 0.5);
+    StatChoice stat_choice(stat);
+    OutputBuffers buffers(nbins);
+    const ParallelSpec parallel_spec = {nproc, false, pool};
+    VsfInstrumentation instrumentation;
+
+    while (state.keep_running()) {
+      int code = calc_vsf_props(points_a.props(),
+                                cross ? points_b.props() : null_props,
+                                stat_choice.stat_list.data(),
+                                stat_choice.stat_list.size(),
+                                bin_edges.data(), nbins, parallel_spec,
+                                buffers.flt_vals.data(),
+                                buffers.i64_vals.data(),
+                                instrumented ? &instrumentation : nullptr,
+                                nullptr);
+      if (code != VSF_SUCCESS) { error("calc_vsf_props failed"); }
+      do_not_optimize(buffers.flt_vals[0]);
+    }
+    const double n = n_points;
+    state.set_items_per_iteration(cross ? n * n : 0.5 * n * (n - 1));
+    state.set_counter("n_points", n_points);
+    state.set_counter("nbins", nbins);
+    state.set_counter("nproc", nproc);
+  }
+
+  void bm_identify_bin_index(BenchState& state, bool linear,
+                             std::size_t nbins){
+    const std::vector<double> bin_edges = make_bin_edges(nbins, 1.0);
+    std::vector<double> vals(1 << 14);
+    std::mt19937_64 rng(3);
+    // sample squared distances the way they would be distributed for
+    // uniformly distributed points
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (double& v : vals) { v = std::pow(uniform(rng), 2.0/3.0); }
+
+    while (state.keep_running()) {
+      std::size_t total = 0;
+      if (linear) {
+        for (double v : vals) {
+          total += identify_bin_index_linear(v, bin_edges.data(), nbins);
+        }
+      } else {
+        for (double v : vals) {
+          total += identify_bin_index(v, bin_edges.data(), nbins);
+        }
+      }
+      do_not_optimize(total);
+    }
+    state.set_items_per_iteration(vals.size());
+    state.set_counter("nbins", nbins);
+  }
+
+  /// Overhead of constructing a TaskItFactory & iterating over all tasks
+  void bm_partition(BenchState& state, bool cross, std::size_t n_points,
+                    std::size_t nproc){
+    std::uint64_t n_tasks = 0;
+    while (state.keep_running()) {
+      TaskItFactory factory(nproc, n_points, cross ? n_points : 0, true);
+      for (std::size_t proc_id = 0; proc_id < nproc; proc_id++){
+        TaskIt task_it = factory.build_TaskIt(proc_id);
+        while (task_it.has_next()) {
+          StatTask task = task_it.next();
+          do_not_optimize(task);
+          n_tasks++;
+        }
+      }
+    }
+    state.set_counter("n_points", n_points);
+    state.set_counter("nproc", nproc);
+    state.set_counter("tasks_per_iteration",
+                      double(n_tasks) / std::max<std::uint64_t>(
+                        1, state.iterations()));
+  }
+
+  /// Cost of computing the permutation that orders points along a
+  /// space-filling curve
+  void bm_spatial_sort(BenchState& state, int curve, std::size_t n_points,
+                       std::size_t nproc){
+    const PointData points = make_points(n_points, 5);
+    std::vector<std::uint64_t> perm(n_points);
+    while (state.keep_running()) {
+      int code = compute_spatial_sort_permutation(
+        points.props(), curve, nullptr, 0.0, ParallelSpec{nproc, false, nullptr},
+        perm.data(), nullptr);
+      if (code != VSF_SUCCESS) { error("compute_spatial_sort_permutation"); }
+      do_not_optimize(perm.data());
+    }
+    state.set_items_per_iteration(n_points);
+    state.set_counter("n_points", n_points);
+    state.set_counter("nproc", nproc);
+  }
+
+  /// Cost of consolidating 2 accumulator collections
+  void bm_accum_merge(BenchState& state, const std::string& stat,
+                      std::size_t nbins){
+    StatChoice stat_choice(stat);
+    AccumColVariant accum_a = build_accum_collection(
+      stat_choice.stat_list.data(), stat_choice.stat_list.size(), nbins);
+    AccumColVariant accum_b = accum_a;
+
+    std::mt19937_64 rng(4);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (std::size_t i = 0; i < 64*nbins; i++){
+      const std::size_t bin = i % nbins;
+      std::visit([&](auto& accum){ accum.add_entry(bin, uniform(rng)); },
+                 accum_a);
+      std::visit([&](auto& accum){ accum.add_entry(bin, uniform(rng)); },
+                 accum_b);
+    }
+
+    while (state.keep_running()) {
+      AccumColVariant tmp = accum_a;
+      std::visit([&](auto& accum){
+          using T = std::decay_t<decltype(accum)>;
+          accum.consolidate_with_other(std::get<T>(accum_b));
+        }, tmp);
+      do_not_optimize(tmp);
+    }
+    state.set_items_per_iteration(nbins);
+    state.set_counter("nbins", nbins);
+  }
+
+  // ----------------------------------------------------------------------
+  // Registration
+  // ----------------------------------------------------------------------
+
+  std::string fmt_name(const std::string& base,
+                       std::initializer_list<std::string> parts){
+    std::string out = base;
+    for (const std::string& p : parts) { out += "/" + p; }
+    return out;
+  }
+
+  void register_all(bool quick){
+    using std::to_string;
+
+    const std::vector<std::size_t> n_points_l =
+      quick ? std::vector<std::size_t>{1000}
+            : std::vector<std::size_t>{1000, 4000, 16000};
+    const std::vector<std::size_t> nbins_l =
+      quick ? std::vector<std::size_t>{16}
+            : std::vector<std::size_t>{8, 32, 128};
+    std::vector<std::size_t> nproc_l = {1, 2, 4, 8, 16};
+    if (quick) { nproc_l = {1, 2}; }
+
+    // statistic choice, N, nbins (single process)
+    for (std::string stat : {"mean", "variance", "histogram",
+                             "histogram+variance"}) {
+      for (std::size_t n : n_points_l){
+        for (std::size_t nbins : nbins_l){
+          register_bench(
+            fmt_name("BM_calc_vsf_props", {stat, to_string(n),
+                                           to_string(nbins)}),
+            [=](BenchState& s){ bm_calc_vsf_props(s, stat, n, nbins,
+                                                  false, 1); });
+        }
+      }
+    }
+
+    // overhead of the optional instrumentation
+    for (bool instrumented : {false, true}){
+      const std::size_t n = quick ? 1000 : 4000;
+      register_bench(
+        fmt_name("BM_instrumentation", {instrumented ? "on" : "off",
+                                        to_string(n)}),
+        [=](BenchState& s){ bm_calc_vsf_props(s, "variance", n, 32, false,
+                                              1, instrumented); });
+    }
+
+    // thread scaling (the auto-structure function doesn't support multiple
+    // processes, so we use the cross-structure function)
+    for (std::size_t nproc : nproc_l){
+      const std::size_t n = quick ? 2000 : 8000;
+      register_bench(
+        fmt_name("BM_thread_scaling", {"variance", to_string(n),
+                                       to_string(nproc)}),
+        [=](BenchState& s){ bm_calc_vsf_props(s, "variance", n, 32, true,
+                                              nproc); });
+    }
+
+    // fixed per-call overhead of small multi-process calculations, with a
+    // fresh OpenMP team & accumulators (omp) or a persistent pool (pool)
+    for (bool use_pool : {false, true}){
+      const std::size_t nproc = 4;
+      for (std::size_t n : {32, 256}){
+        register_bench(
+          fmt_name("BM_small_cross", {use_pool ? "pool" : "omp",
+                                      to_string(n), to_string(nproc)}),
+          [=](BenchState& s){
+            void* pool = (use_pool) ? vsfpool_create(nproc, nullptr)
+                                    : nullptr;
+            if (use_pool && (pool == nullptr)) { error("vsfpool_create"); }
+            bm_calc_vsf_props(s, "variance", n, 32, true, nproc, false, pool);
+            vsfpool_destroy(pool);
+          });
+      }
+    }
+
+    // bin-search strategies
+    for (std::size_t nbins : {4, 16, 64, 256}){
+      register_bench(fmt_name("BM_identify_bin_index", {"binary",
+                                                        to_string(nbins)}),
+                     [=](BenchState& s){ bm_identify_bin_index(s, false,
+                                                               nbins); });
+      register_bench(fmt_name("BM_identify_bin_index", {"linear",
+                                                        to_string(nbins)}),
+                     [=](BenchState& s){ bm_identify_bin_index(s, true,
+                                                               nbins); });
+    }
+
+    // partitioner overhead
+    for (bool cross : {false, true}){
+      for (std::size_t nproc : nproc_l){
+        const std::size_t n = 1000000;
+        register_bench(fmt_name("BM_partition", {cross ? "cross" : "auto",
+                                                 to_string(n),
+                                                 to_string(nproc)}),
+                       [=](BenchState& s){ bm_partition(s, cross, n,
+                                                        nproc); });
+      }
+    }
+
+    // space-filling curve sorts
+    for (int curve : {VSF_CURVE_MORTON, VSF_CURVE_HILBERT}){
+      for (std::size_t nproc : nproc_l){
+        const std::size_t n = quick ? 100000 : 1000000;
+        register_bench(
+          fmt_name("BM_spatial_sort", {(curve == VSF_CURVE_MORTON)
+                                       ? "morton" : "hilbert",
+                                       to_string(n), to_string(nproc)}),
+          [=](BenchState& s){ bm_spatial_sort(s, curve, n, nproc); });
+      }
+    }
+
+    // accumulator merges (MeanAccum doesn't support consolidation)
+    for (std::string stat : {"variance", "histogram", "histogram+variance"}){
+      for (std::size_t nbins : nbins_l){
+        register_bench(fmt_name("BM_accum_merge", {stat, to_string(nbins)}),
+                       [=](BenchState& s){ bm_accum_merge(s, stat, nbins); });
+      }
+    }
+  }
+
+  bool starts_with(const char* str, const char* prefix){
+    return std::strncmp(str, prefix, std::strlen(prefix)) == 0;
+  }
+
+}
+
+int main(int argc, char** argv){
+  std::string filter = "";
+  std::string out_path = "";
+  double min_time = 0.2;
+  bool quick = false;
+
+  for (int i = 1; i < argc; i++){
+    if (starts_with(argv[i], "--filter=")) {
+      filter = argv[i] + std::strlen("--filter=");
+    } else if (starts_with(argv[i], "--min_time=")) {
+      min_time = std::atof(argv[i] + std::strlen("--min_time="));
+    } else if (starts_with(argv[i], "--out=")) {
+      out_path = argv[i] + std::strlen("--out=");
+    } else if (std::strcmp(argv[i], "--quick") == 0) {
+      quick = true;
+    } else {
+      std::fprintf(stderr, "unrecognized argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  try {
+    register_all(quick);
+
+    std::vector<BenchRslt> rslts;
+    for (const BenchCase& bench : registry()){
+      if (bench.name.find(filter) == std::string::npos) { continue; }
+      BenchRslt rslt = run_bench(bench, min_time);
+      std::fprintf(stderr, "%-50s %14.0f ns %12" PRIu64 "\n",
+                   rslt.name.c_str(), rslt.real_ns, rslt.iterations);
+      rslts.push_back(rslt);
+    }
+
+    if (out_path.empty()) {
+      write_json(stdout, rslts);
+    } else {
+      std::FILE* fp = std::fopen(out_path.c_str(), "w");
+      if (fp == nullptr) {
+        std::fprintf(stderr, "unable to open %s\n", out_path.c_str());
+        return 1;
+      }
+      write_json(fp, rslts);
+      std::fclose(fp);
+    }
+  } catch (const std::exception& err) {
+    std::fprintf(stderr, "ERROR: %s\n", err.what());
+    return 1;
+  }
+  return 0;
+}
@@ -3,6 +3,7 @@
 
 # Standard library
 import atexit
+import io
 import pickle
 import sys
 import traceback
@@ -18,6 +19,8 @@ import numpy as np
 from schwimmbad import log, _VERBOSE
 from schwimmbad.pool import BasePool
 
+from ._ArrayDict_cy import ArrayMap
+
 
 def _dummy_callback(x):
     pass
@@ -39,7 +42,11 @@ def _import_mpi(quiet=False, use_dill=False):
     return MPI
 
 
-class _DefaultResultCommunication:
+class PickledResultCommunication:
+    """
+    Communicate each result as a single pickled message (this was previously
+    the default)
+    """
 
     @staticmethod
     def receive_result(comm):
@@ -193,6 +200,117 @@ class LargeResultCommunication:
             self._throttled_transfer(comm, master_rank = master_rank,
                                      tag = tag, result = result)
 
+# dtypes that can be stored in an ArrayMap (and sent without pickling)
+_TYPED_DTYPES = (np.dtype(np.int64), np.dtype(np.uint64),
+                 np.dtype(np.float64))
+
+def _pack_result(result):
+    """
+    Splits result into a pickled skeleton & an ArrayMap
+
+    Every (non-empty) int64, uint64, or float64 array in result is copied into
+    the ArrayMap and is replaced by a placeholder in the skeleton.
+    """
+    arrays = []
+
+    class _Pickler(pickle.Pickler):
+        def persistent_id(self, obj):
+            if ((type(obj) is np.ndarray) and (obj.dtype in _TYPED_DTYPES)
+                and (obj.ndim > 0) and (obj.size > 0)):
+                arrays.append(obj)
+                return str(len(arrays) - 1)
+            return None
+
+    f = io.BytesIO()
+    _Pickler(f, protocol = pickle.HIGHEST_PROTOCOL).dump(result)
+    if len(arrays) == 0:
+        return f.getvalue(), None
+    array_map = ArrayMap([(str(i), arr.dtype, tuple(int(e) for e in arr.shape))
+                          for i, arr in enumerate(arrays)])
+    for i, arr in enumerate(arrays):
+        array_map[str(i)][...] = arr
+    return f.getvalue(), array_map
+
+def _unpack_result(skeleton, array_map):
+    """
+    Reverses _pack_result (the arrays in the output are views of the
+    ArrayMap's buffer)
+    """
+    class _Unpickler(pickle.Unpickler):
+        def persistent_load(self, pid):
+            return array_map[pid]
+    return _Unpickler(io.BytesIO(skeleton)).load()
+
+class _PendingTypedTransfer:
+    # tracks a result whose payload is being received in the background
+    def __init__(self, worker, taskid, skeleton, array_map, request):
+        self.worker = worker
+        self.taskid = taskid
+        self.skeleton = skeleton
+        self.array_map = array_map
+        self.request = request
+
+    def test(self):
+        return (self.request is None) or self.request.Test()
+
+    def finish(self):
+        if self.request is not None:
+            self.request.Wait()
+        return _unpack_result(self.skeleton, self.array_map)
+
+class TypedResultCommunication:
+    """
+    Communicate results without pickling their (large) numeric arrays.
+
+    Each result is split into a small pickled skeleton and an ArrayMap that
+    holds all of the non-empty int64, uint64, and float64 arrays contained by
+    the result. The worker first sends the skeleton along with the layout of
+    the ArrayMap (its ArrayMapEntrySpec). Then it sends the ArrayMap's
+    backing buffer with ``Send``, which the master receives directly into a
+    preallocated buffer.
+
+    The master posts a non-blocking receive for each buffer, so it can
+    process other results (e.g. consolidate them) while the data arrives.
+
+    Notes
+    -----
+    The skeleton and the buffer are sent with the same tag. This is safe
+    because the master posts the receive for the buffer immediately after it
+    receives the skeleton (a message that is matched by a posted receive
+    can't be probed).
+    """
+
+    def post_receive(self, comm):
+        """
+        Receives the skeleton of the next result and posts a non-blocking
+        receive for its buffer. Returns a _PendingTypedTransfer.
+        """
+        status = MPI.Status()
+        skeleton, entry_spec = comm.recv(source=MPI.ANY_SOURCE,
+                                         tag=MPI.ANY_TAG, status=status)
+        worker, taskid = status.source, status.tag
+        if entry_spec is None:
+            array_map, request = None, None
+        else:
+            array_map = ArrayMap(entry_spec)
+            request = comm.Irecv([array_map.data_buffer, MPI.UINT64_T],
+                                 source=worker, tag=taskid)
+        return _PendingTypedTransfer(worker, taskid, skeleton, array_map,
+                                     request)
+
+    def receive_result(self, comm):
+        transfer = self.post_receive(comm)
+        return transfer.worker, transfer.taskid, transfer.finish()
+
+    def send_result(self, comm, master_rank, tag, result):
+        skeleton, array_map = _pack_result(result)
+        if array_map is None:
+            comm.ssend((skeleton, None), master_rank, tag)
+        else:
+            entry_spec = [entry[:3] for entry in array_map.entry_spec]
+            comm.ssend((skeleton, entry_spec), master_rank, tag)
+            comm.Send([array_map.data_buffer, MPI.UINT64_T], master_rank, tag)
+
 class MPIPool(BasePool):
     """A processing pool that distributes tasks using MPI.
 
@@ -211,8 +329,10 @@ class MPIPool(BasePool):
         ``MPI.COMM_WORLD`` by default.
     use_dill
         Set `True` to use `dill` serialization. Default is `False`.
-    result_comm
-        Optional argument for breaking up messages into smaller sizes
+    result_comm_routines
+        Optional object that specifies how results are communicated (e.g.
+        ``LargeResultCommunication`` or ``PickledResultCommunication``). By
+        default, ``TypedResultCommunication`` is used.
     use_ssend_task : bool
         When true, uses comm.ssend for communicating the tasks. When false (the
         default), uses comm.send. Ordinarily a false value will be faster, but
@@ -231,7 +351,7 @@ class MPIPool(BasePool):
         self.comm = comm
 
         if result_comm_routines is None:
-            self.result_comm_routines = _DefaultResultCommunication()
+            self.result_comm_routines = TypedResultCommunication()
         else:
             self.result_comm_routines = result_comm_routines
 
@@ -351,9 +471,18 @@ class MPIPool(BasePool):
         workerset = self.workers.copy()
         tasklist = [(tid, (worker, arg)) for tid, arg in enumerate(tasks)]
         resultlist = [None] * len(tasklist)
+        # tasks are popped from the end of tasklist. We reverse it so that
+        # tasks are dispatched in the order they are provided (callers can
+        # then schedule the most expensive tasks first)
+        tasklist.reverse()
         pending = len(tasklist)
 
         receive_result = self.result_comm_routines.receive_result
+        # when available, payloads are received in the background (while
+        # completed results are processed)
+        post_receive = getattr(self.result_comm_routines, 'post_receive',
+                               None)
+        in_flight = []
 
         log.log(_VERBOSE,
                 "Master about to start distributing work. There are " +
@@ -372,6 +501,37 @@ class MPIPool(BasePool):
                     self.comm.send(task, **_send_kwargs)
 
 
+            if post_receive is not None:
+                # post receives for the results that have been announced. A
+                # worker can accept a new task as soon as its result is
+                # announced
+                while self.comm.Iprobe(source=MPI.ANY_SOURCE,
+                                       tag=MPI.ANY_TAG):
+                    transfer = post_receive(self.comm)
+                    log.log(_VERBOSE, "Master receiving from worker %s with "
+                            "tag %s", transfer.worker, transfer.taskid)
+                    workerset.add(transfer.worker)
+                    in_flight.append(transfer)
+
+                completed = [t for t in in_flight if t.test()]
+                if (not completed) and workerset and tasklist:
+                    continue
+                elif (not completed) and in_flight:
+                    index = MPI.Request.Waitany(
+                        [t.request for t in in_flight])
+                    completed = [in_flight[index]]
+                elif not completed:
+                    self.comm.Probe(source=MPI.ANY_SOURCE, tag=MPI.ANY_TAG)
+                    continue
+
+                for transfer in completed:
+                    in_flight.remove(transfer)
+                    result = transfer.finish()
+                    callback(result)
+                    resultlist[transfer.taskid] = result
+                    pending -= 1
+                continue
+
             # now check if there is a message waiting to be received
             if workerset and tasklist:
                 # branch performs a non-blocking check for messages
@@ -1,3 +1,15 @@
-__all__ = ["vsf_props"]
+__all__ = ["vsf_props", "sampled_vsf_props", "grid_vsf_props", "fft_sf2_props",
+           "calibrate_tuning", "load_tuning", "get_tuning", "set_tuning",
+           "PointSet", "spatial_sort_permutation", "spatially_sort_points",
+           "vsf_props_2D", "quan_sf_props", "streaming_vsf_props",
+           "open_raw_points", "write_raw_points",
+           "grid_neighbor_vdiff_hists", "PairBinCache", "batched_sf_props",
+           "ThreadPool"]
 
-from .pyvsf import vsf_props
+from .pyvsf import vsf_props, sampled_vsf_props, grid_vsf_props
+from .pyvsf import calibrate_tuning, load_tuning, get_tuning, set_tuning
+from .pyvsf import PointSet, spatial_sort_permutation, spatially_sort_points
+from .pyvsf import vsf_props_2D, quan_sf_props, grid_neighbor_vdiff_hists
+from .pyvsf import PairBinCache, batched_sf_props, ThreadPool
+from .fft_sf import fft_sf2_props
+from .streaming import streaming_vsf_props, open_raw_points, write_raw_points
@@ -0,0 +1,174 @@
+"""
+Reads and writes checkpoint files, which let long-running drivers (like
+``small_dist_sf_props``) resume after they get killed.
+
+A checkpoint file holds a single record (see ``_record_file``) with the magic
+string b"VSFCKPT1" and one binary blob per entry listed in the header.
+
+Each entry holds a (partial) statistic result. Results for statistics that
+are backed by a C++ accumulator are stored as records written by
+``serialize_sf_rslt`` (see accum_handle.hpp). Results of other statistics
+(e.g. the bulk statistics) are stored as a sequence of ``.npy`` arrays.
+
+Files are always written to a temporary path and then atomically renamed, so
+a crash while writing never corrupts an existing checkpoint.
+"""
+
+import hashlib
+import io
+import json
+import os
+
+import numpy as np
+
+from ._kernels import get_kernel
+from ._kernels_cy import serialize_sf_rslt, deserialize_sf_rslt
+from ._record_file import (
+    TruncatedRecordError,
+    encode_header,
+    padded_nbytes,
+    read_record_header,
+    to_jsonable,
+    write_record
+)
+
+_MAGIC = b"VSFCKPT1"
+
+def checkpoint_fingerprint(*components):
+    """
+    Computes a digest of the parameters of a calculation.
+
+    A checkpoint can only be resumed by a calculation with the same
+    fingerprint. Each component should be json-serializable (numpy arrays are
+    converted to lists).
+    """
+    encoded = json.dumps(to_jsonable(components), sort_keys = True)
+    return hashlib.sha256(encoded.encode('utf-8')).hexdigest()
+
+def _npy_blob(rslt):
+    f = io.BytesIO()
+    for key in sorted(rslt.keys()):
+        np.save(f, np.asarray(rslt[key]), allow_pickle = False)
+    return f.getvalue()
+
+def encode_entries(entries, dist_bin_edges):
+    """
+    Encodes a sequence of ``(key, stat_name, stat_kw, rslt)`` tuples (see
+    ``save_checkpoint``). Returns a list of json-serializable descriptions of
+    each entry and the corresponding list of binary blobs.
+    """
+    dist_bin_edges = np.asarray(dist_bin_edges, dtype = np.float64)
+    header_entries, blobs = [], []
+    for key, stat_name, stat_kw, rslt in entries:
+        kernel = get_kernel(stat_name)
+        if len(rslt) == 0:
+            kind, blob = 'empty', b''
+        elif kernel.non_vsf_func is None:
+            kind = 'accum'
+            blob = serialize_sf_rslt(kernel, stat_kw, rslt,
+                                     dist_bin_edges).tobytes()
+        else:
+            kind, blob = 'npy', _npy_blob(rslt)
+        header_entries.append({'key' : [int(e) for e in key],
+                               'stat_name' : stat_name, 'kind' : kind,
+                               'keys' : sorted(rslt.keys()),
+                               'nbytes' : len(blob)})
+        blobs.append(blob)
+    return header_entries, blobs
+
+def decode_entries(buf, offset, header_entries):
+    """
+    Decodes the blobs described by header_entries (the output of
+    ``encode_entries``), starting at offset of the uint8 array, buf.
+
+    Returns a dict mapping the key of each entry to the result, and the offset
+    just past the last blob. Raises a ValueError if buf is truncated.
+    """
+    rslts = {}
+    for entry in header_entries:
+        nbytes = entry['nbytes']
+        if offset + nbytes > buf.size:
+            raise ValueError("truncated")
+        blob = buf[offset:offset + nbytes]
+        if entry['kind'] == 'empty':
+            rslt = {}
+        elif entry['kind'] == 'accum':
+            stat_name, _, rslt, _, _ = deserialize_sf_rslt(blob)
+            assert stat_name == entry['stat_name']
+        else:
+            f = io.BytesIO(blob.tobytes())
+            rslt = {key : np.load(f, allow_pickle = False)
+                    for key in entry['keys']}
+        rslts[tuple(entry['key'])] = rslt
+        offset += padded_nbytes(nbytes)
+    return rslts, offset
+
+def save_checkpoint(path, fingerprint, state, entries, dist_bin_edges):
+    """
+    Atomically writes a checkpoint file
+
+    Parameters
+    ----------
+    path : str
+        Destination of the checkpoint
+    fingerprint : str
+        Output of ``checkpoint_fingerprint``
+    state : dict
+        json-serializable metadata (e.g. the completed subvolume indices)
+    entries : sequence of tuples
+        Each entry holds ``(key, stat_name, stat_kw, rslt)``, where key is a
+        tuple of ints that identifies the entry and rslt is an
+        unpostprocessed result (it may be an empty dict).
+    dist_bin_edges : np.ndarray
+        The distance bin edges
+    """
+    header_entries, blobs = encode_entries(entries, dist_bin_edges)
+    header = encode_header({'fingerprint' : fingerprint,
+                            'state' : to_jsonable(state),
+                            'entries' : header_entries})
+
+    tmp_path = f'{path}.tmp'
+    with open(tmp_path, 'wb') as f:
+        write_record(f, _MAGIC, header, blobs)
+        f.flush()
+        os.fsync(f.fileno())
+    os.replace(tmp_path, path)
+
+def load_checkpoint(path, fingerprint):
+    """
+    Reads a checkpoint file written by ``save_checkpoint``
+
+    Returns
+    -------
+    state : dict or None
+        The metadata passed to ``save_checkpoint``. This is ``None`` if there
+        isn't a file at path.
+    rslts : dict
+        Maps the key of each entry to the corresponding (unpostprocessed)
+        result.
+
+    Raises
+    ------
+    ValueError
+        The file is corrupted or it was written by a calculation with a
+        different fingerprint.
+    """
+    if not os.path.exists(path):
+        return None, {}
+    buf = np.fromfile(path, dtype = np.uint8)
+    try:
+        header, offset = read_record_header(buf, 0, _MAGIC)
+    except TruncatedRecordError:
+        raise ValueError(f"{path!r} is truncated") from None
+    except ValueError:
+        raise ValueError(f"{path!r} isn't a checkpoint file") from None
+    if header['fingerprint'] != fingerprint:
+        raise ValueError(
+            f"{path!r} was written by a calculation with different parameters"
+        )
+
+    try:
+        rslts, _ = decode_entries(buf, offset, header['entries'])
+    except ValueError:
+        raise ValueError(f"{path!r} is truncated") from None
+    return header['state'], rslts
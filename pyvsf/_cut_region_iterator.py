@@ -1,5 +1,6 @@
 # module that defines some helper functions related to loading subvolume data
 # in save_sf_to_file
+from collections import OrderedDict
 import gc
 from itertools import product
 import logging
@@ -53,7 +54,8 @@ def neighbor_ind_iter(central_subvol_ind, subvol_decomp, yield_batches = False):
             for elem in tmp: yield elem
 
 def _pos_quan_equan_arr_generator(data_region, sf_props, rand_generator = None,
-                                  extra_quantities = {}):
+                                  extra_quantities = {},
+                                  position_cache = None):
     """
     Generator that yields the cut_region_index, positions, quantities, and
     extra quantities for each cut_region in data_region.
@@ -65,18 +67,33 @@ def _pos_quan_equan_arr_generator(data_region, sf_props, rand_generator = None,
         corresponding entry should be a tuple where the first element specifies
         the desired units and the second entry is a boolean specifying if it's 
         used for pairs of points.
+    position_cache: dict, optional
+        When specified, the positions of the cut_regions that include every
+        point are read from (and stored in) this dict. The keys are cut_region
+        indices. This should only be used when the positions (and their
+        ordering) are known to be identical to those of the data that was
+        originally cached (e.g. for snapshots of a unigrid simulation).
     """
 
     for cut_region_index, cut_string in enumerate(sf_props.cut_regions):
 
         if cut_string is None or cut_string == '':
             cad = data_region
+            use_position_cache = ((position_cache is not None) and
+                                  (sf_props.max_points is None))
         else:
             cad = data_region.cut_region(cut_string)
+            use_position_cache = False
 
         # get the positions for each point
-        pos = np.array([cad[ii].to(sf_props.dist_units).ndarray_view() \
-                        for ii in ['x', 'y', 'z']])
+        if use_position_cache and (cut_region_index in position_cache):
+            pos = position_cache[cut_region_index]
+        else:
+            pos = np.array([cad[ii].to(sf_props.dist_units).ndarray_view() \
+                            for ii in ['x', 'y', 'z']])
+            if use_position_cache:
+                pos.flags.writeable = False
+                position_cache[cut_region_index] = pos
 
         npoints = pos.shape[1]
         max_points = sf_props.max_points
@@ -101,9 +118,13 @@ def _pos_quan_equan_arr_generator(data_region, sf_props, rand_generator = None,
                 tmp_l.append(cad[field][ipoints].to(sf_props.quantity_units)\
                              .ndarray_view())
 
-            for i in range(len(tmp_l),3):
-                tmp_l.append(np.zeros_like(tmp_l[0]))
+            # (quantities with fewer than 3 components aren't padded)
             quan_arr = np.array(tmp_l)
+            if quan_arr.shape[1] != npoints:
+                raise RuntimeError(
+                    "The number of points doesn't match the cached positions. "
+                    "Are the positions really fixed?"
+                )
 
             equan_dict = {}
             for equan_name, (equan_units, _) in extra_quantities.items():
@@ -242,6 +263,182 @@ def subvolume_dataobjects(ds, subvol_indices, subvol_decomp):
         return _generator()
 
 
+class FixedPositionCache:
+    """
+    Caches the positions loaded for subvolumes, so that they can be reused for
+    later snapshots in which the positions don't change (e.g. on a unigrid).
+
+    The positions of at most ``max_subvols`` subvolumes are retained (the
+    least recently used entries are evicted first).
+    """
+    def __init__(self, max_subvols):
+        if max_subvols <= 0:
+            raise ValueError("max_subvols must be positive")
+        self.max_subvols = max_subvols
+        self._entries = OrderedDict()
+
+    def __len__(self):
+        return len(self._entries)
+
+    def entry(self, subvol_index):
+        """
+        Returns the dict that maps cut_region indices to the cached positions
+        for subvol_index (an empty dict is created when there isn't an entry).
+        """
+        subvol_index = tuple(int(e) for e in subvol_index)
+        try:
+            self._entries.move_to_end(subvol_index)
+        except KeyError:
+            self._entries[subvol_index] = {}
+            while len(self._entries) > self.max_subvols:
+                self._entries.popitem(last = False)
+        return self._entries[subvol_index]
+
+# the caches are stored in a module-level registry so that they persist
+# between tasks (workers are re-sent to the process for each task)
+_FIXED_POSITION_CACHES = {}
+
+def get_fixed_position_cache(token, max_subvols):
+    """
+    Retrieves the process-local FixedPositionCache associated with token
+    (a new cache is created if there isn't one)
+    """
+    cache = _FIXED_POSITION_CACHES.get(token, None)
+    if cache is None:
+        cache = FixedPositionCache(max_subvols)
+        _FIXED_POSITION_CACHES[token] = cache
+    return cache
+
+def release_fixed_position_cache(token):
+    _FIXED_POSITION_CACHES.pop(token, None)
+
+class FixedPairBinCaches:
+    """
+    Retains the ``PairBinCache`` built for pairs of subvolumes, so that the
+    distance bins of their pairs of points are reused for later snapshots in
+    which the positions don't change.
+
+    The keys are ``(subvol_index, other_subvol_index, cut_region_index)``
+    tuples (``other_subvol_index`` is `None` for the auto-structure function
+    pairs of a subvolume). The caches occupying at most ``max_nbytes`` bytes
+    are retained (the least recently used entries are evicted first).
+    """
+    def __init__(self, max_nbytes):
+        if max_nbytes <= 0:
+            raise ValueError("max_nbytes must be positive")
+        self.max_nbytes = max_nbytes
+        self.nbytes = 0
+        self._entries = OrderedDict()
+
+    def __len__(self):
+        return len(self._entries)
+
+    def get_or_build(self, key, builder):
+        """
+        Returns the PairBinCache associated with key. When there isn't an
+        entry, ``builder()`` is called to produce the cache, which is stored
+        (unless it's larger than max_nbytes).
+        """
+        try:
+            self._entries.move_to_end(key)
+            return self._entries[key]
+        except KeyError:
+            pass
+
+        cache = builder()
+        nbytes = cache.nbytes
+        if nbytes > self.max_nbytes:
+            return cache
+        self._entries[key] = cache
+        self.nbytes += nbytes
+        while self.nbytes > self.max_nbytes:
+            _, evicted = self._entries.popitem(last = False)
+            self.nbytes -= evicted.nbytes
+        return cache
+
+# like _FIXED_POSITION_CACHES, these persist between tasks
+_FIXED_PAIR_BIN_CACHES = {}
+
+def get_fixed_pair_bin_caches(token, max_nbytes):
+    """
+    Retrieves the process-local FixedPairBinCaches associated with token (a
+    new instance is created if there isn't one)
+    """
+    caches = _FIXED_PAIR_BIN_CACHES.get(token, None)
+    if caches is None:
+        caches = FixedPairBinCaches(max_nbytes)
+        _FIXED_PAIR_BIN_CACHES[token] = caches
+    return caches
+
+def release_fixed_pair_bin_caches(token):
+    _FIXED_PAIR_BIN_CACHES.pop(token, None)
+
+class LoadedSubvolCache:
+    """
+    Retains the data loaded for the most recently used subvolumes, so that a
+    worker process can reuse it when later tasks need the same subvolumes
+    (e.g. as neighbors of other central subvolumes).
+
+    At most ``max_subvols`` subvolumes are retained (the least recently used
+    entries are evicted first). The cached arrays are read-only.
+    """
+    def __init__(self, max_subvols):
+        if max_subvols <= 0:
+            raise ValueError("max_subvols must be positive")
+        self.max_subvols = max_subvols
+        self._entries = OrderedDict()
+
+    def __len__(self):
+        return len(self._entries)
+
+    def __contains__(self, subvol_index):
+        return tuple(int(e) for e in subvol_index) in self._entries
+
+    def get_or_load(self, subvol_index, loader):
+        """
+        Returns the records of subvol_index. When there isn't an entry,
+        ``loader()`` is called to produce an iterable of records (the output
+        of ``_pos_quan_equan_arr_generator``), which is stored.
+        """
+        subvol_index = tuple(int(e) for e in subvol_index)
+        try:
+            self._entries.move_to_end(subvol_index)
+            return self._entries[subvol_index]
+        except KeyError:
+            pass
+
+        records = tuple(loader())
+        for _, pos, quan, equan_dict, _ in records:
+            arrays = [pos, quan] + list((equan_dict or {}).values())
+            for arr in arrays:
+                if isinstance(arr, np.ndarray):
+                    arr.flags.writeable = False
+        self._entries[subvol_index] = records
+        while len(self._entries) > self.max_subvols:
+            self._entries.popitem(last = False)
+        return records
+
+# like _FIXED_POSITION_CACHES, these persist between tasks. Since a worker
+# process only works on one calculation at a time, only the cache of the most
+# recently requested token is retained.
+_LOADED_SUBVOL_CACHES = {}
+
+def get_loaded_subvol_cache(token, max_subvols):
+    """
+    Retrieves the process-local LoadedSubvolCache associated with token (a
+    new cache is created if there isn't one). The caches associated with any
+    other tokens are released.
+    """
+    cache = _LOADED_SUBVOL_CACHES.get(token, None)
+    if cache is None:
+        _LOADED_SUBVOL_CACHES.clear()
+        cache = LoadedSubvolCache(max_subvols)
+        _LOADED_SUBVOL_CACHES[token] = cache
+    return cache
+
+def release_loaded_subvol_cache(token):
+    _LOADED_SUBVOL_CACHES.pop(token, None)
+
 class SimpleCutRegionIterBuilder:
     """
     Builder of cut_region iterators for specified subvolumes.
@@ -264,23 +461,32 @@ class SimpleCutRegionIterBuilder:
         corresponding entry should be a tuple where the first element specifies
         the desired units and the second entry is a boolean specifying if it's 
         used for pairs of points.
+    position_cache: FixedPositionCache, optional
+        When specified, positions are reused from (and stored in) this cache.
 
 
     TODO: when is_central == False, avoid loading unnecessary extra_quantities
 
     """
     def __init__(self, ds, subvol_decomp, sf_props, extra_quantities = {},
-                 rand_generator = None):
+                 rand_generator = None, position_cache = None):
         self.ds = ds
         self.subvol_decomp = subvol_decomp
         self.sf_props = sf_props
         self.extra_quantities = extra_quantities
         self.rand_generator = rand_generator
+        self.position_cache = position_cache
 
-    def _pos_quan_equan_arr_iterator(self, data_region):
+    def _position_cache_entry(self, subvol_index):
+        if (self.position_cache is None) or (subvol_index is None):
+            return None
+        return self.position_cache.entry(subvol_index)
+
+    def _pos_quan_equan_arr_iterator(self, data_region, subvol_index = None):
         return _pos_quan_equan_arr_generator(
             data_region, self.sf_props, self.rand_generator,
-            extra_quantities = self.extra_quantities
+            extra_quantities = self.extra_quantities,
+            position_cache = self._position_cache_entry(subvol_index)
         )
 
     def __call__(self, subvol_index, is_central = False):
@@ -293,7 +499,7 @@ class SimpleCutRegionIterBuilder:
         _, data_region = list(subvolume_dataobjects(self.ds, [subvol_index],
                                                     self.subvol_decomp))[0]
         assert _ == subvol_index # sanity check
-        return self._pos_quan_equan_arr_iterator(data_region)
+        return self._pos_quan_equan_arr_iterator(data_region, subvol_index)
 
 
 class EagerCutRegionIterBuilder(SimpleCutRegionIterBuilder):
@@ -330,9 +536,9 @@ class EagerCutRegionIterBuilder(SimpleCutRegionIterBuilder):
         else:
             # remove the non-neighbors of cur_center
             unneeded_keys = set(self.cached_iterators.keys())
-            unneeded_keys.remove(self.cur_center)
+            unneeded_keys.discard(self.cur_center)
             for ind in neighbor_ind_iter(self.cur_center, self.subvol_decomp):
-                unneeded_keys.remove(ind)
+                unneeded_keys.discard(ind)
             for key in unneeded_keys:
                 del self.cached_iterators[key]
 
@@ -357,10 +563,7 @@ class EagerCutRegionIterBuilder(SimpleCutRegionIterBuilder):
         for ind, data_region in index_region_pairs:
             assert ind not in self.cached_iterators
             # get the pos_quan_equan_arr_iterator for the current region
-            _iterator = _pos_quan_equan_arr_generator(
-                data_region, self.sf_props, self.rand_generator,
-                extra_quantities = self.extra_quantities
-            )
+            _iterator = self._pos_quan_equan_arr_iterator(data_region, ind)
 
             # store the eagerly evaluated iterator
             self.cached_iterators[ind] = tuple(_iterator)
@@ -375,7 +578,7 @@ class EagerCutRegionIterBuilder(SimpleCutRegionIterBuilder):
             if prev_center is not None:
                 # clear out entries from the cache that aren't neighbors of the
                 # new center
-                self.clear_cache(self, keep_cur_center = True, run_gc = True)
+                self.clear_cache(keep_cur_center = True, run_gc = True)
                 raise RuntimeError("Reusing this object for multiple central "
                                    "subvol indices is not tested yet")
 
@@ -389,8 +592,53 @@ class EagerCutRegionIterBuilder(SimpleCutRegionIterBuilder):
         assert subvol_index in self.cached_iterators
         return self.cached_iterators[subvol_index]
 
-def get_cut_region_itr_builder(*args, eager_loader = False, **kwargs):
-    if eager_loader:
+class CachedCutRegionIterBuilder(SimpleCutRegionIterBuilder):
+    """
+    Similar to SimpleCutRegionIterBuilder, but the data of each subvolume is
+    retrieved from a sequence of caches.
+
+    The caches are consulted in order (the fastest should come first). When
+    a cache doesn't hold a subvolume, the data is retrieved from the next
+    cache (or loaded from disk, after the last cache) and stored. For
+    example, a process-local LoadedSubvolCache can be backed by a node-local
+    SharedSubvolCache. Consequently, each subvolume's data is usually only
+    loaded from disk once, rather than once for its own auto-structure
+    function and once for each subvolume that it neighbors.
+
+    Parameters
+    ----------
+    subvol_caches: sequence
+        The caches. Each must have a ``get_or_load(subvol_index, loader)``
+        method. The remaining arguments are forwarded to
+        SimpleCutRegionIterBuilder.
+    """
+
+    def __init__(self, *args, subvol_caches, **kwargs):
+        SimpleCutRegionIterBuilder.__init__(self, *args, **kwargs)
+        self.subvol_caches = tuple(subvol_caches)
+
+    def __call__(self, subvol_index, is_central = False):
+        """
+        Retrieve the data for `subvol_index`. is_central is ignored.
+        """
+        def load_from(level):
+            if level == len(self.subvol_caches):
+                return SimpleCutRegionIterBuilder.__call__(self, subvol_index)
+            return self.subvol_caches[level].get_or_load(
+                subvol_index, lambda: load_from(level + 1)
+            )
+        return load_from(0)
+
+def get_cut_region_itr_builder(*args, eager_loader = False,
+                               shared_cache = None, loaded_cache = None,
+                               **kwargs):
+    subvol_caches = [cache for cache in (loaded_cache, shared_cache)
+                     if cache is not None]
+    if len(subvol_caches) > 0:
+        # (every subvolume is loaded eagerly by this builder)
+        return CachedCutRegionIterBuilder(*args, subvol_caches = subvol_caches,
+                                          **kwargs)
+    elif eager_loader:
         cls = EagerCutRegionIterBuilder
     else:
         cls = SimpleCutRegionIterBuilder
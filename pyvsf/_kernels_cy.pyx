@@ -1,7 +1,7 @@
 from copy import deepcopy
 import numpy as np
 
-from libc.stdint cimport int64_t
+from libc.stdint cimport int64_t, uint8_t, uint32_t, uint64_t
 from libc.stddef cimport size_t
 
 from cpython.version cimport PY_MAJOR_VERSION
@@ -20,6 +20,17 @@ def _verify_bin_edges(bin_edges):
         return True
 
 cdef extern from "vsf.hpp":
+    cdef enum VsfErrorCode:
+        VSF_SUCCESS
+        VSF_INVALID_ARG
+        VSF_NOT_IMPLEMENTED
+        VSF_ALLOC_ERROR
+        VSF_INTERNAL_ERROR
+
+    ctypedef struct VsfErrorInfo:
+        int code
+        char* message
+
     ctypedef struct BinSpecification:
         double* bin_edges
         size_t n_bins
@@ -33,18 +44,62 @@ cdef extern from "accum_handle.hpp":
 
     void* accumhandle_create(const StatListItem* stat_list,
                              size_t stat_list_len,
-                             size_t num_dist_bins)
+                             size_t num_dist_bins,
+                             VsfErrorInfo* err_info)
 
     void accumhandle_destroy(void* handle)
 
-    void accumhandle_export_data(void* handle, double *out_flt_vals,
-                                 int64_t *out_i64_vals)
+    int accumhandle_export_data(void* handle, double *out_flt_vals,
+                                int64_t *out_i64_vals,
+                                VsfErrorInfo* err_info)
+
+    int accumhandle_restore(void* handle, const double *in_flt_vals,
+                            const int64_t *in_i64_vals,
+                            VsfErrorInfo* err_info)
+
+    int accumhandle_consolidate_into_primary(void* handle_primary,
+                                             void* handle_secondary,
+                                             VsfErrorInfo* err_info)
+
+    ctypedef struct AccumRecordInfo:
+        uint32_t format_version
+        uint64_t record_size
+        char statistic[32]
+        uint64_t n_dist_bins
+        uint64_t n_dist_bin_edges
+        uint64_t n_val_bin_edges
+
+    int accumhandle_serialize(void* handle, const double* dist_bin_edges,
+                              uint8_t* out_buf, size_t buf_len,
+                              size_t* out_size, VsfErrorInfo* err_info)
+
+    int accumhandle_record_info(const uint8_t* buf, size_t buf_len,
+                                AccumRecordInfo* out, VsfErrorInfo* err_info)
 
-    void accumhandle_restore(void* handle, const double *in_flt_vals,
-                             const int64_t *in_i64_vals)
+    void* accumhandle_deserialize(const uint8_t* buf, size_t buf_len,
+                                  double* out_dist_bin_edges,
+                                  double* out_val_bin_edges,
+                                  VsfErrorInfo* err_info)
 
-    void accumhandle_consolidate_into_primary(void* handle_primary,
-                                              void* handle_secondary)
+def _vsf_error_to_exception(code, message):
+    """
+    Constructs the python exception corresponding to an error code (and
+    message) reported by libvsf
+    """
+    if isinstance(message, (bytes, bytearray)):
+        message = message.decode('ASCII', errors = 'replace')
+    if code == VSF_INVALID_ARG:
+        return ValueError(message)
+    elif code == VSF_NOT_IMPLEMENTED:
+        return NotImplementedError(message)
+    elif code == VSF_ALLOC_ERROR:
+        return MemoryError(message)
+    return RuntimeError(f"libvsf error (code {code}): {message}")
+
+cdef int _check_vsf_error(int code, VsfErrorInfo* err_info) except -1:
+    if code != VSF_SUCCESS:
+        raise _vsf_error_to_exception(code, err_info.message)
+    return 0
 
 
 cdef BinSpecification _build_BinSpecification(arr, wrap_array = True):
@@ -96,7 +151,12 @@ cdef void* _construct_accum_handle(size_t num_dist_bins, object name,
     else:
         list_entry.arg_ptr = NULL
 
-    return accumhandle_create(&list_entry, 1, num_dist_bins)
+    cdef VsfErrorInfo err_info
+    cdef void* out = accumhandle_create(&list_entry, 1, num_dist_bins,
+                                        &err_info)
+    if out == NULL:
+        _check_vsf_error(err_info.code, &err_info)
+    return out
 
 cdef int64_t* _ArrayMap_i64_ptr(object array_map):
     cdef object i64_array = array_map.get_int64_buffer()
@@ -112,15 +172,23 @@ cdef double* _ArrayMap_flt_ptr(object array_map):
     cdef double[::1] flt_vals = flt_array
     return &flt_vals[0]
 
-cdef void _restore_handle_from_ArrayMap(void* handle, object array_map):
-    accumhandle_restore(handle,
-                        _ArrayMap_flt_ptr(array_map),
-                        _ArrayMap_i64_ptr(array_map))
-
-cdef void _export_to_ArrayMap_from_handle(void* handle, object array_map):
-    accumhandle_export_data(handle,
-                            _ArrayMap_flt_ptr(array_map),
-                            _ArrayMap_i64_ptr(array_map))
+cdef int _restore_handle_from_ArrayMap(void* handle,
+                                       object array_map) except -1:
+    cdef VsfErrorInfo err_info
+    cdef int code = accumhandle_restore(handle,
+                                        _ArrayMap_flt_ptr(array_map),
+                                        _ArrayMap_i64_ptr(array_map),
+                                        &err_info)
+    return _check_vsf_error(code, &err_info)
+
+cdef int _export_to_ArrayMap_from_handle(void* handle,
+                                         object array_map) except -1:
+    cdef VsfErrorInfo err_info
+    cdef int code = accumhandle_export_data(handle,
+                                            _ArrayMap_flt_ptr(array_map),
+                                            _ArrayMap_i64_ptr(array_map),
+                                            &err_info)
+    return _check_vsf_error(code, &err_info)
 
 cdef class SFConsolidator:
     """
@@ -143,6 +211,8 @@ cdef class SFConsolidator:
             assert len(kwargs) == 0
 
         cdef size_t num_dist_bins = dist_bin_edges.size - 1
+        self.primary_handle = NULL
+        self.secondary_handle = NULL
         self.primary_handle = _construct_accum_handle(num_dist_bins, name,
                                                       val_bin_edges)
         self.secondary_handle = _construct_accum_handle(num_dist_bins, name,
@@ -176,6 +246,8 @@ cdef class SFConsolidator:
         self._purge_values()
 
         cdef object tmp = ArrayMap(self._get_entry_spec())
+        cdef VsfErrorInfo err_info
+        cdef int code
         for rslt in rslts:
             if len(rslt) == 0:
                 continue
@@ -189,8 +261,9 @@ cdef class SFConsolidator:
                 _restore_handle_from_ArrayMap(self.secondary_handle, tmp)
 
             # update self.primary_handle
-            accumhandle_consolidate_into_primary(self.primary_handle,
-                                                 self.secondary_handle)
+            code = accumhandle_consolidate_into_primary(
+                self.primary_handle, self.secondary_handle, &err_info)
+            _check_vsf_error(code, &err_info)
         # export data from self.primary_handle
         _export_to_ArrayMap_from_handle(self.primary_handle, tmp)
         return tmp.asdict()
@@ -210,6 +283,178 @@ def build_consolidater(dist_bin_edges, kernel, kwargs):
     return PyConsolidator(kernel)
 
 
+def serialize_sf_rslt(kernel, kwargs, rslt, dist_bin_edges):
+    """
+    Serializes an (unpostprocessed) structure function result into a
+    self-describing binary record (see accum_handle.hpp for the layout).
+
+    Parameters
+    ----------
+    kernel
+        The kernel for the statistic (e.g. the output of ``get_kernel``)
+    kwargs : dict
+        The kwargs for the statistic
+    rslt : dict
+        The result. This should NOT have been postprocessed.
+    dist_bin_edges : np.ndarray
+        The distance bin edges (these are stored in the record)
+
+    Returns
+    -------
+    record : np.ndarray
+        1D ``np.uint8`` array holding the record. This supports the buffer
+        protocol, so it can be sent directly with MPI or written to a file.
+    """
+    dist_bin_edges = np.ascontiguousarray(dist_bin_edges, dtype = np.float64)
+    cdef object val_bin_edges = None
+    if 'val_bin_edges' in kwargs:
+        val_bin_edges = np.ascontiguousarray(kwargs['val_bin_edges'],
+                                             dtype = np.float64)
+
+    cdef void* handle = _construct_accum_handle(dist_bin_edges.size - 1,
+                                                kernel.name, val_bin_edges)
+    cdef double[::1] dist_bin_edges_view = dist_bin_edges
+    cdef VsfErrorInfo err_info
+    cdef size_t nbytes = 0
+    cdef uint8_t[::1] out_view
+    cdef int code
+    try:
+        if len(rslt) == 0:
+            rslt = kernel.zero_initialize_rslt(dist_bin_edges, kwargs,
+                                               postprocess_rslt = False)
+        tmp = ArrayMap(kernel.get_dset_props(dist_bin_edges, kwargs = kwargs))
+        for key in tmp:
+            tmp[key][...] = rslt[key]
+        _restore_handle_from_ArrayMap(handle, tmp)
+
+        code = accumhandle_serialize(handle, &dist_bin_edges_view[0], NULL, 0,
+                                     &nbytes, &err_info)
+        _check_vsf_error(code, &err_info)
+        out = np.empty((nbytes,), dtype = np.uint8)
+        out_view = out
+        code = accumhandle_serialize(handle, &dist_bin_edges_view[0],
+                                     &out_view[0], nbytes, &nbytes, &err_info)
+        _check_vsf_error(code, &err_info)
+    finally:
+        accumhandle_destroy(handle)
+    return out
+
+def deserialize_sf_rslt(buf, offset = 0):
+    """
+    Reconstructs a structure function result from the record that starts at
+    byte ``offset`` of buf (the inverse of ``serialize_sf_rslt``).
+
+    Returns
+    -------
+    stat_name : str
+        The name of the statistic
+    kwargs : dict
+        The kwargs of the statistic
+    rslt : dict
+        The (unpostprocessed) result
+    dist_bin_edges : np.ndarray or None
+        The stored distance bin edges
+    nbytes : int
+        The size of the record. The next record (if any) starts at
+        ``offset + nbytes``.
+    """
+    cdef const uint8_t[::1] view = np.frombuffer(buf, dtype = np.uint8)
+    if (offset < 0) or (offset >= view.shape[0]):
+        raise ValueError("offset must lie within buf")
+    cdef const uint8_t* ptr = &view[offset]
+    cdef size_t buf_len = view.shape[0] - offset
+
+    cdef AccumRecordInfo info
+    cdef VsfErrorInfo err_info
+    cdef int code = accumhandle_record_info(ptr, buf_len, &info, &err_info)
+    _check_vsf_error(code, &err_info)
+
+    dist_bin_edges = np.empty((info.n_dist_bin_edges,), dtype = np.float64)
+    val_bin_edges = np.empty((info.n_val_bin_edges,), dtype = np.float64)
+    cdef double[::1] dist_view = dist_bin_edges
+    cdef double[::1] val_view = val_bin_edges
+    cdef void* handle = accumhandle_deserialize(
+        ptr, buf_len,
+        &dist_view[0] if info.n_dist_bin_edges > 0 else NULL,
+        &val_view[0] if info.n_val_bin_edges > 0 else NULL,
+        &err_info)
+    if handle == NULL:
+        _check_vsf_error(err_info.code, &err_info)
+
+    stat_name = (<bytes>info.statistic).decode('ASCII')
+    kwargs = {}
+    if info.n_val_bin_edges > 0:
+        kwargs['val_bin_edges'] = val_bin_edges
+
+    # avoid a circular import
+    from ._kernels import get_kernel
+    kernel = get_kernel(stat_name)
+    try:
+        tmp = ArrayMap(kernel.get_dset_props(
+            np.empty((info.n_dist_bins + 1,)), kwargs = kwargs))
+        _export_to_ArrayMap_from_handle(handle, tmp)
+    finally:
+        accumhandle_destroy(handle)
+
+    if info.n_dist_bin_edges == 0:
+        dist_bin_edges = None
+    return (stat_name, kwargs, tmp.asdict(), dist_bin_edges,
+            int(info.record_size))
+
+def append_sf_rslt_records(path, records):
+    """
+    Appends serialized records (from ``serialize_sf_rslt``) to a file.
+
+    The file is flushed & synced before returning, so that the records
+    survive a crash.
+    """
+    import os
+    with open(path, 'ab') as f:
+        for record in records:
+            f.write(memoryview(record))
+        f.flush()
+        os.fsync(f.fileno())
+
+def _is_truncated_record(buf, offset):
+    # checks whether buf[offset:] holds the start of a valid record that got
+    # cut off
+    header = bytes(buf[offset:offset + 24])
+    if len(header) < 24:
+        return b'VSFACCUM'.startswith(header[:8])
+    record_size = int(np.frombuffer(header[16:24], dtype = np.uint64)[0])
+    return header[:8] == b'VSFACCUM' and record_size > (buf.size - offset)
+
+def load_sf_rslt_records(path):
+    """
+    Deserializes all records from a file written by
+    ``append_sf_rslt_records``.
+
+    A truncated trailing record (e.g. from a write that was interrupted) is
+    ignored.
+
+    Returns
+    -------
+    records : list of tuple
+        Each entry holds ``(stat_name, kwargs, rslt, dist_bin_edges)``
+    """
+    buf = np.fromfile(path, dtype = np.uint8)
+    out = []
+    cdef size_t offset = 0
+    cdef AccumRecordInfo info
+    cdef VsfErrorInfo err_info
+    cdef const uint8_t[::1] view = buf
+    while offset < buf.size:
+        if accumhandle_record_info(&view[offset], buf.size - offset, &info,
+                                   &err_info) != VSF_SUCCESS:
+            if _is_truncated_record(buf, offset):
+                break
+            _check_vsf_error(err_info.code, &err_info)
+        stat_name, kwargs, rslt, dist_bin_edges, nbytes = \
+            deserialize_sf_rslt(buf, offset)
+        out.append((stat_name, kwargs, rslt, dist_bin_edges))
+        offset += nbytes
+    return out
+
 def _validate_basic_quan_props(kernel, rslt, dist_bin_edges, kwargs = {}):
     quan_props = kernel.get_dset_props(dist_bin_edges, kwargs)
     assert len(quan_props) == len(rslt)
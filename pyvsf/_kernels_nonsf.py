@@ -1,6 +1,11 @@
 """
 Define some statistical kernels that are unrelated to the calculation of the
 structure function
+
+The bulk moments are computed by the compiled ``calc_bulk_moments`` function
+(see ``pyvsf.bulk_moments``). The worker calls it separately from the pair
+kernels, but it uses the same loaded arrays (see src/bulk_stats.hpp for why
+the two aren't fused).
 """
 from copy import deepcopy
 
@@ -77,6 +82,30 @@ def _generic_kernel_handle_args(quan, extra_quantities, kwargs,
         out.append(weights)
     return out
 
+def _consolidate_bulk_moments(rslts, with_variance):
+    """
+    Combines the results of the bulk statistic kernels (all weight fields and
+    components are merged at once with a compensated update).
+    """
+    # pyvsf.pyvsf imports this module (indirectly), so the import is deferred
+    from .pyvsf import merge_bulk_moments
+
+    rslts = [rslt for rslt in rslts if len(rslt) > 0]
+    if len(rslts) == 0:
+        return {}
+    elif len(rslts) == 1:
+        return deepcopy(rslts[0])
+
+    weight_total, average, variance = merge_bulk_moments(
+        [rslt['weight_total'] for rslt in rslts],
+        [rslt['average'] for rslt in rslts],
+        [rslt['variance'] for rslt in rslts] if with_variance else None
+    )
+    out = {'weight_total' : weight_total, 'average' : average}
+    if with_variance:
+        out['variance'] = variance
+    return out
+
 def compute_bulkaverage(quan, extra_quantities, kwargs):
     """
     Parameters
@@ -94,25 +123,15 @@ def compute_bulkaverage(quan, extra_quantities, kwargs):
         of the weight field and the second element specifies the expected units.
 
     """
-    weight_l = _generic_kernel_handle_args(quan, extra_quantities, kwargs)
-    assert len(weight_l) == 1
-    weights = weight_l[0]
+    from .pyvsf import bulk_moments
 
-    # axis = 1 seems counter-intuitive, but I've confirmed it's correct
-    averages, sum_of_weights = np.average(quan, axis = 1,
-                                          weights = weights,
-                                          returned = True)
-
-    assert averages.ndim == sum_of_weights.ndim == 1 # sanity check!
-
-    # since sum_of_weights is 1D and has a length equal to quan.shape[1], all 3
-    # entires are identical
-    assert (sum_of_weights[0] == sum_of_weights).all()
-    assert sum_of_weights[0] != 0.0 # we may want to revisit return vals if
-                                    # untrue
+    weight_l = _generic_kernel_handle_args(quan, extra_quantities, kwargs)
+    if len(weight_l) == 0:
+        return {}
 
-    weight_total = np.array([[sum_of_weights[0]]], dtype= sum_of_weights.dtype)
-    averages.shape = (1, averages.shape[0])
+    weight_total, averages, _ = bulk_moments(quan, weight_l, variance = False)
+    assert (weight_total != 0.0).all() # we may want to revisit return vals if
+                                       # untrue
 
     return {'average' : averages, 'weight_total' : weight_total}
 
@@ -122,7 +141,6 @@ class BulkAverage:
     components.
 
     TODO: consider letting the number of components change
-    TODO: consider handling multiple weight fields at once
     TODO: consider handling no weight field
     """
     name = "bulkaverage"
@@ -138,69 +156,22 @@ class BulkAverage:
     @classmethod
     def get_extra_fields(cls, kwargs = {}):
         weight_unit_pairs = _extract_weight_unit_pairs(kwargs)
-        if len(weight_unit_pairs) != 1:
-            raise ValueError("Currently only 1 weight field is supported.")
 
-        weight_field_name, weight_field_units = weight_unit_pairs[0]
-        return {weight_field_name : (weight_field_units, cls.operate_on_pairs)}
+        out = {}
+        for weight_field_name, weight_field_units in weight_unit_pairs:
+            out[weight_field_name] = (weight_field_units, cls.operate_on_pairs)
+        return out
 
     @classmethod
     def get_dset_props(cls, dist_bin_edges, kwargs = {}):
         weight_unit_pairs = _extract_weight_unit_pairs(kwargs)
         n_weight_fields = len(weight_unit_pairs)
-        if n_weight_fields != 1:
-            raise ValueError("Currently only 1 weight field is supported.")
         return [('weight_total',  np.float64, (n_weight_fields, 1,)),
                 ('average',       np.float64, (n_weight_fields, 3,))]
 
     @classmethod
     def consolidate_stats(cls, *rslts):
-        out = {}
-        num_keys = len(cls.output_keys)
-
-        # we could run into overflow problems.
-        # We're using a compensated summation
-        accum_prodsum = np.zeros((3,), np.float64)
-        c_prodsum = np.zeros_like(accum_prodsum)    # needs to be zeros
-
-        accum_wsum = np.zeros((1,), np.float64)
-        c_wsum = np.zeros_like(accum_wsum)        # needs to be zeros
-
-        first_filled_rslt = None
-        for rslt in rslts:
-            if len(rslt) == 0:
-                continue
-            if first_filled_rslt is None:
-                first_filled_rslt = rslt
-
-            assert len(rslt) == 2 # check the keys
-
-            cur_weight = rslt['weight_total'][0,:]
-            cur_product = cur_weight*rslt['average'][0,:]
-
-            # first, accumulate weight
-            cur_elem = cur_weight - c_wsum
-            tmp_accum = accum_wsum + cur_elem
-            c_wsum = (tmp_accum - accum_wsum) - cur_elem
-            accum_wsum = tmp_accum
-
-            # next, accumulate product
-            cur_elem = cur_product - c_prodsum
-            tmp_accum = accum_prodsum + cur_elem
-            c_prodsum = (tmp_accum - accum_prodsum) - cur_elem
-            accum_prodsum = tmp_accum
-
-        if first_filled_rslt is None:
-            return {}
-        elif (accum_wsum[0] == first_filled_rslt['weight_total'][0,0]).all():
-            return {'weight_total' : first_filled_rslt['weight_total'].copy(),
-                    'average'      : first_filled_rslt['average'].copy()}
-        else:
-            weight_total, weight_times_avg  = accum_wsum, accum_prodsum
-            weight_total.shape = (1,1)
-            weight_times_avg.shape = (1,3)
-            return {'weight_total' : weight_total,
-                    'average' : weight_times_avg / weight_total}
+        return _consolidate_bulk_moments(rslts, with_variance = False)
 
     @classmethod
     def validate_rslt(cls, rslt, dist_bin_edges, kwargs = {}):
@@ -299,35 +270,20 @@ def compute_bulk_variance(quan, extra_quantities, kwargs):
         of the weight field and the second element specifies the expected units.
 
     """
-    weight_l = _generic_kernel_handle_args(quan, extra_quantities, kwargs)
-    n_weight_fields = len(weight_l)
-
-    variance = np.empty((n_weight_fields, quan.shape[0]), dtype = np.float64)
-    averages = np.empty_like(variance)
-    weight_total = np.empty((n_weight_fields, 1), dtype = np.float64)
-
-    for i, weights in enumerate(weight_l):
+    from .pyvsf import bulk_moments
 
-        # axis = 1 seems counter-intuitive, but I've confirmed it's correct
-        cur_vars, cur_avgs, cur_sum_of_weights = _weighted_variance(
-            quan, axis = 1, weights = weights, returned = True
-        )
-
-        # since weights is 1D and has a length equal to quan.shape[1], all 3
-        # entires of cur_sum_of_weights are identical
-        assert (cur_sum_of_weights[0] == cur_sum_of_weights).all()
-
-        assert cur_sum_of_weights[0] != 0.0 # we may want to revisit return
-                                            # vals if untrue
+    weight_l = _generic_kernel_handle_args(quan, extra_quantities, kwargs)
+    if len(weight_l) == 0:
+        return {}
 
-        weight_total[i,0] = cur_sum_of_weights[0]
-        averages[i,:] = cur_avgs
-        variance[i,:] = cur_vars
+    weight_total, averages, variance = bulk_moments(quan, weight_l,
+                                                    variance = True)
+    assert (weight_total != 0.0).all() # we may want to revisit return vals if
+                                       # untrue
 
     return {'variance' : variance, 'average' : averages,
             'weight_total' : weight_total}
 
-
 class BulkVariance:
     """
     This is used to directly compute weight variance values for velocity 
@@ -430,95 +386,12 @@ class BulkVariance:
 
     @classmethod
     def consolidate_stats(cls, *rslts):
-
-        # find first non-empty result
-        sample = next(filter(lambda e: e != {}, rslts), None)
-        if sample is None:
-            return {}
-        else:
-            # initialize output dict:
-            out = dict((k, np.zeros_like(v)) for k,v in sample.items())
-
-        # concatenate entries from each dict into 3 larger arrays
-        n_rslts = len(rslts)
-        if n_rslts == 1:
-            return deepcopy(rslts[0])
-        all_weight_totals = np.empty((n_rslts,) + sample['weight_total'].shape,
-                                     dtype = np.float64)
-        all_means = np.empty((n_rslts,) + sample['average'].shape,
-                             dtype = np.float64)
-        all_variances = np.empty((n_rslts,) + sample['variance'].shape,
-                                 dtype = np.float64)
-
-        assert all_weight_totals.shape[:-1] == all_means.shape[:-1]
-        assert all_weight_totals.shape[-1] == 1
-        assert all_means.shape == all_variances.shape
-
-        for i, rslt in enumerate(rslts):
-            if rslt == {}:
-                all_weight_totals[i,...] = 0.0
-                # fill in the rest after the loop
-            else:
-                all_weight_totals[i,...] = rslt['weight_total']
-                all_means[i,...] = rslt['average']
-                all_variances[i,...] = rslt['variance']
-
-        # for each location in all_weight_totals that is 0, make sure that
-        # corresponding location in all_means and all_variances are also 0
-        # (we want to make sure they're NOT NaNs) 
-        _mask = (all_weight_totals == 0.0)
-        assert (_mask.shape[-1] == 1) and (_mask.ndim == all_means.ndim)
-        _mask.shape = _mask.shape[:-1]
-        all_means[_mask] = 0.0
-        all_variances[_mask] = 0.0
-
-        def func(local_weight_tots, local_means, local_vars):
-            # this borrows heavily from the yt-project!
-            dtype = np.float64
-
-            global_weight_total = local_weight_tots.sum(dtype = dtype)
-            if global_weight_total == 0.0:
-                return np.nan, np.nan, 0.0
-
-            global_mean = (
-                (local_weight_tots*local_means).sum(dtype = dtype)
-                / global_weight_total
-            )
-
-            delta2 = np.square(local_means - global_mean, dtype = dtype)
-            global_var = (
-                (local_weight_tots * (local_vars + delta2)).sum(dtype = dtype)
-                / global_weight_total
-            )
-
-            return global_var, global_mean, global_weight_total
-
-        assert all_variances.ndim == 3
-
-        # outer loop indices correspond to calculations that used different
-        # weight fields
-        for weight_ind in range(all_variances.shape[-2]):
-            # inner loop all used the same weight field
-            for i in range(all_variances.shape[-1]):
-                global_var, global_mean, global_weight_total = func(
-                    all_weight_totals[:,weight_ind,0],
-                    all_means[:,weight_ind, i],
-                    all_variances[:,weight_ind, i]
-                )
-                if i == 0:
-                    out['weight_total'][weight_ind, 0] = global_weight_total
-                else:
-                    assert (out['weight_total'][weight_ind,0]
-                             == global_weight_total) # sanity check
-                out['average'][weight_ind, i] = global_mean
-                out['variance'][weight_ind, i] = global_var
-
-        if (out['weight_total'] == 0.0).any():
+        out = _consolidate_bulk_moments(rslts, with_variance = True)
+        if (len(out) > 0) and (out['weight_total'] == 0.0).any():
             raise RuntimeError(
                 "Encountered weight_total == 0. We may want to reconsider "
                 "some things."
             )
-
         return out
 
     @classmethod
@@ -0,0 +1,151 @@
+"""
+Helps balance the work of ``small_dist_sf_props`` between workers.
+
+The cost of processing a subvolume scales roughly as
+``0.5*N_central**2 + sum(N_central*N_neighbor)``, where the sum runs over the
+(up to 13) neighbors for which cross terms are computed. Since the number of
+points per subvolume can vary by orders of magnitude, we:
+1. estimate the number of points per subvolume from the grid metadata (no
+   field data is read),
+2. dispatch the most expensive tasks first (so that the cheap tasks fill in
+   the gaps at the end of the calculation), and
+3. split subvolumes that are too expensive for a single worker into
+   ``SubvolPart`` tasks (the pairs of each part are picked with the same
+   ``TaskItFactory`` partitioning used within the C++ library).
+"""
+
+import logging
+import math
+
+import numpy as np
+
+from ._cut_region_iterator import neighbor_ind_iter
+from .worker import SubvolPart
+
+# TaskItFactory can't partition an auto-structure function between more than
+# 30 processes
+_MAX_PARTS_PER_SUBVOL = 30
+
+def estimate_subvol_num_points(ds, subvol_decomp):
+    """
+    Estimates the number of points in each subvolume.
+
+    This counts the leaf cells (of every grid) whose centers lie in each
+    subvolume. The cut_regions are ignored. If the dataset isn't grid-based,
+    every subvolume is assigned an estimate proportional to its volume.
+
+    Returns a 3D array with shape ``subvol_decomp.subvols_per_ax``.
+    """
+    subvols_per_ax = subvol_decomp.subvols_per_ax
+    out = np.zeros(subvols_per_ax, dtype = np.int64)
+
+    grids = getattr(ds.index, 'grids', None)
+    if grids is None:
+        logging.warning("Can't estimate the number of points per subvolume "
+                        "(the dataset isn't grid-based). Assuming that they "
+                        "are all equal")
+        out[...] = 1
+        return out
+
+    length_unit = subvol_decomp.length_unit
+    left_edge = np.array(subvol_decomp.left_edge)
+    right_edge = np.array(subvol_decomp.right_edge)
+    subvol_widths, _ = subvol_decomp.subvol_widths
+
+    for grid in grids:
+        grid_left = grid.LeftEdge.to(length_unit).ndarray_view()
+        dds = grid.dds.to(length_unit).ndarray_view()
+
+        # compute the subvolume index of the cell centers along each axis (-1
+        # denotes cells that lie outside of the decomposed volume)
+        ax_inds = []
+        for dim in range(3):
+            centers = grid_left[dim] + (np.arange(grid.ActiveDimensions[dim])
+                                        + 0.5) * dds[dim]
+            inds = np.minimum(
+                np.floor((centers - left_edge[dim]) / subvol_widths[dim]),
+                subvols_per_ax[dim] - 1
+            ).astype(np.int64)
+            inside = (centers >= left_edge[dim]) & (centers <= right_edge[dim])
+            inds[~inside] = -1
+            ax_inds.append(inds)
+        if any((inds == -1).all() for inds in ax_inds):
+            continue
+
+        # child_mask is True for the cells that aren't refined
+        leaf = np.asarray(grid.child_mask, dtype = bool)
+        ix, iy, iz = np.meshgrid(*ax_inds, indexing = 'ij')
+        w = leaf & (ix >= 0) & (iy >= 0) & (iz >= 0)
+        np.add.at(out, (ix[w], iy[w], iz[w]), 1)
+
+    return out
+
+def estimate_subvol_costs(num_points, subvol_decomp):
+    """
+    Estimates the relative cost of processing each subvolume (as the number
+    of pairs that must be considered).
+
+    Returns a 3D array with the same shape as num_points.
+    """
+    n = np.asarray(num_points, dtype = np.float64)
+    costs = 0.5 * n * n
+    for subvol_index in np.ndindex(*n.shape):
+        for other_ind in neighbor_ind_iter(subvol_index, subvol_decomp):
+            costs[subvol_index] += n[subvol_index] * n[other_ind]
+    return costs
+
+def balance_subvol_batches(batches, costs, n_workers):
+    """
+    Reorganizes batches of subvolume indices so that the work is balanced
+    between n_workers.
+
+    Any subvolume whose cost exceeds half of the ideal load per worker is
+    removed from its batch and split into parts that each form a separate
+    task. The tasks are returned in order of decreasing cost.
+
+    Parameters
+    ----------
+    batches: iterable
+        Batches of subvolume indices (like those yielded by
+        ``subvol_index_batch_generator``)
+    costs: np.ndarray
+        The estimated cost of each subvolume (see ``estimate_subvol_costs``)
+    n_workers: int
+        The number of workers
+
+    Returns
+    -------
+    tasks: list of tuples
+        Each task is a tuple of subvolume indices or a tuple holding a single
+        ``SubvolPart``.
+    """
+    batches = [tuple(tuple(int(e) for e in ind) for ind in batch)
+               for batch in batches]
+    total_cost = sum(costs[ind] for batch in batches for ind in batch)
+
+    max_parts = min(n_workers, _MAX_PARTS_PER_SUBVOL)
+    if (max_parts > 1) and (total_cost > 0):
+        part_cost = 0.5 * total_cost / n_workers
+    else:
+        part_cost = None
+
+    weighted_tasks = []
+    for batch in batches:
+        remaining, remaining_cost = [], 0.0
+        for ind in batch:
+            if (part_cost is None) or (costs[ind] <= part_cost):
+                remaining.append(ind)
+                remaining_cost += costs[ind]
+                continue
+            n_parts = min(math.ceil(costs[ind] / part_cost), max_parts)
+            for part_index in range(n_parts):
+                weighted_tasks.append(
+                    (costs[ind] / n_parts,
+                     (SubvolPart(ind, part_index, n_parts),))
+                )
+        if len(remaining) > 0:
+            weighted_tasks.append((remaining_cost, tuple(remaining)))
+
+    # sorting is stable, so tasks of equal cost retain their order
+    weighted_tasks.sort(key = lambda pair: -pair[0])
+    return [task for _, task in weighted_tasks]
@@ -1,4 +1,5 @@
-# this only exists to ease testing
+# exposes the partitioning machinery of libvsf (used for testing and for
+# splitting expensive subvolumes between workers)
 
 from libc.stdint cimport uint64_t
 from libc.stddef cimport size_t
@@ -12,13 +13,13 @@ cdef extern from "partition.hpp":
 
     cdef cppclass TaskIt:
         bint has_next()
-        StatTask next()
+        StatTask next() except +
 
     cdef cppclass TaskItFactory:
         TaskItFactory(size_t nproc, size_t n_points, size_t n_points_other,
-                      bint skip_small_prob_check)
+                      bint skip_small_prob_check) except +
         uint64_t n_partitions()
-        TaskIt* build_TaskIt_ptr(size_t proc_id)
+        TaskIt* build_TaskIt_ptr(size_t proc_id) except +
 
 
 cdef class _PyStatTask:
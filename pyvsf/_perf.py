@@ -16,6 +16,38 @@ class PerfRegions:
 
         self._starttimes = dict((name, None) for name in self.times)
 
+        # counters are arbitrary named values that are summed (e.g. the
+        # number of pairs that were evaluated by libvsf)
+        self.counters = {}
+
+    def add_counters(self, counters):
+        for k, v in counters.items():
+            self.counters[k] = self.counters.get(k, 0) + v
+
+    def record_vsf_instrumentation(self, name, instrumentation):
+        """
+        Folds the instrumentation data returned by ``vsf_props`` into the
+        counters (each counter name is prefixed by ``name``).
+
+        In addition to the totals, we track the sum and maximum of the
+        per-process wall times. Their ratio helps identify load imbalance.
+        """
+        proc_wall_ns = instrumentation['proc_wall_ns']
+        evaluated = int(instrumentation['proc_pairs_evaluated'].sum())
+        binned = int(instrumentation['proc_pairs_binned'].sum())
+        self.add_counters({
+            f'{name}:calls' : 1,
+            f'{name}:total_ns' : instrumentation['total_ns'],
+            f'{name}:setup_ns' : instrumentation['setup_ns'],
+            f'{name}:merge_ns' : instrumentation['merge_ns'],
+            f'{name}:proc_wall_sum_ns' : float(proc_wall_ns.sum()),
+            f'{name}:proc_wall_max_ns' : float(proc_wall_ns.max(initial = 0)),
+            f'{name}:tasks' : int(instrumentation['proc_tasks'].sum()),
+            f'{name}:pairs_evaluated' : evaluated,
+            f'{name}:pairs_binned' : binned,
+            f'{name}:pairs_discarded' : evaluated - binned,
+        })
+
     def start_region(self, name):
         assert name in self.times
         assert name not in self._activeset
@@ -47,6 +79,8 @@ class PerfRegions:
             raise ValueError("operands don't have the same region names")
         out = PerfRegions(out_times.keys())
         out.times = out_times
+        out.add_counters(self.counters)
+        out.add_counters(other.counters)
         return out
 
     def any_active_regions(self):
@@ -77,6 +111,9 @@ class PerfRegions:
         times = self.times_sec()
         return '    '.join(f'{key}: {val:>15}' for key,val in times.items())
 
+    def summarize_counters(self):
+        return '    '.join(f'{key}: {val}' for key,val in self.counters.items())
+
     def __getstate__(self):
         """
         Modified pickling behavior since this object is stateful
@@ -92,6 +129,7 @@ class PerfRegions:
     def __setstate__(self,state):
         # restore instance attributes
         self.__dict__.update(state)
+        self.__dict__.setdefault('counters', {})
         # initialize stateful attributes
         self._activeset = set()
         self._starttimes = dict((name, None) for name in self.times)
@@ -0,0 +1,124 @@
+"""
+Reads and writes the binary record format shared by checkpoint files (see
+``_checkpoint``), time-series outputs (see ``time_series``), and the entries
+of a ``SharedSubvolCache``.
+
+A record holds:
+- 8 byte magic string (identifies the kind of record)
+- uint64 length of the (utf-8 encoded) json header, followed by the header
+  (zero-padded to a multiple of 8 bytes)
+- a sequence of binary blobs (each zero-padded to a multiple of 8 bytes)
+  that are described by the header
+
+Every blob starts at a multiple of 8 bytes from the start of the record, so
+arrays can be viewed in place (e.g. from a memory-map).
+"""
+
+import json
+
+import numpy as np
+
+_MAGIC_LEN = 8
+_PREAMBLE_LEN = _MAGIC_LEN + 8
+
+class TruncatedRecordError(ValueError):
+    """
+    Raised when a buffer ends before the end of a record
+    """
+
+def pad8(nbytes):
+    # the number of zero bytes that follow a section with nbytes bytes
+    return (-nbytes) % 8
+
+def padded_nbytes(nbytes):
+    # the number of bytes occupied by a section with nbytes bytes
+    return nbytes + pad8(nbytes)
+
+def to_jsonable(obj):
+    """
+    Converts the numpy arrays and scalars in obj (which may be nested in
+    dicts, lists, and tuples) to json-serializable types
+    """
+    if isinstance(obj, dict):
+        return {str(k) : to_jsonable(v) for k,v in obj.items()}
+    elif isinstance(obj, (list, tuple)):
+        return [to_jsonable(e) for e in obj]
+    elif isinstance(obj, np.ndarray):
+        return obj.tolist()
+    elif isinstance(obj, np.generic):
+        return obj.item()
+    return obj
+
+def encode_header(header):
+    """
+    Encodes a json-serializable header
+    """
+    return json.dumps(header).encode('utf-8')
+
+def record_nbytes(encoded_header, blob_nbytes):
+    """
+    Returns the size of a record with the encoded header and blobs of the
+    specified sizes
+    """
+    return (_PREAMBLE_LEN + padded_nbytes(len(encoded_header)) +
+            sum(padded_nbytes(nbytes) for nbytes in blob_nbytes))
+
+def write_record(f, magic, encoded_header, blobs):
+    """
+    Writes a record to the binary file object, f.
+
+    Parameters
+    ----------
+    f : file object
+        The destination
+    magic : bytes
+        The 8 byte magic string
+    encoded_header : bytes
+        Output of ``encode_header``
+    blobs : sequence
+        Each element is a bytes object or a contiguous np.ndarray
+    """
+    assert len(magic) == _MAGIC_LEN
+    f.write(magic)
+    f.write(np.uint64(len(encoded_header)).tobytes())
+    f.write(encoded_header + b'\0' * pad8(len(encoded_header)))
+    for blob in blobs:
+        nbytes = blob.nbytes if isinstance(blob, np.ndarray) else len(blob)
+        f.write(blob.tobytes() if isinstance(blob, np.ndarray) else blob)
+        f.write(b'\0' * pad8(nbytes))
+
+def read_record_header(buf, offset, magic):
+    """
+    Reads the header of the record that starts at offset of the uint8 array,
+    buf.
+
+    Returns
+    -------
+    header
+        The decoded json header
+    blob_start : int
+        The offset of the record's first blob
+
+    Raises
+    ------
+    ValueError
+        The bytes at offset don't start with magic
+    TruncatedRecordError
+        buf ends before the end of the header
+    """
+    head = buf[offset:offset + _MAGIC_LEN].tobytes()
+    if head != magic[:len(head)]:
+        raise ValueError("the record has an invalid magic string")
+    elif offset + _PREAMBLE_LEN > buf.size:
+        raise TruncatedRecordError("the record is truncated")
+    header_len = int(
+        buf[offset + _MAGIC_LEN:offset + _PREAMBLE_LEN].view(np.uint64)[0]
+    )
+    header_start = offset + _PREAMBLE_LEN
+    blob_start = header_start + padded_nbytes(header_len)
+    if blob_start > buf.size:
+        raise TruncatedRecordError("the record is truncated")
+    header = json.loads(
+        buf[header_start:header_start + header_len].tobytes().decode('utf-8')
+    )
+    return header, blob_start
@@ -0,0 +1,222 @@
+"""
+A node-local cache of the data loaded for each subvolume, shared by every
+worker process on the node.
+
+Every subvolume is loaded once for its own auto-structure function and up to
+13 more times as a neighbor of other subvolumes. Loading that data through yt
+can cost more than the pair kernels. The arrays extracted for a subvolume
+(the output of ``_pos_quan_equan_arr_generator``) are instead written to a
+file in a node-local directory (``/dev/shm`` by default, which is backed by
+memory). Later requests from any process on the node memory-map the file, so
+the pages are shared rather than copied.
+
+Each entry is a single file holding a record (see ``_record_file``) with the
+magic string b"VSFSUBV1" and one binary blob holding the raw contents of each
+array.
+
+Entries are written to a temporary path and atomically renamed. A per-entry
+lock (``fcntl.flock``) ensures that only one process loads a given subvolume,
+while the others wait and then read its entry. The least recently used
+entries are evicted once the total size exceeds a limit (unlinking a file
+doesn't invalidate existing memory-maps of it).
+"""
+
+import contextlib
+import fcntl
+import os
+import shutil
+import tempfile
+import uuid
+
+import numpy as np
+
+from ._record_file import (
+    encode_header,
+    padded_nbytes,
+    read_record_header,
+    record_nbytes,
+    write_record
+)
+
+_MAGIC = b"VSFSUBV1"
+_ENTRY_SUFFIX = '.subvol'
+
+def default_shared_cache_root():
+    """
+    Returns the directory where shared subvolume caches are created by default
+    """
+    if os.path.isdir('/dev/shm'):
+        return '/dev/shm'
+    return tempfile.gettempdir()
+
+def create_shared_cache_dir(root = None):
+    """
+    Returns a new (unique) path for a shared subvolume cache inside of root
+
+    The directory itself is created lazily by each node's worker processes.
+    """
+    if root is None:
+        root = default_shared_cache_root()
+    return os.path.join(root, f'pyvsf-subvols-{uuid.uuid4().hex}')
+
+def remove_shared_cache_dir(path):
+    """
+    Removes the directory of a shared subvolume cache (on the current node)
+    """
+    shutil.rmtree(path, ignore_errors = True)
+
+@contextlib.contextmanager
+def _file_lock(path):
+    with open(path, 'a') as f:
+        fcntl.flock(f.fileno(), fcntl.LOCK_EX)
+        try:
+            yield
+        finally:
+            fcntl.flock(f.fileno(), fcntl.LOCK_UN)
+
+def _encode_records(records):
+    # returns a json-serializable description of records and the list of
+    # arrays that it refers to
+    arrays, offset = [], 0
+    def describe(arr):
+        nonlocal offset
+        if arr is None:
+            return None
+        arr = np.ascontiguousarray(arr)
+        out = {'offset' : offset, 'shape' : list(arr.shape),
+               'dtype' : arr.dtype.str}
+        arrays.append(arr)
+        offset += padded_nbytes(arr.nbytes)
+        return out
+
+    described = []
+    for cr_index, pos, quan, equan_dict, npoints in records:
+        described.append({
+            'cr_index' : int(cr_index), 'npoints' : int(npoints),
+            'pos' : describe(pos), 'quan' : describe(quan),
+            'equan' : (None if equan_dict is None else
+                       {k : describe(v) for k,v in equan_dict.items()})
+        })
+    return described, arrays
+
+def _decode_records(buf, data_start, described):
+    def view(desc):
+        if desc is None:
+            return None
+        dtype = np.dtype(desc['dtype'])
+        start = data_start + desc['offset']
+        stop = start + dtype.itemsize * int(np.prod(desc['shape']))
+        return buf[start:stop].view(dtype).reshape(desc['shape'])
+
+    out = []
+    for rec in described:
+        equan = rec['equan']
+        out.append((rec['cr_index'], view(rec['pos']), view(rec['quan']),
+                    None if equan is None else {k : view(v)
+                                                for k,v in equan.items()},
+                    rec['npoints']))
+    return tuple(out)
+
+class SharedSubvolCache:
+    """
+    Node-local cache of the data loaded for each subvolume (see the module
+    docstring).
+
+    Parameters
+    ----------
+    path : str
+        The cache's directory. It must be unique to a single calculation
+        (e.g. from ``create_shared_cache_dir``) and should be node-local.
+    max_nbytes : int
+        The maximum total size of the cached entries. Entries larger than
+        this are never cached.
+    """
+
+    def __init__(self, path, max_nbytes):
+        if max_nbytes <= 0:
+            raise ValueError("max_nbytes must be positive")
+        self.path = path
+        self.max_nbytes = max_nbytes
+        os.makedirs(path, exist_ok = True)
+
+    def _entry_path(self, subvol_index):
+        name = '_'.join(str(int(e)) for e in subvol_index)
+        return os.path.join(self.path, name + _ENTRY_SUFFIX)
+
+    def _read(self, entry_path):
+        try:
+            buf = np.memmap(entry_path, dtype = np.uint8, mode = 'r')
+        except FileNotFoundError:
+            return None
+        try:
+            header, data_start = read_record_header(buf, 0, _MAGIC)
+        except ValueError:
+            raise RuntimeError(
+                f"{entry_path!r} isn't a subvolume cache entry"
+            ) from None
+        # mark the entry as recently used (this is used for eviction)
+        with contextlib.suppress(FileNotFoundError):
+            os.utime(entry_path)
+        return _decode_records(buf, data_start, header)
+
+    def _write(self, entry_path, records):
+        described, arrays = _encode_records(records)
+        header = encode_header(described)
+        nbytes = record_nbytes(header, [arr.nbytes for arr in arrays])
+        if nbytes > self.max_nbytes:
+            return
+
+        tmp_path = f'{entry_path}.{os.getpid()}.tmp'
+        with open(tmp_path, 'wb') as f:
+            write_record(f, _MAGIC, header, arrays)
+        os.replace(tmp_path, entry_path)
+        self._evict(keep = entry_path)
+
+    def _evict(self, keep):
+        # removes the least recently used entries until the total size is
+        # within the limit
+        with _file_lock(os.path.join(self.path, '.evict.lock')):
+            entries = []
+            for name in os.listdir(self.path):
+                if not name.endswith(_ENTRY_SUFFIX):
+                    continue
+                entry_path = os.path.join(self.path, name)
+                try:
+                    stat = os.stat(entry_path)
+                except FileNotFoundError:
+                    continue
+                entries.append((stat.st_mtime, stat.st_size, entry_path))
+
+            total = sum(size for _, size, _ in entries)
+            for _, size, entry_path in sorted(entries):
+                if total <= self.max_nbytes:
+                    break
+                elif entry_path == keep:
+                    continue
+                with contextlib.suppress(FileNotFoundError):
+                    os.remove(entry_path)
+                total -= size
+
+    def __contains__(self, subvol_index):
+        return os.path.exists(self._entry_path(subvol_index))
+
+    def get_or_load(self, subvol_index, loader):
+        """
+        Returns the cached records of subvol_index. When there isn't an
+        entry, ``loader()`` is called to produce an iterable of records (the
+        output of ``_pos_quan_equan_arr_generator``), which is stored.
+
+        Arrays read from the cache are read-only.
+        """
+        entry_path = self._entry_path(subvol_index)
+        out = self._read(entry_path)
+        if out is not None:
+            return out
+
+        with _file_lock(entry_path + '.lock'):
+            # another process may have stored the entry while we waited
+            out = self._read(entry_path)
+            if out is None:
+                out = tuple(loader())
+                self._write(entry_path, out)
+        return out
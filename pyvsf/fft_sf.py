@@ -0,0 +1,132 @@
+"""
+Computes the second order structure function of a vector field on a periodic
+uniform grid with FFTs.
+
+This relies upon the fact that for a periodic field
+    S_2(r) = < |v(x + r) - v(x)|^2 > = 2 < |v|^2 > - 2 C(r)
+where C(r) = < v(x) . v(x + r) > is the autocorrelation function. The
+autocorrelation for every displacement vector is computed in O(N log N) with
+the Wiener-Khinchin theorem.
+
+numpy.fft is used (the C++ library doesn't have an FFT dependency).
+"""
+
+import numpy as np
+
+from ._kernels_cy import _verify_bin_edges, _set_empty_count_locs_to_NaN
+
+def _min_image_sqr_separations(n, width):
+    # squared separation associated with each index offset (along a single
+    # periodic axis)
+    offsets = np.arange(n)
+    return np.square(np.minimum(offsets, n - offsets) * width)
+
+def fft_sf2_props(vel_components, dist_bin_edges, cell_widths,
+                  postprocess_stat = True):
+    """
+    Calculates the binned second order velocity structure function for all
+    unique pairs of cells in a periodic uniform 3D grid.
+
+    Distances between cells are computed with the minimum image convention.
+
+    Parameters
+    ----------
+    vel_components : sequence of 3 array_like
+        3D arrays (each with the same shape) holding the x, y, and z velocity
+        components of each cell. A single 4D array, where axis 0 has a length
+        of 3, is also accepted.
+    dist_bin_edges : array_like
+        1D array of monotonically increasing values that represent edges for
+        distance bins. These have the same meaning as in ``vsf_props``.
+    cell_widths : float or sequence of 3 floats
+        The width of a cell along each axis.
+    postprocess_stat : bool, optional
+        When `True` (the default), entries of 'mean' in bins without any pairs
+        are set to NaN.
+
+    Returns
+    -------
+    out : dict
+        Has the same layout as the output of the 'mean' statistic in
+        ``vsf_props``. 'counts' holds the number of unique pairs of cells in
+        each distance bin. 'mean' holds the average of ``|delta v|^2`` (the
+        second order structure function) in each bin.
+
+    Notes
+    -----
+    Up to floating point round-off, the outputs match a direct summation over
+    all pairs (using minimum image distances). The memory footprint is a few
+    times the size of a single velocity component.
+    """
+    vel_components = [np.asarray(comp, dtype = np.float64)
+                      for comp in vel_components]
+    if len(vel_components) != 3:
+        raise ValueError("vel_components must hold 3 3D arrays")
+    shape = vel_components[0].shape
+    if len(shape) != 3 or any(comp.shape != shape for comp in vel_components):
+        raise ValueError("vel_components must hold 3 3D arrays with the same "
+                         "shape")
+
+    cell_widths = np.broadcast_to(np.asarray(cell_widths, dtype = np.float64),
+                                  (3,))
+    if not (cell_widths > 0).all():
+        raise ValueError("each entry in cell_widths must be positive")
+
+    dist_bin_edges = np.asanyarray(dist_bin_edges, dtype = np.float64)
+    if not _verify_bin_edges(dist_bin_edges):
+        raise ValueError(
+            'dist_bin_edges must be a 1D monotonically increasing array with '
+            '2 or more values'
+        )
+    nbins = dist_bin_edges.size - 1
+    n_cells = int(np.prod(shape))
+
+    # compute the sum of the autocorrelation of each component
+    autocorr = np.zeros(shape, dtype = np.float64)
+    mean_sqr = 0.0
+    for comp in vel_components:
+        power = np.abs(np.fft.rfftn(comp))**2
+        autocorr += np.fft.irfftn(power, s = shape,
+                                  axes = range(len(shape)))
+        del power
+        mean_sqr += np.square(comp).sum()
+    autocorr /= n_cells
+    mean_sqr /= n_cells
+
+    # sf2 holds the average of |dv|^2 for each displacement vector
+    sf2 = autocorr
+    sf2 *= -2.0
+    sf2 += 2.0 * mean_sqr
+
+    # bin the displacement vectors. Following the convention used by
+    # calc_vsf_props, bin i holds distances in (edges[i], edges[i+1]]. We work
+    # with squared distances & process a slab at a time to limit memory usage
+    dist_sqr_bin_edges = np.where(dist_bin_edges < 0, dist_bin_edges,
+                                  np.square(dist_bin_edges))
+    sep_sqr = [_min_image_sqr_separations(n, width)
+               for n, width in zip(shape, cell_widths)]
+    sep_sqr_yz = sep_sqr[1][:, None] + sep_sqr[2][None, :]
+
+    ndisp = np.zeros((nbins,), dtype = np.int64)
+    sf2_sum = np.zeros((nbins,), dtype = np.float64)
+    for ix in range(shape[0]):
+        bin_ind = np.searchsorted(dist_sqr_bin_edges,
+                                  (sep_sqr[0][ix] + sep_sqr_yz).ravel(),
+                                  side = 'left') - 1
+        if ix == 0:
+            bin_ind[0] = -1 # exclude the zero-displacement vector
+        w = (bin_ind >= 0) & (bin_ind < nbins)
+        ndisp += np.bincount(bin_ind[w], minlength = nbins)
+        sf2_sum += np.bincount(bin_ind[w], weights = sf2[ix].ravel()[w],
+                               minlength = nbins)
+
+    # each displacement vector corresponds to n_cells ordered pairs. Each
+    # unique pair appears twice (as d and -d) when considering all displacement
+    # vectors
+    out = {'counts' : (ndisp * n_cells) // 2,
+           'mean' : np.zeros((nbins,), dtype = np.float64)}
+    w = ndisp > 0
+    out['mean'][w] = sf2_sum[w] / ndisp[w]
+    if postprocess_stat:
+        _set_empty_count_locs_to_NaN(out)
+    return out
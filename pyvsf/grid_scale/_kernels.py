@@ -42,95 +42,8 @@ class TrailingGhostSpec:
         z_slc = slice(0, -1 * self.z) if self.z > 0 else slice(None)
         return (x_slc, y_slc, z_slc)
 
-class _NeighborOpExecutor:
-    def __init__(self, axis, trailing_ghost_spec):
-        assert isinstance(trailing_ghost_spec, TrailingGhostSpec)
-
-        # initialize default values of x_slcs, y_slcs, and z_slcs so that
-        # they select all non-ghost cells
-        active_zone_slcs = trailing_ghost_spec.active_zone_idx()
-
-        self.x_slcs = active_zone_slcs[0], active_zone_slcs[0]
-        self.y_slcs = active_zone_slcs[1], active_zone_slcs[1]
-        self.z_slcs = active_zone_slcs[2], active_zone_slcs[2]
-
-        # overwrite the value x_slcs, y_slcs, and z_slcs
-        if axis == 'x':
-            self.x_slcs = slice(0,-1,1), slice(1,None, 1)
-        elif axis == 'y':
-            self.y_slcs = slice(0,-1,1), slice(1,None, 1)
-        elif axis == 'z':
-            self.z_slcs = slice(0,-1,1), slice(1,None, 1)
-        else:
-            raise ValueError(f"Can't handle axis = {axis}")
-
-    def exec_on_array(self, op, arr):
-        x_slc0, x_slc1 = self.x_slcs
-        y_slc0, y_slc1 = self.y_slcs
-        z_slc0, z_slc1 = self.z_slcs
-        vals_0 = arr[x_slc0, y_slc0, z_slc0]
-        vals_1 = arr[x_slc1, y_slc1, z_slc1]
-        return op(vals_0, vals_1)
-
-    def exec_on_field(self, op, field, grid):
-        return self.exec_on_array(op, grid[field])
-
 _NO_GHOST_CELLS_SPEC = TrailingGhostSpec(False, False, False)
 
-def _neighbor_vec_differences(components, axis, diff_type,
-                              trailing_ghost_spec = _NO_GHOST_CELLS_SPEC):
-    """
-    Computes differences between vectors
-    
-    Parmeters
-    ---------
-    diff_type : str
-        Accepts values of 'parallel', 'transverse', 'total'
-    trailing_ghost_spec: TrailingGhostSpec, optional
-        Specifies the number of trailing ghost cells for each axis. The default
-        is no ghost cells
-
-    Notes
-    -----
-    The different values accepted by diff_type haven the 
-    following meanings:
-        - 'parallel': compute the signed difference of the 
-          vector component parallel to the displacement 
-          vector between 2 cells
-        - 'transverse': compute the magnitude of the 
-          2 components perpendicular to the displacement 
-          vector between 2 cells
-        - 'total': computes the magnitude of the differences
-          between all components
-    """
-    assert isinstance(trailing_ghost_spec, TrailingGhostSpec)
-    exec_operation = _NeighborOpExecutor(axis, trailing_ghost_spec)
-
-    if axis == 'x':
-        aligned_comp,transverse_comps = 0, (1,2)
-    elif axis == 'y':
-        aligned_comp,transverse_comps = 1, (2,0)
-    elif axis == 'z':
-        aligned_comp,transverse_comps = 2, (0,1)
-    else:
-        raise ValueError(f'invalid axis value: {axis}')
-
-    op = lambda x0, x1: x1 - x0
-    if diff_type == 'transverse':
-        diff_l = [exec_operation.exec_on_field(op, comp, components) \
-                  for comp in transverse_comps]
-        return np.sqrt(np.square(diff_l[0]) + np.square(diff_l[1]))
-    elif diff_type == 'total':   # magnitude of vel including all 3 components
-        diff_l = [exec_operation.exec_on_field(op, comp, components) \
-                  for comp in (0,1,2)]
-        return np.sqrt(np.square(diff_l[0]) + np.square(diff_l[1]) +
-                       np.square(diff_l[2]))
-    elif diff_type == 'parallel': # signed difference of component parallel to 
-                                  # displacement vector between 2 cells
-        return exec_operation.exec_on_field(op, aligned_comp, components)
-    else:
-        raise ValueError(f'invalid diff_type value: {diff_type}')
-
 def neighbor_vdiffs(quan_dict, extra_quan_dict, cr_map, kwargs,
                     trailing_ghost_spec = _NO_GHOST_CELLS_SPEC):
     """
@@ -158,43 +71,30 @@ def neighbor_vdiffs(quan_dict, extra_quan_dict, cr_map, kwargs,
         is no ghost cells
     """
     assert isinstance(trailing_ghost_spec, TrailingGhostSpec)
+    # imported here to avoid a circular import
+    from ..pyvsf import grid_neighbor_vdiff_hists
 
     components = [quan_dict[("gas", "velocity_x")],
                   quan_dict[("gas", "velocity_y")],
                   quan_dict[("gas", "velocity_z")]]
     cs_vals = extra_quan_dict[('gas', 'sound_speed')]
 
-    calc_pairs = [('aligned_vdiff', 'parallel'),
-                  ('transverse_vdiff', 'transverse'),
-                  ('mag_vdiff', 'total')]
-    
-    out = {}
-    for cr_ind in cr_map.keys():
-        out[cr_ind] = GridscaleVdiffHistogram.zero_initialize_rslt(
-            [], kwargs, False
-        )
-    for axis in 'xyz':
-        exec_operation = _NeighborOpExecutor(axis, trailing_ghost_spec)
-
-        # find the maximum sound speed from pairs of cells
-        max_shared_cs = exec_operation.exec_on_array(np.maximum, cs_vals)
+    prefixes = ['aligned_vdiff', 'transverse_vdiff', 'mag_vdiff']
+    cr_indices = list(cr_map.keys())
 
-        for prefix, diff_type in calc_pairs:
-            dtype = f'{prefix}_counts'
-            bin_edges = kwargs[f'{prefix}_edges']
+    # all 3 histograms are filled for every cut region in a single sweep
+    counts = grid_neighbor_vdiff_hists(
+        components, cs_vals, [cr_map[cr_ind] for cr_ind in cr_indices],
+        vdiff_bin_edges = [kwargs[f'{prefix}_edges'] for prefix in prefixes],
+        n_trailing_ghost = (int(trailing_ghost_spec.x),
+                            int(trailing_ghost_spec.y),
+                            int(trailing_ghost_spec.z))
+    )
 
-            # find the velocity differences
-            vdiffs = (_neighbor_vec_differences(components, axis, diff_type,
-                                                trailing_ghost_spec)
-                      / max_shared_cs)
-
-            for cr_ind, cr_select_mask in cr_map.items():
-                # identify pairs of of cells that are in the same cut region
-                idx = exec_operation.exec_on_array(np.logical_and,
-                                                   cr_select_mask)
-                # bin the velocity counts
-                out[cr_ind][dtype] += np.histogram(vdiffs[idx],
-                                                   bins = bin_edges)[0]
+    out = {}
+    for i, cr_ind in enumerate(cr_indices):
+        out[cr_ind] = {f'{prefix}_counts' : counts[k][i].copy()
+                       for k, prefix in enumerate(prefixes)}
     return out
 
 class GridscaleVdiffHistogram:
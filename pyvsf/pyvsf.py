@@ -1,13 +1,14 @@
 from collections import OrderedDict
 from collections.abc import Sequence
 import ctypes
+import os
 import os.path
 
 
 import numpy as np
 
 from ._kernels import get_kernel
-from ._kernels_cy import _verify_bin_edges
+from ._kernels_cy import _verify_bin_edges, _vsf_error_to_exception
 
 # get the directory of the current file 
 _dir_of_cur_file = os.path.dirname(os.path.abspath(__file__))
@@ -33,7 +34,11 @@ class POINTPROPS(ctypes.Structure):
 
     @staticmethod
     def construct(pos, vel, dtype = np.float64, allow_null_pair = False):
-        if allow_null_pair and (pos is None) and (vel is None):
+        if isinstance(pos, PointSet):
+            if vel is not None:
+                raise ValueError("vel must be None when pos is a PointSet")
+            return pos._pointprops()
+        elif allow_null_pair and (pos is None) and (vel is None):
             return POINTPROPS(None, None, n_points = 0, n_spatial_dims = 0,
                               spatial_dim_stride = 0)
         elif (pos is None) or (vel is None):
@@ -58,11 +63,214 @@ class POINTPROPS(ctypes.Structure):
         assert vel_arr.strides[0] == (n_points * vel_arr.itemsize)
         spatial_dim_stride = int(n_points)
 
-        return POINTPROPS(positions = pos_arr.ctypes.data_as(_double_ptr),
-                          velocities = vel_arr.ctypes.data_as(_double_ptr),
-                          n_points = n_points,
-                          n_spatial_dims = n_spatial_dims,
-                          spatial_dim_stride = spatial_dim_stride)
+        out = POINTPROPS(positions = pos_arr.ctypes.data_as(_double_ptr),
+                         velocities = vel_arr.ctypes.data_as(_double_ptr),
+                         n_points = n_points,
+                         n_spatial_dims = n_spatial_dims,
+                         spatial_dim_stride = spatial_dim_stride)
+        # pos_arr & vel_arr may be temporary copies. Attach them to out so
+        # that the pointers remain valid for out's lifetime
+        out._arrays = (pos_arr, vel_arr)
+        return out
+
+_lib.pointset_create.argtypes = [ctypes.c_size_t, ctypes.c_size_t,
+                                 ctypes.c_void_p]
+_lib.pointset_create.restype = ctypes.c_void_p
+_lib.pointset_destroy.argtypes = [ctypes.c_void_p]
+_lib.pointset_destroy.restype = None
+_lib.pointset_props.argtypes = [ctypes.c_void_p]
+_lib.pointset_props.restype = POINTPROPS
+_lib.pointset_positions.argtypes = [ctypes.c_void_p]
+_lib.pointset_positions.restype = _double_ptr
+_lib.pointset_velocities.argtypes = [ctypes.c_void_p]
+_lib.pointset_velocities.restype = _double_ptr
+
+class PointSet:
+    """
+    Holds a copy of positions and velocities in memory owned by libvsf.
+
+    Each component is stored in a separate 64-byte aligned (and padded) array.
+    A PointSet can be passed to ``vsf_props`` in place of ``pos_a`` or
+    ``pos_b`` (the corresponding velocity argument must then be `None`). This
+    avoids copying the same data over and over again when a set of points is
+    used in many calculations.
+
+    Parameters
+    ----------
+    pos, vel : array_like
+        2D arrays holding the positions and velocities of each point (with
+        the same layout expected by ``vsf_props``).
+    """
+
+    def __init__(self, pos, vel):
+        self._handle = None
+        pos = np.asarray(pos, dtype = np.float64)
+        vel = np.asarray(vel, dtype = np.float64)
+        if pos.ndim != 2 or pos.shape != vel.shape:
+            raise ValueError("pos and vel must be 2D arrays with the same "
+                             "shape")
+        n_spatial_dims, n_points = map(int, pos.shape)
+
+        err_info = VSFERRORINFO()
+        self._handle = _lib.pointset_create(n_points, n_spatial_dims,
+                                            ctypes.byref(err_info))
+        if self._handle is None:
+            err_info.raise_if_error(err_info.code)
+
+        # copy the data directly into the library's buffers
+        self.pos[...] = pos
+        self.vel[...] = vel
+
+    def _buffer_view(self, ptr):
+        props = _lib.pointset_props(self._handle)
+        n_points, stride = props.n_points, props.spatial_dim_stride
+        if stride == 0:
+            return np.empty((props.n_spatial_dims, 0), dtype = np.float64)
+        arr = np.ctypeslib.as_array(ptr, shape = (props.n_spatial_dims *
+                                                  stride,))
+        return arr.reshape(props.n_spatial_dims, stride)[:, :n_points]
+
+    @property
+    def pos(self):
+        """
+        Writable view of the positions (only valid while self is alive)
+        """
+        return self._buffer_view(_lib.pointset_positions(self._handle))
+
+    @property
+    def vel(self):
+        """
+        Writable view of the velocities (only valid while self is alive)
+        """
+        return self._buffer_view(_lib.pointset_velocities(self._handle))
+
+    @property
+    def n_points(self):
+        return int(_lib.pointset_props(self._handle).n_points)
+
+    def spatial_sort(self, curve = 'hilbert', nproc = 1):
+        """
+        Reorders the points (in place) along a space-filling curve.
+
+        Returns the permutation (the ith entry is the original index of the
+        ith point). This can be used to reorder associated data (e.g. with
+        ``weights[perm]``).
+        """
+        perm = np.empty((self.n_points,), dtype = np.uint64)
+        err_info = VSFERRORINFO()
+        err_info.raise_if_error(_lib.pointset_spatial_sort(
+            self._handle, _curve_kind(curve),
+            PARALLELSPEC(nproc = nproc, force_sequential = False),
+            perm.ctypes.data_as(_uint64_ptr), ctypes.byref(err_info)))
+        return perm.astype(np.int64)
+
+    def _pointprops(self):
+        out = _lib.pointset_props(self._handle)
+        out._arrays = (self,) # keep the buffers alive
+        return out
+
+    def __del__(self):
+        if getattr(self, '_handle', None) is not None:
+            _lib.pointset_destroy(self._handle)
+            self._handle = None
+
+    def __reduce__(self):
+        return (PointSet, (np.array(self.pos), np.array(self.vel)))
+
+_uint64_ptr = ctypes.POINTER(ctypes.c_uint64)
+_int64_ptr = ctypes.POINTER(ctypes.c_int64)
+
+_CURVE_KINDS = {'morton' : 0, 'hilbert' : 1}
+
+def _curve_kind(curve):
+    try:
+        return _CURVE_KINDS[curve]
+    except KeyError:
+        raise ValueError(f"curve must be one of {list(_CURVE_KINDS)}") \
+            from None
+
+def spatial_sort_permutation(pos, curve = 'hilbert', box_min = None,
+                             box_width = None, nproc = 1):
+    """
+    Computes the permutation that orders points along a space-filling curve.
+
+    Points that are adjacent along the curve tend to be close together in
+    space. Reordering points in this way makes calculations that visit nearby
+    points together more cache-friendly.
+
+    Parameters
+    ----------
+    pos : array_like
+        2D array (with shape ``(3, n_points)``) holding the positions
+    curve : {'hilbert', 'morton'}
+        The space-filling curve.
+    box_min, box_width : optional
+        Specifies the lower corner and width of the cubic box used to quantize
+        the positions. By default, the bounding box of the points is used.
+    nproc : int, optional
+        The number of processes used to compute the keys and sort them. The
+        result doesn't depend on this value.
+
+    Returns
+    -------
+    perm : np.ndarray
+        The ith entry is the index of the point that is ith along the curve.
+        ``pos[:, perm]`` holds the sorted positions.
+    """
+    pos_arr = np.ascontiguousarray(pos, dtype = np.float64)
+    if pos_arr.ndim != 2 or pos_arr.shape[0] != 3:
+        raise ValueError("pos must be a 2D array with shape (3, n_points)")
+    n_points = int(pos_arr.shape[1])
+    points = POINTPROPS(positions = pos_arr.ctypes.data_as(_double_ptr),
+                        velocities = None, n_points = n_points,
+                        n_spatial_dims = 3, spatial_dim_stride = n_points)
+
+    if (box_min is None) != (box_width is None):
+        raise ValueError("box_min and box_width must both be specified or "
+                         "both be None")
+    elif box_min is None:
+        box_min_ptr, box_width = None, 0.0
+    else:
+        box_min = np.ascontiguousarray(box_min, dtype = np.float64)
+        if box_min.shape != (3,):
+            raise ValueError("box_min must have 3 entries")
+        box_min_ptr = box_min.ctypes.data_as(_double_ptr)
+
+    perm = np.empty((n_points,), dtype = np.uint64)
+    err_info = VSFERRORINFO()
+    err_info.raise_if_error(_lib.compute_spatial_sort_permutation(
+        points, _curve_kind(curve), box_min_ptr, float(box_width),
+        PARALLELSPEC(nproc = nproc, force_sequential = False),
+        perm.ctypes.data_as(_uint64_ptr), ctypes.byref(err_info)))
+    return perm.astype(np.int64)
+
+def spatially_sort_points(pos, vel, *other_arrays, curve = 'hilbert',
+                          nproc = 1):
+    """
+    Reorders points (and their velocities, weights, etc.) along a
+    space-filling curve.
+
+    Parameters
+    ----------
+    pos, vel : array_like
+        2D arrays with shape ``(3, n_points)``
+    *other_arrays : array_like
+        Additional arrays that are reordered with the points (their last axis
+        must have a length of ``n_points``)
+    curve, nproc
+        Passed to ``spatial_sort_permutation``
+
+    Returns
+    -------
+    perm : np.ndarray
+        The permutation (see ``spatial_sort_permutation``)
+    sorted_arrays : tuple of np.ndarray
+        The sorted versions of pos, vel and each of the other arrays.
+    """
+    perm = spatial_sort_permutation(pos, curve = curve, nproc = nproc)
+    sorted_arrays = tuple(np.ascontiguousarray(np.asarray(arr)[..., perm])
+                          for arr in (pos, vel) + other_arrays)
+    return perm, sorted_arrays
 
 class STATLISTITEM(ctypes.Structure):
     _fields_ = [("statistic", ctypes.c_char_p),
@@ -140,10 +348,134 @@ _HISTBINS_ptr = ctypes.POINTER(HISTBINS)
 
 class PARALLELSPEC(ctypes.Structure):
     _fields_ = [("nproc", ctypes.c_size_t),
-                ("force_sequential", ctypes.c_bool)]
+                ("force_sequential", ctypes.c_bool),
+                ("pool", ctypes.c_void_p)]
+
+def _parallel_spec(nproc, force_sequential, pool):
+    return PARALLELSPEC(nproc = nproc, force_sequential = force_sequential,
+                        pool = None if pool is None else pool._get_handle())
 
 _ptr_to_double_ptr = ctypes.POINTER(_double_ptr)
 
+_VSF_ERR_MSG_LEN = 512
+
+class VSFERRORINFO(ctypes.Structure):
+    _fields_ = [("code", ctypes.c_int),
+                ("message", ctypes.c_char * _VSF_ERR_MSG_LEN)]
+
+    def raise_if_error(self, code):
+        # code is the value returned by the function that filled in self
+        if code != 0:
+            raise _vsf_error_to_exception(code, self.message)
+
+_VSFERRORINFO_ptr = ctypes.POINTER(VSFERRORINFO)
+
+_lib.vsfpool_create.argtypes = [ctypes.c_size_t, _VSFERRORINFO_ptr]
+_lib.vsfpool_create.restype = ctypes.c_void_p
+_lib.vsfpool_destroy.argtypes = [ctypes.c_void_p]
+_lib.vsfpool_destroy.restype = None
+_lib.vsfpool_nthreads.argtypes = [ctypes.c_void_p]
+_lib.vsfpool_nthreads.restype = ctypes.c_size_t
+_lib.vsfpool_run_test_tasks.argtypes = [
+    ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t,
+    ctypes.POINTER(ctypes.c_uint64), _VSFERRORINFO_ptr
+]
+_lib.vsfpool_run_test_tasks.restype = ctypes.c_int
+
+class ThreadPool:
+    """
+    A persistent team of threads owned by libvsf.
+
+    Passing a ThreadPool through the ``pool`` kwarg of ``vsf_props``,
+    ``vsf_props_2D``, ``quan_sf_props`` or ``batched_sf_props`` evaluates the
+    calculation with the pool's threads instead of launching a new OpenMP
+    team. The pool also keeps the accumulators of each process alive between
+    calls. This mostly matters for many small calculations, where the fixed
+    cost of setting up the threads and accumulators can rival the actual
+    work.
+
+    The results are bitwise identical to the results computed without a
+    pool (with the same nproc). Calls from different Python threads that
+    share a pool are serialized. The threads don't survive a fork, so a pool
+    can only be used by the process that created it.
+
+    Parameters
+    ----------
+    nthreads : int, optional
+        Number of threads (including the calling thread). A value of 0 (the
+        default) falls back to the OMP_NUM_THREADS environment variable.
+    """
+
+    def __init__(self, nthreads = 0):
+        self._handle = None
+        if nthreads < 0:
+            raise ValueError("nthreads must not be negative")
+        self._pid = os.getpid()
+        err_info = VSFERRORINFO()
+        self._handle = _lib.vsfpool_create(nthreads, ctypes.byref(err_info))
+        if self._handle is None:
+            err_info.raise_if_error(err_info.code)
+
+    def _get_handle(self):
+        if self._handle is None:
+            raise ValueError("the pool has been closed")
+        elif self._pid != os.getpid():
+            raise RuntimeError("a ThreadPool can't be used after a fork")
+        return self._handle
+
+    @property
+    def nthreads(self):
+        return int(_lib.vsfpool_nthreads(self._get_handle()))
+
+    def close(self):
+        """
+        Stops the threads. The pool can't be used afterwards.
+        """
+        if getattr(self, '_handle', None) is None:
+            return
+        elif self._pid == os.getpid():
+            _lib.vsfpool_destroy(self._handle)
+        # after a fork, there aren't any threads to stop (we leak the memory)
+        self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def __reduce__(self):
+        return (ThreadPool, (self.nthreads,))
+
+_VSF_INSTR_MAX_PROCS = 32
+
+class VSFINSTRUMENTATION(ctypes.Structure):
+    _fields_ = [("n_procs", ctypes.c_size_t),
+                ("total_ns", ctypes.c_double),
+                ("setup_ns", ctypes.c_double),
+                ("merge_ns", ctypes.c_double),
+                ("proc_wall_ns", ctypes.c_double * _VSF_INSTR_MAX_PROCS),
+                ("proc_tasks", ctypes.c_uint64 * _VSF_INSTR_MAX_PROCS),
+                ("proc_pairs_evaluated",
+                 ctypes.c_uint64 * _VSF_INSTR_MAX_PROCS),
+                ("proc_pairs_binned", ctypes.c_uint64 * _VSF_INSTR_MAX_PROCS)]
+
+    def asdict(self):
+        n = min(self.n_procs, _VSF_INSTR_MAX_PROCS)
+        out = {'n_procs' : int(self.n_procs), 'total_ns' : self.total_ns,
+               'setup_ns' : self.setup_ns, 'merge_ns' : self.merge_ns}
+        for key, dtype in [('proc_wall_ns', np.float64),
+                           ('proc_tasks', np.int64),
+                           ('proc_pairs_evaluated', np.int64),
+                           ('proc_pairs_binned', np.int64)]:
+            out[key] = np.array(getattr(self, key)[:n], dtype = dtype)
+        return out
+
+_VSFINSTRUMENTATION_ptr = ctypes.POINTER(VSFINSTRUMENTATION)
+
 # define the argument types
 _lib.calc_vsf_props.argtypes = [
     POINTPROPS, POINTPROPS,
@@ -155,10 +487,371 @@ _lib.calc_vsf_props.argtypes = [
     np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
                            flags = ['C_CONTIGUOUS', 'WRITEABLE']),
     np.ctypeslib.ndpointer(dtype = np.int64, ndim = 1,
-                           flags = ['C_CONTIGUOUS', 'WRITEABLE'])
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    _VSFINSTRUMENTATION_ptr,
+    _VSFERRORINFO_ptr
+]
+_lib.calc_vsf_props.restype = ctypes.c_int
+
+class QUANDIFFSPEC(ctypes.Structure):
+    _fields_ = [("kind", ctypes.c_int),
+                ("n_components", ctypes.c_size_t)]
+
+_lib.calc_quan_sf_props.argtypes = [
+    POINTPROPS, POINTPROPS,
+    _STATLISTITEM_ptr, ctypes.c_size_t,
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = 'C_CONTIGUOUS'),
+    ctypes.c_size_t,
+    QUANDIFFSPEC,
+    PARALLELSPEC,
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    np.ctypeslib.ndpointer(dtype = np.int64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    _VSFINSTRUMENTATION_ptr,
+    _VSFERRORINFO_ptr
+]
+_lib.calc_quan_sf_props.restype = ctypes.c_int
+
+class PAIRBINCACHEPROPS(ctypes.Structure):
+    _fields_ = [("n_points_a", ctypes.c_size_t),
+                ("n_points_b", ctypes.c_size_t),
+                ("duplicated_points", ctypes.c_bool),
+                ("nbins", ctypes.c_size_t),
+                ("n_runs", ctypes.c_uint64),
+                ("n_pairs", ctypes.c_uint64),
+                ("nbytes", ctypes.c_size_t)]
+
+_lib.pairbincache_create.argtypes = [
+    POINTPROPS, POINTPROPS,
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = 'C_CONTIGUOUS'),
+    ctypes.c_size_t,
+    PARALLELSPEC,
+    _VSFERRORINFO_ptr
+]
+_lib.pairbincache_create.restype = ctypes.c_void_p
+_lib.pairbincache_destroy.argtypes = [ctypes.c_void_p]
+_lib.pairbincache_destroy.restype = None
+_lib.pairbincache_props.argtypes = [ctypes.c_void_p]
+_lib.pairbincache_props.restype = PAIRBINCACHEPROPS
+_lib.pairbincache_calc_sf_props.argtypes = [
+    ctypes.c_void_p,
+    _double_ptr, ctypes.c_size_t,
+    _double_ptr, ctypes.c_size_t,
+    _STATLISTITEM_ptr, ctypes.c_size_t,
+    QUANDIFFSPEC,
+    PARALLELSPEC,
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    np.ctypeslib.ndpointer(dtype = np.int64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    _VSFERRORINFO_ptr
 ]
-_lib.calc_vsf_props.restype = ctypes.c_bool
+_lib.pairbincache_calc_sf_props.restype = ctypes.c_int
 
+class BIN2DSPEC(ctypes.Structure):
+    _fields_ = [("kind", ctypes.c_int),
+                ("reference_axis", ctypes.c_double * 3),
+                ("bin_edges_0", _double_ptr),
+                ("nbins_0", ctypes.c_size_t),
+                ("bin_edges_1", _double_ptr),
+                ("nbins_1", ctypes.c_size_t)]
+
+_lib.calc_vsf_props_2D.argtypes = [
+    POINTPROPS, POINTPROPS,
+    _STATLISTITEM_ptr, ctypes.c_size_t,
+    BIN2DSPEC,
+    PARALLELSPEC,
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    np.ctypeslib.ndpointer(dtype = np.int64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    _VSFINSTRUMENTATION_ptr,
+    _VSFERRORINFO_ptr
+]
+_lib.calc_vsf_props_2D.restype = ctypes.c_int
+
+class SAMPLINGSPEC(ctypes.Structure):
+    _fields_ = [("pairs_per_bin", ctypes.c_uint64),
+                ("max_draws_per_bin", ctypes.c_uint64),
+                ("seed", ctypes.c_uint64)]
+
+_lib.calc_vsf_props_sampled.argtypes = [
+    POINTPROPS, POINTPROPS,
+    _STATLISTITEM_ptr, ctypes.c_size_t,
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = 'C_CONTIGUOUS'),
+    ctypes.c_size_t,
+    SAMPLINGSPEC,
+    PARALLELSPEC,
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    np.ctypeslib.ndpointer(dtype = np.int64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    _VSFERRORINFO_ptr
+]
+_lib.calc_vsf_props_sampled.restype = ctypes.c_int
+
+class GRIDPROPS(ctypes.Structure):
+    _fields_ = [("velocities", _double_ptr),
+                ("component_stride", ctypes.c_size_t),
+                ("shape", ctypes.c_size_t * 3),
+                ("cell_widths", ctypes.c_double * 3),
+                ("mask", ctypes.POINTER(ctypes.c_uint8))]
+
+    @staticmethod
+    def construct(vel_arr, cell_widths, mask_arr = None):
+        # vel_arr must be a C-contiguous array with shape (3, nx, ny, nz)
+        assert vel_arr.ndim == 4 and vel_arr.shape[0] == 3
+        assert vel_arr.flags['C_CONTIGUOUS']
+        if mask_arr is None:
+            mask_ptr = ctypes.POINTER(ctypes.c_uint8)()
+        else:
+            assert mask_arr.shape == vel_arr.shape[1:]
+            assert mask_arr.flags['C_CONTIGUOUS']
+            mask_ptr = mask_arr.ctypes.data_as(ctypes.POINTER(ctypes.c_uint8))
+        out = GRIDPROPS(
+            velocities = vel_arr.ctypes.data_as(_double_ptr),
+            component_stride = vel_arr[0].size,
+            shape = (ctypes.c_size_t * 3)(*vel_arr.shape[1:]),
+            cell_widths = (ctypes.c_double * 3)(*cell_widths),
+            mask = mask_ptr
+        )
+        out._arrays = (vel_arr, mask_arr) # keep the pointers valid
+        return out
+
+_lib.calc_grid_vsf_props.argtypes = [
+    GRIDPROPS,
+    _STATLISTITEM_ptr, ctypes.c_size_t,
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = 'C_CONTIGUOUS'),
+    ctypes.c_size_t,
+    PARALLELSPEC,
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    np.ctypeslib.ndpointer(dtype = np.int64, ndim = 1,
+                           flags = ['C_CONTIGUOUS', 'WRITEABLE']),
+    _VSFERRORINFO_ptr
+]
+_lib.calc_grid_vsf_props.restype = ctypes.c_int
+
+class NEIGHBORGRIDPROPS(ctypes.Structure):
+    _fields_ = [("velocities", _double_ptr * 3),
+                ("sound_speed", _double_ptr),
+                ("cut_region_masks",
+                 ctypes.POINTER(ctypes.POINTER(ctypes.c_uint8))),
+                ("n_cut_regions", ctypes.c_size_t),
+                ("shape", ctypes.c_size_t * 3),
+                ("strides", ctypes.c_int64 * 3),
+                ("n_trailing_ghost", ctypes.c_size_t * 3)]
+
+    @staticmethod
+    def construct(vel_components, sound_speed, cut_region_masks,
+                  n_trailing_ghost):
+        # vel_components & sound_speed must be float64 arrays and
+        # cut_region_masks must be uint8 arrays. Each array must have the
+        # same shape
+        arrays = list(vel_components) + [sound_speed] + list(cut_region_masks)
+        shape = arrays[0].shape
+        assert all(arr.shape == shape for arr in arrays)
+
+        # every array must share a layout (in units of elements). In the
+        # common case, this requires no copies
+        def elem_strides(arr):
+            if any((s % arr.itemsize) != 0 for s in arr.strides):
+                return None
+            return tuple(s // arr.itemsize for s in arr.strides)
+        strides = elem_strides(arrays[0])
+        if (strides is None) or any(elem_strides(arr) != strides
+                                    for arr in arrays):
+            arrays = [np.ascontiguousarray(arr) for arr in arrays]
+            strides = elem_strides(arrays[0])
+
+        n_cr = len(cut_region_masks)
+        _uint8_ptr = ctypes.POINTER(ctypes.c_uint8)
+        mask_ptrs = (_uint8_ptr * max(n_cr, 1))(
+            *[arr.ctypes.data_as(_uint8_ptr) for arr in arrays[4:]]
+        )
+        out = NEIGHBORGRIDPROPS(
+            velocities = (_double_ptr * 3)(
+                *[arr.ctypes.data_as(_double_ptr) for arr in arrays[:3]]
+            ),
+            sound_speed = arrays[3].ctypes.data_as(_double_ptr),
+            cut_region_masks = ctypes.cast(
+                mask_ptrs, ctypes.POINTER(_uint8_ptr)
+            ),
+            n_cut_regions = n_cr,
+            shape = (ctypes.c_size_t * 3)(*shape),
+            strides = (ctypes.c_int64 * 3)(*strides),
+            n_trailing_ghost = (ctypes.c_size_t * 3)(*n_trailing_ghost)
+        )
+        out._arrays = (arrays, mask_ptrs) # keep the pointers valid
+        return out
+
+_lib.calc_grid_neighbor_vdiff_hists.argtypes = [
+    NEIGHBORGRIDPROPS, _HISTBINS_ptr, PARALLELSPEC,
+    _int64_ptr, _int64_ptr, _int64_ptr, _VSFERRORINFO_ptr
+]
+_lib.calc_grid_neighbor_vdiff_hists.restype = ctypes.c_int
+
+class BULKMOMENTPROPS(ctypes.Structure):
+    _fields_ = [("values", _double_ptr),
+                ("n_components", ctypes.c_size_t),
+                ("n_points", ctypes.c_size_t),
+                ("component_stride", ctypes.c_size_t),
+                ("weights", ctypes.POINTER(_double_ptr)),
+                ("n_weights", ctypes.c_size_t)]
+
+    @staticmethod
+    def construct(values, weights):
+        # values must be a C-contiguous 2D float64 array and weights must be
+        # a sequence of C-contiguous 1D float64 arrays
+        weight_ptrs = (_double_ptr * max(len(weights), 1))(
+            *[arr.ctypes.data_as(_double_ptr) for arr in weights]
+        )
+        out = BULKMOMENTPROPS(
+            values = values.ctypes.data_as(_double_ptr),
+            n_components = values.shape[0],
+            n_points = values.shape[1],
+            component_stride = values.shape[1],
+            weights = ctypes.cast(weight_ptrs, ctypes.POINTER(_double_ptr)),
+            n_weights = len(weights)
+        )
+        out._arrays = (values, weights, weight_ptrs) # keep pointers valid
+        return out
+
+_lib.calc_bulk_moments.argtypes = [
+    BULKMOMENTPROPS, PARALLELSPEC, _double_ptr, _double_ptr, _double_ptr,
+    _VSFERRORINFO_ptr
+]
+_lib.calc_bulk_moments.restype = ctypes.c_int
+_lib.merge_bulk_moments.argtypes = [
+    ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t, _double_ptr,
+    _double_ptr, _double_ptr, _double_ptr, _double_ptr, _double_ptr,
+    _VSFERRORINFO_ptr
+]
+_lib.merge_bulk_moments.restype = ctypes.c_int
+
+_lib.compute_spatial_sort_permutation.argtypes = [
+    POINTPROPS, ctypes.c_int, _double_ptr, ctypes.c_double, PARALLELSPEC,
+    _uint64_ptr, _VSFERRORINFO_ptr
+]
+_lib.compute_spatial_sort_permutation.restype = ctypes.c_int
+_lib.pointset_spatial_sort.argtypes = [ctypes.c_void_p, ctypes.c_int,
+                                       PARALLELSPEC, _uint64_ptr,
+                                       _VSFERRORINFO_ptr]
+_lib.pointset_spatial_sort.restype = ctypes.c_int
+
+class VSFTUNING(ctypes.Structure):
+    _fields_ = [("pair_ns", ctypes.c_double),
+                ("hist_pair_ns", ctypes.c_double),
+                ("team_overhead_ns", ctypes.c_double),
+                ("proc_overhead_ns", ctypes.c_double),
+                ("small_auto_n_points", ctypes.c_uint64),
+                ("small_cross_npairs", ctypes.c_uint64),
+                ("auto_chunks_per_proc", ctypes.c_uint64),
+                ("linear_search_max_nbins", ctypes.c_uint64)]
+
+    def asdict(self):
+        return dict((name, getattr(self, name)) for name, _ in self._fields_)
+
+_VSFTUNING_ptr = ctypes.POINTER(VSFTUNING)
+
+_lib.vsf_default_tuning.argtypes = [_VSFTUNING_ptr]
+_lib.vsf_default_tuning.restype = None
+_lib.vsf_get_tuning.argtypes = [_VSFTUNING_ptr, _VSFERRORINFO_ptr]
+_lib.vsf_get_tuning.restype = ctypes.c_int
+_lib.vsf_set_tuning.argtypes = [_VSFTUNING_ptr, _VSFERRORINFO_ptr]
+_lib.vsf_set_tuning.restype = ctypes.c_int
+_lib.vsf_calibrate.argtypes = [ctypes.c_size_t, _VSFTUNING_ptr,
+                               _VSFERRORINFO_ptr]
+_lib.vsf_calibrate.restype = ctypes.c_int
+_lib.vsf_save_tuning.argtypes = [_VSFTUNING_ptr, ctypes.c_char_p,
+                                 _VSFERRORINFO_ptr]
+_lib.vsf_save_tuning.restype = ctypes.c_int
+_lib.vsf_load_tuning.argtypes = [ctypes.c_char_p, _VSFTUNING_ptr,
+                                 _VSFERRORINFO_ptr]
+_lib.vsf_load_tuning.restype = ctypes.c_int
+
+def get_tuning():
+    """
+    Returns a dict holding the tuning parameters currently used by libvsf
+    """
+    tuning, err_info = VSFTUNING(), VSFERRORINFO()
+    err_info.raise_if_error(_lib.vsf_get_tuning(ctypes.byref(tuning),
+                                                ctypes.byref(err_info)))
+    return tuning.asdict()
+
+def set_tuning(tuning = None):
+    """
+    Replaces the tuning parameters used by libvsf.
+
+    Parameters
+    ----------
+    tuning : dict, optional
+        Maps parameter names to values. Parameters that aren't specified take
+        their default values. When `None`, the defaults are restored.
+    """
+    out = VSFTUNING()
+    _lib.vsf_default_tuning(ctypes.byref(out))
+    for key, val in ({} if tuning is None else tuning).items():
+        if key not in out.asdict():
+            raise ValueError(f"'{key}' is not a known tuning parameter")
+        setattr(out, key, val)
+    err_info = VSFERRORINFO()
+    err_info.raise_if_error(_lib.vsf_set_tuning(ctypes.byref(out),
+                                                ctypes.byref(err_info)))
+
+def load_tuning(path, apply = True):
+    """
+    Reads the tuning parameters saved in a file (by ``calibrate_tuning``).
+
+    When apply is `True` (the default), libvsf starts using the parameters.
+    """
+    tuning, err_info = VSFTUNING(), VSFERRORINFO()
+    err_info.raise_if_error(_lib.vsf_load_tuning(
+        os.fsencode(path), ctypes.byref(tuning), ctypes.byref(err_info)))
+    if apply:
+        set_tuning(tuning.asdict())
+    return tuning.asdict()
+
+def calibrate_tuning(path = None, max_nproc = 0, apply = True):
+    """
+    Benchmarks the local machine to measure the parameters of the cost model
+    that libvsf uses to pick the number of processes, the small problem
+    thresholds, the kernel variant and the number of partitions per process
+    for auto-structure functions. This takes a few seconds.
+
+    Parameters
+    ----------
+    path : str, optional
+        When specified, the parameters are saved to this file. They can be
+        reloaded later with ``load_tuning`` (or by setting the
+        ``PYVSF_TUNING_FILE`` environment variable before importing pyvsf).
+    max_nproc : int, optional
+        The largest number of processes that is considered. A value of 0
+        falls back to the maximum number of OpenMP threads.
+    apply : bool, optional
+        When `True` (the default), libvsf starts using the parameters.
+    """
+    tuning, err_info = VSFTUNING(), VSFERRORINFO()
+    err_info.raise_if_error(_lib.vsf_calibrate(max_nproc, ctypes.byref(tuning),
+                                               ctypes.byref(err_info)))
+    if path is not None:
+        err_info.raise_if_error(_lib.vsf_save_tuning(
+            ctypes.byref(tuning), os.fsencode(path), ctypes.byref(err_info)))
+    if apply:
+        set_tuning(tuning.asdict())
+    return tuning.asdict()
+
+if os.environ.get('PYVSF_TUNING_FILE', ''):
+    load_tuning(os.environ['PYVSF_TUNING_FILE'])
 
 class VSFPropsRsltContainer:
     def __init__(self, int64_quans, float64_quans):
@@ -300,7 +993,7 @@ def _validate_stat_kw_pairs(arg):
 def vsf_props(pos_a, pos_b, vel_a, vel_b, dist_bin_edges,
               stat_kw_pairs = [('variance', {})],
               nproc = 1, force_sequential = False,
-              postprocess_stat = True):
+              postprocess_stat = True, instrumentation = None, pool = None):
     """
     Calculates properties pertaining to the velocity structure function for 
     pairs of points.
@@ -311,10 +1004,11 @@ def vsf_props(pos_a, pos_b, vel_a, vel_b, dist_bin_edges,
 
     Parameters
     ----------
-    pos_a, pos_b : array_like
+    pos_a, pos_b : array_like or PointSet
         2D arrays holding the positions of each point. Axis 0 should be the 
         number of spatial dimensions must be consistent for each array. Axis 1
-        can be different for each array
+        can be different for each array. A ``PointSet`` may be passed instead
+        (in which case the corresponding velocity argument must be `None`).
     vel_a, vel_b : array_like
         2D arrays holding the velocities at each point. The shape of ``vel_a`` 
         should match ``pos_a`` and the shape of ``vel_b`` should match
@@ -343,6 +1037,17 @@ def vsf_props(pos_a, pos_b, vel_a, vel_b, dist_bin_edges,
         Users directly employing this function should almost always set this
         kwarg to `True` (the default). This option is only provided to simplify
         the process of consolidating results from multiple calls to vsf_props.
+    instrumentation : dict, optional
+        When a dict is provided, it's cleared and filled with timers and
+        counters recorded by the C++ library. The keys include 'n_procs',
+        'total_ns', 'setup_ns', 'merge_ns' and the per-process arrays
+        'proc_wall_ns', 'proc_tasks', 'proc_pairs_evaluated' &
+        'proc_pairs_binned'. When this is `None` (the default), the
+        uninstrumented version of the calculation is used.
+    pool : ThreadPool, optional
+        When specified, the pool's threads evaluate the calculation (rather
+        than a newly launched OpenMP team). In this case, a `nproc` of 0 uses
+        all of the pool's threads.
 
     Notes
     -----
@@ -363,7 +1068,7 @@ def vsf_props(pos_a, pos_b, vel_a, vel_b, dist_bin_edges,
     points_b = POINTPROPS.construct(pos_b, vel_b, dtype = np.float64,
                                     allow_null_pair = True)
 
-    if pos_b is None:
+    if (pos_b is None) and (vel_b is None):
         assert points_a.n_points > 1
     else:
         assert points_a.n_spatial_dims == points_b.n_spatial_dims
@@ -386,21 +1091,35 @@ def vsf_props(pos_a, pos_b, vel_a, vel_b, dist_bin_edges,
     stat_list, rslt_container = _process_statistic_args(stat_kw_pairs,
                                                         dist_bin_edges)
 
-    parallel_spec = PARALLELSPEC(nproc = nproc,
-                                 force_sequential = force_sequential)
+    parallel_spec = _parallel_spec(nproc, force_sequential, pool)
+
+    if instrumentation is None:
+        instr_ptr = _VSFINSTRUMENTATION_ptr()
+    else:
+        c_instrumentation = VSFINSTRUMENTATION()
+        instr_ptr = ctypes.pointer(c_instrumentation)
 
     # now actually call the function
-    success = _lib.calc_vsf_props(
+    err_info = VSFERRORINFO()
+    code = _lib.calc_vsf_props(
         points_a, points_b,
         stat_list.get_STATLISTITEM_ptr(), len(stat_list),
         dist_bin_edges, ndist_bins,
         parallel_spec,
         rslt_container.get_flt_vals_arr(),
-        rslt_container.get_i64_vals_arr()
+        rslt_container.get_i64_vals_arr(),
+        instr_ptr,
+        ctypes.byref(err_info)
     )
+    err_info.raise_if_error(code)
 
-    assert success
+    if instrumentation is not None:
+        instrumentation.clear()
+        instrumentation.update(c_instrumentation.asdict())
 
+    return _extract_rslts(rslt_container, stat_kw_pairs, postprocess_stat)
+
+def _extract_rslts(rslt_container, stat_kw_pairs, postprocess_stat):
     out = []
     for stat_name, _ in stat_kw_pairs:
         val_dict = rslt_container.extract_statistic_dict(stat_name)
@@ -411,3 +1130,897 @@ def vsf_props(pos_a, pos_b, vel_a, vel_b, dist_bin_edges,
         out.append(val_dict)
 
     return out
+
+def _quan_pointprops(pos, quan, allow_null_pair):
+    # like POINTPROPS.construct, except that quan can have any number of
+    # components (a 1D array is treated as a single component)
+    if allow_null_pair and (pos is None) and (quan is None):
+        return POINTPROPS(None, None, n_points = 0, n_spatial_dims = 0,
+                          spatial_dim_stride = 0), 0
+    elif (pos is None) or (quan is None):
+        raise ValueError("pos and quan must not be None")
+
+    pos_arr = np.ascontiguousarray(pos, dtype = np.float64)
+    quan_arr = np.ascontiguousarray(quan, dtype = np.float64)
+    if quan_arr.ndim == 1:
+        quan_arr = quan_arr.reshape((1, quan_arr.size))
+    if pos_arr.ndim != 2 or pos_arr.shape[0] != 3:
+        raise ValueError("pos must be a 2D array with shape (3, n_points)")
+    elif quan_arr.ndim != 2 or quan_arr.shape[1] != pos_arr.shape[1]:
+        raise ValueError("quan must have a shape of (n_points,) or "
+                         "(n_components, n_points)")
+
+    n_points = int(pos_arr.shape[1])
+    out = POINTPROPS(positions = pos_arr.ctypes.data_as(_double_ptr),
+                     velocities = quan_arr.ctypes.data_as(_double_ptr),
+                     n_points = n_points, n_spatial_dims = 3,
+                     spatial_dim_stride = n_points)
+    out._arrays = (pos_arr, quan_arr) # keep the pointers valid
+    return out, int(quan_arr.shape[0])
+
+def quan_sf_props(pos_a, pos_b, quan_a, quan_b, dist_bin_edges,
+                  signed = False, stat_kw_pairs = [('variance', {})],
+                  nproc = 1, force_sequential = False,
+                  postprocess_stat = True, instrumentation = None,
+                  pool = None):
+    """
+    Calculates structure function properties for an arbitrary quantity
+    (e.g. density or temperature) rather than the velocity.
+
+    Parameters
+    ----------
+    pos_a, pos_b, dist_bin_edges, stat_kw_pairs, nproc, force_sequential
+        These all have the same meaning as in ``vsf_props``.
+    quan_a, quan_b : array_like
+        The quantity at each point. Either a 1D array with a value per point
+        (a scalar) or a 2D array with shape ``(n_components, n_points)``.
+        ``quan_b`` must be `None` when ``pos_b`` is `None`.
+    signed : bool, optional
+        When `False` (the default), the magnitude of the difference in the
+        quantity (the Euclidean norm for multiple components) is used for
+        each pair. When `True`, the signed difference ``quan_a - quan_b`` is
+        used (this requires a scalar quantity). Since the ordering within a
+        pair is arbitrary when ``pos_b`` is `None`, signed differences are
+        mostly useful between 2 separate sets of points.
+    postprocess_stat, instrumentation, pool : optional
+        See ``vsf_props`` for details.
+    """
+    _validate_stat_kw_pairs(stat_kw_pairs)
+
+    points_a, n_components = _quan_pointprops(pos_a, quan_a,
+                                              allow_null_pair = False)
+    points_b, n_components_b = _quan_pointprops(pos_b, quan_b,
+                                                allow_null_pair = True)
+    if (pos_b is not None) and (n_components != n_components_b):
+        raise ValueError("quan_a and quan_b must have the same number of "
+                         "components")
+    elif signed and (n_components != 1):
+        raise ValueError("signed differences require a scalar quantity")
+
+    dist_bin_edges = np.asanyarray(dist_bin_edges, dtype = np.float64)
+    if not _verify_bin_edges(dist_bin_edges):
+        raise ValueError(
+            'dist_bin_edges must be a 1D monotonically increasing array with '
+            '2 or more values'
+        )
+    ndist_bins = dist_bin_edges.size - 1
+
+    stat_list, rslt_container = _process_statistic_args(stat_kw_pairs,
+                                                        dist_bin_edges)
+    quan_spec = QUANDIFFSPEC(kind = 1 if signed else 0,
+                             n_components = n_components)
+    parallel_spec = _parallel_spec(nproc, force_sequential, pool)
+
+    if instrumentation is None:
+        instr_ptr = _VSFINSTRUMENTATION_ptr()
+    else:
+        c_instrumentation = VSFINSTRUMENTATION()
+        instr_ptr = ctypes.pointer(c_instrumentation)
+
+    err_info = VSFERRORINFO()
+    code = _lib.calc_quan_sf_props(
+        points_a, points_b,
+        stat_list.get_STATLISTITEM_ptr(), len(stat_list),
+        dist_bin_edges, ndist_bins,
+        quan_spec, parallel_spec,
+        rslt_container.get_flt_vals_arr(),
+        rslt_container.get_i64_vals_arr(),
+        instr_ptr,
+        ctypes.byref(err_info)
+    )
+    err_info.raise_if_error(code)
+
+    if instrumentation is not None:
+        instrumentation.clear()
+        instrumentation.update(c_instrumentation.asdict())
+
+    return _extract_rslts(rslt_container, stat_kw_pairs, postprocess_stat)
+
+# mirrors the VSF_BATCH_AUTO sentinel
+_VSF_BATCH_AUTO = ctypes.c_size_t(-1).value
+
+class VSFBATCHTERM(ctypes.Structure):
+    _fields_ = [("index_a", ctypes.c_size_t),
+                ("index_b", ctypes.c_size_t),
+                ("out_index", ctypes.c_size_t)]
+
+_lib.calc_sf_props_batched.argtypes = [
+    ctypes.POINTER(POINTPROPS), ctypes.c_size_t,
+    ctypes.POINTER(VSFBATCHTERM), ctypes.c_size_t,
+    _STATLISTITEM_ptr, ctypes.c_size_t,
+    np.ctypeslib.ndpointer(dtype = np.float64, ndim = 1,
+                           flags = 'C_CONTIGUOUS'),
+    ctypes.c_size_t,
+    QUANDIFFSPEC,
+    PARALLELSPEC,
+    ctypes.c_size_t,
+    ctypes.POINTER(_double_ptr),
+    ctypes.POINTER(ctypes.POINTER(ctypes.c_int64)),
+    _VSFINSTRUMENTATION_ptr,
+    _VSFERRORINFO_ptr
+]
+_lib.calc_sf_props_batched.restype = ctypes.c_int
+
+def batched_sf_props(point_sets, terms, dist_bin_edges, signed = False,
+                     stat_kw_pairs = [('variance', {})], nproc = 1,
+                     force_sequential = False, postprocess_stat = True,
+                     instrumentation = None, pool = None):
+    """
+    Computes structure function properties for several terms (auto and
+    cross structure function calculations) with a single team of threads.
+
+    This is equivalent to a series of calls to ``quan_sf_props``, but the
+    pairs from all of the terms are divided among the threads at once (so the
+    threads stay busy even when the individual terms are small).
+
+    Parameters
+    ----------
+    point_sets : sequence
+        Each entry is a ``PointSet`` or a ``(pos, quan)`` pair (with the same
+        meaning as the corresponding arguments of ``quan_sf_props``). Every
+        entry must have the same number of quantity components.
+    terms : sequence of tuples
+        Each term is an ``(index_a, index_b, out_index)`` tuple. index_a and
+        index_b are indices of point_sets (index_b is `None` for an auto
+        structure function). The pairs from all terms with the same out_index
+        contribute to the same output.
+    dist_bin_edges, signed, stat_kw_pairs, nproc, force_sequential
+        These all have the same meaning as in ``quan_sf_props``.
+    postprocess_stat, instrumentation, pool : optional
+        See ``vsf_props`` for details.
+
+    Returns
+    -------
+    out : list
+        Holds an entry for each output (``max(out_index) + 1`` entries). Each
+        entry is formatted like the value returned by ``quan_sf_props``.
+    """
+    _validate_stat_kw_pairs(stat_kw_pairs)
+
+    props_l, n_components = [], None
+    for entry in point_sets:
+        if isinstance(entry, PointSet):
+            props, cur_n_components = entry._pointprops(), 3
+        else:
+            props, cur_n_components = _quan_pointprops(*entry,
+                                                       allow_null_pair = False)
+        if n_components is None:
+            n_components = cur_n_components
+        elif n_components != cur_n_components:
+            raise ValueError("every point set must have the same number of "
+                             "quantity components")
+        props_l.append(props)
+
+    if signed and (n_components not in (None, 1)):
+        raise ValueError("signed differences require a scalar quantity")
+
+    c_terms = (VSFBATCHTERM * max(len(terms), 1))()
+    n_outputs = 0
+    for i, (index_a, index_b, out_index) in enumerate(terms):
+        c_terms[i] = VSFBATCHTERM(
+            index_a = index_a,
+            index_b = _VSF_BATCH_AUTO if index_b is None else index_b,
+            out_index = out_index
+        )
+        n_outputs = max(n_outputs, out_index + 1)
+
+    dist_bin_edges = np.asanyarray(dist_bin_edges, dtype = np.float64)
+    if not _verify_bin_edges(dist_bin_edges):
+        raise ValueError(
+            'dist_bin_edges must be a 1D monotonically increasing array with '
+            '2 or more values'
+        )
+    ndist_bins = dist_bin_edges.size - 1
+
+    # each output needs its own buffers (the stat_list is the same for all)
+    stat_list, rslt_containers = None, []
+    for _ in range(n_outputs):
+        stat_list, rslt_container = _process_statistic_args(stat_kw_pairs,
+                                                            dist_bin_edges)
+        rslt_containers.append(rslt_container)
+    if stat_list is None: # there aren't any terms
+        return []
+
+    flt_ptrs = (_double_ptr * n_outputs)(
+        *[c.get_flt_vals_arr().ctypes.data_as(_double_ptr)
+          for c in rslt_containers])
+    i64_ptrs = (ctypes.POINTER(ctypes.c_int64) * n_outputs)(
+        *[c.get_i64_vals_arr().ctypes.data_as(ctypes.POINTER(ctypes.c_int64))
+          for c in rslt_containers])
+
+    quan_spec = QUANDIFFSPEC(kind = 1 if signed else 0,
+                             n_components = n_components or 0)
+    parallel_spec = _parallel_spec(nproc, force_sequential, pool)
+
+    if instrumentation is None:
+        instr_ptr = _VSFINSTRUMENTATION_ptr()
+    else:
+        c_instrumentation = VSFINSTRUMENTATION()
+        instr_ptr = ctypes.pointer(c_instrumentation)
+
+    # props_l keeps the buffers referenced by c_point_sets alive
+    c_point_sets = (POINTPROPS * max(len(props_l), 1))(*props_l)
+    err_info = VSFERRORINFO()
+    code = _lib.calc_sf_props_batched(
+        c_point_sets, len(props_l), c_terms, len(terms),
+        stat_list.get_STATLISTITEM_ptr(), len(stat_list),
+        dist_bin_edges, ndist_bins,
+        quan_spec, parallel_spec,
+        n_outputs, flt_ptrs, i64_ptrs,
+        instr_ptr,
+        ctypes.byref(err_info)
+    )
+    err_info.raise_if_error(code)
+
+    if instrumentation is not None:
+        instrumentation.clear()
+        instrumentation.update(c_instrumentation.asdict())
+
+    return [_extract_rslts(c, stat_kw_pairs, postprocess_stat)
+            for c in rslt_containers]
+
+def _position_pointprops(pos, allow_null):
+    # builds a POINTPROPS that only refers to positions
+    if allow_null and (pos is None):
+        return POINTPROPS(None, None, n_points = 0, n_spatial_dims = 0,
+                          spatial_dim_stride = 0)
+    pos_arr = np.ascontiguousarray(pos, dtype = np.float64)
+    if pos_arr.ndim != 2 or pos_arr.shape[0] != 3:
+        raise ValueError("positions must be a 2D array with shape "
+                         "(3, n_points)")
+    n_points = int(pos_arr.shape[1])
+    out = POINTPROPS(positions = pos_arr.ctypes.data_as(_double_ptr),
+                     velocities = None, n_points = n_points,
+                     n_spatial_dims = 3, spatial_dim_stride = n_points)
+    out._arrays = (pos_arr,)
+    return out
+
+class PairBinCache:
+    """
+    Records the distance bin of every pair of points, so that structure
+    function properties can be computed for many quantities (or snapshots)
+    sharing fixed positions without recomputing any distances.
+
+    For each point in ``pos_a``, the cache stores runs of consecutive points
+    in ``pos_b`` that lie in the same distance bin (pairs outside of all bins
+    are omitted). Its size is reported by ``nbytes``.
+
+    Parameters
+    ----------
+    pos_a, pos_b : array_like
+        Arrays with shape ``(3, n_points)`` holding the positions. When
+        ``pos_b`` is `None`, the cache holds the unique pairs of ``pos_a``
+        (like an auto-structure function).
+    dist_bin_edges : array_like
+        1D monotonically increasing array of distance bin edges
+    nproc : int, optional
+        Number of processes used to build the cache
+    """
+
+    def __init__(self, pos_a, pos_b, dist_bin_edges, nproc = 1):
+        self._handle = None
+        dist_bin_edges = np.array(dist_bin_edges, dtype = np.float64)
+        if not _verify_bin_edges(dist_bin_edges):
+            raise ValueError(
+                'dist_bin_edges must be a 1D monotonically increasing array '
+                'with 2 or more values'
+            )
+        self.dist_bin_edges = dist_bin_edges
+
+        points_a = _position_pointprops(pos_a, allow_null = False)
+        points_b = _position_pointprops(pos_b, allow_null = True)
+
+        err_info = VSFERRORINFO()
+        self._handle = _lib.pairbincache_create(
+            points_a, points_b, dist_bin_edges, dist_bin_edges.size - 1,
+            PARALLELSPEC(nproc = nproc, force_sequential = False),
+            ctypes.byref(err_info)
+        )
+        if self._handle is None:
+            err_info.raise_if_error(err_info.code)
+
+    @property
+    def props(self):
+        """
+        dict summarizing the contents of the cache
+        """
+        props = _lib.pairbincache_props(self._handle)
+        return {name : getattr(props, name) for name, _ in props._fields_}
+
+    @property
+    def nbytes(self):
+        return int(_lib.pairbincache_props(self._handle).nbytes)
+
+    def sf_props(self, quan_a, quan_b = None, signed = False,
+                 stat_kw_pairs = [('variance', {})], nproc = 1,
+                 force_sequential = False, postprocess_stat = True):
+        """
+        Computes structure function properties for the cached pairs.
+
+        Parameters
+        ----------
+        quan_a, quan_b : array_like
+            The quantity at each point (these have the same meaning as in
+            ``quan_sf_props``). Pass the velocities to compute velocity
+            structure function properties. ``quan_b`` must be `None` if (and
+            only if) the cache was built without ``pos_b``.
+        signed, stat_kw_pairs, nproc, force_sequential, postprocess_stat
+            These all have the same meaning as in ``quan_sf_props``.
+
+        Returns
+        -------
+        rslts : list of dict
+            The same output as ``quan_sf_props`` (when a single process is
+            used, the results are bitwise identical).
+        """
+        _validate_stat_kw_pairs(stat_kw_pairs)
+        props = _lib.pairbincache_props(self._handle)
+
+        def prep(quan, n_points):
+            arr = np.ascontiguousarray(quan, dtype = np.float64)
+            if arr.ndim == 1:
+                arr = arr.reshape((1, arr.size))
+            if arr.ndim != 2 or arr.shape[1] != n_points:
+                raise ValueError("each quantity must have a shape of "
+                                 "(n_points,) or (n_components, n_points)")
+            return arr
+
+        quan_a = prep(quan_a, props.n_points_a)
+        if props.duplicated_points != (quan_b is None):
+            raise ValueError("quan_b must be None if (and only if) the cache "
+                             "was built without pos_b")
+        elif quan_b is not None:
+            quan_b = prep(quan_b, props.n_points_b)
+            if quan_b.shape[0] != quan_a.shape[0]:
+                raise ValueError("quan_a and quan_b must have the same number "
+                                 "of components")
+        n_components = int(quan_a.shape[0])
+        if signed and (n_components != 1):
+            raise ValueError("signed differences require a scalar quantity")
+
+        stat_list, rslt_container = _process_statistic_args(
+            stat_kw_pairs, self.dist_bin_edges
+        )
+        quan_spec = QUANDIFFSPEC(kind = 1 if signed else 0,
+                                 n_components = n_components)
+        parallel_spec = PARALLELSPEC(nproc = nproc,
+                                     force_sequential = force_sequential)
+
+        err_info = VSFERRORINFO()
+        code = _lib.pairbincache_calc_sf_props(
+            self._handle,
+            quan_a.ctypes.data_as(_double_ptr), quan_a.shape[1],
+            None if quan_b is None else quan_b.ctypes.data_as(_double_ptr),
+            0 if quan_b is None else quan_b.shape[1],
+            stat_list.get_STATLISTITEM_ptr(), len(stat_list),
+            quan_spec, parallel_spec,
+            rslt_container.get_flt_vals_arr(),
+            rslt_container.get_i64_vals_arr(),
+            ctypes.byref(err_info)
+        )
+        err_info.raise_if_error(code)
+
+        return _extract_rslts(rslt_container, stat_kw_pairs, postprocess_stat)
+
+    def __del__(self):
+        if getattr(self, '_handle', None) is not None:
+            _lib.pairbincache_destroy(self._handle)
+            self._handle = None
+
+_BIN2D_KINDS = {'parallel_perp' : 0, 'dist_costheta' : 1}
+
+def vsf_props_2D(pos_a, pos_b, vel_a, vel_b, bin_edges_0, bin_edges_1,
+                 reference_axis = (0.0, 0.0, 1.0), mode = 'parallel_perp',
+                 stat_kw_pairs = [('variance', {})], nproc = 1,
+                 force_sequential = False, postprocess_stat = True,
+                 instrumentation = None, pool = None):
+    """
+    Calculates properties pertaining to the velocity structure function for
+    pairs of points that are binned in 2 dimensions (relative to a reference
+    axis).
+
+    Parameters
+    ----------
+    pos_a, pos_b, vel_a, vel_b, stat_kw_pairs, nproc, force_sequential
+        These all have the same meaning as in ``vsf_props``.
+    bin_edges_0, bin_edges_1 : array_like
+        1D arrays of monotonically increasing bin edges for the first and
+        second coordinates (see `mode`).
+    reference_axis : array_like, optional
+        3 element vector (it doesn't need to be normalized). The z-axis is
+        used by default.
+    mode : {'parallel_perp', 'dist_costheta'}
+        When 'parallel_perp', pairs are binned by the magnitude of the
+        components of the separation vector that are parallel and
+        perpendicular to the reference axis. When 'dist_costheta', pairs are
+        binned by the separation distance and by ``|cos(theta)|``, where theta
+        is the angle between the separation vector and the reference axis.
+        Like the distance bins of ``vsf_props``, each bin includes its upper
+        edge. However, the first bin of each coordinate also includes its
+        lower edge (so that pairs with a coordinate of exactly 0, such as
+        pairs of grid points in a plane perpendicular to the axis, aren't
+        skipped). Pairs with zero separation are always skipped.
+    postprocess_stat, instrumentation, pool : optional
+        See ``vsf_props`` for details.
+
+    Returns
+    -------
+    rslts : list of dict
+        The layout matches ``vsf_props``, except that the axis associated with
+        distance bins is replaced by 2 axes with lengths of
+        ``len(bin_edges_0) - 1`` and ``len(bin_edges_1) - 1``.
+    """
+    _validate_stat_kw_pairs(stat_kw_pairs)
+    try:
+        kind = _BIN2D_KINDS[mode]
+    except KeyError:
+        raise ValueError(f"mode must be one of {list(_BIN2D_KINDS)}") \
+            from None
+
+    points_a = POINTPROPS.construct(pos_a, vel_a, dtype = np.float64,
+                                    allow_null_pair = False)
+    points_b = POINTPROPS.construct(pos_b, vel_b, dtype = np.float64,
+                                    allow_null_pair = True)
+    if points_a.n_spatial_dims != 3:
+        raise NotImplementedError("only 3 spatial dimensions are supported")
+
+    edges = []
+    for name, arr in [('bin_edges_0', bin_edges_0),
+                      ('bin_edges_1', bin_edges_1)]:
+        arr = np.ascontiguousarray(arr, dtype = np.float64)
+        if not _verify_bin_edges(arr):
+            raise ValueError(f'{name} must be a 1D monotonically increasing '
+                             'array with 2 or more values')
+        edges.append(arr)
+    nbins_0, nbins_1 = edges[0].size - 1, edges[1].size - 1
+
+    reference_axis = np.asarray(reference_axis, dtype = np.float64)
+    if reference_axis.shape != (3,):
+        raise ValueError("reference_axis must have 3 entries")
+
+    bin_spec = BIN2DSPEC(kind = kind,
+                         reference_axis = (ctypes.c_double * 3)(
+                             *reference_axis),
+                         bin_edges_0 = edges[0].ctypes.data_as(_double_ptr),
+                         nbins_0 = nbins_0,
+                         bin_edges_1 = edges[1].ctypes.data_as(_double_ptr),
+                         nbins_1 = nbins_1)
+
+    # the outputs are computed for the flattened bins (only the number of
+    # placeholder bin edges matters here)
+    stat_list, rslt_container = _process_statistic_args(
+        stat_kw_pairs, np.arange(nbins_0 * nbins_1 + 1, dtype = np.float64))
+    parallel_spec = _parallel_spec(nproc, force_sequential, pool)
+
+    if instrumentation is None:
+        instr_ptr = _VSFINSTRUMENTATION_ptr()
+    else:
+        c_instrumentation = VSFINSTRUMENTATION()
+        instr_ptr = ctypes.pointer(c_instrumentation)
+
+    err_info = VSFERRORINFO()
+    code = _lib.calc_vsf_props_2D(
+        points_a, points_b,
+        stat_list.get_STATLISTITEM_ptr(), len(stat_list),
+        bin_spec, parallel_spec,
+        rslt_container.get_flt_vals_arr(),
+        rslt_container.get_i64_vals_arr(),
+        instr_ptr,
+        ctypes.byref(err_info)
+    )
+    err_info.raise_if_error(code)
+
+    if instrumentation is not None:
+        instrumentation.clear()
+        instrumentation.update(c_instrumentation.asdict())
+
+    out = _extract_rslts(rslt_container, stat_kw_pairs, postprocess_stat)
+    for val_dict in out:
+        for key, val in val_dict.items():
+            val_dict[key] = val.reshape((nbins_0, nbins_1) + val.shape[1:])
+    return out
+
+def sampled_vsf_props(pos_a, pos_b, vel_a, vel_b, dist_bin_edges,
+                      pairs_per_bin, stat_kw_pairs = [('variance', {})],
+                      seed = 0, max_draws_per_bin = None, nproc = 1,
+                      force_sequential = False, postprocess_stat = True):
+    """
+    Estimates properties pertaining to the velocity structure function from
+    randomly sampled pairs of points.
+
+    Sampling is stratified by distance bin: up to ``pairs_per_bin`` pairs are
+    drawn (uniformly, with replacement) from the pairs in each bin. The cost
+    is roughly linear in the number of points and the number of samples
+    (rather than quadratic in the number of points).
+
+    Parameters
+    ----------
+    pos_a, pos_b, vel_a, vel_b, dist_bin_edges, stat_kw_pairs
+        These all have the same meaning as in ``vsf_props``.
+    pairs_per_bin : int
+        The number of pairs to sample from each distance bin.
+    seed : int, optional
+        Seed for the random number generator. For a given seed, the results
+        are identical regardless of ``nproc``.
+    max_draws_per_bin : int, optional
+        The maximum number of random draws for each bin (most draws are
+        rejected when a bin holds few pairs). Defaults to
+        ``64 * pairs_per_bin``.
+    nproc : int, optional
+        Number of threads. The distance bins are divided between threads.
+    force_sequential : bool, optional
+        When `True`, only a single thread is used.
+    postprocess_stat : bool, optional
+        See ``vsf_props`` for details.
+
+    Returns
+    -------
+    rslts : list of dict
+        The statistics computed from the sampled pairs (the layout matches
+        ``vsf_props``). Note that 'counts' holds the number of sampled pairs.
+    sampling_info : dict
+        Holds 2 1D arrays with an entry per distance bin. 'std_err' holds the
+        standard error of the mean velocity difference magnitude (NaN for
+        bins with fewer than 2 samples). 'pair_count_estimate' holds an
+        estimate of the total number of pairs in the bin.
+    """
+    _validate_stat_kw_pairs(stat_kw_pairs)
+
+    points_a = POINTPROPS.construct(pos_a, vel_a, dtype = np.float64,
+                                    allow_null_pair = False)
+    points_b = POINTPROPS.construct(pos_b, vel_b, dtype = np.float64,
+                                    allow_null_pair = True)
+    if points_a.n_spatial_dims != 3:
+        raise NotImplementedError("only 3 spatial dimensions are supported")
+
+    dist_bin_edges = np.asanyarray(dist_bin_edges, dtype = np.float64)
+    if not _verify_bin_edges(dist_bin_edges):
+        raise ValueError(
+            'dist_bin_edges must be a 1D monotonically increasing array with '
+            '2 or more values'
+        )
+    ndist_bins = dist_bin_edges.size - 1
+
+    if pairs_per_bin <= 0:
+        raise ValueError("pairs_per_bin must be positive")
+    sampling_spec = SAMPLINGSPEC(
+        pairs_per_bin = pairs_per_bin,
+        max_draws_per_bin = 0 if max_draws_per_bin is None \
+                              else max_draws_per_bin,
+        seed = seed
+    )
+
+    stat_list, rslt_container = _process_statistic_args(stat_kw_pairs,
+                                                        dist_bin_edges)
+    parallel_spec = PARALLELSPEC(nproc = nproc,
+                                 force_sequential = force_sequential)
+
+    sampling_info = {
+        'std_err' : np.empty((ndist_bins,), dtype = np.float64),
+        'pair_count_estimate' : np.empty((ndist_bins,), dtype = np.float64)
+    }
+
+    err_info = VSFERRORINFO()
+    code = _lib.calc_vsf_props_sampled(
+        points_a, points_b,
+        stat_list.get_STATLISTITEM_ptr(), len(stat_list),
+        dist_bin_edges, ndist_bins,
+        sampling_spec, parallel_spec,
+        rslt_container.get_flt_vals_arr(),
+        rslt_container.get_i64_vals_arr(),
+        sampling_info['std_err'], sampling_info['pair_count_estimate'],
+        ctypes.byref(err_info)
+    )
+    err_info.raise_if_error(code)
+
+    rslts = _extract_rslts(rslt_container, stat_kw_pairs, postprocess_stat)
+    return rslts, sampling_info
+
+def grid_vsf_props(vel_components, dist_bin_edges, cell_widths,
+                   mask = None, stat_kw_pairs = [('variance', {})],
+                   nproc = 1, force_sequential = False,
+                   postprocess_stat = True):
+    """
+    Calculates properties pertaining to the velocity structure function for 
+    all unique pairs of cells in a uniform 3D grid.
+
+    This produces the same results, up to floating-point round-off, as
+    calling ``vsf_props`` (with ``pos_b`` and ``vel_b`` set to ``None``) on
+    the cell-centers (the pairs are accumulated in a different order).
+    However, rather than considering every pair of cells, this iterates over
+    integer displacement vectors between cells (up to the largest distance
+    bin edge). For each displacement vector, the distance bin is only computed
+    once and the velocity differences are computed with regular memory
+    access. The cost scales with the number of cells multiplied by the number
+    of displacement vectors.
+
+    Parameters
+    ----------
+    vel_components : sequence of 3 array_like
+        3D arrays (each with the same shape) holding the x, y, and z velocity
+        components of each cell. A single 4D array, where axis 0 has a length
+        of 3, is also accepted. (This matches the arrays produced by
+        ``WorkerStructuredGrid.load_subvol_data``)
+    dist_bin_edges : array_like
+        1D array of monotonically increasing values that represent edges for 
+        distance bins.
+    cell_widths : float or sequence of 3 floats
+        The width of a cell along each axis.
+    mask : array_like, optional
+        Optional boolean 3D array with the same shape as each velocity
+        component. When specified, only pairs where both cells have `True`
+        values are considered (e.g. this can be used to specify a cut region).
+    stat_kw_pairs : sequence of (str, dict) tuples
+        Specifies the statistics to compute. See ``vsf_props`` for details.
+    nproc : int, optional
+        Number of processes to use for parallelizing this calculation (the
+        displacement vectors are divided between processes). Default is 1.
+    force_sequential : bool, optional
+        When `True`, this uses a single process while partitioning the work as
+        though it were using `nproc` processes. Default is `False`.
+    postprocess_stat : bool, optional
+        See ``vsf_props`` for details.
+    """
+    _validate_stat_kw_pairs(stat_kw_pairs)
+
+    vel_arr = np.ascontiguousarray(
+        np.stack([np.asarray(comp, dtype = np.float64)
+                  for comp in vel_components]),
+        dtype = np.float64
+    )
+    if vel_arr.ndim != 4 or vel_arr.shape[0] != 3:
+        raise ValueError("vel_components must hold 3 3D arrays")
+
+    cell_widths = np.broadcast_to(np.asarray(cell_widths, dtype = np.float64),
+                                  (3,))
+    if not (cell_widths > 0).all():
+        raise ValueError("each entry in cell_widths must be positive")
+
+    if mask is not None:
+        mask = np.ascontiguousarray(mask, dtype = np.bool_)
+        if mask.shape != vel_arr.shape[1:]:
+            raise ValueError("mask must have the same shape as each velocity "
+                             "component")
+        mask = mask.view(np.uint8)
+
+    dist_bin_edges = np.asanyarray(dist_bin_edges, dtype = np.float64)
+    if not _verify_bin_edges(dist_bin_edges):
+        raise ValueError(
+            'dist_bin_edges must be a 1D monotonically increasing array with '
+            '2 or more values'
+        )
+    ndist_bins = dist_bin_edges.size - 1
+
+    stat_list, rslt_container = _process_statistic_args(stat_kw_pairs,
+                                                        dist_bin_edges)
+
+    grid = GRIDPROPS.construct(vel_arr, cell_widths, mask)
+    parallel_spec = PARALLELSPEC(nproc = nproc,
+                                 force_sequential = force_sequential)
+
+    err_info = VSFERRORINFO()
+    code = _lib.calc_grid_vsf_props(
+        grid,
+        stat_list.get_STATLISTITEM_ptr(), len(stat_list),
+        dist_bin_edges, ndist_bins,
+        parallel_spec,
+        rslt_container.get_flt_vals_arr(),
+        rslt_container.get_i64_vals_arr(),
+        ctypes.byref(err_info)
+    )
+    err_info.raise_if_error(code)
+
+    return _extract_rslts(rslt_container, stat_kw_pairs, postprocess_stat)
+
+def grid_neighbor_vdiff_hists(vel_components, sound_speed, cut_region_masks,
+                              vdiff_bin_edges, n_trailing_ghost = (0,0,0),
+                              nproc = 1, force_sequential = False):
+    """
+    Computes histograms of the velocity differences between directly
+    adjacent cells of a uniform 3D grid, normalized by the larger sound speed
+    of each pair, for several cut regions at once.
+
+    All histograms are filled during a single sweep over the grid (without
+    allocating temporary arrays).
+
+    Parameters
+    ----------
+    vel_components : sequence of 3 array_like
+        3D arrays (each with the same shape) holding the x, y, and z velocity
+        components of each cell.
+    sound_speed : array_like
+        3D array holding the sound speed of each cell
+    cut_region_masks : sequence of array_like
+        Boolean 3D arrays. For each mask, only pairs where both cells have
+        `True` values are counted.
+    vdiff_bin_edges : sequence of 3 array_like
+        The bin edges for the parallel (signed), transverse, and total
+        velocity differences. Like ``np.histogram``, each bin includes its
+        left edge (the last bin also includes its right edge).
+    n_trailing_ghost : sequence of 3 ints, optional
+        The number of trailing ghost cells along each axis. A pair of cells
+        separated along one axis is only counted when the first cell lies
+        outside of the ghost zones along the other 2 axes.
+    nproc : int, optional
+        Number of processes to use for parallelizing this calculation.
+    force_sequential : bool, optional
+        When `True`, this uses a single process while partitioning the work as
+        though it were using `nproc` processes. Default is `False`.
+
+    Returns
+    -------
+    aligned_counts, transverse_counts, mag_counts : np.ndarray
+        Each array has a shape of ``(len(cut_region_masks), nbins)``
+    """
+    vel_components = [np.asarray(comp, dtype = np.float64)
+                      for comp in vel_components]
+    sound_speed = np.asarray(sound_speed, dtype = np.float64)
+    cut_region_masks = [np.asarray(mask, dtype = np.bool_).view(np.uint8)
+                        for mask in cut_region_masks]
+    if len(vel_components) != 3 or vel_components[0].ndim != 3:
+        raise ValueError("vel_components must hold 3 3D arrays")
+    elif any(arr.shape != sound_speed.shape
+             for arr in vel_components + cut_region_masks):
+        raise ValueError("vel_components, sound_speed, and cut_region_masks "
+                         "must all hold arrays with the same shape")
+
+    if len(vdiff_bin_edges) != 3:
+        raise ValueError("vdiff_bin_edges must hold 3 arrays")
+    vdiff_bin_edges = [np.ascontiguousarray(edges, dtype = np.float64)
+                       for edges in vdiff_bin_edges]
+    if not all(_verify_bin_edges(edges) for edges in vdiff_bin_edges):
+        raise ValueError(
+            'each entry of vdiff_bin_edges must be a 1D monotonically '
+            'increasing array with 2 or more values'
+        )
+    bins = (HISTBINS * 3)(*[HISTBINS.construct(edges)
+                            for edges in vdiff_bin_edges])
+
+    out = [np.zeros((len(cut_region_masks), edges.size - 1),
+                    dtype = np.int64)
+           for edges in vdiff_bin_edges]
+
+    grid = NEIGHBORGRIDPROPS.construct(vel_components, sound_speed,
+                                       cut_region_masks, n_trailing_ghost)
+    parallel_spec = PARALLELSPEC(nproc = nproc,
+                                 force_sequential = force_sequential)
+
+    err_info = VSFERRORINFO()
+    code = _lib.calc_grid_neighbor_vdiff_hists(
+        grid, bins, parallel_spec,
+        *[arr.ctypes.data_as(_int64_ptr) for arr in out],
+        ctypes.byref(err_info)
+    )
+    err_info.raise_if_error(code)
+    return tuple(out)
+
+def _optional_double_ptr(arr):
+    return None if arr is None else arr.ctypes.data_as(_double_ptr)
+
+def bulk_moments(values, weights, variance = True, nproc = 1,
+                 force_sequential = False):
+    """
+    Computes the weighted average and the (biased) weighted variance of each
+    component of values for one or more weight fields.
+
+    Every weight field is handled during a single call to the C++ library.
+    The result doesn't depend on the number of processes.
+
+    Parameters
+    ----------
+    values : array_like
+        2D array with shape ``(n_components, n_points)``
+    weights : sequence of array_like
+        Each entry is a 1D array holding ``n_points`` weights
+    variance : bool, optional
+        Whether to compute the variance. Default is `True`.
+    nproc : int, optional
+        Number of processes to use for parallelizing this calculation.
+    force_sequential : bool, optional
+        When `True`, this uses a single process. Default is `False`.
+
+    Returns
+    -------
+    weight_total : np.ndarray
+        Array with shape ``(len(weights), 1)``
+    average : np.ndarray
+        Array with shape ``(len(weights), n_components)``. Entries are NaN
+        when the corresponding weight total is zero.
+    variance : np.ndarray or None
+        Array with the same shape as average (or `None`, when the variance
+        isn't computed).
+    """
+    values = np.ascontiguousarray(values, dtype = np.float64)
+    if values.ndim != 2:
+        raise ValueError("values must be a 2D array")
+    weights = [np.ascontiguousarray(arr, dtype = np.float64)
+               for arr in weights]
+    if any(arr.shape != values.shape[1:] for arr in weights):
+        raise ValueError("each entry of weights must be a 1D array with "
+                         f"{values.shape[1]} entries")
+
+    n_weights, n_components = len(weights), values.shape[0]
+    weight_total = np.empty((n_weights, 1), dtype = np.float64)
+    average = np.empty((n_weights, n_components), dtype = np.float64)
+    var = np.empty_like(average) if variance else None
+
+    props = BULKMOMENTPROPS.construct(values, weights)
+    parallel_spec = PARALLELSPEC(nproc = nproc,
+                                 force_sequential = force_sequential)
+    err_info = VSFERRORINFO()
+    code = _lib.calc_bulk_moments(
+        props, parallel_spec, weight_total.ctypes.data_as(_double_ptr),
+        average.ctypes.data_as(_double_ptr), _optional_double_ptr(var),
+        ctypes.byref(err_info)
+    )
+    err_info.raise_if_error(code)
+    return weight_total, average, var
+
+def merge_bulk_moments(weight_totals, averages, variances = None):
+    """
+    Combines the outputs of ``bulk_moments`` that were computed for disjoint
+    sets of points.
+
+    Parameters
+    ----------
+    weight_totals : array_like
+        Array with shape ``(n_parts, n_weights, 1)``
+    averages : array_like
+        Array with shape ``(n_parts, n_weights, n_components)``. Entries
+        associated with a weight total of zero are ignored.
+    variances : array_like, optional
+        Array with the same shape as averages.
+
+    Returns
+    -------
+    weight_total, average, variance : np.ndarray
+        The combined values (variance is `None` when variances is `None`)
+    """
+    weight_totals = np.ascontiguousarray(weight_totals, dtype = np.float64)
+    averages = np.ascontiguousarray(averages, dtype = np.float64)
+    if (averages.ndim != 3) or (weight_totals.shape !=
+                                averages.shape[:2] + (1,)):
+        raise ValueError("averages must have shape (n_parts, n_weights, "
+                         "n_components) and weight_totals must have shape "
+                         "(n_parts, n_weights, 1)")
+    if variances is not None:
+        variances = np.ascontiguousarray(variances, dtype = np.float64)
+        if variances.shape != averages.shape:
+            raise ValueError("variances and averages must have the same shape")
+
+    n_parts, n_weights, n_components = averages.shape
+    weight_total = np.empty((n_weights, 1), dtype = np.float64)
+    average = np.empty((n_weights, n_components), dtype = np.float64)
+    var = None if variances is None else np.empty_like(average)
+
+    err_info = VSFERRORINFO()
+    code = _lib.merge_bulk_moments(
+        n_parts, n_weights, n_components,
+        weight_totals.ctypes.data_as(_double_ptr),
+        averages.ctypes.data_as(_double_ptr), _optional_double_ptr(variances),
+        weight_total.ctypes.data_as(_double_ptr),
+        average.ctypes.data_as(_double_ptr), _optional_double_ptr(var),
+        ctypes.byref(err_info)
+    )
+    err_info.raise_if_error(code)
+    return weight_total, average, var
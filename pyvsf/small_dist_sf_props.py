@@ -1,5 +1,8 @@
 from copy import deepcopy
+from itertools import product
 import logging
+import time
+import uuid
 from typing import Tuple, Sequence, Optional
 
 import numpy as np
@@ -11,15 +14,33 @@ from pydantic import (
     root_validator
 )
 
-from ._cut_region_iterator import get_root_level_cell_width
+from ._cut_region_iterator import (
+    get_root_level_cell_width,
+    release_loaded_subvol_cache
+)
 
 from .worker import (
     SFWorker,
     _PERF_REGION_NAMES,
-    consolidate_partial_vsf_results
+    consolidate_partial_vsf_results,
+    merge_partial_task_results
 )
 
 from ._kernels import get_kernel, kernel_operates_on_pairs
+from ._checkpoint import (
+    checkpoint_fingerprint,
+    load_checkpoint,
+    save_checkpoint
+)
+from ._shared_subvol_cache import (
+    create_shared_cache_dir,
+    remove_shared_cache_dir
+)
+from ._load_balance import (
+    balance_subvol_batches,
+    estimate_subvol_costs,
+    estimate_subvol_num_points
+)
 
 
 from ._perf import PerfRegions
@@ -69,6 +90,8 @@ class StructureFuncProps(BaseModel):
     cut_regions: conlist(Optional[str], min_items = 1)
     max_points: Optional[PositiveInt] = ...
     geometric_selector: Optional[BoxSelector]
+    # when True, the signed difference of a scalar quantity is used
+    signed_quantity_diff: bool = False
 
     # validators
     _validate_comp = validator('quantity_components', each_item = True,
@@ -76,6 +99,14 @@ class StructureFuncProps(BaseModel):
     _validate_dist_bin_edges = validator('dist_bin_edges',
                                          allow_reuse=True)(_validate_bin_edges)
 
+    @root_validator(pre = False)
+    def check_signed_quantity_diff(cls, values):
+        if (values.get('signed_quantity_diff', False) and
+            len(values.get('quantity_components', ())) != 1):
+            raise ValueError("signed_quantity_diff requires a single "
+                             "quantity component")
+        return values
+
     class Config:
         allow_mutation = False
     
@@ -252,25 +283,87 @@ def decompose_volume(ds, sf_params, subvol_side_len = None,
     return SubVolumeDecomposition(intrinsic_decomp = False, **kwargs)
 
 
+def _morton_key(subvol_index):
+    # interleaves the bits of the indices (the x index holds the lowest bit)
+    key = 0
+    for bit in range(21):
+        for dim in range(3):
+            key |= ((int(subvol_index[dim]) >> bit) & 1) << (3 * bit + dim)
+    return key
+
+_BATCH_ORDERINGS = ('row', 'morton', 'slab')
+
+def _ordered_subvol_indices(subvols_per_ax, ordering):
+    num_x, num_y, num_z = subvols_per_ax
+    out = list(product(range(num_x), range(num_y), range(num_z)))
+    if ordering == 'row':
+        # x varies fastest, then y, then z
+        out.sort(key = lambda ind: (ind[2], ind[1], ind[0]))
+    elif ordering == 'morton':
+        out.sort(key = _morton_key)
+    elif ordering == 'slab':
+        # pairs of adjacent z-layers are interleaved, so that the (0,0,1)
+        # neighbor of a subvolume directly follows it
+        out.sort(key = lambda ind: (ind[2] // 2, ind[1], ind[0], ind[2] % 2))
+    else:
+        raise ValueError(f"ordering must be one of {_BATCH_ORDERINGS}")
+    return out
+
 def subvol_index_batch_generator(subvol_decomp, n_workers,
                                  subvols_per_chunk = None,
-                                 max_subvols_per_chunk = None):
+                                 max_subvols_per_chunk = None,
+                                 skip_subvols = None, ordering = 'row'):
+    """
+    Yields batches of subvolume indices (each batch is a task for a worker).
+
+    ordering determines how the subvolumes are grouped into batches:
+    - ``'row'``: each batch holds a run of subvolumes along the x-axis
+    - ``'morton'``: the subvolumes are ordered along a Morton (z-order)
+      curve, so each batch holds a compact block of subvolumes. The default
+      batch size is rounded down to a power of 8 (so that batches are cubes
+      when the number of subvolumes along each axis is even)
+    - ``'slab'``: each batch holds a run of subvolumes along the x-axis from
+      2 adjacent z-layers (the default batch size is rounded down to an even
+      number)
+
+    With the latter orderings, many of the neighbors that a worker needs for
+    one subvolume are other subvolumes in the same batch. This is most
+    useful when workers retain loaded subvolumes between tasks (see the
+    ``max_reused_subvols`` argument of ``small_dist_sf_props``).
+
+    skip_subvols optionally lists subvolume indices that are omitted (e.g.
+    because they were completed before a restart)
+    """
+    skip_subvols = frozenset() if skip_subvols is None else \
+        frozenset(tuple(e) for e in skip_subvols)
+    if ordering not in _BATCH_ORDERINGS:
+        raise ValueError(f"ordering must be one of {_BATCH_ORDERINGS}")
 
     num_x, num_y, num_z = subvol_decomp.subvols_per_ax
+    num_subvols = num_x*num_y*num_z
     
     if subvols_per_chunk is None:
         if (n_workers == 1):
             chunksize = num_x
-        elif n_workers % (num_y*num_z) == 0:
+        elif (ordering == 'row') and (n_workers % (num_y*num_z) == 0):
             chunksize = num_x
         else:
-            num_subvols = num_x*num_y*num_z
             chunksize, remainder = divmod(num_subvols, 2*n_workers)
             if remainder != 0:
                 chunksize+=1
-            chunksize = min(chunksize, num_x)
+            if ordering == 'row':
+                chunksize = min(chunksize, num_x)
+
+        if ordering == 'morton':
+            block_size = 1
+            while 8 * block_size <= chunksize:
+                block_size *= 8
+            chunksize = block_size
+        elif (ordering == 'slab') and (chunksize > 1):
+            chunksize -= chunksize % 2
     else:
-        assert subvols_per_chunk <= num_x
+        if ordering == 'row':
+            assert subvols_per_chunk <= num_x
         chunksize = subvols_per_chunk
     assert chunksize > 0
 
@@ -288,13 +381,14 @@ def subvol_index_batch_generator(subvol_decomp, n_workers,
 
     cur_batch = []
 
-    for z_ind in range(num_z):
-        for y_ind in range(num_y):
-            for x_ind in range(num_x):
-                cur_batch.append((x_ind, y_ind, z_ind))
-                if len(cur_batch) == chunksize:
-                    yield tuple(cur_batch)
-                    cur_batch = []
+    for subvol_index in _ordered_subvol_indices((num_x, num_y, num_z),
+                                                ordering):
+        if subvol_index in skip_subvols:
+            continue
+        cur_batch.append(subvol_index)
+        if len(cur_batch) == chunksize:
+            yield tuple(cur_batch)
+            cur_batch = []
     if len(cur_batch) > 0:
         yield tuple(cur_batch)
 
@@ -312,27 +406,142 @@ class _PoolCallback:
         self.total_count = np.prod(subvol_decomp.subvols_per_ax)
 
         # the following attributes are updated with each call
-        self.tmp_result_arr = np.empty(
-            shape = (len(stat_kw_pairs), n_cut_regions,
-                     np.prod(subvol_decomp.subvols_per_ax)),
-            dtype = object
-        )
-        self.total_num_points_arr = np.array([0 for _ in range(n_cut_regions)])
+        self.reset()
+
+        # checkpointing is disabled until enable_checkpointing is called
+        self.checkpoint_path = None
+        self.checkpoint_fingerprint = None
+        self.checkpoint_interval = None
+        self.last_checkpoint_time = None
+
+    def reset(self):
+        """
+        Discards the accumulated results (so that the callback can be reused
+        for another calculation with the same layout, like a later snapshot)
+        """
+        n_cut_regions = self.n_cut_regions
+        if getattr(self, 'tmp_result_arr', None) is None:
+            self.tmp_result_arr = np.empty(
+                shape = (len(self.stat_kw_pairs), n_cut_regions,
+                         np.prod(self.subvol_decomp.subvols_per_ax)),
+                dtype = object
+            )
+            self.total_num_points_arr = np.array(
+                [0 for _ in range(n_cut_regions)]
+            )
+        else: # reuse the existing arrays
+            self.tmp_result_arr[...] = None
+            self.total_num_points_arr[:] = 0
 
+        # the lists of consolidated results are replaced (rather than
+        # cleared), since they're handed out by _consolidate_rslts
         self.accum_rslt = {}
-        for stat_ind, (stat_name,_) in enumerate(stat_kw_pairs):
+        for stat_ind, (stat_name,_) in enumerate(self.stat_kw_pairs):
             if get_kernel(stat_name).commutative_consolidate:
                 self.accum_rslt[stat_ind] = [{} for _ in range(n_cut_regions)]
 
         self.cumulative_count = -1
         self.cumulative_perf = PerfRegions(_PERF_REGION_NAMES)
 
+        # the 1D indices of the subvolumes that have been processed
+        self.completed_subvols = set()
+
+        # maps subvolume indices to the TaskResults received for some (but
+        # not all) of the subvolume's SubvolParts. These aren't saved in
+        # checkpoints (the whole subvolume is processed again after a restart)
+        self.pending_parts = {}
+
+    def _collect_part(self, item):
+        # returns the merged TaskResult once every part of the subvolume has
+        # been received (otherwise, returns None)
+        subvol_index = tuple(item.subvol_index)
+        parts = self.pending_parts.setdefault(subvol_index, [])
+        parts.append(item)
+        if len(parts) < item.part.n_parts:
+            return None
+        del self.pending_parts[subvol_index]
+        return merge_partial_task_results(parts, self.stat_kw_pairs,
+                                          self.dist_bin_edges)
+
+    def _subvol_index_3D(self, subvol_index_1D):
+        nx, ny, _ = self.subvol_decomp.subvols_per_ax
+        return (subvol_index_1D % nx, (subvol_index_1D // nx) % ny,
+                subvol_index_1D // (nx * ny))
+
+    def completed_subvol_indices(self):
+        return [self._subvol_index_3D(e) for e in sorted(self.completed_subvols)]
+
+    def enable_checkpointing(self, path, fingerprint, interval):
+        """
+        Restores the state previously saved at path (if the file exists) and
+        ensures that the state is periodically saved to path in the future.
+        Returns the 3D indices of the subvolumes that were already completed.
+        """
+        completed_subvols = self.restore_checkpoint(path, fingerprint)
+        self.checkpoint_path = path
+        self.checkpoint_fingerprint = fingerprint
+        self.checkpoint_interval = interval
+        self.last_checkpoint_time = time.monotonic()
+        return completed_subvols
+
+    def save_checkpoint(self, path = None, fingerprint = None):
+        """
+        Saves the accumulated state (and the completed subvolumes) to path
+        """
+        if path is None:
+            path = self.checkpoint_path
+            fingerprint = self.checkpoint_fingerprint
+        entries = []
+        for stat_ind, (stat_name, stat_kw) in enumerate(self.stat_kw_pairs):
+            for cut_region_i in range(self.n_cut_regions):
+                if stat_ind in self.accum_rslt:
+                    entries.append(
+                        ((stat_ind, cut_region_i, -1), stat_name, stat_kw,
+                         self.accum_rslt[stat_ind][cut_region_i])
+                    )
+                    continue
+                for subvol_index_1D in sorted(self.completed_subvols):
+                    rslt = self.tmp_result_arr[stat_ind, cut_region_i,
+                                               subvol_index_1D]
+                    entries.append(
+                        ((stat_ind, cut_region_i, subvol_index_1D), stat_name,
+                         stat_kw, rslt)
+                    )
+        state = {'completed_subvols' : sorted(self.completed_subvols),
+                 'total_num_points' : self.total_num_points_arr}
+        save_checkpoint(path, fingerprint, state, entries,
+                        self.dist_bin_edges)
+        self.last_checkpoint_time = time.monotonic()
+
+    def restore_checkpoint(self, path, fingerprint):
+        """
+        Restores the state saved by ``save_checkpoint`` (if path exists).
+        Returns the 3D indices of the subvolumes that were already completed.
+        """
+        state, rslts = load_checkpoint(path, fingerprint)
+        if state is None:
+            return []
+        for (stat_ind, cut_region_i, subvol_index_1D), rslt in rslts.items():
+            if subvol_index_1D == -1:
+                self.accum_rslt[stat_ind][cut_region_i] = rslt
+            else:
+                self.tmp_result_arr[stat_ind, cut_region_i,
+                                    subvol_index_1D] = rslt
+        self.completed_subvols = set(state['completed_subvols'])
+        self.total_num_points_arr[:] = state['total_num_points']
+        self.cumulative_count = len(self.completed_subvols) - 1
+        return self.completed_subvol_indices()
+
 
     def __call__(self, batched_result):
         subvols_per_ax = self.subvol_decomp.subvols_per_ax
         autosf_subvolume_callback = self.autosf_subvolume_user_callback
 
         for item in batched_result:
+            if item.part is not None:
+                item = self._collect_part(item)
+                if item is None:
+                    continue
             subvol_index = item.subvol_index
 
             subvol_index_1D = (
@@ -395,6 +604,7 @@ class _PoolCallback:
 
             # we only update total_num_points_arr once per task rslt
             self.total_num_points_arr[:] += subvol_available_pts
+            self.completed_subvols.add(int(subvol_index_1D))
 
             _str_prefix = f'Driver: {_fmt_subvol_index(subvol_index)} - '
             self.cumulative_count += 1
@@ -421,6 +631,11 @@ class _PoolCallback:
             item.main_subvol_rslts.purge()
             item.consolidated_rslts.purge()
 
+        if ((self.checkpoint_path is not None) and
+            ((time.monotonic() - self.last_checkpoint_time) >=
+             self.checkpoint_interval)):
+            self.save_checkpoint()
+
 def _prep_pool(pool = None):
     if pool is None:
         class Pool:
@@ -436,8 +651,22 @@ def _prep_pool(pool = None):
         n_workers = pool.size
     return pool, n_workers
 
+def _run_subvol_tasks(pool, worker, iterable, post_proc_callback,
+                      save_checkpoint = False):
+    for batched_result in pool.map(worker, iterable,
+                                   callback = post_proc_callback):
+        continue # simply consume the iterator
+
+    if save_checkpoint:
+        post_proc_callback.save_checkpoint()
+
+    print("Cumulative subvol-processing perf-sec -\n    " +
+          post_proc_callback.cumulative_perf.summarize_timing_sec())
+    print("Cumulative subvol-processing counters -\n    " +
+          post_proc_callback.cumulative_perf.summarize_counters())
+
 def _consolidate_rslts(stat_kw_pairs, post_proc_callback,
-                       dist_bin_edges):
+                       dist_bin_edges, postprocess = True):
     prop_l = []
     for stat_ind, (stat_name,_) in enumerate(stat_kw_pairs):
         if stat_ind in post_proc_callback.accum_rslt:
@@ -451,15 +680,141 @@ def _consolidate_rslts(stat_kw_pairs, post_proc_callback,
                 ))
             prop_l.append(tmp)
 
-        kernel = get_kernel(stat_name)
-        for elem in prop_l[-1]:
-            kernel.postprocess_rslt(elem)
+        if postprocess:
+            kernel = get_kernel(stat_name)
+            for elem in prop_l[-1]:
+                kernel.postprocess_rslt(elem)
     return prop_l
 
+def _build_structure_func_props(dist_bin_edges, cut_regions, pos_units,
+                                quantity_units, component_fields,
+                                geometric_selector, max_points, rand_seed,
+                                signed_quantity_diff):
+    # validates the arguments & returns dist_bin_edges (as an array) and the
+    # corresponding StructureFuncProps
+    assert len(cut_regions) > 0
+    dist_bin_edges = np.asarray(dist_bin_edges, dtype = np.float64)
+    if dist_bin_edges.ndim != 1:
+        raise ValueError("dist_bin_edges must be a 1D np.ndarray")
+    elif dist_bin_edges.size <= 1:
+        raise ValueError("dist_bin_edges must have 2 or more elements")
+    elif (dist_bin_edges[1:] <= dist_bin_edges[:-1]).any():
+        raise ValueError(
+            "dist_bin_edges must have monotonically increasing elements"
+        )
+
+    if (max_points is None) != (rand_seed is None):
+        raise ValueError("max_points and rand_seed must both be "
+                         "specified or unspecified")
+    if max_points is not None:
+        assert int(max_points) == max_points
+        max_points = int(maxpoints)
+        assert int(rand_seed) == rand_seed
+        rand_seed = int(rand_seed)
+
+        # to support this in the future, I think we need to adopt the
+        # following procedure (for each cut_region)
+        # 1. Root dispatches tasks where every subvolume counts up the number
+        #    of valid points and send back to ro
+        # 2. Root builds an array which lists the number of points per
+        #    subvolume, availpts_per_subvol
+        # 3. Root (it doesn't actually have to happen on root). Then randomly
+        #    determines how many points come from each subvolume. Below is
+        #    pseudo-code to sketch an inefficient way to do this:
+        #      >>> gen = np.random.default_rng(seed = rand_seed - 1)
+        #      >>> remaining = np.copy(availpts_per_subvol)
+        #      >>> drawn = np.zeros_like(remaining)
+        #      >>> for i in range(max_points):
+        #      >>>     choice = gen.choice(remaining.size,
+        #      ...                         p = remaining/remaining.sum())
+        #      >>>     drawn[choice] += 1
+        #      >>>     drawn[choice] -= 1
+        #      >>> assert out.sum() == max_points
+        #      >>> assert (remaining >= 0).all()
+        # 4. Then, to identify the points for a subvolume, with index
+        #    `sv_index`, use the following pseudo-code:
+        #     >>> sv_ind1D = # 1D representation for sv_index
+        #     >>> gen = np.random.default_rng(seed = rand_seed + sv_ind1D)
+        #     >>> ipoints = gen.choice(availpts_per_subvol[sv_ind1D],
+        #     ...                      size = drawn[choice], replace = False)
+
+        raise NotImplementedError(
+            "Support is not currently provided for randomly drawing a subset "
+            "of points"
+        )
+
+    # some of the argument checking is automatically performed by validation in
+    # structure_func_props
+    structure_func_props = StructureFuncProps(
+        dist_bin_edges = list(dist_bin_edges),
+        dist_units = pos_units,
+        quantity_components = component_fields,
+        quantity_units = quantity_units,
+        cut_regions = cut_regions,
+        max_points = max_points,
+        geometric_selector = geometric_selector,
+        signed_quantity_diff = signed_quantity_diff
+    )
+
+    return dist_bin_edges, structure_func_props
+
+def _build_stat_kw_pairs(statistic, kwargs):
+    # returns the list of (statistic, kwargs) pairs and whether a single
+    # statistic was specified
+    if isinstance(statistic, str):
+        if not isinstance(kwargs, dict):
+            raise ValueError("kwargs must be a dict when statistic is a string")
+        stat_kw_pairs = [(statistic, kwargs)]
+        single_statistic = True
+    elif len(statistic) == 0:
+        raise ValueError("statistic can't be an empty sequence")
+    elif not all(isinstance(e, str) for e in statistic):
+        raise TypeError("statistic must be a string or a sequence of strings")
+    elif isinstance(kwargs,dict) or not all(isinstance(e,dict) for e in kwargs):
+        raise ValueError("When statistic is a sequence of strings, kwargs "
+                         "must be a sequence of dicts.")
+    elif len(statistic) != len(kwargs):
+        raise ValueError("When statistic is a sequence of strings, kwargs "
+                         "must be a sequence of as many dicts.")
+    elif np.unique(statistic).size != len(statistic):
+        raise ValueError("When statistic is a sequence of strings, none of "
+                         "the strings are allowed to be duplicates.")
+    else:
+        stat_kw_pairs = list(zip(statistic, kwargs))
+        single_statistic = False
+
+    return stat_kw_pairs, single_statistic
+
 _dflt_vel_components = (('gas','velocity_x'),
                         ('gas','velocity_y'),
                         ('gas','velocity_z'))
 
+def _build_shared_cache_spec(max_nbytes, root):
+    # returns the shared_cache_spec passed to SFWorker (or None when the
+    # node-local subvolume cache is disabled)
+    if max_nbytes is None:
+        return None
+    elif max_nbytes <= 0:
+        raise ValueError("shared_subvol_cache_nbytes must be positive")
+    return (create_shared_cache_dir(root), int(max_nbytes))
+
+def _build_loaded_cache_spec(max_reused_subvols):
+    # returns the loaded_cache_spec passed to SFWorker (or None when workers
+    # don't retain loaded subvolumes between tasks). A unique token is used
+    # for each calculation, since the cached data is only valid for a single
+    # dataset.
+    if max_reused_subvols is None:
+        return None
+    elif max_reused_subvols <= 0:
+        raise ValueError("max_reused_subvols must be positive")
+    return (uuid.uuid4().hex, int(max_reused_subvols))
+
+def _dataset_identity(ds):
+    # identifies the snapshot that a checkpoint was written for (so that it
+    # can't be resumed with a different snapshot that has the same domain)
+    return {'parameter_filename' : str(ds.parameter_filename),
+            'current_time' : float(ds.current_time.to('s').v)}
+
 def small_dist_sf_props(ds_initializer, dist_bin_edges,
                         cut_regions = [None],
                         pos_units = None, quantity_units = None,
@@ -471,7 +826,14 @@ def small_dist_sf_props(ds_initializer, dist_bin_edges,
                         force_subvols_per_ax = None,
                         eager_loading = False,
                         max_subvols_per_chunk = None,
-                        pool = None, autosf_subvolume_callback = None):
+                        pool = None, autosf_subvolume_callback = None,
+                        signed_quantity_diff = False,
+                        checkpoint_path = None, checkpoint_interval = 600.0,
+                        shared_subvol_cache_nbytes = None,
+                        shared_subvol_cache_root = None,
+                        batch_ordering = 'row', max_reused_subvols = None,
+                        load_balance = False, threads_per_worker = None,
+                        prefetch_depth = 0):
     """
     Computes the structure function.
 
@@ -512,7 +874,9 @@ def small_dist_sf_props(ds_initializer, dist_bin_edges,
     component_fields: list of fields
         List of 1 to 3 `yt` fields that are used to represent the individual 
         components of the quntity for which the structure function properties
-        are computed
+        are computed. The magnitude of the difference in the quantity is
+        computed for each pair. Fewer components involve less work (scalar
+        fields aren't padded to 3 components).
     geometric_selector: BoxSelector, optional
         Optional specification of a subregion to compute the structure function
         within.
@@ -555,6 +919,76 @@ def small_dist_sf_props(ds_initializer, dist_bin_edges,
         - the structure function properties computed within the subvolume
         - the number of points in that subvolume that are available to be used
           to compute the structure function properties.
+    signed_quantity_diff: bool, optional
+        When `True`, the signed difference of the quantity is used for each
+        pair, rather than the magnitude. This requires a single component
+        field. Note that the ordering of points within a pair is arbitrary.
+    checkpoint_path: str, optional
+        When specified, the accumulated results and the indices of the
+        completed subvolumes are periodically saved to this path. If the file
+        already exists (e.g. the job was previously killed), the saved state
+        is restored and the completed subvolumes are skipped. An error is
+        raised if the file was written by a calculation with different
+        parameters or for a different dataset (identified by its parameter
+        file and its current time). Note: `autosf_subvolume_callback` isn't called again for
+        the skipped subvolumes.
+    checkpoint_interval: float, optional
+        The minimum number of seconds between successive checkpoints. A final
+        checkpoint is always written once all subvolumes are processed.
+    shared_subvol_cache_nbytes: int, optional
+        When specified, the data loaded for each subvolume is stored in a
+        node-local cache that is shared by all worker processes on a node
+        (so that it's usually loaded once per node, rather than once for
+        the subvolume and once for each of its neighbors). This is the
+        maximum size (in bytes) of the cache on each node. This takes
+        precedence over `eager_loading`.
+    shared_subvol_cache_root: str, optional
+        The node-local directory where the shared cache is created (by
+        default, ``/dev/shm``). A uniquely named subdirectory is created on
+        each node and the calling process removes its node's subdirectory at
+        the end. When workers run on other nodes, their subdirectories must
+        be removed separately (e.g. by the job's epilog).
+    batch_ordering: str, optional
+        Specifies how subvolumes are grouped into the batches that are
+        assigned to workers: ``'row'`` (the default, runs along the x-axis),
+        ``'morton'`` (compact blocks), or ``'slab'`` (runs along the x-axis
+        from 2 adjacent z-layers). See ``subvol_index_batch_generator``.
+    max_reused_subvols: int, optional
+        When specified, each worker process retains the data of (at most)
+        this many of the subvolumes that it most recently loaded, and reuses
+        it in later tasks (e.g. when a subvolume is the neighbor of several
+        central subvolumes). This is most effective with a `batch_ordering`
+        of ``'morton'`` or ``'slab'``.
+    load_balance: bool, optional
+        When True, the cost of each subvolume is estimated from the number of
+        cells that the grid metadata places in it and its neighbors (no field
+        data is read and the cut_regions are ignored). The batches are then
+        dispatched in order of decreasing cost, and any subvolume that costs
+        more than half of a worker's ideal share of the total is split into
+        parts that are processed by separate workers (this requires a pool).
+        Tasks are only dispatched in this order by pools that preserve the
+        order of the tasks (like ``MPIPool``).
+    threads_per_worker: int, optional
+        When specified, each worker evaluates all of the structure function
+        terms of a subvolume (the auto term and the cross terms with every
+        neighbor) with a single team of this many threads (0 falls back to
+        OMP_NUM_THREADS). This is intended for hybrid configurations with a
+        few MPI ranks per node (e.g. 1 per socket). The OpenMP runtime keeps
+        the team alive between tasks. Because the neighbors are all loaded
+        before the pairs are evaluated, this holds the data of up to 14
+        subvolumes in memory. By default, the auto terms are evaluated with
+        1 thread and each cross term is evaluated separately with
+        OMP_NUM_THREADS threads.
+    prefetch_depth: int, optional
+        When positive, each worker loads the data of the neighboring
+        subvolumes on a background thread, while it computes the terms of
+        the central subvolume and of the preceding neighbors (so reading
+        from the file system overlaps with computation). This is the maximum
+        number of neighbors that are loaded ahead of the one being computed
+        (each of them is held in memory). By default (0), every subvolume is
+        loaded right before it's used. This mostly helps when
+        `threads_per_worker` isn't specified (otherwise, the pairs are only
+        evaluated once every neighbor has been loaded).
 
     Returns
     -------
@@ -579,67 +1013,11 @@ def small_dist_sf_props(ds_initializer, dist_bin_edges,
 
     pool, n_workers = _prep_pool(pool)
 
-    assert len(cut_regions) > 0
-    dist_bin_edges = np.asarray(dist_bin_edges, dtype = np.float64)
-    if dist_bin_edges.ndim != 1:
-        raise ValueError("dist_bin_edges must be a 1D np.ndarray")
-    elif dist_bin_edges.size <= 1:
-        raise ValueError("dist_bin_edges must have 2 or more elements")
-    elif (dist_bin_edges[1:] <= dist_bin_edges[:-1]).any():
-        raise ValueError(
-            "dist_bin_edges must have monotonically increasing elements"
-        )
-
-    if (max_points is None) != (rand_seed is None):
-        raise ValueError("max_points and rand_seed must both be "
-                         "specified or unspecified")
-    if max_points is not None:
-        assert int(max_points) == max_points
-        max_points = int(maxpoints)
-        assert int(rand_seed) == rand_seed
-        rand_seed = int(rand_seed)
-
-        # to support this in the future, I think we need to adopt the
-        # following procedure (for each cut_region)
-        # 1. Root dispatches tasks where every subvolume counts up the number
-        #    of valid points and send back to ro
-        # 2. Root builds an array which lists the number of points per
-        #    subvolume, availpts_per_subvol
-        # 3. Root (it doesn't actually have to happen on root). Then randomly
-        #    determines how many points come from each subvolume. Below is
-        #    pseudo-code to sketch an inefficient way to do this:
-        #      >>> gen = np.random.default_rng(seed = rand_seed - 1)
-        #      >>> remaining = np.copy(availpts_per_subvol)
-        #      >>> drawn = np.zeros_like(remaining)
-        #      >>> for i in range(max_points):
-        #      >>>     choice = gen.choice(remaining.size,
-        #      ...                         p = remaining/remaining.sum())
-        #      >>>     drawn[choice] += 1
-        #      >>>     drawn[choice] -= 1
-        #      >>> assert out.sum() == max_points
-        #      >>> assert (remaining >= 0).all()
-        # 4. Then, to identify the points for a subvolume, with index
-        #    `sv_index`, use the following pseudo-code:
-        #     >>> sv_ind1D = # 1D representation for sv_index
-        #     >>> gen = np.random.default_rng(seed = rand_seed + sv_ind1D)
-        #     >>> ipoints = gen.choice(availpts_per_subvol[sv_ind1D],
-        #     ...                      size = drawn[choice], replace = False)
-
-        raise NotImplementedError(
-            "Support is not currently provided for randomly drawing a subset "
-            "of points"
-        )
-
-    # some of the argument checking is automatically performed by validation in
-    # structure_func_props
-    structure_func_props = StructureFuncProps(
-        dist_bin_edges = list(dist_bin_edges),
-        dist_units = pos_units,
-        quantity_components = component_fields,
-        quantity_units = quantity_units,
-        cut_regions = cut_regions,
-        max_points = max_points,
-        geometric_selector = geometric_selector
+    dist_bin_edges, structure_func_props = _build_structure_func_props(
+        dist_bin_edges, cut_regions = cut_regions, pos_units = pos_units,
+        quantity_units = quantity_units, component_fields = component_fields,
+        geometric_selector = geometric_selector, max_points = max_points,
+        rand_seed = rand_seed, signed_quantity_diff = signed_quantity_diff
     )
 
     subvol_decomp = decompose_volume(
@@ -652,39 +1030,20 @@ def small_dist_sf_props(ds_initializer, dist_bin_edges,
         f"Number of subvolumes per axis: {subvol_decomp.subvols_per_ax}"
     )
 
-    if isinstance(statistic, str):
-        if not isinstance(kwargs, dict):
-            raise ValueError("kwargs must be a dict when statistic is a string")
-        stat_kw_pairs = [(statistic, kwargs)]
-        single_statistic = True
-    elif len(statistic) == 0:
-        raise ValueError("statistic can't be an empty sequence")
-    elif not all(isinstance(e, str) for e in statistic):
-        raise TypeError("statistic must be a string or a sequence of strings")
-    elif isinstance(kwargs,dict) or not all(isinstance(e,dict) for e in kwargs):
-        raise ValueError("When statistic is a sequence of strings, kwargs "
-                         "must be a sequence of dicts.")
-    elif len(statistic) != len(kwargs):
-        raise ValueError("When statistic is a sequence of strings, kwargs "
-                         "must be a sequence of as many dicts.")
-    elif np.unique(statistic).size != len(statistic):
-        raise ValueError("When statistic is a sequence of strings, none of "
-                         "the strings are allowed to be duplicates.")
-    else:
-        stat_kw_pairs = list(zip(statistic, kwargs))
-        single_statistic = False
-
+    stat_kw_pairs, single_statistic = _build_stat_kw_pairs(statistic, kwargs)
     del statistic, kwargs # deleted for debugging purposes
 
+    shared_cache_spec = _build_shared_cache_spec(shared_subvol_cache_nbytes,
+                                                 shared_subvol_cache_root)
+    loaded_cache_spec = _build_loaded_cache_spec(max_reused_subvols)
     worker = SFWorker(ds_initializer, subvol_decomp,
                       sf_param = structure_func_props,
                       stat_kw_pairs = stat_kw_pairs,
-                      eager_loading = eager_loading)
-
-    iterable = subvol_index_batch_generator(
-        subvol_decomp, n_workers = n_workers,
-        max_subvols_per_chunk = max_subvols_per_chunk
-    )
+                      eager_loading = eager_loading,
+                      shared_cache_spec = shared_cache_spec,
+                      loaded_cache_spec = loaded_cache_spec,
+                      nproc = threads_per_worker,
+                      prefetch_depth = prefetch_depth)
 
     post_proc_callback = _PoolCallback(
         stat_kw_pairs, n_cut_regions = len(cut_regions),
@@ -693,12 +1052,42 @@ def small_dist_sf_props(ds_initializer, dist_bin_edges,
         structure_func_props = structure_func_props
     )
 
-    for batched_result in pool.map(worker, iterable,
-                                   callback = post_proc_callback):
-        continue # simply consume the iterator
+    completed_subvols = []
+    if checkpoint_path is not None:
+        fingerprint = checkpoint_fingerprint(
+            structure_func_props.json(), subvol_decomp.json(), stat_kw_pairs,
+            _dataset_identity(ds_initializer()),
+            structure_func_props.cut_regions,
+            structure_func_props.dist_units,
+            structure_func_props.quantity_units
+        )
+        completed_subvols = post_proc_callback.enable_checkpointing(
+            checkpoint_path, fingerprint, checkpoint_interval
+        )
+        logging.info(f"Restored {len(completed_subvols)} completed subvolumes "
+                     f"from {checkpoint_path!r}")
 
-    print("Cumulative subvol-processing perf-sec -\n    " +
-          post_proc_callback.cumulative_perf.summarize_timing_sec())
+    iterable = subvol_index_batch_generator(
+        subvol_decomp, n_workers = n_workers,
+        max_subvols_per_chunk = max_subvols_per_chunk,
+        skip_subvols = completed_subvols, ordering = batch_ordering
+    )
+    if load_balance:
+        costs = estimate_subvol_costs(
+            estimate_subvol_num_points(ds_initializer(), subvol_decomp),
+            subvol_decomp
+        )
+        iterable = balance_subvol_batches(iterable, costs, n_workers)
+
+    try:
+        _run_subvol_tasks(pool, worker, iterable, post_proc_callback,
+                          save_checkpoint = checkpoint_path is not None)
+    finally:
+        if shared_cache_spec is not None:
+            remove_shared_cache_dir(shared_cache_spec[0])
+        if loaded_cache_spec is not None:
+            # (this only releases the cache of the current process)
+            release_loaded_subvol_cache(loaded_cache_spec[0])
 
     # now, let's consolidate the results together
     prop_l = _consolidate_rslts(stat_kw_pairs, post_proc_callback,
@@ -821,12 +1210,7 @@ def grid_scale_vel_diffs(ds_initializer,
         structure_func_props = structure_func_props
     )
 
-    for batched_result in pool.map(worker, iterable,
-                                   callback = post_proc_callback):
-        continue # simply consume the iterator
-
-    print("Cumulative subvol-processing perf-sec -\n    " +
-          post_proc_callback.cumulative_perf.summarize_timing_sec())
+    _run_subvol_tasks(pool, worker, iterable, post_proc_callback)
 
     # now, let's consolidate the results together
     prop_l = _consolidate_rslts(stat_kw_pairs, post_proc_callback,
@@ -0,0 +1,209 @@
+"""
+Computes cross structure function properties between a point set that fits in
+memory and a (potentially much larger) point set that is streamed in chunks
+from disk.
+
+The second point set is read from array-like objects that support slicing
+along axis 1 (e.g. ``np.memmap`` arrays or ``h5py.Dataset`` objects). While
+the pair kernel processes one chunk, a background thread reads the next chunk
+(the C++ library releases the GIL while it runs), so I/O overlaps with
+computation. Only 2 chunks are ever held in memory.
+"""
+
+import os
+import queue
+import threading
+
+import numpy as np
+
+from ._kernels import get_kernel
+from ._kernels_cy import build_consolidater
+from .pyvsf import vsf_props, PointSet
+
+def write_raw_points(path, pos, vel, dtype = np.float64):
+    """
+    Writes positions and velocities to a raw binary file that can be read by
+    ``open_raw_points``.
+
+    The file holds the C-ordered ``(3, n_points)`` position array, followed by
+    the C-ordered ``(3, n_points)`` velocity array (there's no header).
+    """
+    pos = np.asarray(pos, dtype = dtype)
+    vel = np.asarray(vel, dtype = dtype)
+    if (pos.ndim != 2) or (pos.shape[0] != 3) or (pos.shape != vel.shape):
+        raise ValueError("pos and vel must both have shape (3, n_points)")
+    with open(path, 'wb') as f:
+        np.ascontiguousarray(pos).tofile(f)
+        np.ascontiguousarray(vel).tofile(f)
+
+def open_raw_points(path, n_points = None, dtype = np.float64, offset = 0):
+    """
+    Memory-maps the positions and velocities stored in a raw binary file (see
+    ``write_raw_points`` for the layout).
+
+    Parameters
+    ----------
+    path : str
+        Path to the file
+    n_points : int, optional
+        The number of points. By default, this is inferred from the file size.
+    dtype : optional
+        The datatype of the values.
+    offset : int, optional
+        The number of bytes preceding the position array in the file.
+
+    Returns
+    -------
+    pos, vel : np.memmap
+        Read-only arrays with shape ``(3, n_points)``
+    """
+    itemsize = np.dtype(dtype).itemsize
+    if n_points is None:
+        nbytes = os.path.getsize(path) - offset
+        if (nbytes < 0) or (nbytes % (6 * itemsize)) != 0:
+            raise ValueError(f"the size of {path!r} isn't consistent with 2 "
+                             "arrays with shape (3, n_points)")
+        n_points = nbytes // (6 * itemsize)
+    shape = (3, int(n_points))
+    pos = np.memmap(path, dtype = dtype, mode = 'r', offset = offset,
+                    shape = shape)
+    vel = np.memmap(path, dtype = dtype, mode = 'r',
+                    offset = offset + 3 * int(n_points) * itemsize,
+                    shape = shape)
+    return pos, vel
+
+def _read_chunk(src, start, stop, dest):
+    # copies src[:, start:stop] into dest (which has shape (3, stop - start))
+    if hasattr(src, 'read_direct'): # h5py.Dataset - read without temporaries
+        src.read_direct(dest, source_sel = np.s_[:, start:stop])
+    else:
+        np.copyto(dest, src[:, start:stop], casting = 'same_kind')
+
+def _chunk_iter(pos, vel, chunk_size, prefetch):
+    """
+    Yields (pos_chunk, vel_chunk) pairs of C-contiguous float64 arrays.
+
+    The yielded arrays are reused, so they're only valid until the next chunk
+    is requested.
+    """
+    n_points = pos.shape[1]
+    bounds = [(start, min(start + chunk_size, n_points))
+              for start in range(0, n_points, chunk_size)]
+
+    def alloc():
+        # the buffers are flat so that a (3, m) view of a partial chunk is
+        # still C-contiguous (h5py's read_direct requires that)
+        n = min(chunk_size, n_points)
+        return (np.empty((3 * n,), dtype = np.float64),
+                np.empty((3 * n,), dtype = np.float64))
+
+    def fill(buffers, start, stop):
+        m = stop - start
+        out = tuple(buf[:3 * m].reshape(3, m) for buf in buffers)
+        _read_chunk(pos, start, stop, out[0])
+        _read_chunk(vel, start, stop, out[1])
+        return out
+
+    if not prefetch:
+        buffers = alloc()
+        for start, stop in bounds:
+            yield fill(buffers, start, stop)
+        return
+
+    # double buffering: the reader thread fills a free buffer while the
+    # consumer works on the other one
+    free_q, ready_q = queue.Queue(), queue.Queue()
+    for _ in range(2): free_q.put(alloc())
+    stop_event = threading.Event()
+
+    def reader():
+        try:
+            for start, stop in bounds:
+                buffers = free_q.get()
+                if stop_event.is_set():
+                    return
+                ready_q.put((buffers, fill(buffers, start, stop)))
+        except BaseException as e:
+            ready_q.put((None, e))
+
+    thread = threading.Thread(target = reader, daemon = True)
+    thread.start()
+    try:
+        for _ in bounds:
+            buffers, chunk = ready_q.get()
+            if buffers is None:
+                raise chunk
+            yield chunk
+            free_q.put(buffers)
+    finally:
+        # unblock the reader (if the consumer stopped early)
+        stop_event.set()
+        free_q.put(None)
+        thread.join()
+
+def streaming_vsf_props(pos_a, vel_a, pos_b, vel_b, dist_bin_edges,
+                        stat_kw_pairs = [('variance', {})],
+                        chunk_size = 65536, nproc = 1, prefetch = True,
+                        postprocess_stat = True):
+    """
+    Computes the cross structure function properties between 2 sets of
+    points, where the second set is streamed in chunks.
+
+    Parameters
+    ----------
+    pos_a, vel_a : array_like or PointSet
+        The stationary set of points (held in memory for the duration of the
+        calculation). These have the same meaning as in ``vsf_props``.
+    pos_b, vel_b
+        Arrays with shape ``(3, n_points)`` that support slicing along axis 1
+        (e.g. the arrays returned by ``open_raw_points``, or ``h5py.Dataset``
+        objects). Only ``chunk_size`` points are read at a time.
+    dist_bin_edges, stat_kw_pairs, nproc, postprocess_stat
+        These have the same meaning as in ``vsf_props``. Each statistic must
+        support consolidation.
+    chunk_size : int, optional
+        The number of points from the second set that are processed at once.
+    prefetch : bool, optional
+        When `True` (the default), the next chunk is read by a background
+        thread while the current chunk is processed.
+
+    Returns
+    -------
+    rslts : list of dict
+        The same output as ``vsf_props(pos_a, pos_b, vel_a, vel_b, ...)``
+        (aside from floating point round-off).
+    """
+    if chunk_size <= 0:
+        raise ValueError("chunk_size must be positive")
+    if (pos_b.ndim != 2) or (pos_b.shape[0] != 3) or \
+       (tuple(pos_b.shape) != tuple(vel_b.shape)):
+        raise ValueError("pos_b and vel_b must both have shape (3, n_points)")
+    dist_bin_edges = np.asanyarray(dist_bin_edges, dtype = np.float64)
+
+    # copy the stationary points into a library-owned (aligned) buffer once
+    if isinstance(pos_a, PointSet):
+        points_a = pos_a
+    else:
+        points_a = PointSet(pos_a, vel_a)
+
+    consolidaters = [build_consolidater(dist_bin_edges, get_kernel(name), kw)
+                     for name, kw in stat_kw_pairs]
+    totals = [{} for _ in stat_kw_pairs]
+
+    for pos_chunk, vel_chunk in _chunk_iter(pos_b, vel_b, chunk_size,
+                                            prefetch):
+        rslts = vsf_props(points_a, pos_chunk, None, vel_chunk,
+                          dist_bin_edges, stat_kw_pairs = stat_kw_pairs,
+                          nproc = nproc, postprocess_stat = False)
+        for i, rslt in enumerate(rslts):
+            totals[i] = consolidaters[i].consolidate(totals[i], rslt)
+
+    if pos_b.shape[1] == 0: # produce zero-initialized results
+        totals = [get_kernel(name).zero_initialize_rslt(
+                      dist_bin_edges, kw, postprocess_rslt = False)
+                  for name, kw in stat_kw_pairs]
+
+    if postprocess_stat:
+        for (name, _), total in zip(stat_kw_pairs, totals):
+            get_kernel(name).postprocess_rslt(total)
+    return totals
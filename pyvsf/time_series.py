@@ -0,0 +1,392 @@
+"""
+Computes the structure function properties for a time-series of snapshots,
+while reusing the setup (the subvolume decomposition, the statistic
+configuration, and the layout of the accumulated results) between snapshots.
+
+The results of each snapshot are appended to a single output file as a
+self-contained record (see ``_record_file``) with the magic string
+b"VSFSNAP1" and one binary blob per (statistic, cut_region) pair (see
+``_checkpoint.encode_entries``).
+
+A truncated trailing record (e.g. from a job that was killed while writing)
+is ignored when the file is read, and it's discarded before a resumed
+calculation appends new records.
+"""
+
+import logging
+import os
+import uuid
+
+import numpy as np
+
+from ._checkpoint import (
+    checkpoint_fingerprint,
+    decode_entries,
+    encode_entries
+)
+from ._cut_region_iterator import (
+    release_fixed_pair_bin_caches,
+    release_fixed_position_cache,
+    release_loaded_subvol_cache
+)
+from ._shared_subvol_cache import remove_shared_cache_dir
+from ._kernels import get_kernel
+from ._record_file import (
+    TruncatedRecordError,
+    encode_header,
+    read_record_header,
+    to_jsonable,
+    write_record
+)
+from .small_dist_sf_props import (
+    _PoolCallback,
+    _build_loaded_cache_spec,
+    _build_shared_cache_spec,
+    _build_stat_kw_pairs,
+    _build_structure_func_props,
+    _consolidate_rslts,
+    _dflt_vel_components,
+    _prep_pool,
+    _run_subvol_tasks,
+    decompose_volume,
+    subvol_index_batch_generator
+)
+from .worker import SFWorker
+
+
+_MAGIC = b"VSFSNAP1"
+
+def append_snapshot_record(path, snapshot_index, label, fingerprint,
+                           stat_kw_pairs, rslts, total_num_points,
+                           dist_bin_edges):
+    """
+    Appends the results for a single snapshot to path
+
+    Parameters
+    ----------
+    path : str
+        The output file (it's created if it doesn't exist)
+    snapshot_index : int
+        Index of the snapshot in the time-series
+    label : str
+        A description of the snapshot (e.g. a file name)
+    fingerprint : str
+        Output of ``checkpoint_fingerprint`` for the calculation's parameters
+    stat_kw_pairs : sequence of tuples
+        The (stat_name, stat_kw) pair of each statistic
+    rslts : sequence of sequences of dicts
+        ``rslts[i][j]`` is the unpostprocessed result of the ith statistic for
+        the jth cut region
+    total_num_points : array_like
+        The number of points in each cut region
+    dist_bin_edges : np.ndarray
+        The distance bin edges
+    """
+    entries = []
+    for stat_ind, (stat_name, stat_kw) in enumerate(stat_kw_pairs):
+        for cut_region_i, rslt in enumerate(rslts[stat_ind]):
+            entries.append(((stat_ind, cut_region_i), stat_name, stat_kw,
+                            rslt))
+    header_entries, blobs = encode_entries(entries, dist_bin_edges)
+
+    header = encode_header({
+        'snapshot' : int(snapshot_index), 'label' : label,
+        'fingerprint' : fingerprint,
+        'stat_names' : [stat_name for stat_name, _ in stat_kw_pairs],
+        'n_cut_regions' : len(rslts[0]),
+        'total_num_points' : to_jsonable(np.asarray(total_num_points)),
+        'entries' : header_entries
+    })
+
+    with open(path, 'ab') as f:
+        write_record(f, _MAGIC, header, blobs)
+        f.flush()
+        os.fsync(f.fileno())
+
+def _read_snapshot_records(path, postprocess):
+    # returns the records in path and the offset just past the last complete
+    # record (the bytes after it belong to a truncated record)
+    if not os.path.exists(path):
+        return [], 0
+    buf = np.fromfile(path, dtype = np.uint8)
+    offset, records = 0, []
+    while offset < buf.size:
+        try:
+            header, blob_start = read_record_header(buf, offset, _MAGIC)
+        except TruncatedRecordError:
+            break # truncated trailing record
+        except ValueError:
+            raise ValueError(f"{path!r} holds an invalid record") from None
+        try:
+            entries, offset = decode_entries(buf, blob_start,
+                                             header['entries'])
+        except ValueError:
+            break # truncated trailing record
+
+        rslts = [[None for _ in range(header['n_cut_regions'])]
+                 for _ in header['stat_names']]
+        for (stat_ind, cut_region_i), rslt in entries.items():
+            if postprocess:
+                get_kernel(header['stat_names'][stat_ind]).postprocess_rslt(
+                    rslt
+                )
+            rslts[stat_ind][cut_region_i] = rslt
+        records.append({'snapshot' : header['snapshot'],
+                        'label' : header['label'],
+                        'fingerprint' : header['fingerprint'],
+                        'total_num_points' : np.array(
+                            header['total_num_points']
+                        ),
+                        'rslts' : rslts})
+    return records, offset
+
+def load_sf_series(path, postprocess = True):
+    """
+    Reads the snapshot records written by ``small_dist_sf_props_series``
+
+    Returns
+    -------
+    records : list of dicts
+        Each dict has the keys ``'snapshot'``, ``'label'``, ``'fingerprint'``,
+        ``'total_num_points'``, and ``'rslts'``. ``rslts[i][j]`` holds the
+        result of the ith statistic for the jth cut region.
+    """
+    return _read_snapshot_records(path, postprocess)[0]
+
+def small_dist_sf_props_series(ds_initializers, dist_bin_edges,
+                               output_path = None, snapshot_labels = None,
+                               cut_regions = [None],
+                               pos_units = None, quantity_units = None,
+                               component_fields = _dflt_vel_components,
+                               geometric_selector = None,
+                               statistic = 'variance', kwargs = {},
+                               subvol_side_len = None,
+                               force_subvols_per_ax = None,
+                               eager_loading = False,
+                               max_subvols_per_chunk = None,
+                               pool = None, signed_quantity_diff = False,
+                               positions_fixed = False,
+                               max_cached_subvols = 64,
+                               max_pair_bin_cache_nbytes = 2**30,
+                               shared_subvol_cache_nbytes = None,
+                               shared_subvol_cache_root = None,
+                               batch_ordering = 'row',
+                               max_reused_subvols = None,
+                               threads_per_worker = None,
+                               prefetch_depth = 0):
+    """
+    Computes the structure function properties (like ``small_dist_sf_props``)
+    for each snapshot in a time-series.
+
+    The structure function parameters, the statistic configuration, and the
+    subvolume decomposition are only set up once (the decomposition is
+    computed from the first snapshot, so every snapshot must share the same
+    domain). The results of each snapshot can be appended to a single output
+    file as soon as they are computed.
+
+    Parameters
+    ----------
+    ds_initializers: sequence
+        The callables that initialize the yt-dataset of each snapshot (in
+        order). When a pool is specified, these must be picklable.
+    dist_bin_edges
+        The distance bin edges (see ``small_dist_sf_props``)
+    output_path: str, optional
+        When specified, the results of each snapshot are appended to this
+        file (see ``load_sf_series``). Snapshots that were already recorded
+        in the file (e.g. by a job that was killed) are skipped, and a
+        truncated trailing record is discarded. An error is
+        raised if the existing records were computed with different
+        parameters or if their labels differ from `snapshot_labels`.
+    snapshot_labels: sequence of str, optional
+        A description of each snapshot that is recorded alongside its
+        results. By default, the index of each snapshot is used.
+    positions_fixed: bool, optional
+        When `True`, the positions of the points are assumed to be identical
+        in every snapshot (e.g. the cell centers of a unigrid simulation).
+        Each worker process then caches the positions that it loads for
+        the cut regions that include all points, and only reloads the
+        quantities for later snapshots. For these cut regions, the structure
+        function terms of each subvolume (and of each pair of neighboring
+        subvolumes) are evaluated with a `PairBinCache`, so the pair
+        distances are only binned once.
+    max_cached_subvols: int, optional
+        The maximum number of subvolumes whose positions are cached by each
+        worker process when `positions_fixed` is `True`.
+    max_pair_bin_cache_nbytes: int, optional
+        The maximum number of bytes of `PairBinCache` objects retained by
+        each worker process when `positions_fixed` is `True` (the least
+        recently used caches are evicted first). When the caches of a
+        worker's subvolumes don't fit, the evicted caches are rebuilt for
+        every snapshot, which is slower than not using them. `None` disables
+        the caches.
+    cut_regions, pos_units, quantity_units, component_fields,
+    geometric_selector, statistic, kwargs, subvol_side_len,
+    force_subvols_per_ax, eager_loading, max_subvols_per_chunk, pool,
+    signed_quantity_diff, shared_subvol_cache_nbytes, shared_subvol_cache_root,
+    batch_ordering, max_reused_subvols, threads_per_worker, prefetch_depth
+        These have the same meaning as in ``small_dist_sf_props``. (The
+        subvolume caches are never reused between snapshots.)
+
+    Returns
+    -------
+    prop_ls: list
+        The (postprocessed) ``prop_l`` of each snapshot (see
+        ``small_dist_sf_props``). This includes snapshots that were loaded
+        from output_path.
+    total_num_points_arrs: list of np.ndarray
+        The total number of points (for each cut region) in each snapshot
+    subvol_decomp: `SubVolumeDecomposition`
+        Specifies how the domain has been decomposed into subvolumes
+    sf_params: StructureFuncProps
+        Summarizes the structure function calculation properties
+    """
+    ds_initializers = list(ds_initializers)
+    if len(ds_initializers) == 0:
+        raise ValueError("ds_initializers can't be empty")
+    for i, ds_initializer in enumerate(ds_initializers):
+        if not callable(ds_initializer):
+            assert pool is None
+            ds_initializers[i] = (lambda _ds: (lambda: _ds))(ds_initializer)
+
+    if snapshot_labels is None:
+        snapshot_labels = [str(i) for i in range(len(ds_initializers))]
+    elif len(snapshot_labels) != len(ds_initializers):
+        raise ValueError("snapshot_labels and ds_initializers must have the "
+                         "same length")
+
+    pool, n_workers = _prep_pool(pool)
+
+    dist_bin_edges, structure_func_props = _build_structure_func_props(
+        dist_bin_edges, cut_regions = cut_regions, pos_units = pos_units,
+        quantity_units = quantity_units, component_fields = component_fields,
+        geometric_selector = geometric_selector, max_points = None,
+        rand_seed = None, signed_quantity_diff = signed_quantity_diff
+    )
+    stat_kw_pairs, single_statistic = _build_stat_kw_pairs(statistic, kwargs)
+    del statistic, kwargs
+
+    subvol_decomp = decompose_volume(
+        ds_initializers[0](), structure_func_props,
+        subvol_side_len = subvol_side_len,
+        force_subvols_per_ax = force_subvols_per_ax
+    )
+    logging.info(
+        f"Number of subvolumes per axis: {subvol_decomp.subvols_per_ax}"
+    )
+
+    fingerprint = checkpoint_fingerprint(
+        structure_func_props.json(), subvol_decomp.json(), stat_kw_pairs
+    )
+    recorded = {}
+    if output_path is not None:
+        records, end_offset = _read_snapshot_records(output_path,
+                                                     postprocess = True)
+        for record in records:
+            if record['fingerprint'] != fingerprint:
+                raise ValueError(
+                    f"{output_path!r} holds results computed with different "
+                    "parameters"
+                )
+            snap_ind = record['snapshot']
+            if ((snap_ind >= len(snapshot_labels)) or
+                (record['label'] != snapshot_labels[snap_ind])):
+                raise ValueError(
+                    f"{output_path!r} holds a record for snapshot {snap_ind} "
+                    f"labelled {record['label']!r}, which doesn't match "
+                    "snapshot_labels"
+                )
+            recorded[snap_ind] = record
+        if (os.path.exists(output_path) and
+            (os.path.getsize(output_path) > end_offset)):
+            # drop the truncated trailing record, so that new records are
+            # appended directly after the last complete one
+            logging.warning("Discarding the truncated record at the end of "
+                            f"{output_path!r}")
+            os.truncate(output_path, end_offset)
+
+    if positions_fixed:
+        position_cache_spec = (uuid.uuid4().hex, max_cached_subvols)
+    else:
+        position_cache_spec = None
+    if positions_fixed and (max_pair_bin_cache_nbytes is not None):
+        pair_bin_cache_spec = (uuid.uuid4().hex, max_pair_bin_cache_nbytes)
+    else:
+        pair_bin_cache_spec = None
+
+    # the callback (and the layout of its accumulated results) is reused for
+    # every snapshot
+    post_proc_callback = _PoolCallback(
+        stat_kw_pairs, n_cut_regions = len(cut_regions),
+        subvol_decomp = subvol_decomp, dist_bin_edges = dist_bin_edges,
+        autosf_subvolume_callback = None,
+        structure_func_props = structure_func_props
+    )
+
+    prop_ls, total_num_points_arrs = [], []
+    try:
+        for snap_ind, ds_initializer in enumerate(ds_initializers):
+            if snap_ind in recorded:
+                logging.info(f"Snapshot {snap_ind} was already recorded in "
+                             f"{output_path!r}")
+                prop_l = recorded[snap_ind]['rslts']
+                total_num_points = recorded[snap_ind]['total_num_points']
+            else:
+                post_proc_callback.reset()
+                shared_cache_spec = _build_shared_cache_spec(
+                    shared_subvol_cache_nbytes, shared_subvol_cache_root
+                )
+                loaded_cache_spec = _build_loaded_cache_spec(
+                    max_reused_subvols
+                )
+                worker = SFWorker(ds_initializer, subvol_decomp,
+                                  sf_param = structure_func_props,
+                                  stat_kw_pairs = stat_kw_pairs,
+                                  eager_loading = eager_loading,
+                                  position_cache_spec = position_cache_spec,
+                                  shared_cache_spec = shared_cache_spec,
+                                  loaded_cache_spec = loaded_cache_spec,
+                                  nproc = threads_per_worker,
+                                  prefetch_depth = prefetch_depth,
+                                  pair_bin_cache_spec = pair_bin_cache_spec)
+                iterable = subvol_index_batch_generator(
+                    subvol_decomp, n_workers = n_workers,
+                    max_subvols_per_chunk = max_subvols_per_chunk,
+                    ordering = batch_ordering
+                )
+                try:
+                    _run_subvol_tasks(pool, worker, iterable,
+                                      post_proc_callback)
+                finally:
+                    if shared_cache_spec is not None:
+                        remove_shared_cache_dir(shared_cache_spec[0])
+                    if loaded_cache_spec is not None:
+                        release_loaded_subvol_cache(loaded_cache_spec[0])
+
+                prop_l = _consolidate_rslts(stat_kw_pairs, post_proc_callback,
+                                            dist_bin_edges,
+                                            postprocess = False)
+                total_num_points = np.array(
+                    post_proc_callback.total_num_points_arr
+                )
+                if output_path is not None:
+                    append_snapshot_record(
+                        output_path, snap_ind, snapshot_labels[snap_ind],
+                        fingerprint, stat_kw_pairs, prop_l, total_num_points,
+                        dist_bin_edges
+                    )
+                for (stat_name, _), stat_rslts in zip(stat_kw_pairs, prop_l):
+                    for rslt in stat_rslts:
+                        get_kernel(stat_name).postprocess_rslt(rslt)
+
+            prop_ls.append(prop_l[0] if single_statistic else prop_l)
+            total_num_points_arrs.append(total_num_points)
+    finally:
+        if position_cache_spec is not None:
+            # (this only releases the cache of the current process)
+            release_fixed_position_cache(position_cache_spec[0])
+        if pair_bin_cache_spec is not None:
+            release_fixed_pair_bin_caches(pair_bin_cache_spec[0])
+
+    return (prop_ls, total_num_points_arrs, subvol_decomp,
+            structure_func_props)
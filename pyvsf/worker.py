@@ -1,16 +1,25 @@
+from collections import deque
+from concurrent.futures import ThreadPoolExecutor
 from copy import deepcopy
+import os
 from typing import Tuple, Sequence, NamedTuple, Dict, Any
 import numpy as np
 
-from .pyvsf import vsf_props
+from .pyvsf import (vsf_props, quan_sf_props, batched_sf_props, PointSet,
+                    PairBinCache, ThreadPool)
 
-from ._kernels import get_kernel
+from ._kernels import get_kernel, kernel_operates_on_pairs
 from ._kernels_cy import build_consolidater
+from ._partition_cy import build_task_it_factory
 from ._perf import PerfRegions
 from ._cut_region_iterator import (
     neighbor_ind_iter,
-    get_cut_region_itr_builder
+    get_cut_region_itr_builder,
+    get_fixed_pair_bin_caches,
+    get_fixed_position_cache,
+    get_loaded_subvol_cache
 )
+from ._shared_subvol_cache import SharedSubvolCache
 
 def consolidate_partial_vsf_results(statistic, *rslts,
                                     stat_kw = {}, dist_bin_edges = None):
@@ -27,6 +36,347 @@ def consolidate_partial_vsf_results(statistic, *rslts,
         consolidator = build_consolidater(dist_bin_edges, kernel, stat_kw)
         return consolidator.consolidate(*rslts)
 
+# like the caches in _cut_region_iterator, the thread pools persist between
+# tasks (a worker process only ever needs the pool of 1 size). They're keyed
+# by the process id since a forked child can't use its parent's pool
+_THREAD_POOLS = {}
+
+def _get_thread_pool(nthreads):
+    """
+    Retrieves the process-local ThreadPool with nthreads threads (0 falls
+    back to OMP_NUM_THREADS). Any other pools are released.
+    """
+    key = (os.getpid(), nthreads)
+    pool = _THREAD_POOLS.get(key, None)
+    if pool is None:
+        for other in _THREAD_POOLS.values():
+            other.close()
+        _THREAD_POOLS.clear()
+        pool = ThreadPool(nthreads)
+        _THREAD_POOLS[key] = pool
+    return pool
+
+def _sf_props(pos_a, pos_b, quan_a, quan_b, dist_bin_edges, stat_kw_pairs,
+              nproc, signed_quantity_diff, instrumentation, pool = None):
+    """
+    Computes structure function stats with vsf_props for 3 component
+    quantities (or PointSets) and with quan_sf_props for all other quantities
+    """
+    if (not signed_quantity_diff) and ((quan_a is None) or
+                                       (quan_a.shape[0] == 3)):
+        func, kw = vsf_props, {'vel_a' : quan_a, 'vel_b' : quan_b}
+    else:
+        func, kw = quan_sf_props, {'quan_a' : quan_a, 'quan_b' : quan_b,
+                                   'signed' : signed_quantity_diff}
+    return func(pos_a = pos_a, pos_b = pos_b, dist_bin_edges = dist_bin_edges,
+                stat_kw_pairs = stat_kw_pairs, postprocess_stat = False,
+                nproc = nproc, instrumentation = instrumentation,
+                pool = pool, **kw)
+
+def _pad_to_3_components(quan):
+    # the non-structure function kernels expect 3 components
+    if (quan is None) or (quan.shape[0] == 3):
+        return quan
+    out = np.zeros((3, quan.shape[1]), dtype = quan.dtype)
+    out[:quan.shape[0]] = quan
+    return out
+
+def _num_cached_points(pos):
+    # the number of points in an entry of pos_and_quan_cache_l
+    if pos is None:
+        return 0
+    elif isinstance(pos, PointSet):
+        return pos.n_points
+    return pos.shape[1]
+
+class SubvolPart(NamedTuple):
+    # identifies 1 of the n_parts tasks that a (very expensive) subvolume is
+    # split into. Each part loads all of the subvolume's data, but only
+    # computes a subset of the pairs:
+    # - the auto-structure function pairs are partitioned with the same
+    #   TaskItFactory used within libvsf
+    # - the cross-structure function pairs are partitioned by splitting the
+    #   points of the central subvolume into n_parts contiguous slices
+    # The other statistics are only computed by the part with part_index 0.
+    subvol_index: Tuple[int, int, int]
+    part_index: int
+    n_parts: int
+
+    def slice_points(self, n_points):
+        # the slice of the central subvolume's points used for cross terms
+        return slice((n_points * self.part_index) // self.n_parts,
+                     (n_points * (self.part_index + 1)) // self.n_parts)
+
+# when a part has fewer points than this (times n_parts), the first part
+# computes the entire auto-structure function (TaskItFactory can't partition
+# very small problems)
+_MIN_PARTITIONED_POINTS_PER_PART = 64
+
+def _partial_auto_slice_pairs(n_points, part):
+    # returns (slc_a, slc_b) pairs that describe the auto-structure function
+    # pairs assigned to part (slc_b is None for an auto-sf chunk)
+    if n_points <= _MIN_PARTITIONED_POINTS_PER_PART * part.n_parts:
+        # the first part computes everything
+        return [(slice(None), None)] if part.part_index == 0 else []
+
+    factory = build_task_it_factory(part.n_parts, n_points,
+                                    skip_small_prob_check = True)
+    slice_pairs = []
+    for task in factory.build_iterator(part.part_index):
+        if task.start_B == task.stop_B == 0: # an auto-sf chunk
+            if (task.stop_A - task.start_A) > 1:
+                slice_pairs.append((slice(task.start_A, task.stop_A), None))
+        else:
+            slice_pairs.append((slice(task.start_A, task.stop_A),
+                                slice(task.start_B, task.stop_B)))
+    return slice_pairs
+
+def _partial_auto_sf_props(pos, quan, part, dist_bin_edges, stat_kw_pairs,
+                           signed_quantity_diff, perf):
+    # computes the auto-structure function pairs assigned to part (the
+    # results of each StatTask are consolidated together)
+    slice_pairs = _partial_auto_slice_pairs(pos.shape[1], part)
+
+    partial_rslts = []
+    for slc_a, slc_b in slice_pairs:
+        instrumentation = {}
+        partial_rslts.append(_sf_props(
+            pos_a = pos[:, slc_a], quan_a = quan[:, slc_a],
+            pos_b = None if slc_b is None else pos[:, slc_b],
+            quan_b = None if slc_b is None else quan[:, slc_b],
+            dist_bin_edges = dist_bin_edges, stat_kw_pairs = stat_kw_pairs,
+            nproc = 1, signed_quantity_diff = signed_quantity_diff,
+            instrumentation = instrumentation
+        ))
+        perf.record_vsf_instrumentation('auto-sf', instrumentation)
+
+    out = []
+    for stat_ind, (stat_name, stat_kw) in enumerate(stat_kw_pairs):
+        rslts = [e[stat_ind] for e in partial_rslts]
+        if len(rslts) == 0:
+            out.append({})
+        else:
+            out.append(consolidate_partial_vsf_results(
+                stat_name, *rslts, stat_kw = stat_kw,
+                dist_bin_edges = dist_bin_edges
+            ))
+    return out
+
+class _SFBatch:
+    """
+    Collects the structure function calculations (from the auto and cross
+    terms) of a task, so that they can all be evaluated by a single call to
+    ``batched_sf_props``.
+
+    The data of every point set is retained until ``evaluate`` is called.
+    """
+
+    def __init__(self, stat_details, dist_bin_edges, signed_quantity_diff,
+                 nproc):
+        self.stat_details = stat_details
+        self.dist_bin_edges = dist_bin_edges
+        self.signed_quantity_diff = signed_quantity_diff
+        self.nproc = nproc
+        self._point_sets = []
+        self._point_set_indices = {} # maps id(pos) to an index
+        self._terms = []
+        self._targets = [] # (rslt_container, cut_region_index) per output
+        self._copies = [] # (rslt_container, src_cr_index, dest_cr_index)
+
+    def _point_set_index(self, pos, quan):
+        # _point_sets holds a reference to pos, so its id isn't reused
+        key = id(pos)
+        if key not in self._point_set_indices:
+            self._point_set_indices[key] = len(self._point_sets)
+            self._point_sets.append(pos if quan is None else (pos, quan))
+        return self._point_set_indices[key]
+
+    def _add_output(self, rslt_container, cr_index):
+        self._targets.append((rslt_container, cr_index))
+        return len(self._targets) - 1
+
+    def add_auto(self, rslt_container, cr_index, pos, quan, part = None):
+        """
+        Adds the auto-structure function of the points (or only the pairs
+        assigned to part, when it's a SubvolPart).
+        """
+        out_index = self._add_output(rslt_container, cr_index)
+        if part is None:
+            self._terms.append((self._point_set_index(pos, quan), None,
+                                out_index))
+            return
+        for slc_a, slc_b in _partial_auto_slice_pairs(pos.shape[1], part):
+            index_a = self._point_set_index(pos[:, slc_a], quan[:, slc_a])
+            if slc_b is None:
+                index_b = None
+            else:
+                index_b = self._point_set_index(pos[:, slc_b], quan[:, slc_b])
+            self._terms.append((index_a, index_b, out_index))
+
+    def add_cross(self, rslt_container, cr_index, pos_a, quan_a, pos_b,
+                  quan_b):
+        out_index = self._add_output(rslt_container, cr_index)
+        self._terms.append((self._point_set_index(pos_a, quan_a),
+                            self._point_set_index(pos_b, quan_b), out_index))
+
+    def add_duplicate(self, rslt_container, src_cr_index, dest_cr_index):
+        """
+        Defers a call to rslt_container.duplicate_results_for_cut_region until
+        the results of src_cr_index have been computed.
+        """
+        self._copies.append((rslt_container, src_cr_index, dest_cr_index))
+
+    def evaluate(self, perf):
+        """
+        Computes all of the structure functions & stores the results.
+        """
+        sf_stat_kw_pairs = self.stat_details.sf_stat_kw_pairs
+        if len(self._terms) > 0:
+            with perf.region('batched-sf'):
+                instrumentation = {}
+                rslts = batched_sf_props(
+                    self._point_sets, self._terms, self.dist_bin_edges,
+                    signed = self.signed_quantity_diff,
+                    stat_kw_pairs = sf_stat_kw_pairs, nproc = self.nproc,
+                    postprocess_stat = False,
+                    instrumentation = instrumentation,
+                    pool = _get_thread_pool(self.nproc)
+                )
+                perf.record_vsf_instrumentation('batched-sf', instrumentation)
+        else:
+            rslts = []
+
+        # an output without any terms (e.g. a SubvolPart that isn't
+        # assigned any auto-sf pairs) has empty results
+        has_terms = set(out_index for _, _, out_index in self._terms)
+        for out_index, (rslt_container, cr_index) in enumerate(self._targets):
+            if out_index in has_terms:
+                cur_rslts = rslts[out_index]
+            else:
+                cur_rslts = [{} for _ in sf_stat_kw_pairs]
+            for rslt, (stat_name, _) in zip(cur_rslts, sf_stat_kw_pairs):
+                rslt_container.store_result(
+                    stat_index = self.stat_details.name_index_map[stat_name],
+                    cut_region_index = cr_index, rslt = rslt
+                )
+
+        for rslt_container, src_cr_index, dest_cr_index in self._copies:
+            rslt_container.duplicate_results_for_cut_region(
+                src_cr_index = src_cr_index, dest_cr_index = dest_cr_index
+            )
+
+class _FixedPairBins:
+    """
+    Evaluates the structure function terms between a subvolume and one of its
+    neighbors (or itself) with the ``PairBinCache`` objects retained by a
+    ``FixedPairBinCaches`` instance.
+
+    This is only used for the cut regions whose positions are reused from a
+    ``FixedPositionCache`` (the distance bin of each pair never changes).
+    """
+
+    def __init__(self, caches, subvol_index, other_subvol_index, cr_indices,
+                 dist_bin_edges, signed_quantity_diff):
+        self.caches = caches
+        self.subvol_index = tuple(int(e) for e in subvol_index)
+        if other_subvol_index is None:
+            self.other_subvol_index = None
+        else:
+            self.other_subvol_index = tuple(int(e) for e in other_subvol_index)
+        self.cr_indices = cr_indices
+        self.dist_bin_edges = dist_bin_edges
+        self.signed_quantity_diff = signed_quantity_diff
+
+    def for_neighbor(self, other_subvol_index):
+        return _FixedPairBins(self.caches, self.subvol_index,
+                              other_subvol_index, self.cr_indices,
+                              self.dist_bin_edges, self.signed_quantity_diff)
+
+    def applies(self, cr_index):
+        return cr_index in self.cr_indices
+
+    def sf_props(self, cr_index, pos_a, pos_b, quan_a, quan_b, stat_kw_pairs,
+                 nproc):
+        key = (self.subvol_index, self.other_subvol_index, cr_index)
+        cache = self.caches.get_or_build(
+            key, lambda: PairBinCache(pos_a, pos_b, self.dist_bin_edges,
+                                      nproc = nproc)
+        )
+        return cache.sf_props(quan_a, quan_b,
+                              signed = self.signed_quantity_diff,
+                              stat_kw_pairs = stat_kw_pairs, nproc = nproc,
+                              postprocess_stat = False)
+
+class _NeighborPrefetcher:
+    """
+    Iterates over ``(subvol_index, cut_region_iter)`` pairs for a sequence of
+    neighboring subvolumes.
+
+    When depth is positive, a background thread loads the data of (at most)
+    the next depth neighbors while the caller computes the terms of the
+    current neighbor (ctypes releases the GIL while libvsf runs, so loading
+    & computing actually overlap). Thus, the data of up to depth + 1
+    neighbors is held in memory at once. Until close is called, the
+    background thread is the only user of cut_region_itr_builder (so the
+    caller must finish loading any other data first).
+
+    When depth is 0, each neighbor is only loaded as it's iterated over.
+    """
+
+    def __init__(self, cut_region_itr_builder, neighbor_inds, depth, perf):
+        self._builder = cut_region_itr_builder
+        self._inds = list(neighbor_inds)
+        self._perf = perf
+        self._pending = deque() # (subvol_index, future) pairs
+        self._next = 0 # the index of the next entry of _inds to submit
+        self._executor = None
+        if (depth > 0) and (len(self._inds) > 0):
+            self._executor = ThreadPoolExecutor(max_workers = 1)
+            for _ in range(depth):
+                self._submit_next()
+
+    def _load(self, subvol_index):
+        return tuple(self._builder(subvol_index, is_central = False))
+
+    def _submit_next(self):
+        if self._next < len(self._inds):
+            subvol_index = self._inds[self._next]
+            self._pending.append(
+                (subvol_index, self._executor.submit(self._load, subvol_index))
+            )
+            self._next += 1
+
+    def __iter__(self):
+        if self._executor is None:
+            for subvol_index in self._inds:
+                yield subvol_index, self._builder(subvol_index,
+                                                  is_central = False)
+            return
+
+        while len(self._pending) > 0:
+            subvol_index, future = self._pending.popleft()
+            with self._perf.region('prefetch-wait'):
+                data = future.result()
+            self._submit_next()
+            yield subvol_index, data
+
+    def close(self):
+        """
+        Cancels any outstanding loads & stops the background thread.
+        """
+        if self._executor is not None:
+            for _, future in self._pending:
+                future.cancel()
+            self._pending.clear()
+            self._executor.shutdown(wait = True)
+            self._executor = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
 class StatDetails(NamedTuple):
     # lightweight class used internally by SFWorker
 
@@ -137,8 +487,12 @@ class TaskResult:
 
     def __init__(self, subvol_index, main_subvol_available_points,
                  main_subvol_rslts, consolidated_rslts,
-                 num_neighboring_subvols = None, perf_region = None):
+                 num_neighboring_subvols = None, perf_region = None,
+                 part = None):
         self.subvol_index = subvol_index
+        # when not None, this is the SubvolPart that was processed (the
+        # results only hold the contributions of its subset of pairs)
+        self.part = part
         tmp = np.array(main_subvol_available_points)
         if tmp.shape != (main_subvol_rslts.num_cut_regions,):
             raise ValueError("main_subvol_available_points should be a 1D "
@@ -161,6 +515,45 @@ class TaskResult:
         self.num_neighboring_subvols = num_neighboring_subvols
         self.perf_region = deepcopy(perf_region)
 
+def merge_partial_task_results(parts, stat_kw_pairs, dist_bin_edges):
+    """
+    Combines the TaskResults computed for every SubvolPart of a subvolume
+    into a single TaskResult (equivalent to processing the whole subvolume).
+    """
+    parts = sorted(parts, key = lambda item: item.part.part_index)
+    n_parts = parts[0].part.n_parts
+    if [item.part.part_index for item in parts] != list(range(n_parts)):
+        raise ValueError("a TaskResult is needed for each part")
+    first = parts[0]
+
+    merged = []
+    for attr in ['main_subvol_rslts', 'consolidated_rslts']:
+        containers = [getattr(item, attr) for item in parts]
+        out = StatRsltContainer(num_statistics = containers[0].num_statistics,
+                                num_cut_regions = containers[0].num_cut_regions)
+        for stat_ind, (stat_name, stat_kw) in enumerate(stat_kw_pairs):
+            for cr_index in range(out.num_cut_regions):
+                rslts = [c.retrieve_result(stat_ind, cr_index)
+                         for c in containers]
+                if kernel_operates_on_pairs(stat_name):
+                    rslt = consolidate_partial_vsf_results(
+                        stat_name, *rslts, stat_kw = stat_kw,
+                        dist_bin_edges = dist_bin_edges
+                    )
+                else: # only the first part computes these statistics
+                    rslt = rslts[0]
+                out.store_result(stat_ind, cr_index, rslt)
+        merged.append(out)
+
+    perf_region = first.perf_region
+    for item in parts[1:]:
+        perf_region = perf_region + item.perf_region
+
+    return TaskResult(first.subvol_index, first.main_subvol_available_points,
+                      merged[0], merged[1],
+                      num_neighboring_subvols = first.num_neighboring_subvols,
+                      perf_region = perf_region)
+
 class MaxSizeCutRegionTracker:
     """
     Lightweight functor used to track which cut_region contains the maximum
@@ -187,7 +580,8 @@ class MaxSizeCutRegionTracker:
         return ((self._max_num_points is not None) and
                 (self._max_num_points == num_points))
 
-_PERF_REGION_NAMES = ('all', 'auto-sf', 'auto-other', 'cross-sf', 'cross-other')
+_PERF_REGION_NAMES = ('all', 'auto-sf', 'auto-other', 'cross-sf', 'cross-other',
+                      'batched-sf', 'prefetch-wait')
 
 class _BaseWorker:
     """
@@ -200,10 +594,16 @@ class _BaseWorker:
                                   "subclasses")
 
     def __call__(self, subvol_indices):
+        # each entry of subvol_indices is a subvolume index or a SubvolPart
+        # (only supported by workers whose process_index accepts a part)
         tmp = []
         for subvol_index in subvol_indices:
             try:
-                tmp.append(self.process_index(subvol_index))
+                if isinstance(subvol_index, SubvolPart):
+                    tmp.append(self.process_index(subvol_index.subvol_index,
+                                                  part = subvol_index))
+                else:
+                    tmp.append(self.process_index(subvol_index))
             except BaseException as e:
                 raise RuntimeError(
                     f"Problem encountered while processing {subvol_index}"
@@ -215,7 +615,10 @@ class SFWorker(_BaseWorker):
     Computes the structure function properties for different subvolumes
     """
     def __init__(self, ds_initializer, subvol_decomp, sf_param, stat_kw_pairs,
-                 eager_loading = False):
+                 eager_loading = False, position_cache_spec = None,
+                 shared_cache_spec = None, loaded_cache_spec = None,
+                 nproc = None, prefetch_depth = 0,
+                 pair_bin_cache_spec = None):
         self.ds_initializer = ds_initializer
         self.subvol_decomp = subvol_decomp
         if any(subvol_decomp.periodicity):
@@ -223,6 +626,67 @@ class SFWorker(_BaseWorker):
         self.sf_param = sf_param
         self.stat_kw_pairs = stat_kw_pairs
         self.eager_loading = eager_loading
+        # when not None, this is a (token, max_subvols) pair identifying the
+        # process-local FixedPositionCache from which positions are reused
+        self.position_cache_spec = position_cache_spec
+        # when not None, this is a (token, max_nbytes) pair identifying the
+        # process-local FixedPairBinCaches used to evaluate the structure
+        # function terms of the cut regions whose positions are reused
+        if (pair_bin_cache_spec is not None) and (position_cache_spec is None):
+            raise ValueError("pair_bin_cache_spec requires a "
+                             "position_cache_spec")
+        self.pair_bin_cache_spec = pair_bin_cache_spec
+        # when not None, this is a (path, max_nbytes) pair specifying the
+        # node-local SharedSubvolCache used to load subvolume data
+        self.shared_cache_spec = shared_cache_spec
+        # when not None, this is a (token, max_subvols) pair identifying the
+        # process-local LoadedSubvolCache that retains loaded subvolumes
+        # between tasks
+        self.loaded_cache_spec = loaded_cache_spec
+        # when not None, all of the structure function calculations of a task
+        # are evaluated by a single call to libvsf with this many threads (0
+        # falls back to OMP_NUM_THREADS). Otherwise, the auto terms are
+        # evaluated with 1 thread and the cross terms with OMP_NUM_THREADS
+        self.nproc = nproc
+        # the maximum number of neighboring subvolumes that are loaded (by a
+        # background thread) ahead of the one whose terms are being computed
+        if prefetch_depth < 0:
+            raise ValueError("prefetch_depth must not be negative")
+        self.prefetch_depth = prefetch_depth
+
+    def _get_position_cache(self):
+        if self.position_cache_spec is None:
+            return None
+        token, max_subvols = self.position_cache_spec
+        return get_fixed_position_cache(token, max_subvols)
+
+    def _get_fixed_pair_bins(self, subvol_index, dist_bin_edges):
+        # the cut regions whose positions are reused from the position cache
+        # (see _pos_quan_equan_arr_generator)
+        if ((self.pair_bin_cache_spec is None) or
+            (self.sf_param.max_points is not None)):
+            return None
+        cr_indices = frozenset(
+            i for i, cut_string in enumerate(self.sf_param.cut_regions)
+            if cut_string is None or cut_string == ''
+        )
+        token, max_nbytes = self.pair_bin_cache_spec
+        return _FixedPairBins(
+            get_fixed_pair_bin_caches(token, max_nbytes), subvol_index, None,
+            cr_indices, dist_bin_edges, self.sf_param.signed_quantity_diff
+        )
+
+    def _get_shared_cache(self):
+        if self.shared_cache_spec is None:
+            return None
+        path, max_nbytes = self.shared_cache_spec
+        return SharedSubvolCache(path, max_nbytes)
+
+    def _get_loaded_cache(self):
+        if self.loaded_cache_spec is None:
+            return None
+        token, max_subvols = self.loaded_cache_spec
+        return get_loaded_subvol_cache(token, max_subvols)
 
     def _get_num_statistics(self):
         return len(self.stat_kw_pairs)
@@ -243,7 +707,9 @@ class SFWorker(_BaseWorker):
     def process_auto_stats(cut_region_iter, stat_details, dist_bin_edges, perf,
                            rslt_container, available_points_arr,
                            pos_and_quan_cache_l,
-                           all_inclusive_cr_index = None):
+                           all_inclusive_cr_index = None,
+                           signed_quantity_diff = False, part = None,
+                           batch = None, fixed_pair_bins = None):
         """
         Computes the auto-component of stats from a single subvolume.
 
@@ -259,11 +725,31 @@ class SFWorker(_BaseWorker):
         pos_and_quan_cache_l
             list where tuples of the positions and quantities for each subregion
             will be cached (so they can be reused for computing cross-terms).
+            When structure function statistics are computed, the positions and
+            quantities are copied into a ``PointSet`` (to avoid repeatedly
+            marshalling them for each neighboring subvolume). In that case,
+            the tuple holds the ``PointSet`` and `None`.
         all_inclusive_cr_index : int, optional
             Optionally specified cut_region_index corresponding to a cut_region
             that includes all points is specified. When specified and there is
             another cut_region that happens to also include all points in the
             subvolume, a duplicated calculation will be avoided.
+        part : SubvolPart, optional
+            When specified, only the pairs assigned to this part are
+            considered (and the other statistics are only computed for the
+            first part). In this case, pos_and_quan_cache_l only holds the
+            points of the central subvolume that this part uses for cross
+            terms.
+        batch : _SFBatch, optional
+            When specified, the structure function calculations are added to
+            batch (rather than being evaluated immediately). The results are
+            stored in rslt_container when the batch is evaluated.
+        fixed_pair_bins : _FixedPairBins, optional
+            When specified (and part isn't), the structure function
+            calculations for the cut regions that it applies to are evaluated
+            with its cached distance bins (even when batch is specified). The
+            positions and quantities of these cut regions are cached in
+            pos_and_quan_cache_l as arrays.
 
         Notes
         -----
@@ -280,17 +766,40 @@ class SFWorker(_BaseWorker):
             cr_index, pos, quan, extra_quan, available_points = tmp
 
             available_points_arr[cr_index] = available_points
-            pos_and_quan_cache_l.append((pos,quan))
+            use_pair_bins = ((fixed_pair_bins is not None) and (part is None)
+                             and fixed_pair_bins.applies(cr_index))
+            if (part is None) or (available_points == 0):
+                cache_pos, cache_quan = pos, quan
+            else:
+                slc = part.slice_points(available_points)
+                cache_pos, cache_quan = pos[:, slc], quan[:, slc]
+            if ((_num_cached_points(cache_pos) > 0) and (quan.shape[0] == 3)
+                and (len(stat_details.sf_stat_kw_pairs) != 0) and
+                (not use_pair_bins)):
+                pos_and_quan_cache_l.append(
+                    (PointSet(cache_pos, cache_quan), None)
+                )
+            else:
+                pos_and_quan_cache_l.append((cache_pos, cache_quan))
+            if part is None:
+                sf_pos, sf_quan = pos_and_quan_cache_l[-1]
 
             largest_cr_tracker.process_cr_size(cr_index, available_points)
             if ((cr_index == all_inclusive_cr_index) and
                 largest_cr_tracker.matches_max_num_points(available_points)):
 
                 # copy results from prior cut_region & skip the calculation
-                rslt_container.duplicate_results_for_cut_region(
-                    src_cr_index = largest_cr_tracker.max_size_cr_index,
-                    dest_cr_index = cr_index
-                )
+                if batch is None:
+                    rslt_container.duplicate_results_for_cut_region(
+                        src_cr_index = largest_cr_tracker.max_size_cr_index,
+                        dest_cr_index = cr_index
+                    )
+                else:
+                    batch.add_duplicate(
+                        rslt_container,
+                        src_cr_index = largest_cr_tracker.max_size_cr_index,
+                        dest_cr_index = cr_index
+                    )
                 assert available_points > 0 # sanity check
                 continue
 
@@ -299,15 +808,41 @@ class SFWorker(_BaseWorker):
                 if len(stat_details.sf_stat_kw_pairs) != 0:
                     if (available_points <= 1):
                         rslts = [{} for _ in stat_details.sf_stat_kw_pairs]
+                    elif use_pair_bins:
+                        rslts = fixed_pair_bins.sf_props(
+                            cr_index, pos_a = sf_pos, pos_b = None,
+                            quan_a = sf_quan, quan_b = None,
+                            stat_kw_pairs = stat_details.sf_stat_kw_pairs,
+                            nproc = 1
+                        )
+                    elif batch is not None:
+                        if part is None:
+                            batch.add_auto(rslt_container, cr_index,
+                                           sf_pos, sf_quan)
+                        else:
+                            batch.add_auto(rslt_container, cr_index,
+                                           pos, quan, part = part)
+                        rslts = []
+                    elif part is not None:
+                        rslts = _partial_auto_sf_props(
+                            pos, quan, part, dist_bin_edges,
+                            stat_kw_pairs = stat_details.sf_stat_kw_pairs,
+                            signed_quantity_diff = signed_quantity_diff,
+                            perf = perf
+                        )
                     else:
-                        rslts = vsf_props(
-                            pos_a = pos, vel_a = quan,
-                            pos_b = None, vel_b = None,
+                        instrumentation = {}
+                        rslts = _sf_props(
+                            pos_a = sf_pos, pos_b = None,
+                            quan_a = sf_quan, quan_b = None,
                             dist_bin_edges = dist_bin_edges,
                             stat_kw_pairs = stat_details.sf_stat_kw_pairs,
-                            postprocess_stat = False,
-                            nproc = 1
+                            nproc = 1,
+                            signed_quantity_diff = signed_quantity_diff,
+                            instrumentation = instrumentation
                         )
+                        perf.record_vsf_instrumentation('auto-sf',
+                                                        instrumentation)
 
                     itr = zip(rslts, stat_details.sf_stat_kw_pairs)
                     for rslt, (stat_name, _) in itr:
@@ -321,11 +856,13 @@ class SFWorker(_BaseWorker):
                 for kernel, kw in stat_details.nonsf_kernel_kw_pairs:
                     stat_index = stat_details.name_index_map[kernel.name]
                     if ( (available_points == 0) or
-                         (kernel.operate_on_pairs and (available_points<=1)) ):
+                         (kernel.operate_on_pairs and (available_points<=1)) or
+                         ((part is not None) and (part.part_index != 0)) ):
                         rslt = {}
                     else:
                         func = kernel.non_vsf_func
-                        rslt = func(quan = quan, extra_quantities = extra_quan,
+                        rslt = func(quan = _pad_to_3_components(quan),
+                                    extra_quantities = extra_quan,
                                     kwargs = kw)
                     rslt_container.store_result(stat_index = stat_index,
                                                 cut_region_index = cr_index,
@@ -335,7 +872,9 @@ class SFWorker(_BaseWorker):
     def process_cross_stats(cut_region_iter, main_subvol_pos_and_quan,
                             main_subvol_available_points, stat_details,
                             dist_bin_edges, perf, rslt_container,
-                            all_inclusive_cr_index = None):
+                            all_inclusive_cr_index = None,
+                            signed_quantity_diff = False, nproc = 0,
+                            batch = None, fixed_pair_bins = None):
         """
         Parameters
         ----------
@@ -344,6 +883,19 @@ class SFWorker(_BaseWorker):
             that includes all points is specified. When specified and there is
             another cut_region that happens to also include all points in both
             subvolumes, a duplicated calculation will be avoided.
+        nproc : int, optional
+            The number of threads used for each structure function
+            calculation. The default (0) falls back to OMP_NUM_THREADS. The
+            threads come from a process-local ThreadPool that persists
+            between calls.
+        batch : _SFBatch, optional
+            When specified, the structure function calculations are added to
+            batch (see ``process_auto_stats``).
+        fixed_pair_bins : _FixedPairBins, optional
+            When specified, the structure function calculations for the cut
+            regions that it applies to are evaluated with its cached distance
+            bins (see ``process_auto_stats``). It must correspond to the
+            neighboring subvolume.
 
         Notes
         -----
@@ -364,6 +916,9 @@ class SFWorker(_BaseWorker):
             # of the main subvolume
             m_pos, m_quan = main_subvol_pos_and_quan[cr_index]
             m_available_points = main_subvol_available_points[cr_index]
+            if _num_cached_points(m_pos) == 0:
+                # (a SubvolPart may not be assigned any of the points)
+                m_available_points = 0
 
             if (m_available_points == 0) or (o_available_points == 0):
                 rslt_container.store_all_empty_cut_region(cr_index)
@@ -374,22 +929,49 @@ class SFWorker(_BaseWorker):
             if ((cr_index == all_inclusive_cr_index) and
                 largest_cr_tracker.matches_max_num_points(npoint_pair)):
                 # copy results from prior cut_region & skip the calculation
-                rslt_container.duplicate_results_for_cut_region(
-                    src_cr_index = largest_cr_tracker.max_size_cr_index,
-                    dest_cr_index = cr_index
-                )
+                if batch is None:
+                    rslt_container.duplicate_results_for_cut_region(
+                        src_cr_index = largest_cr_tracker.max_size_cr_index,
+                        dest_cr_index = cr_index
+                    )
+                else:
+                    batch.add_duplicate(
+                        rslt_container,
+                        src_cr_index = largest_cr_tracker.max_size_cr_index,
+                        dest_cr_index = cr_index
+                    )
                 continue
 
+            use_pair_bins = ((fixed_pair_bins is not None) and
+                             fixed_pair_bins.applies(cr_index))
             with perf.region('cross-sf'): # calc structure-func stats
-                if len(stat_details.sf_stat_kw_pairs) != 0:
-                    rslts = vsf_props(
-                        pos_a = m_pos, vel_a = m_quan,
-                        pos_b = o_pos, vel_b = o_quan,
-                        dist_bin_edges = dist_bin_edges,
-                        stat_kw_pairs = stat_details.sf_stat_kw_pairs,
-                        postprocess_stat = False,
-                        nproc = 0 # fall back to OMP_NUM_THREADS env var
-                    )
+                if len(stat_details.sf_stat_kw_pairs) == 0:
+                    pass
+                elif (batch is not None) and (not use_pair_bins):
+                    batch.add_cross(rslt_container, cr_index, m_pos, m_quan,
+                                    o_pos, o_quan)
+                else:
+                    if use_pair_bins:
+                        rslts = fixed_pair_bins.sf_props(
+                            cr_index, pos_a = m_pos, pos_b = o_pos,
+                            quan_a = m_quan, quan_b = o_quan,
+                            stat_kw_pairs = stat_details.sf_stat_kw_pairs,
+                            nproc = nproc if batch is None else batch.nproc
+                        )
+                    else:
+                        instrumentation = {}
+                        rslts = _sf_props(
+                            pos_a = m_pos, pos_b = o_pos,
+                            quan_a = m_quan, quan_b = o_quan,
+                            dist_bin_edges = dist_bin_edges,
+                            stat_kw_pairs = stat_details.sf_stat_kw_pairs,
+                            nproc = nproc,
+                            signed_quantity_diff = signed_quantity_diff,
+                            instrumentation = instrumentation,
+                            pool = _get_thread_pool(nproc)
+                        )
+                        perf.record_vsf_instrumentation('cross-sf',
+                                                        instrumentation)
 
                     itr = zip(rslts, stat_details.sf_stat_kw_pairs)
                     for rslt, (stat_name, _) in itr:
@@ -410,7 +992,12 @@ class SFWorker(_BaseWorker):
 
     
 
-    def process_index(self, subvol_index):
+    def process_index(self, subvol_index, part = None):
+        """
+        Computes the statistics for the subvolume at subvol_index. When part
+        (a SubvolPart) is specified, only the contributions of that part's
+        subset of pairs are computed.
+        """
         perf = PerfRegions(_PERF_REGION_NAMES)
         perf.start_region('all')
 
@@ -433,7 +1020,10 @@ class SFWorker(_BaseWorker):
         cut_region_itr_builder = get_cut_region_itr_builder(
             ds, self.subvol_decomp, self.sf_param, rand_generator = None,
             eager_loader = self.eager_loading,
-            extra_quantities = extra_quan_spec
+            extra_quantities = extra_quan_spec,
+            position_cache = self._get_position_cache(),
+            shared_cache = self._get_shared_cache(),
+            loaded_cache = self._get_loaded_cache()
         )
 
         all_inclusive_cr_index = self._get_all_inclusive_cr_index()
@@ -451,40 +1041,77 @@ class SFWorker(_BaseWorker):
                                                 dtype = np.int64)
         main_subvol_pos_and_quan = []
 
-        # First, load in the main assigned subvolume and compute the auto-vsf
-        # terms and terms of other statistics (that don't operate on pairs)
-        #print(f"{subvol_index}-auto")
-        SFWorker.process_auto_stats(
-            cut_region_itr_builder(subvol_index, is_central = True),
-            stat_details, dist_bin_edges, perf,
-            rslt_container = main_subvol_rslts,
-            available_points_arr = main_subvol_available_points,
-            pos_and_quan_cache_l = main_subvol_pos_and_quan,
-            all_inclusive_cr_index = all_inclusive_cr_index
+        if part is None:
+            fixed_pair_bins = self._get_fixed_pair_bins(subvol_index,
+                                                        dist_bin_edges)
+        else:
+            fixed_pair_bins = None
+
+        if self.nproc is None:
+            batch = None
+        else:
+            batch = _SFBatch(stat_details, dist_bin_edges,
+                             sf_param.signed_quantity_diff, self.nproc)
+
+        # First, load in the main assigned subvolume. When prefetching, the
+        # main subvolume is fully loaded before the background thread starts
+        # loading the neighbors (while we compute the auto terms)
+        central_cut_region_iter = cut_region_itr_builder(subvol_index,
+                                                         is_central = True)
+        if self.prefetch_depth > 0:
+            central_cut_region_iter = tuple(central_cut_region_iter)
+        neighbors = _NeighborPrefetcher(
+            cut_region_itr_builder,
+            neighbor_ind_iter(subvol_index, self.subvol_decomp),
+            self.prefetch_depth, perf
         )
 
-        assert main_subvol_rslts.entries_stored_for_all_results() # sanity check
+        with neighbors:
+            # compute the auto-vsf terms and terms of other statistics (that
+            # don't operate on pairs)
+            #print(f"{subvol_index}-auto")
+            SFWorker.process_auto_stats(
+                central_cut_region_iter,
+                stat_details, dist_bin_edges, perf,
+                rslt_container = main_subvol_rslts,
+                available_points_arr = main_subvol_available_points,
+                pos_and_quan_cache_l = main_subvol_pos_and_quan,
+                all_inclusive_cr_index = all_inclusive_cr_index,
+                signed_quantity_diff = sf_param.signed_quantity_diff,
+                part = part, batch = batch, fixed_pair_bins = fixed_pair_bins
+            )
 
-        cross_sf_rslts = []
+            if batch is None: # sanity check
+                assert main_subvol_rslts.entries_stored_for_all_results()
 
-        # Next, load the adjacent subvolumes (on the right side) and compute
-        # the cross term for the vsf (and any other stats)
+            cross_sf_rslts = []
 
-        for other_ind in neighbor_ind_iter(subvol_index, self.subvol_decomp):
-            #print(f"{subvol_index}-{other_ind}")
+            # Next, load the adjacent subvolumes (on the right side) and
+            # compute the cross term for the vsf (and any other stats)
 
-            cross_sf_rslts.append(StatRsltContainer(
-                num_statistics = self._get_num_statistics(),
-                num_cut_regions = self._get_num_cut_regions()
-            ))
+            for other_ind, other_cut_region_iter in neighbors:
+                #print(f"{subvol_index}-{other_ind}")
 
-            SFWorker.process_cross_stats(
-                cut_region_itr_builder(other_ind, is_central = False),
-                main_subvol_pos_and_quan, main_subvol_available_points,
-                stat_details, dist_bin_edges, perf,
-                rslt_container = cross_sf_rslts[-1],
-                all_inclusive_cr_index = all_inclusive_cr_index
-            )
+                cross_sf_rslts.append(StatRsltContainer(
+                    num_statistics = self._get_num_statistics(),
+                    num_cut_regions = self._get_num_cut_regions()
+                ))
+
+                SFWorker.process_cross_stats(
+                    other_cut_region_iter,
+                    main_subvol_pos_and_quan, main_subvol_available_points,
+                    stat_details, dist_bin_edges, perf,
+                    rslt_container = cross_sf_rslts[-1],
+                    all_inclusive_cr_index = all_inclusive_cr_index,
+                    signed_quantity_diff = sf_param.signed_quantity_diff,
+                    batch = batch,
+                    fixed_pair_bins = (None if fixed_pair_bins is None else
+                                       fixed_pair_bins.for_neighbor(other_ind))
+                )
+
+        if batch is not None:
+            batch.evaluate(perf)
+            assert main_subvol_rslts.entries_stored_for_all_results()
 
         # finally, consolidate cross_sf_rslts together with main_subvol_rslts
         consolidated_rslts = StatRsltContainer(
@@ -515,7 +1142,7 @@ class SFWorker(_BaseWorker):
         return TaskResult(subvol_index, main_subvol_available_points,
                           main_subvol_rslts, consolidated_rslts,
                           num_neighboring_subvols = len(cross_sf_rslts),
-                          perf_region = perf)
+                          perf_region = perf, part = part)
 
 
 
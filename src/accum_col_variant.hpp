@@ -1,6 +1,7 @@
 #ifndef ACCUMCOLVARIANT_H
 #define ACCUMCOLVARIANT_H
 
+#include <string>
 #include <tuple>
 #include <utility> // std::in_place_type
 #include <variant>
@@ -25,12 +26,16 @@ using AccumColVariant =
 inline AccumColVariant build_accum_collection(const StatListItem* stat_list,
                                               std::size_t stat_list_len,
                                               std::size_t num_dist_bins)
-  noexcept
 {
-  if (stat_list_len == 0){
-    error("stat_list_len must not be 0");
+  if (stat_list == nullptr){
+    error("stat_list must not be a nullptr", VSF_INVALID_ARG);
+  } else if (stat_list_len == 0){
+    error("stat_list_len must not be 0", VSF_INVALID_ARG);
   } else if (stat_list_len == 1){
 
+    if (stat_list[0].statistic == nullptr){
+      error("the statistic name must not be a nullptr", VSF_INVALID_ARG);
+    }
     std::string stat_str(stat_list[0].statistic);
     void* accum_arg_ptr = stat_list[0].arg_ptr;
 
@@ -54,13 +59,18 @@ inline AccumColVariant build_accum_collection(const StatListItem* stat_list,
 
     } else {
 
-      error("unrecognized statistic.");
+      error("unrecognized statistic: \"" + stat_str + "\"",
+            VSF_INVALID_ARG);
 
     }
   } else if (stat_list_len == 2){
     // Note: we might be able to do something clever where we call this
     // function to construct each of the individual accumulators
 
+    if ((stat_list[0].statistic == nullptr) ||
+        (stat_list[1].statistic == nullptr)){
+      error("the statistic names must not be nullptrs", VSF_INVALID_ARG);
+    }
     std::string stat_str_a(stat_list[0].statistic);
     void* accum_arg_ptr_a = stat_list[0].arg_ptr;
 
@@ -77,11 +87,12 @@ inline AccumColVariant build_accum_collection(const StatListItem* stat_list,
          std::move(temp_tuple));
 
     } else {
-      error("unrecognized stat combination.");
+      error("unrecognized stat combination: \"" + stat_str_a + "\", \"" +
+            stat_str_b + "\"", VSF_INVALID_ARG);
     }
 
   } else {
-    error("stat_list_len must be 1 or 2");
+    error("stat_list_len must be 1 or 2", VSF_INVALID_ARG);
   }
 }
 
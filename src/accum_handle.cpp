@@ -1,63 +1,388 @@
 #include <cstdint> // std::int64_t
+#include <cstring> // std::memcpy
+#include <string>
 #include <type_traits> // std::decay
+#include <vector>
 
 #include "accum_handle.hpp"
 #include "accum_col_variant.hpp"
+#include "utils.hpp"
+
+namespace{
+
+  const char ACCUM_MAGIC[8] = {'V','S','F','A','C','C','U','M'};
+  const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+  std::size_t padded_len_(std::size_t nbytes) noexcept
+  { return ((nbytes + 7) / 8) * 8; }
+
+  /// Writes fields of a record. When dest is a nullptr, the fields are only
+  /// counted (to determine the size of the record)
+  class RecordWriter{
+  public:
+    explicit RecordWriter(std::uint8_t* dest) : dest_(dest), offset_(0) { }
+
+    void write(const void* src, std::size_t nbytes){
+      if ((dest_ != nullptr) && (nbytes > 0)){
+        std::memcpy(dest_ + offset_, src, nbytes);
+      }
+      offset_ += nbytes;
+      // zero-pad to an 8 byte boundary
+      const std::size_t stop = padded_len_(offset_);
+      if (dest_ != nullptr){
+        for (std::size_t i = offset_; i < stop; i++) { dest_[i] = 0; }
+      }
+      offset_ = stop;
+    }
+
+    void write_u64(std::uint64_t val) { write(&val, sizeof(val)); }
+
+    template<typename T>
+    void write_array(const T* vals, std::size_t len){
+      write_u64(len);
+      write(vals, len * sizeof(T));
+    }
+
+    std::size_t offset() const noexcept { return offset_; }
+
+  private:
+    std::uint8_t* dest_;
+    std::size_t offset_;
+  };
+
+  /// Reads the fields of a record (with bounds checking)
+  class RecordReader{
+  public:
+    RecordReader(const std::uint8_t* src, std::size_t len)
+      : src_(src), len_(len), offset_(0)
+    { }
+
+    void read(void* dest, std::size_t nbytes){
+      if ((nbytes > len_) || (offset_ > (len_ - nbytes))){
+        error("the serialized record is truncated", VSF_INVALID_ARG);
+      }
+      if (nbytes > 0) { std::memcpy(dest, src_ + offset_, nbytes); }
+      offset_ = padded_len_(offset_ + nbytes);
+    }
+
+    std::uint64_t read_u64(){
+      std::uint64_t out;
+      read(&out, sizeof(out));
+      return out;
+    }
+
+    template<typename T>
+    std::vector<T> read_array(){
+      const std::uint64_t len = read_u64();
+      if (len > (len_ / sizeof(T))){
+        error("the serialized record is corrupted", VSF_INVALID_ARG);
+      }
+      std::vector<T> out(len);
+      read(out.data(), len * sizeof(T));
+      return out;
+    }
+
+  private:
+    const std::uint8_t* src_;
+    std::size_t len_;
+    std::size_t offset_;
+  };
+
+  template<typename T>
+  std::size_t n_vals_(const std::vector<std::pair<std::string,
+                                                  std::size_t>>& props,
+                      const T& accum)
+  {
+    std::size_t n = 0;
+    for (const auto& prop : props) { n += prop.second; }
+    return n * accum.n_spatial_bins();
+  }
+
+  /// Writes a record (or just computes its size when dest is a nullptr)
+  std::size_t write_record_(const AccumColVariant& variant,
+                            const double* dist_bin_edges, std::uint8_t* dest)
+  {
+    RecordWriter writer(dest);
+
+    std::visit([&](const auto& accum){
+      using T = std::decay_t<decltype(accum)>;
+      if constexpr (std::is_same_v<T, HistVarCompoundAccumCollection>) {
+        error("serialization of compound accumulators isn't supported",
+              VSF_NOT_IMPLEMENTED);
+      } else {
+        const std::size_t n_dist_bins = accum.n_spatial_bins();
+        const std::string name = T::stat_name();
+
+        std::vector<double> val_bin_edges;
+        if constexpr (std::is_same_v<T, HistogramAccumCollection>) {
+          val_bin_edges = accum.data_bin_edges();
+        }
+
+        std::vector<double> flt_vals(n_vals_(accum.flt_val_props(), accum));
+        std::vector<std::int64_t> i64_vals(n_vals_(accum.i64_val_props(),
+                                                   accum));
+        if (dest != nullptr){
+          accum.copy_flt_vals(flt_vals.data());
+          accum.copy_i64_vals(i64_vals.data());
+        }
+
+        writer.write(ACCUM_MAGIC, sizeof(ACCUM_MAGIC));
+        const std::uint32_t version_and_bom[2] = {VSF_ACCUM_FORMAT_VERSION,
+                                                  BYTE_ORDER_MARK};
+        writer.write(version_and_bom, sizeof(version_and_bom));
+        // the record size is written once we know it (see below)
+        const std::size_t size_offset = writer.offset();
+        writer.write_u64(0);
+        writer.write_u64(n_dist_bins);
+        writer.write_array(dist_bin_edges,
+                           (dist_bin_edges == nullptr) ? 0 : n_dist_bins + 1);
+        writer.write_array(name.data(), name.size());
+        writer.write_array(val_bin_edges.data(), val_bin_edges.size());
+        writer.write_array(flt_vals.data(), flt_vals.size());
+        writer.write_array(i64_vals.data(), i64_vals.size());
+
+        if (dest != nullptr){
+          const std::uint64_t record_size = writer.offset();
+          std::memcpy(dest + size_offset, &record_size, sizeof(record_size));
+        }
+      }
+    }, variant);
+    return writer.offset();
+  }
+
+  /// The contents of a record
+  struct ParsedRecord{
+    AccumRecordInfo info;
+    std::vector<double> dist_bin_edges;
+    std::string name;
+    std::vector<double> val_bin_edges;
+    std::vector<double> flt_vals;
+    std::vector<std::int64_t> i64_vals;
+  };
+
+  ParsedRecord parse_record_(const std::uint8_t* buf, std::size_t buf_len){
+    if (buf == nullptr) { error("buf is a nullptr", VSF_INVALID_ARG); }
+
+    RecordReader reader(buf, buf_len);
+    ParsedRecord out;
+
+    char magic[sizeof(ACCUM_MAGIC)];
+    reader.read(magic, sizeof(magic));
+    if (std::memcmp(magic, ACCUM_MAGIC, sizeof(magic)) != 0){
+      error("buf doesn't hold a serialized accumulator", VSF_INVALID_ARG);
+    }
+    std::uint32_t version_and_bom[2];
+    reader.read(version_and_bom, sizeof(version_and_bom));
+    if (version_and_bom[1] != BYTE_ORDER_MARK){
+      error("the serialized accumulator was written with a different byte "
+            "order", VSF_NOT_IMPLEMENTED);
+    } else if (version_and_bom[0] != VSF_ACCUM_FORMAT_VERSION){
+      error("unsupported serialization format version: " +
+            std::to_string(version_and_bom[0]), VSF_NOT_IMPLEMENTED);
+    }
+    out.info.format_version = version_and_bom[0];
+    out.info.record_size = reader.read_u64();
+    if (out.info.record_size > buf_len){
+      error("the serialized record is truncated", VSF_INVALID_ARG);
+    }
+    // don't read past the end of the current record
+    reader = RecordReader(buf, out.info.record_size);
+    reader.read(magic, sizeof(magic));
+    reader.read(version_and_bom, sizeof(version_and_bom));
+    reader.read_u64();
+
+    out.info.n_dist_bins = reader.read_u64();
+    out.dist_bin_edges = reader.read_array<double>();
+    out.info.n_dist_bin_edges = out.dist_bin_edges.size();
+    if ((out.info.n_dist_bin_edges != 0) &&
+        (out.info.n_dist_bin_edges != out.info.n_dist_bins + 1)){
+      error("the serialized record is corrupted", VSF_INVALID_ARG);
+    }
+
+    const std::vector<char> name = reader.read_array<char>();
+    if (name.size() >= VSF_ACCUM_STAT_NAME_LEN){
+      error("the serialized statistic name is too long", VSF_INVALID_ARG);
+    }
+    out.name = std::string(name.begin(), name.end());
+    std::memset(out.info.statistic, 0, VSF_ACCUM_STAT_NAME_LEN);
+    std::memcpy(out.info.statistic, out.name.data(), out.name.size());
+
+    out.val_bin_edges = reader.read_array<double>();
+    out.info.n_val_bin_edges = out.val_bin_edges.size();
+    if (out.info.n_val_bin_edges == 1){
+      // a single edge can't bound any value bins
+      error("the serialized record is corrupted", VSF_INVALID_ARG);
+    }
+    out.flt_vals = reader.read_array<double>();
+    out.i64_vals = reader.read_array<std::int64_t>();
+    return out;
+  }
+
+}
 
 void* accumhandle_create(const StatListItem* stat_list,
                           std::size_t stat_list_len,
-                          std::size_t num_dist_bins)
+                          std::size_t num_dist_bins,
+                          VsfErrorInfo* err_info) noexcept
 {
-  if (stat_list_len != 1){
-    // it currently doesn't make any sense to try to work with
-    // CompoundAccumCollection...
-    // it doesn't define everything necessary to be useful
-    error("This function currently only expects a single stat_list item to be "
-          "passed.");
-  }
+  AccumColVariant *out = nullptr;
+  auto impl = [&]()
+  {
+    if (stat_list_len != 1){
+      // it currently doesn't make any sense to try to work with
+      // CompoundAccumCollection...
+      // it doesn't define everything necessary to be useful
+      error("This function currently only expects a single stat_list item "
+            "to be passed.", VSF_INVALID_ARG);
+    }
 
-  // this is very inefficient, but we don't have a ton of options if we want
-  // to avoid repeating a lot of code
-  AccumColVariant tmp = build_accum_collection(stat_list, stat_list_len,
-                                               num_dist_bins);
-  AccumColVariant *out = new AccumColVariant(tmp);
+    // this is very inefficient, but we don't have a ton of options if we want
+    // to avoid repeating a lot of code
+    AccumColVariant tmp = build_accum_collection(stat_list, stat_list_len,
+                                                 num_dist_bins);
+    out = new AccumColVariant(tmp);
+  };
+
+  if (catch_vsf_errors(err_info, impl) != VSF_SUCCESS) { return nullptr; }
   return static_cast<void*>(out);
 }
 
-void accumhandle_destroy(void* handle){
+void accumhandle_destroy(void* handle) noexcept {
   AccumColVariant *ptr = static_cast<AccumColVariant*>(handle);
   delete ptr;
 }
 
-void accumhandle_export_data(void* handle, double *out_flt_vals,
-                             int64_t *out_i64_vals)
+int accumhandle_export_data(void* handle, double *out_flt_vals,
+                            int64_t *out_i64_vals,
+                            VsfErrorInfo* err_info) noexcept
 {
-  AccumColVariant *ptr = static_cast<AccumColVariant*>(handle);
-  std::visit([=](auto& accum){ accum.copy_flt_vals(out_flt_vals); }, *ptr);
-  std::visit([=](auto& accum){ accum.copy_i64_vals(out_i64_vals); }, *ptr);
+  return catch_vsf_errors(err_info, [=](){
+    if (handle == nullptr) { error("handle is a nullptr", VSF_INVALID_ARG); }
+    AccumColVariant *ptr = static_cast<AccumColVariant*>(handle);
+    std::visit([=](auto& accum){ accum.copy_flt_vals(out_flt_vals); }, *ptr);
+    std::visit([=](auto& accum){ accum.copy_i64_vals(out_i64_vals); }, *ptr);
+  });
 }
 
-void accumhandle_restore(void* handle, const double *in_flt_vals,
-                         const int64_t *in_i64_vals)
+int accumhandle_restore(void* handle, const double *in_flt_vals,
+                        const int64_t *in_i64_vals,
+                        VsfErrorInfo* err_info) noexcept
 {
-  AccumColVariant *ptr = static_cast<AccumColVariant*>(handle);
-  std::visit([=](auto& accum){ accum.import_flt_vals(in_flt_vals); }, *ptr);
-  std::visit([=](auto& accum){ accum.import_i64_vals(in_i64_vals); }, *ptr);
+  return catch_vsf_errors(err_info, [=](){
+    if (handle == nullptr) { error("handle is a nullptr", VSF_INVALID_ARG); }
+    AccumColVariant *ptr = static_cast<AccumColVariant*>(handle);
+    std::visit([=](auto& accum){ accum.import_flt_vals(in_flt_vals); }, *ptr);
+    std::visit([=](auto& accum){ accum.import_i64_vals(in_i64_vals); }, *ptr);
+  });
 }
 
 
-void accumhandle_consolidate_into_primary(void* handle_primary,
-                                          void* handle_secondary)
+int accumhandle_consolidate_into_primary(void* handle_primary,
+                                         void* handle_secondary,
+                                         VsfErrorInfo* err_info) noexcept
+{
+  return catch_vsf_errors(err_info, [=](){
+    if ((handle_primary == nullptr) || (handle_secondary == nullptr)){
+      error("neither handle can be a nullptr", VSF_INVALID_ARG);
+    }
+    AccumColVariant *primary_ptr
+      = static_cast<AccumColVariant*>(handle_primary);
+    AccumColVariant *secondary_ptr
+      = static_cast<AccumColVariant*>(handle_secondary);
+
+    std::visit([=](auto& accum){
+      using T = std::decay_t<decltype(accum)>;
+      if (std::holds_alternative<T>(*secondary_ptr)){
+        accum.consolidate_with_other(std::get<T>(*secondary_ptr));
+      } else {
+        error("the arguments don't hold the same types of accumulators",
+              VSF_INVALID_ARG);
+      }}, *primary_ptr);
+  });
+}
+
+int accumhandle_serialize(void* handle, const double* dist_bin_edges,
+                          uint8_t* out_buf, size_t buf_len, size_t* out_size,
+                          VsfErrorInfo* err_info) noexcept
 {
-  AccumColVariant *primary_ptr = static_cast<AccumColVariant*>(handle_primary);
-  AccumColVariant *secondary_ptr
-    = static_cast<AccumColVariant*>(handle_secondary);
-
-  std::visit([=](auto& accum){
-    using T = std::decay_t<decltype(accum)>;
-    if (std::holds_alternative<T>(*secondary_ptr)){
-      accum.consolidate_with_other(std::get<T>(*secondary_ptr));
-    } else {
-      error("the arguments don't hold the same types of accumulators");
-    }}, *primary_ptr);
+  return catch_vsf_errors(err_info, [=](){
+    if (handle == nullptr) { error("handle is a nullptr", VSF_INVALID_ARG); }
+    const AccumColVariant& variant = *static_cast<AccumColVariant*>(handle);
+
+    const std::size_t size = write_record_(variant, dist_bin_edges, nullptr);
+    if (out_size != nullptr) { *out_size = size; }
+    if (out_buf != nullptr){
+      if (buf_len < size){
+        error("buf_len is too small to hold the serialized record",
+              VSF_INVALID_ARG);
+      }
+      write_record_(variant, dist_bin_edges, out_buf);
+    }
+  });
+}
+
+int accumhandle_record_info(const uint8_t* buf, size_t buf_len,
+                            AccumRecordInfo* out,
+                            VsfErrorInfo* err_info) noexcept
+{
+  return catch_vsf_errors(err_info, [=](){
+    if (out == nullptr) { error("out is a nullptr", VSF_INVALID_ARG); }
+    *out = parse_record_(buf, buf_len).info;
+  });
+}
+
+void* accumhandle_deserialize(const uint8_t* buf, size_t buf_len,
+                              double* out_dist_bin_edges,
+                              double* out_val_bin_edges,
+                              VsfErrorInfo* err_info) noexcept
+{
+  AccumColVariant *out = nullptr;
+  auto impl = [&]()
+  {
+    const ParsedRecord record = parse_record_(buf, buf_len);
+
+    // records of statistics without value bins have no val_bin_edges
+    BinSpecification val_bins{nullptr, 0};
+    if (!record.val_bin_edges.empty()){
+      val_bins = {record.val_bin_edges.data(),
+                  record.val_bin_edges.size() - 1};
+    }
+    const StatListItem stat_list_item =
+      {record.name.c_str(),
+       (record.val_bin_edges.empty()) ? nullptr : &val_bins};
+
+    AccumColVariant tmp = build_accum_collection(&stat_list_item, 1,
+                                                 record.info.n_dist_bins);
+
+    // confirm that the stored state has the expected size
+    std::visit([&](auto& accum){
+      using T = std::decay_t<decltype(accum)>;
+      if constexpr (std::is_same_v<T, HistVarCompoundAccumCollection>) {
+        error("serialization of compound accumulators isn't supported",
+              VSF_NOT_IMPLEMENTED);
+      } else {
+        if ((record.flt_vals.size() !=
+             n_vals_(accum.flt_val_props(), accum)) ||
+            (record.i64_vals.size() !=
+             n_vals_(accum.i64_val_props(), accum))){
+          error("the serialized record is corrupted", VSF_INVALID_ARG);
+        }
+        accum.import_flt_vals(record.flt_vals.data());
+        accum.import_i64_vals(record.i64_vals.data());
+      }
+    }, tmp);
+
+    if (out_dist_bin_edges != nullptr){
+      std::copy(record.dist_bin_edges.begin(), record.dist_bin_edges.end(),
+                out_dist_bin_edges);
+    }
+    if (out_val_bin_edges != nullptr){
+      std::copy(record.val_bin_edges.begin(), record.val_bin_edges.end(),
+                out_val_bin_edges);
+    }
+    out = new AccumColVariant(std::move(tmp));
+  };
+
+  if (catch_vsf_errors(err_info, impl) != VSF_SUCCESS) { return nullptr; }
+  return static_cast<void*>(out);
 }
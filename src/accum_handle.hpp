@@ -22,12 +22,17 @@ extern "C" {
 /// @param[in]  stat_list_len Specifies the number of entries in stat_list.
 /// @param[in]  num_dist_bins The number of distance bins used in the
 ///     accumulator.
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns The handle. A nullptr is returned if there was an error.
 void* accumhandle_create(const StatListItem* stat_list,
                          size_t stat_list_len,
-                         size_t num_dist_bins);
+                         size_t num_dist_bins,
+                         VsfErrorInfo* err_info) noexcept;
 
 /// Deallocates the AccumulatorCollection associated with the handle
-void accumhandle_destroy(void* handle);
+void accumhandle_destroy(void* handle) noexcept;
 
 /// Saves the values stored in an Accumulator Collection to pre-allocated
 /// external arrays
@@ -38,8 +43,13 @@ void accumhandle_destroy(void* handle);
 ///     point values.
 /// @param[out] out_i64_vals Preallocated array to hold the output int64_t
 ///     values.
-void accumhandle_export_data(void* handle, double *out_flt_vals,
-                             int64_t *out_i64_vals);
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns VSF_SUCCESS or an error code.
+int accumhandle_export_data(void* handle, double *out_flt_vals,
+                            int64_t *out_i64_vals,
+                            VsfErrorInfo* err_info) noexcept;
 
 /// Restore the state of an Accumulator Collection from values stored in
 /// external buffers
@@ -51,14 +61,107 @@ void accumhandle_export_data(void* handle, double *out_flt_vals,
 ///     handle, which will be modified
 /// @param[in]     in_flt_vals Array of floating point values.
 /// @param[in]     in_i64_vals Array of int64_t values.
-void accumhandle_restore(void* handle, const double *in_flt_vals,
-                         const int64_t *in_i64_vals);
+/// @param[out]    err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns VSF_SUCCESS or an error code.
+int accumhandle_restore(void* handle, const double *in_flt_vals,
+                        const int64_t *in_i64_vals,
+                        VsfErrorInfo* err_info) noexcept;
 
 
 /// Updates `handle_primary` with the consolidated values of itself with
 /// `handle_secondary`
-void accumhandle_consolidate_into_primary(void* handle_primary,
-                                          void* handle_secondary);
+///
+/// @returns VSF_SUCCESS or an error code. An error is reported if the
+///     handles don't hold the same kind of accumulator collection.
+int accumhandle_consolidate_into_primary(void* handle_primary,
+                                         void* handle_secondary,
+                                         VsfErrorInfo* err_info) noexcept;
+
+// Serialization
+// -------------
+// An accumulator collection can be serialized into a self-describing binary
+// record (that holds the statistic name, its configuration, the distance bin
+// edges and the raw accumulator state). The layout is:
+//
+//   char[8]  magic ("VSFACCUM")
+//   uint32   format version (VSF_ACCUM_FORMAT_VERSION)
+//   uint32   byte order mark (0x01020304, written in native byte order)
+//   uint64   record size in bytes (including this header)
+//   uint64   number of distance bins
+//   uint64   number of stored distance bin edges (0 or n_dist_bins + 1)
+//   float64  distance bin edges
+//   uint64   length of the statistic name
+//   char     statistic name (zero-padded to a multiple of 8 bytes)
+//   uint64   number of value bin edges (0 unless the stat is "histogram")
+//   float64  value bin edges
+//   uint64   number of floating point values
+//   float64  floating point values (layout of accumhandle_export_data)
+//   uint64   number of int64 values
+//   int64    int64 values (layout of accumhandle_export_data)
+//
+// Every field starts on an 8 byte boundary. Records can simply be
+// concatenated (e.g. appended to a checkpoint file), since each one records
+// its own size.
+
+#define VSF_ACCUM_FORMAT_VERSION 1
+#define VSF_ACCUM_STAT_NAME_LEN 32
+
+/// Summarizes the contents of a serialized record
+struct AccumRecordInfo{
+  uint32_t format_version;
+  uint64_t record_size;
+  char statistic[VSF_ACCUM_STAT_NAME_LEN];
+  uint64_t n_dist_bins;
+  uint64_t n_dist_bin_edges; // 0 if the distance bin edges weren't stored
+  uint64_t n_val_bin_edges;  // 0 unless statistic is "histogram"
+};
+
+/// Serializes the accumulator collection associated with handle
+///
+/// @param[in]  handle The accumulator collection
+/// @param[in]  dist_bin_edges Optional array of the ``num_dist_bins + 1``
+///     distance bin edges to store in the record. This can be a nullptr.
+/// @param[out] out_buf Buffer where the record is written. When this is a
+///     nullptr, only the required size is computed.
+/// @param[in]  buf_len The size of out_buf in bytes.
+/// @param[out] out_size Set to the size of the record in bytes.
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns VSF_SUCCESS or an error code. An error is reported if buf_len is
+///     too small.
+int accumhandle_serialize(void* handle, const double* dist_bin_edges,
+                          uint8_t* out_buf, size_t buf_len, size_t* out_size,
+                          VsfErrorInfo* err_info) noexcept;
+
+/// Reads the summary of the serialized record at the start of buf (this
+/// validates the header without constructing an accumulator collection)
+///
+/// @returns VSF_SUCCESS or an error code.
+int accumhandle_record_info(const uint8_t* buf, size_t buf_len,
+                            AccumRecordInfo* out,
+                            VsfErrorInfo* err_info) noexcept;
+
+/// Constructs an accumulator collection from the serialized record at the
+/// start of buf & returns a handle to it
+///
+/// @param[in]  buf, buf_len The buffer holding the record
+/// @param[out] out_dist_bin_edges Optional array where the stored distance
+///     bin edges are copied (see AccumRecordInfo::n_dist_bin_edges). This
+///     can be a nullptr.
+/// @param[out] out_val_bin_edges Optional array where the value bin edges
+///     are copied (see AccumRecordInfo::n_val_bin_edges). This can be a
+///     nullptr.
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns The handle. A nullptr is returned if there was an error.
+void* accumhandle_deserialize(const uint8_t* buf, size_t buf_len,
+                              double* out_dist_bin_edges,
+                              double* out_val_bin_edges,
+                              VsfErrorInfo* err_info) noexcept;
 
 
 #ifdef __cplusplus
@@ -31,12 +31,12 @@ public: // interface
     return {"mean"};
   }
 
-  double get_flt_val(std::size_t i) const noexcept{
+  double get_flt_val(std::size_t i) const {
     if (i != 0){ error("MeanAccum only has 1 float_val"); }
     return mean;
   }
 
-  void set_flt_val(std::size_t i, double val) noexcept{
+  void set_flt_val(std::size_t i, double val) {
     if (i != 0){ error("MeanAccum only has 1 float_val"); }
     mean = val;
   }
@@ -49,8 +49,8 @@ public: // interface
     mean += (val_minus_last_mean)/count;
   }
 
-  inline void consolidate_with_other(const MeanAccum& other) noexcept
-  { error("Not Implemented Yet"); }
+  inline void consolidate_with_other(const MeanAccum& other)
+  { error("MeanAccum can't be consolidated yet", VSF_NOT_IMPLEMENTED); }
 
 public: // attributes
   // number of entries included (so far)
@@ -71,7 +71,7 @@ public: // interface
     return {"mean", "variance*count"};
   }
 
-  double get_flt_val(std::size_t i) const noexcept{
+  double get_flt_val(std::size_t i) const {
     if (i == 0){
       return mean;
     } else if (i == 1){
@@ -81,7 +81,7 @@ public: // interface
     }
   }
 
-  void set_flt_val(std::size_t i, double val) noexcept{
+  void set_flt_val(std::size_t i, double val) {
     if (i == 0){
       mean = val;
     } else if (i == 1){
@@ -158,11 +158,15 @@ public:
 
   ScalarAccumCollection() noexcept : accum_list_() {}
 
-  ScalarAccumCollection(std::size_t n_spatial_bins, void * other_arg) noexcept
+  ScalarAccumCollection(std::size_t n_spatial_bins, void * other_arg)
     : accum_list_(n_spatial_bins)
   {
-    if (n_spatial_bins == 0) { error("n_spatial_bins must be positive"); }
-    if (other_arg != nullptr) { error("other_arg must be nullptr"); }
+    if (n_spatial_bins == 0) {
+      error("n_spatial_bins must be positive", VSF_INVALID_ARG);
+    }
+    if (other_arg != nullptr) {
+      error("other_arg must be nullptr", VSF_INVALID_ARG);
+    }
   }
 
   inline void add_entry(std::size_t spatial_bin_index, double val) noexcept{
@@ -171,11 +175,11 @@ public:
 
   /// Updates the values of `*this` to include the values from `other`
   inline void consolidate_with_other(const ScalarAccumCollection& other)
-    noexcept
   {
     std::size_t num_bins = accum_list_.size();
     if (other.accum_list_.size() != num_bins){
-      error("There seemed to be a mismatch during consolidation");
+      error("There seemed to be a mismatch during consolidation",
+            VSF_INVALID_ARG);
     }
     for (std::size_t i = 0; i < num_bins; i++){
       accum_list_[i].consolidate_with_other(other.accum_list_[i]);
@@ -213,7 +217,7 @@ public:
 
   /// Copies the floating point values of each scalar accumulator to a
   /// pre-allocatd buffer
-  void copy_flt_vals(double *out_vals) const noexcept {
+  void copy_flt_vals(double *out_vals) const {
     const std::size_t num_flt_vals = Accum::flt_val_names().size();
     const std::size_t n_bins = accum_list_.size();
 
@@ -237,7 +241,7 @@ public:
   ///
   /// This is primarily meant to be passed an external buffer whose values were
   /// initialized by the copy_flt_vals method.
-  void import_flt_vals(const double *in_vals) noexcept {
+  void import_flt_vals(const double *in_vals) {
     const std::size_t num_flt_vals = Accum::flt_val_names().size();
     const std::size_t n_bins = accum_list_.size();
 
@@ -295,6 +299,41 @@ std::size_t identify_bin_index(T x, const T *bin_edges, std::size_t nbins)
   }
 }
 
+/// Identify the bin index for the specified value with a linear search.
+///
+/// This has identical semantics to identify_bin_index. For a small number of
+/// bins, a linear scan tends to be faster than a binary search (the branches
+/// are more predictable).
+template<typename T>
+std::size_t identify_bin_index_linear(T x, const T *bin_edges,
+                                      std::size_t nbins)
+{
+  if (!(x > bin_edges[0])) { return nbins; }
+  for (std::size_t i = 0; i < nbins; i++){
+    if (x <= bin_edges[i+1]) { return i; }
+  }
+  return nbins;
+}
+
+/// Converts an array of ``nbins + 1`` distance bin edges into squared distance
+/// bin edges (so that pairs can be binned without computing square roots)
+inline std::vector<double> build_dist_sqr_bin_edges(const double *bin_edges,
+                                                    std::size_t nbins)
+{
+  std::vector<double> out(nbins+1);
+  for (std::size_t i=0; i < (nbins+1); i++){
+    if (bin_edges[i] < 0){
+      // It doesn't really matter how we handle negative bin edges (since
+      // distances are non-negative), as long as the squared bin edges
+      // monotonically increase.
+      out[i] = bin_edges[i];
+    } else {
+      out[i] = bin_edges[i]*bin_edges[i];
+    }
+  }
+  return out;
+}
+
 class HistogramAccumCollection{
 public:
 
@@ -308,22 +347,25 @@ public:
       data_bin_edges_()
   { }
   
-  HistogramAccumCollection(std::size_t n_spatial_bins,
-                           void * other_arg) noexcept
+  HistogramAccumCollection(std::size_t n_spatial_bins, void * other_arg)
     : n_spatial_bins_(n_spatial_bins),
       n_data_bins_(),
       bin_counts_(),
       data_bin_edges_()
   {
-    if (n_spatial_bins == 0) { error("n_spatial_bins must be positive"); }
-    if (other_arg == nullptr) { error("other_arg must not be a nullptr"); }
+    if (n_spatial_bins == 0) {
+      error("n_spatial_bins must be positive", VSF_INVALID_ARG);
+    }
+    if (other_arg == nullptr) {
+      error("other_arg must not be a nullptr", VSF_INVALID_ARG);
+    }
 
 
     BinSpecification* data_bins = static_cast<BinSpecification*>(other_arg);
 
     // initialize n_data_bins_
     if (data_bins->n_bins == 0) {
-      error("There must be a positive number of bins.");
+      error("There must be a positive number of bins.", VSF_INVALID_ARG);
     }
     n_data_bins_ = data_bins->n_bins;
 
@@ -351,11 +393,11 @@ public:
 
   /// Updates the values of `*this` to include the values from `other`
   inline void consolidate_with_other(const HistogramAccumCollection& other)
-    noexcept
   {
     if ((other.n_spatial_bins_ != n_spatial_bins_) ||
         (other.n_data_bins_ != n_data_bins_)){
-      error("There seemed to be a mismatch during consolidation");
+      error("There seemed to be a mismatch during consolidation",
+            VSF_INVALID_ARG);
     }
     // going to simply assume that contents of data_bin_edges_ are consistent
 
@@ -410,6 +452,10 @@ public:
 
   std::size_t n_spatial_bins() const noexcept { return n_spatial_bins_; }
 
+  /// Returns the bin edges used to bin the data values
+  const std::vector<double>& data_bin_edges() const noexcept
+  { return data_bin_edges_; }
+
 private:
   std::size_t n_spatial_bins_;
   std::size_t n_data_bins_;
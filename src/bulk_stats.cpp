@@ -0,0 +1,276 @@
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <omp.h>
+
+#include "bulk_stats.hpp"
+#include "partition.hpp" // get_nominal_nproc
+#include "utils.hpp"
+
+namespace{
+
+  /// number of points in each block processed with the two-pass algorithm
+  const std::size_t BLOCK_SIZE = 1024;
+
+  /// Adds val to the running sum (sum + comp) with Neumaier's variant of
+  /// compensated summation
+  inline void compensated_add_(double& sum, double& comp, double val) noexcept
+  {
+    const double tmp = sum + val;
+    comp += (std::fabs(sum) >= std::fabs(val)) ? ((sum - tmp) + val)
+                                                : ((val - tmp) + sum);
+    sum = tmp;
+  }
+
+  /// Accumulates the weight total, averages, and (optionally) the weighted
+  /// sum of squared deviations from the average for several weight fields
+  ///
+  /// Each weight field's data is stored contiguously so that the update of
+  /// all components is vectorized. The weight totals, the averages and the
+  /// sums of squared deviations are each tracked with a compensation term,
+  /// so the round-off error doesn't grow with the number of merged blocks.
+  class MomentMerger{
+  public:
+    MomentMerger(std::size_t n_weights, std::size_t n_components,
+                 bool track_m2)
+      : n_weights_(n_weights), n_components_(n_components),
+        track_m2_(track_m2), wsum_(n_weights, 0.0), wcomp_(n_weights, 0.0),
+        mean_(n_weights * n_components, 0.0),
+        mean_comp_(n_weights * n_components, 0.0),
+        m2_(n_weights * n_components, 0.0),
+        m2_comp_(n_weights * n_components, 0.0)
+    { }
+
+    /// Adds the moments of another set of points. m2 is ignored when the
+    /// merger doesn't track the second moment.
+    void add(const double* weight_total, const double* mean, const double* m2)
+      noexcept
+    {
+      const std::size_t n_comp = n_components_;
+      for (std::size_t w = 0; w < n_weights_; w++){
+        const double w_b = weight_total[w];
+        if (w_b == 0.0) { continue; }
+        const double w_a = wsum_[w] + wcomp_[w];
+        compensated_add_(wsum_[w], wcomp_[w], w_b);
+
+        double* mean_a = mean_.data() + w * n_comp;
+        double* mean_comp_a = mean_comp_.data() + w * n_comp;
+        double* m2_a = m2_.data() + w * n_comp;
+        double* m2_comp_a = m2_comp_.data() + w * n_comp;
+        const double* mean_b = mean + w * n_comp;
+        const double* m2_b = m2 + w * n_comp;
+
+        if (w_a == 0.0){
+          for (std::size_t c = 0; c < n_comp; c++) {
+            mean_a[c] = mean_b[c];
+            mean_comp_a[c] = 0.0;
+          }
+          if (track_m2_){
+            for (std::size_t c = 0; c < n_comp; c++) {
+              m2_a[c] = m2_b[c];
+              m2_comp_a[c] = 0.0;
+            }
+          }
+          continue;
+        }
+
+        // the update formula from Chan, Golub, & LeVeque (1979), where each
+        // increment is added with compensated summation
+        const double frac = w_b / (w_a + w_b);
+        const double cross = w_a * frac;
+        if (track_m2_){
+          for (std::size_t c = 0; c < n_comp; c++){
+            const double delta = mean_b[c] - (mean_a[c] + mean_comp_a[c]);
+            compensated_add_(mean_a[c], mean_comp_a[c], delta * frac);
+            compensated_add_(m2_a[c], m2_comp_a[c],
+                             m2_b[c] + delta * delta * cross);
+          }
+        } else {
+          for (std::size_t c = 0; c < n_comp; c++){
+            const double delta = mean_b[c] - (mean_a[c] + mean_comp_a[c]);
+            compensated_add_(mean_a[c], mean_comp_a[c], delta * frac);
+          }
+        }
+      }
+    }
+
+    void write(double* out_weight_total, double* out_mean,
+               double* out_variance) const noexcept
+    {
+      const double nan = std::numeric_limits<double>::quiet_NaN();
+      const std::size_t n_comp = n_components_;
+      for (std::size_t w = 0; w < n_weights_; w++){
+        const double total = wsum_[w] + wcomp_[w];
+        out_weight_total[w] = total;
+        for (std::size_t c = 0; c < n_comp; c++){
+          const std::size_t i = w * n_comp + c;
+          out_mean[i] = (total == 0.0) ? nan : mean_[i] + mean_comp_[i];
+          if (track_m2_) {
+            out_variance[i] = (total == 0.0)
+              ? nan : (m2_[i] + m2_comp_[i]) / total;
+          }
+        }
+      }
+    }
+
+  private:
+    std::size_t n_weights_;
+    std::size_t n_components_;
+    bool track_m2_;
+    std::vector<double> wsum_;
+    std::vector<double> wcomp_;
+    std::vector<double> mean_;
+    std::vector<double> mean_comp_;
+    std::vector<double> m2_;
+    std::vector<double> m2_comp_;
+  };
+
+  /// Computes the moments of the points in [start, stop) with the two-pass
+  /// algorithm
+  void block_moments_(const BulkMomentProps& props, std::size_t start,
+                      std::size_t stop, bool track_m2,
+                      double* weight_total, double* mean, double* m2) noexcept
+  {
+    const std::size_t n_comp = props.n_components;
+    const std::size_t stride = props.component_stride;
+    for (std::size_t w = 0; w < props.n_weights; w++){
+      const double* weights = props.weights[w];
+
+      double total = 0.0;
+      for (std::size_t j = start; j < stop; j++) { total += weights[j]; }
+      weight_total[w] = total;
+      if (total == 0.0) { continue; }
+
+      for (std::size_t c = 0; c < n_comp; c++){
+        const double* vals = props.values + c * stride;
+        double prodsum = 0.0;
+        for (std::size_t j = start; j < stop; j++){
+          prodsum += weights[j] * vals[j];
+        }
+        const double cur_mean = prodsum / total;
+        mean[w * n_comp + c] = cur_mean;
+
+        if (track_m2){
+          double sqr_dev_sum = 0.0;
+          for (std::size_t j = start; j < stop; j++){
+            const double dev = vals[j] - cur_mean;
+            sqr_dev_sum += weights[j] * dev * dev;
+          }
+          m2[w * n_comp + c] = sqr_dev_sum;
+        }
+      }
+    }
+  }
+
+}
+
+int calc_bulk_moments(const BulkMomentProps props,
+                      const ParallelSpec parallel_spec,
+                      double *out_weight_total, double *out_mean,
+                      double *out_variance, VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if ((props.n_points > 0) && (props.n_components > 0) &&
+        (props.values == nullptr)){
+      error("props.values must not be a nullptr", VSF_INVALID_ARG);
+    } else if ((props.n_components > 1) &&
+               (props.component_stride < props.n_points)){
+      error("props.component_stride must be at least as large as the number "
+            "of points", VSF_INVALID_ARG);
+    } else if ((props.n_weights > 0) && (props.weights == nullptr)){
+      error("props.weights must not be a nullptr", VSF_INVALID_ARG);
+    } else if ((out_weight_total == nullptr) || (out_mean == nullptr)){
+      error("out_weight_total and out_mean must not be nullptrs",
+            VSF_INVALID_ARG);
+    }
+    for (std::size_t w = 0; w < props.n_weights; w++){
+      if ((props.n_points > 0) && (props.weights[w] == nullptr)){
+        error("each entry of props.weights must not be a nullptr",
+              VSF_INVALID_ARG);
+      }
+    }
+
+    const bool track_m2 = (out_variance != nullptr);
+    const std::size_t n_w = props.n_weights;
+    const std::size_t n_wc = n_w * props.n_components;
+    const std::size_t n_blocks = (props.n_points + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // the moments of each block are stored (rather than merged per process)
+    // so that the blocks can always be merged in the same order
+    std::vector<double> block_weight_total(n_blocks * n_w);
+    std::vector<double> block_mean(n_blocks * n_wc);
+    std::vector<double> block_m2((track_m2) ? n_blocks * n_wc : 0);
+
+    const std::size_t nproc = std::max<std::size_t>(
+      1, std::min<std::size_t>(get_nominal_nproc(parallel_spec), n_blocks));
+    const bool use_parallel = (!parallel_spec.force_sequential) &&
+                              (nproc > 1);
+    const std::int64_t n_blocks_i64 = static_cast<std::int64_t>(n_blocks);
+
+    #pragma omp parallel for schedule(static) num_threads(nproc) if (use_parallel)
+    for (std::int64_t block = 0; block < n_blocks_i64; block++){
+      const std::size_t start = static_cast<std::size_t>(block) * BLOCK_SIZE;
+      const std::size_t stop = std::min(start + BLOCK_SIZE, props.n_points);
+      block_moments_(props, start, stop, track_m2,
+                     block_weight_total.data() + block * n_w,
+                     block_mean.data() + block * n_wc,
+                     (track_m2) ? block_m2.data() + block * n_wc : nullptr);
+    }
+
+    MomentMerger merger(n_w, props.n_components, track_m2);
+    for (std::size_t block = 0; block < n_blocks; block++){
+      merger.add(block_weight_total.data() + block * n_w,
+                 block_mean.data() + block * n_wc,
+                 (track_m2) ? block_m2.data() + block * n_wc : nullptr);
+    }
+    merger.write(out_weight_total, out_mean, out_variance);
+  };
+  return catch_vsf_errors(err_info, impl);
+}
+
+int merge_bulk_moments(size_t n_parts, size_t n_weights, size_t n_components,
+                       const double *weight_totals, const double *means,
+                       const double *variances, double *out_weight_total,
+                       double *out_mean, double *out_variance,
+                       VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    const bool track_m2 = (variances != nullptr);
+    if ((n_parts > 0) && ((weight_totals == nullptr) || (means == nullptr))){
+      error("weight_totals and means must not be nullptrs", VSF_INVALID_ARG);
+    } else if ((out_weight_total == nullptr) || (out_mean == nullptr)){
+      error("out_weight_total and out_mean must not be nullptrs",
+            VSF_INVALID_ARG);
+    } else if (track_m2 && (out_variance == nullptr)){
+      error("out_variance must not be a nullptr when variances is provided",
+            VSF_INVALID_ARG);
+    }
+
+    const std::size_t n_wc = n_weights * n_components;
+    MomentMerger merger(n_weights, n_components, track_m2);
+    std::vector<double> m2((track_m2) ? n_wc : 0);
+    for (std::size_t part = 0; part < n_parts; part++){
+      const double* cur_weight_total = weight_totals + part * n_weights;
+      if (track_m2){
+        // convert the variances into weighted sums of squared deviations
+        const double* cur_var = variances + part * n_wc;
+        for (std::size_t w = 0; w < n_weights; w++){
+          for (std::size_t c = 0; c < n_components; c++){
+            const std::size_t i = w * n_components + c;
+            m2[i] = cur_var[i] * cur_weight_total[w];
+          }
+        }
+      }
+      merger.add(cur_weight_total, means + part * n_wc,
+                 (track_m2) ? m2.data() : nullptr);
+    }
+    merger.write(out_weight_total, out_mean, out_variance);
+  };
+  return catch_vsf_errors(err_info, impl);
+}
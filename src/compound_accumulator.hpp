@@ -11,7 +11,7 @@ namespace detail{
 
   template<typename Tup, class Func, std::size_t countdown>
   struct for_each_tuple_entry_{
-    static inline void evaluate(Tup& tuple, Func& f) noexcept{
+    static inline void evaluate(Tup& tuple, Func& f){
       auto& elem = std::get<std::tuple_size_v<Tup> - countdown>(tuple);
       f(elem);
       for_each_tuple_entry_<Tup, Func, countdown-1>::evaluate(tuple, f);
@@ -20,7 +20,7 @@ namespace detail{
 
   template<typename Tup, class Func>
   struct for_each_tuple_entry_<Tup,Func,0>{
-    static inline void evaluate(Tup& tuple, Func& f) noexcept{ }
+    static inline void evaluate(Tup& tuple, Func& f){ }
   };
 } /* namespace detail */
 
@@ -38,12 +38,12 @@ namespace detail {
   /// We enable the functions based on the return type
   template<typename AccumCollec, typename T>
   typename std::enable_if<std::is_same<T, int64_t>::value, void>::type
-    copy_data_(const AccumCollec& accum_collec, T* dest) noexcept
+    copy_data_(const AccumCollec& accum_collec, T* dest)
   { accum_collec.copy_i64_vals(dest); }
 
   template<typename AccumCollec, typename T>
   typename std::enable_if<std::is_same<T, double>::value, void>::type
-    copy_data_(const AccumCollec& accum_collec, T* dest) noexcept
+    copy_data_(const AccumCollec& accum_collec, T* dest)
   { accum_collec.copy_flt_vals(dest); }
 
 
@@ -56,7 +56,7 @@ struct CopyValsHelper_{
   { }
 
   template<class AccumCollec>
-  void operator()(const AccumCollec& accum_collec) noexcept{
+  void operator()(const AccumCollec& accum_collec){
 
     detail::copy_data_(accum_collec, data_ptr_ + offset_);
 
@@ -109,7 +109,6 @@ public:
 
   /// Updates the values of `*this` to include the values from `other`
   inline void consolidate_with_other(const CompoundAccumCollection& other)
-    noexcept
   {
     auto func = [&](auto& accum_elem)
       {
@@ -121,31 +120,30 @@ public:
   }
 
   /// Copies the int64_t values of each accumulator to an external buffer
-  void copy_i64_vals(int64_t *out_vals) noexcept {
+  void copy_i64_vals(int64_t *out_vals) {
     for_each_tuple_entry(accum_collec_tuple_, CopyValsHelper_(out_vals));
   }
 
   /// Copies the floating point values of each accumulator to an external buffer
-  void copy_flt_vals(double *out_vals) noexcept {
+  void copy_flt_vals(double *out_vals) {
     for_each_tuple_entry(accum_collec_tuple_, CopyValsHelper_(out_vals));
   }
 
   /// Dummy method that needs to be defined to match interface
   static std::vector<std::pair<std::string,std::size_t>> flt_val_props()
-    noexcept
-  { error("Not Implemented"); }
+  { error("Not Implemented", VSF_NOT_IMPLEMENTED); }
 
   /// Dummy method that needs to be defined to match interface
-  std::vector<std::pair<std::string,std::size_t>> i64_val_props() noexcept
-  { error("Not Implemented"); }
+  std::vector<std::pair<std::string,std::size_t>> i64_val_props()
+  { error("Not Implemented", VSF_NOT_IMPLEMENTED); }
 
   /// Dummy method that needs to be defined to match interface
-  void import_flt_vals(const double *in_vals) noexcept
-  { error("Not Implemented"); }
+  void import_flt_vals(const double *in_vals)
+  { error("Not Implemented", VSF_NOT_IMPLEMENTED); }
 
   /// Dummy method that needs to be defined to match interface
-  void import_i64_vals(const int64_t *in_vals) noexcept
-  { error("Not Implemented"); }
+  void import_i64_vals(const int64_t *in_vals)
+  { error("Not Implemented", VSF_NOT_IMPLEMENTED); }
 
 private:
   AccumCollectionTuple accum_collec_tuple_;
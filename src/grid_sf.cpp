@@ -0,0 +1,482 @@
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <exception> // std::exception_ptr
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "grid_sf.hpp"
+#include "accumulators.hpp"
+#include "compound_accumulator.hpp"
+#include "accum_col_variant.hpp"
+#include "partition.hpp" // get_nominal_nproc
+#include "utils.hpp"
+
+namespace{
+
+  /// Represents an integer displacement vector between 2 cells and the index
+  /// of the distance bin that it belongs to
+  struct Displacement{ std::int64_t dx, dy, dz; std::size_t bin_ind; };
+
+  /// Lists all displacement vectors that lie within one of the distance bins.
+  ///
+  /// Only displacements from the "positive half-space" are considered (i.e.
+  /// for each vector ``d`` we include either ``d`` or ``-d``, but not both).
+  /// This ensures each unique pair of cells is visited exactly once.
+  std::vector<Displacement> build_displacement_list_
+  (const GridProps& grid, const std::vector<double>& dist_sqr_bin_edges,
+   std::size_t nbins)
+  {
+    const double max_dist = std::sqrt(std::max(0.0,
+                                               dist_sqr_bin_edges[nbins]));
+    std::int64_t max_offset[3];
+    for (int i = 0; i < 3; i++){
+      const double tmp = std::floor(max_dist / grid.cell_widths[i]);
+      const std::int64_t n_cells = static_cast<std::int64_t>(grid.shape[i]);
+      max_offset[i] = (tmp < n_cells) ? static_cast<std::int64_t>(tmp)
+                                      : (n_cells - 1);
+    }
+
+    std::vector<Displacement> out;
+    for (std::int64_t dx = 0; dx <= max_offset[0]; dx++){
+      const std::int64_t dy_start = (dx == 0) ? 0 : -max_offset[1];
+      for (std::int64_t dy = dy_start; dy <= max_offset[1]; dy++){
+        const std::int64_t dz_start = ((dx == 0) && (dy == 0))
+          ? 1 : -max_offset[2];
+        for (std::int64_t dz = dz_start; dz <= max_offset[2]; dz++){
+          const double x = dx * grid.cell_widths[0];
+          const double y = dy * grid.cell_widths[1];
+          const double z = dz * grid.cell_widths[2];
+          const std::size_t bin_ind = identify_bin_index(
+            x*x + y*y + z*z, dist_sqr_bin_edges.data(), nbins);
+          if (bin_ind < nbins){
+            out.push_back({dx, dy, dz, bin_ind});
+          }
+        }
+      }
+    }
+    return out;
+  }
+
+  template<class AccumCollection, bool use_mask>
+  void process_displacement_(const GridProps& grid, const Displacement& disp,
+                             AccumCollection& accumulators)
+  {
+    const std::int64_t nx = static_cast<std::int64_t>(grid.shape[0]);
+    const std::int64_t ny = static_cast<std::int64_t>(grid.shape[1]);
+    const std::int64_t nz = static_cast<std::int64_t>(grid.shape[2]);
+
+    const double *vx = grid.velocities;
+    const double *vy = grid.velocities + grid.component_stride;
+    const double *vz = grid.velocities + 2*grid.component_stride;
+    const std::uint8_t *mask = grid.mask;
+
+    // offset between the flattened indices of the pair of cells
+    const std::int64_t offset = (disp.dx*ny + disp.dy)*nz + disp.dz;
+    const std::size_t bin_ind = disp.bin_ind;
+
+    // disp.dx is never negative
+    const std::int64_t iy_start = std::max<std::int64_t>(0, -disp.dy);
+    const std::int64_t iy_stop  = ny - std::max<std::int64_t>(0, disp.dy);
+    const std::int64_t iz_start = std::max<std::int64_t>(0, -disp.dz);
+    const std::int64_t iz_stop  = nz - std::max<std::int64_t>(0, disp.dz);
+
+    for (std::int64_t ix = 0; ix < (nx - disp.dx); ix++){
+      for (std::int64_t iy = iy_start; iy < iy_stop; iy++){
+        const std::int64_t row_start = (ix*ny + iy)*nz;
+        for (std::int64_t iz = iz_start; iz < iz_stop; iz++){
+          const std::int64_t i_a = row_start + iz;
+          const std::int64_t i_b = i_a + offset;
+
+          if (use_mask && !(mask[i_a] && mask[i_b])) { continue; }
+
+          const double dvx = vx[i_b] - vx[i_a];
+          const double dvy = vy[i_b] - vy[i_a];
+          const double dvz = vz[i_b] - vz[i_a];
+          accumulators.add_entry(bin_ind,
+                                 std::sqrt(dvx*dvx + dvy*dvy + dvz*dvz));
+        }
+      }
+    }
+  }
+
+  template<class AccumCollection>
+  void process_displacement_list_(const GridProps& grid,
+                                  const std::vector<Displacement>& disp_list,
+                                  std::size_t start, std::size_t step,
+                                  AccumCollection& accumulators)
+  {
+    for (std::size_t i = start; i < disp_list.size(); i += step){
+      if (grid.mask == nullptr){
+        process_displacement_<AccumCollection, false>(grid, disp_list[i],
+                                                      accumulators);
+      } else {
+        process_displacement_<AccumCollection, true>(grid, disp_list[i],
+                                                     accumulators);
+      }
+    }
+  }
+
+  template<typename AccumCollection>
+  void calc_grid_vsf_props_(const GridProps& grid,
+                            const std::vector<Displacement>& disp_list,
+                            const ParallelSpec parallel_spec,
+                            AccumCollection& accumulators)
+  {
+    // never use more processes than there are displacement vectors
+    const std::size_t nproc = std::max<std::size_t>(
+      1, std::min(get_nominal_nproc(parallel_spec), disp_list.size()));
+
+    if (nproc == 1){
+      process_displacement_list_(grid, disp_list, 0, 1, accumulators);
+      return;
+    }
+
+    const bool use_parallel = !parallel_spec.force_sequential;
+
+    // each process gets its own copy of the accumulators. Process proc_id
+    // handles every nproc-th displacement vector (starting from proc_id).
+    std::vector<AccumCollection> partition_dest(nproc, accumulators);
+    std::exception_ptr first_exception = nullptr;
+
+    #pragma omp parallel for schedule(static,1) num_threads(nproc) \
+      if (use_parallel)
+    for (std::size_t proc_id = 0; proc_id < nproc; proc_id++){
+      try {
+        AccumCollection local_accums(partition_dest[proc_id]);
+        process_displacement_list_(grid, disp_list, proc_id, nproc,
+                                   local_accums);
+        partition_dest[proc_id] = local_accums;
+      } catch (...) {
+        #pragma omp critical
+        {
+          if (first_exception == nullptr) {
+            first_exception = std::current_exception();
+          }
+        }
+      }
+    }
+
+    if (first_exception != nullptr) { std::rethrow_exception(first_exception); }
+
+    accumulators = partition_dest[0];
+    for (std::size_t i = 1; i < nproc; i++){
+      accumulators.consolidate_with_other(partition_dest[i]);
+    }
+  }
+
+  /// Identifies the bin that contains a value, using the convention of
+  /// np.histogram (each bin is closed on the left & the last bin is also
+  /// closed on the right). NaNs & out-of-range values map to nbins.
+  ///
+  /// The values are effectively random, so the lookups are written to
+  /// compile to conditional moves (rather than unpredictable branches).
+  class BinLocator{
+  public:
+    explicit BinLocator(const BinSpecification& spec)
+      : edges_(spec.bin_edges), nbins_(spec.n_bins), uniform_(true),
+        lo_(spec.bin_edges[0]),
+        inv_width_(spec.n_bins / (spec.bin_edges[spec.n_bins] -
+                                  spec.bin_edges[0]))
+    {
+      // the initial guess of the uniform path is monotonic in the value.
+      // Thus, it's only off by 1 (at most) if the guess for each edge is
+      // off by 1 (at most).
+      uniform_ = std::isfinite(inv_width_) && (inv_width_ > 0);
+      for (std::size_t i = 0; uniform_ && (i <= nbins_); i++){
+        const double guess = std::floor((edges_[i] - lo_) * inv_width_);
+        uniform_ = (guess >= (double(i) - 1.0)) && (guess <= double(i));
+      }
+    }
+
+    std::size_t operator()(double val) const noexcept {
+      const bool in_range = (val >= edges_[0]) && (val <= edges_[nbins_]);
+      std::size_t out = uniform_ ? uniform_index_(in_range ? val : lo_)
+                                 : search_index_(val);
+      return in_range ? out : nbins_;
+    }
+
+  private:
+    std::size_t uniform_index_(double val) const noexcept {
+      const double guess = (val - lo_) * inv_width_;
+      std::size_t i = (guess < nbins_) ? static_cast<std::size_t>(guess)
+                                       : (nbins_ - 1);
+      i -= (i > 0) & (val < edges_[i]);
+      i += ((i + 1) < nbins_) & (val >= edges_[i + 1]);
+      return i;
+    }
+
+    std::size_t search_index_(double val) const noexcept {
+      // count the number of edges that are <= val (0 for NaNs)
+      const double* base = edges_;
+      std::size_t n = nbins_ + 1;
+      while (n > 1){
+        const std::size_t half = n / 2;
+        base = (base[half] <= val) ? base + half : base;
+        n -= half;
+      }
+      const std::size_t n_le = (base - edges_) + (*base <= val);
+      // values equal to the last edge belong to the last bin
+      return std::min(n_le, nbins_) - (n_le > 0);
+    }
+
+    const double* edges_;
+    std::size_t nbins_;
+    bool uniform_;
+    double lo_;
+    double inv_width_;
+  };
+
+  /// Adds the contribution from the pair of cells at flattened indices i_a
+  /// and i_b (separated along axis) to counts
+  template<int axis>
+  inline void add_neighbor_pair_(const NeighborGridProps& grid,
+                                 const BinLocator* locators,
+                                 const std::size_t* row_lens,
+                                 std::int64_t i_a, std::int64_t i_b,
+                                 std::int64_t* const* counts) noexcept
+  {
+    // the transverse components (ordered like the python version)
+    constexpr int ax1 = (axis + 1) % 3;
+    constexpr int ax2 = (axis + 2) % 3;
+
+    const double cs_a = grid.sound_speed[i_a];
+    const double cs_b = grid.sound_speed[i_b];
+    // np.maximum propagates NaNs (the normalized values would all be NaNs,
+    // which never fall in a bin)
+    if (std::isnan(cs_a) || std::isnan(cs_b)) { return; }
+    const double max_cs = std::max(cs_a, cs_b);
+
+    double dv[3];
+    for (int c = 0; c < 3; c++){
+      dv[c] = grid.velocities[c][i_b] - grid.velocities[c][i_a];
+    }
+    const std::size_t bin_inds[3] = {
+      locators[0](dv[axis] / max_cs),
+      locators[1](std::sqrt(dv[ax1]*dv[ax1] + dv[ax2]*dv[ax2]) / max_cs),
+      locators[2](std::sqrt(dv[0]*dv[0] + dv[1]*dv[1] + dv[2]*dv[2]) / max_cs)
+    };
+
+    for (std::size_t cr = 0; cr < grid.n_cut_regions; cr++){
+      const std::uint8_t* mask = grid.cut_region_masks[cr];
+      const std::int64_t both_selected = (mask[i_a] != 0) & (mask[i_b] != 0);
+      for (int k = 0; k < 3; k++){
+        counts[k][cr * row_lens[k] + bin_inds[k]] += both_selected;
+      }
+    }
+  }
+
+  /// Adds the contributions from the pairs of neighboring cells, where the
+  /// first cell's x-index lies in [ix_start, ix_stop), to counts (an array
+  /// of 3 histogram buffers). Each buffer holds ``n_bins + 1`` entries per
+  /// cut region, where the last entry counts out-of-range values (this
+  /// avoids branching on the bin index or the masks).
+  ///
+  /// A pair separated along one axis is only considered when the first cell
+  /// lies outside of the trailing ghost zones of the other 2 axes.
+  void neighbor_vdiff_sweep_(const NeighborGridProps& grid,
+                             const BinSpecification* vdiff_bins,
+                             const BinLocator* locators,
+                             std::int64_t ix_start, std::int64_t ix_stop,
+                             std::int64_t* const* counts)
+  {
+    // copy everything into locals (the compiler must otherwise assume that
+    // writes to counts may modify them)
+    const std::int64_t nx = static_cast<std::int64_t>(grid.shape[0]);
+    const std::int64_t ny = static_cast<std::int64_t>(grid.shape[1]);
+    const std::int64_t nz = static_cast<std::int64_t>(grid.shape[2]);
+    const std::int64_t active_x =
+      nx - static_cast<std::int64_t>(grid.n_trailing_ghost[0]);
+    const std::int64_t active_y =
+      ny - static_cast<std::int64_t>(grid.n_trailing_ghost[1]);
+    const std::int64_t active_z =
+      nz - static_cast<std::int64_t>(grid.n_trailing_ghost[2]);
+    const std::int64_t sx = grid.strides[0];
+    const std::int64_t sy = grid.strides[1];
+    const std::int64_t sz = grid.strides[2];
+    const std::size_t row_lens[3] = {vdiff_bins[0].n_bins + 1,
+                                     vdiff_bins[1].n_bins + 1,
+                                     vdiff_bins[2].n_bins + 1};
+
+    for (std::int64_t ix = ix_start; ix < ix_stop; ix++){
+      for (std::int64_t iy = 0; iy < ny; iy++){
+        const bool x_pairs = ((ix + 1) < nx) && (iy < active_y);
+        const bool y_pairs = ((iy + 1) < ny) && (ix < active_x);
+        const bool z_pairs = (ix < active_x) && (iy < active_y);
+        const std::int64_t row_start = ix*sx + iy*sy;
+
+        for (std::int64_t iz = 0; iz < nz; iz++){
+          const std::int64_t i_a = row_start + iz*sz;
+          if (x_pairs && (iz < active_z)){
+            add_neighbor_pair_<0>(grid, locators, row_lens, i_a, i_a + sx,
+                                  counts);
+          }
+          if (y_pairs && (iz < active_z)){
+            add_neighbor_pair_<1>(grid, locators, row_lens, i_a, i_a + sy,
+                                  counts);
+          }
+          if (z_pairs && ((iz + 1) < nz)){
+            add_neighbor_pair_<2>(grid, locators, row_lens, i_a, i_a + sz,
+                                  counts);
+          }
+        }
+      }
+    }
+  }
+
+}
+
+int calc_grid_neighbor_vdiff_hists(const NeighborGridProps grid,
+                                   const BinSpecification* vdiff_bins,
+                                   const ParallelSpec parallel_spec,
+                                   int64_t *out_aligned_counts,
+                                   int64_t *out_transverse_counts,
+                                   int64_t *out_mag_counts,
+                                   VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if ((grid.velocities[0] == nullptr) || (grid.velocities[1] == nullptr) ||
+        (grid.velocities[2] == nullptr) || (grid.sound_speed == nullptr)){
+      error("grid.velocities & grid.sound_speed must not hold nullptrs",
+            VSF_INVALID_ARG);
+    } else if ((grid.n_cut_regions > 0) &&
+               (grid.cut_region_masks == nullptr)){
+      error("grid.cut_region_masks must not be a nullptr", VSF_INVALID_ARG);
+    } else if (vdiff_bins == nullptr){
+      error("vdiff_bins must not be a nullptr", VSF_INVALID_ARG);
+    }
+    for (std::size_t i = 0; i < grid.n_cut_regions; i++){
+      if (grid.cut_region_masks[i] == nullptr){
+        error("each entry of grid.cut_region_masks must not be a nullptr",
+              VSF_INVALID_ARG);
+      }
+    }
+    for (int i = 0; i < 3; i++){
+      if (grid.n_trailing_ghost[i] > grid.shape[i]){
+        error("grid.n_trailing_ghost can't exceed grid.shape",
+              VSF_INVALID_ARG);
+      } else if ((vdiff_bins[i].n_bins == 0) ||
+                 (vdiff_bins[i].bin_edges == nullptr)){
+        error("each entry of vdiff_bins must have at least 1 bin",
+              VSF_INVALID_ARG);
+      }
+    }
+
+    std::int64_t* out_counts[3] = {out_aligned_counts, out_transverse_counts,
+                                   out_mag_counts};
+    if ((out_counts[0] == nullptr) || (out_counts[1] == nullptr) ||
+        (out_counts[2] == nullptr)){
+      error("the output buffers must not be nullptrs", VSF_INVALID_ARG);
+    }
+
+    const std::int64_t nx = static_cast<std::int64_t>(grid.shape[0]);
+    const std::size_t nproc = std::max<std::size_t>(
+      1, std::min<std::size_t>(get_nominal_nproc(parallel_spec),
+                               grid.shape[0]));
+
+    const BinLocator locators[3] = {BinLocator(vdiff_bins[0]),
+                                    BinLocator(vdiff_bins[1]),
+                                    BinLocator(vdiff_bins[2])};
+
+    // each process sweeps over a contiguous slab of cells (& accumulates
+    // counts in its own buffers, which include overflow bins)
+    std::vector<std::vector<std::int64_t>> local_counts(3 * nproc);
+    for (std::size_t proc_id = 0; proc_id < nproc; proc_id++){
+      for (int k = 0; k < 3; k++){
+        local_counts[3*proc_id + k].assign(
+          grid.n_cut_regions * (vdiff_bins[k].n_bins + 1), 0);
+      }
+    }
+
+    const bool use_parallel = (!parallel_spec.force_sequential) &&
+                              (nproc > 1);
+    const std::int64_t nproc_i64 = static_cast<std::int64_t>(nproc);
+    #pragma omp parallel for schedule(static,1) num_threads(nproc) \
+      if (use_parallel)
+    for (std::int64_t proc_id = 0; proc_id < nproc_i64; proc_id++){
+      std::int64_t* counts[3];
+      for (int k = 0; k < 3; k++){
+        counts[k] = local_counts[3*proc_id + k].data();
+      }
+      neighbor_vdiff_sweep_(grid, vdiff_bins, locators,
+                            (nx * proc_id) / nproc_i64,
+                            (nx * (proc_id + 1)) / nproc_i64, counts);
+    }
+
+    for (std::size_t proc_id = 0; proc_id < nproc; proc_id++){
+      for (int k = 0; k < 3; k++){
+        const std::vector<std::int64_t>& src = local_counts[3*proc_id + k];
+        const std::size_t nbins = vdiff_bins[k].n_bins;
+        for (std::size_t cr = 0; cr < grid.n_cut_regions; cr++){
+          for (std::size_t i = 0; i < nbins; i++){ // skip the overflow bin
+            out_counts[k][cr * nbins + i] += src[cr * (nbins + 1) + i];
+          }
+        }
+      }
+    }
+  };
+
+  return catch_vsf_errors(err_info, impl);
+}
+
+int calc_grid_vsf_props(const GridProps grid,
+                        const StatListItem* stat_list,
+                        std::size_t stat_list_len,
+                        const double *bin_edges, std::size_t nbins,
+                        const ParallelSpec parallel_spec,
+                        double *out_flt_vals, int64_t *out_i64_vals,
+                        VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if (nbins == 0){
+      error("nbins must be positive", VSF_INVALID_ARG);
+    } else if (bin_edges == nullptr){
+      error("bin_edges must not be a nullptr", VSF_INVALID_ARG);
+    } else if (grid.velocities == nullptr){
+      error("grid.velocities must not be a nullptr", VSF_INVALID_ARG);
+    } else if ((out_flt_vals == nullptr) || (out_i64_vals == nullptr)) {
+      error("the output buffers must not be nullptrs", VSF_INVALID_ARG);
+    }
+
+    std::size_t n_cells = 1;
+    for (int i = 0; i < 3; i++){
+      if (!(grid.cell_widths[i] > 0)){
+        error("each entry of grid.cell_widths must be positive",
+              VSF_INVALID_ARG);
+      }
+      n_cells *= grid.shape[i];
+    }
+    if (grid.component_stride < n_cells){
+      error("grid.component_stride must be at least as large as the number "
+            "of cells", VSF_INVALID_ARG);
+    }
+
+    const std::vector<double> dist_sqr_bin_edges =
+      build_dist_sqr_bin_edges(bin_edges, nbins);
+
+    std::vector<Displacement> disp_list;
+    if (n_cells > 1){
+      disp_list = build_displacement_list_(grid, dist_sqr_bin_edges, nbins);
+    }
+
+    AccumColVariant accumulators = build_accum_collection(stat_list,
+                                                          stat_list_len,
+                                                          nbins);
+
+    std::visit([&](auto& accums){
+        calc_grid_vsf_props_(grid, disp_list, parallel_spec, accums);
+      }, accumulators);
+
+    std::visit([=](auto &accums){ accums.copy_flt_vals(out_flt_vals); },
+               accumulators);
+    std::visit([=](auto &accums){ accums.copy_i64_vals(out_i64_vals); },
+               accumulators);
+  };
+
+  return catch_vsf_errors(err_info, impl);
+}
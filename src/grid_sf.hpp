@@ -0,0 +1,126 @@
+#ifndef GRID_SF_H
+#define GRID_SF_H
+
+// Define the C interface for computing structure function properties directly
+// from data on a uniform (structured) grid
+
+#include "vsf.hpp"
+
+/// Describes the velocity field on a uniform 3D grid.
+///
+/// Each of the 3 velocity components is stored in a separate C-contiguous
+/// array with shape ``(shape[0], shape[1], shape[2])``. The ith component of
+/// the cell at ``(ix, iy, iz)`` is located at an index of
+/// ``(ix*shape[1] + iy)*shape[2] + iz + i*component_stride``.
+struct GridProps{
+  const double * velocities;
+  size_t component_stride;
+  size_t shape[3];
+  /// the width of a cell along each axis
+  double cell_widths[3];
+  /// Optional array (with the same layout as a single velocity component).
+  /// When it isn't a nullptr, only cells with non-zero entries are
+  /// considered.
+  const uint8_t * mask;
+};
+
+/// Describes the fields on a uniform 3D grid that are used to compute
+/// velocity differences between neighboring cells.
+///
+/// Every array has the shape ``(shape[0], shape[1], shape[2])`` and they all
+/// share a single layout: the entry for the cell at ``(ix, iy, iz)`` is
+/// located at an index of ``ix*strides[0] + iy*strides[1] + iz*strides[2]``.
+struct NeighborGridProps{
+  /// the x, y, and z velocity components
+  const double * velocities[3];
+  const double * sound_speed;
+  /// Array of n_cut_regions masks. A pair of cells only contributes to the
+  /// histograms of a cut region when both cells have non-zero mask entries.
+  const uint8_t * const * cut_region_masks;
+  size_t n_cut_regions;
+  size_t shape[3];
+  int64_t strides[3];
+  /// The number of trailing ghost cells along each axis. A pair of cells
+  /// separated along a given axis is only considered when the first cell
+  /// lies outside of the ghost zones of the other 2 axes.
+  size_t n_trailing_ghost[3];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Computes properties related to the velocity structure function for all
+/// unique pairs of cells on a uniform grid.
+///
+/// This produces the same results (up to floating-point round-off) as calling
+/// calc_vsf_props on the cell centers (without duplicating any pairs). The
+/// pairs are accumulated in a different order. Rather than considering every
+/// pair, this iterates over the integer displacement vectors between cells
+/// that are no larger than the largest bin edge. The distance bin only needs
+/// to be computed once for each displacement vector. The cost scales with
+/// the product of the number of cells and the number of displacement vectors.
+///
+/// @param[in]  grid Struct describing the velocity field
+/// @param[in]  stat_list Pointer to an array of 1 or more StatListItems that
+///     provide details about the statistics that will be computed.
+/// @param[in]  stat_list_len Specifies the number of entries in stat_list.
+/// @param[in]  bin_edges An array of monotonically increasing bin edges for
+///     binning distances. This must have ``nbins + 1`` entries.
+/// @param[in]  nbins The number of distance bins
+/// @param[in]  parallel_spec Specifies the parallelism arguments. The
+///     displacement vectors are divided between the processes.
+/// @param[out] out_flt_vals Preallocated arrays to hold the output floating
+///     point values.
+/// @param[out] out_i64_vals Preallocated array to store the output int64_t
+///     values.
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns VSF_SUCCESS or an error code.
+int calc_grid_vsf_props(const GridProps grid,
+                        const StatListItem* stat_list, size_t stat_list_len,
+                        const double *bin_edges, size_t nbins,
+                        const ParallelSpec parallel_spec,
+                        double *out_flt_vals, int64_t *out_i64_vals,
+                        VsfErrorInfo* err_info) noexcept;
+
+/// Computes histograms of the velocity differences between every pair of
+/// directly adjacent cells (for every cut region) in a single sweep over the
+/// grid.
+///
+/// For a pair of cells separated along a given axis, 3 quantities are
+/// computed from the velocity difference: the (signed) component parallel to
+/// that axis, the magnitude of the 2 transverse components, and the total
+/// magnitude. Each quantity is normalized by the larger sound speed of the
+/// pair. Following the convention of ``np.histogram``, each bin includes its
+/// left edge (and the last bin also includes its right edge). Values that
+/// lie outside of the bins (or are NaN) are ignored.
+///
+/// @param[in]  grid Struct describing the fields
+/// @param[in]  vdiff_bins Array of 3 bin specifications for the parallel,
+///     transverse, and total velocity differences
+/// @param[in]  parallel_spec Specifies the parallelism arguments. The grid
+///     is divided into slabs along the first axis.
+/// @param[out] out_aligned_counts, out_transverse_counts, out_mag_counts
+///     Preallocated arrays with ``grid.n_cut_regions * n_bins`` entries
+///     (``n_bins`` comes from the corresponding entry of vdiff_bins). The
+///     histogram of the ith cut region starts at an index of ``i*n_bins``.
+///     The counts are added to the existing values.
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns VSF_SUCCESS or an error code.
+int calc_grid_neighbor_vdiff_hists(const NeighborGridProps grid,
+                                   const BinSpecification* vdiff_bins,
+                                   const ParallelSpec parallel_spec,
+                                   int64_t *out_aligned_counts,
+                                   int64_t *out_transverse_counts,
+                                   int64_t *out_mag_counts,
+                                   VsfErrorInfo* err_info) noexcept;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GRID_SF_H */
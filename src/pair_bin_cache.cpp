@@ -0,0 +1,426 @@
+#include <cstdint>
+
+#include <algorithm>
+#include <exception> // std::exception_ptr
+#include <limits>
+#include <variant>
+#include <vector>
+
+#include <omp.h>
+
+#include "pair_bin_cache.hpp"
+#include "accumulators.hpp"
+#include "compound_accumulator.hpp"
+#include "accum_col_variant.hpp"
+#include "partition.hpp" // get_nominal_nproc
+#include "quan_differ.hpp"
+#include "tuning.hpp"
+#include "utils.hpp"
+
+namespace{
+
+  /// Consecutive points of the second set (starting at index start) that lie
+  /// in the same distance bin when paired with a given point of the first set
+  struct PairRun{
+    std::uint64_t start;
+    std::uint32_t length;
+    std::uint32_t bin;
+  };
+
+  const std::uint32_t MAX_RUN_LENGTH =
+    std::numeric_limits<std::uint32_t>::max();
+
+  /// The largest supported number of bins (every bin index must fit in
+  /// PairRun::bin)
+  const std::size_t MAX_NBINS = std::numeric_limits<std::uint32_t>::max();
+
+  struct PairBinCache{
+    std::size_t n_points_a;
+    std::size_t n_points_b;
+    bool duplicated_points;
+    std::size_t nbins;
+
+    /// The runs of the ith row are stored in
+    /// ``[row_run_offsets[i], row_run_offsets[i+1])`` of runs
+    std::vector<std::uint64_t> row_run_offsets;
+    /// ``row_pair_offsets[i]`` holds the number of binned pairs in the rows
+    /// preceding the ith row (it's used to balance the work between
+    /// processes)
+    std::vector<std::uint64_t> row_pair_offsets;
+    std::vector<PairRun> runs;
+  };
+
+  /// Divides [0, n_rows) into nparts contiguous ranges of rows with (roughly)
+  /// equal costs. cum_cost(r) must return the total cost of the first r rows.
+  ///
+  /// Returns the nparts+1 boundaries of the ranges.
+  template<typename CumCost>
+  std::vector<std::size_t> balanced_row_bounds_(std::size_t n_rows,
+                                                std::size_t nparts,
+                                                CumCost&& cum_cost)
+  {
+    std::vector<std::size_t> out(nparts + 1, n_rows);
+    out[0] = 0;
+    const double total = static_cast<double>(cum_cost(n_rows));
+    for (std::size_t k = 1; k < nparts; k++){
+      const double target = total * k / nparts;
+      // find the first row, r, where cum_cost(r) >= target
+      std::size_t lo = out[k-1], hi = n_rows;
+      while (lo < hi){
+        const std::size_t mid = lo + (hi - lo) / 2;
+        if (static_cast<double>(cum_cost(mid)) < target){
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      out[k] = lo;
+    }
+    return out;
+  }
+
+  /// Records the runs of each row in [row_start, row_stop)
+  ///
+  /// The runs are appended to runs, while the number of runs & the number of
+  /// binned pairs of the ith row are stored in ``row_run_counts[i]`` and
+  /// ``row_pair_counts[i]``.
+  template<bool duplicated_points, typename DistSqrBinner>
+  void build_rows_(const PointProps& points_a, const PointProps& points_b,
+                   std::size_t nbins, const DistSqrBinner& binner,
+                   std::size_t row_start, std::size_t row_stop,
+                   std::vector<PairRun>& runs, std::uint64_t* row_run_counts,
+                   std::uint64_t* row_pair_counts)
+  {
+    const std::size_t stride_a = points_a.spatial_dim_stride;
+    const double *pos_a = points_a.positions;
+    const std::size_t n_points_b = points_b.n_points;
+    const std::size_t stride_b = points_b.spatial_dim_stride;
+    const double *pos_b = points_b.positions;
+
+    for (std::size_t i_a = row_start; i_a < row_stop; i_a++){
+      const double x_a = pos_a[i_a];
+      const double y_a = pos_a[i_a + stride_a];
+      const double z_a = pos_a[i_a + 2*stride_a];
+
+      const std::size_t first_run = runs.size();
+      std::uint64_t n_pairs = 0;
+      std::size_t cur_bin = nbins;
+
+      const std::size_t i_b_start = (duplicated_points) ? i_a + 1 : 0;
+      for (std::size_t i_b = i_b_start; i_b < n_points_b; i_b++){
+        // this matches the arithmetic of the binners in vsf.cpp
+        const double dx = x_a - pos_b[i_b];
+        const double dy = y_a - pos_b[i_b + stride_b];
+        const double dz = z_a - pos_b[i_b + 2*stride_b];
+        const std::size_t bin_ind = binner(dx*dx + dy*dy + dz*dz);
+
+        if (bin_ind >= nbins){
+          cur_bin = nbins;
+          continue;
+        }
+        n_pairs++;
+        if ((bin_ind == cur_bin) && (runs.back().length < MAX_RUN_LENGTH)){
+          runs.back().length++;
+        } else {
+          runs.push_back({i_b, 1, static_cast<std::uint32_t>(bin_ind)});
+          cur_bin = bin_ind;
+        }
+      }
+      row_run_counts[i_a] = runs.size() - first_run;
+      row_pair_counts[i_a] = n_pairs;
+    }
+  }
+
+  template<bool duplicated_points, typename DistSqrBinner>
+  void build_cache_(const PointProps& points_a, const PointProps& points_b,
+                    const DistSqrBinner& binner,
+                    const ParallelSpec parallel_spec, PairBinCache& cache)
+  {
+    const std::size_t n_rows = points_a.n_points;
+    const std::uint64_t n_b = points_b.n_points;
+
+    const std::size_t nproc = std::max<std::size_t>(
+      1, std::min<std::size_t>(get_nominal_nproc(parallel_spec), n_rows));
+    const bool use_parallel = (!parallel_spec.force_sequential) &&
+                              (nproc > 1);
+
+    // balance the number of pairs that each process must bin
+    const std::vector<std::size_t> bounds = balanced_row_bounds_(
+      n_rows, nproc,
+      [=](std::uint64_t r) -> std::uint64_t {
+        if (duplicated_points){
+          return r * n_b - (r * (r + 1)) / 2;
+        } else {
+          return r * n_b;
+        }
+      });
+
+    // the row counts are written at an offset of 1, so that an inclusive
+    // scan converts them to offsets
+    cache.row_run_offsets.assign(n_rows + 1, 0);
+    cache.row_pair_offsets.assign(n_rows + 1, 0);
+    std::vector<std::vector<PairRun>> part_runs(nproc);
+
+    std::exception_ptr first_exception = nullptr;
+
+    #pragma omp parallel for schedule(static, 1) num_threads(nproc) if (use_parallel)
+    for (std::size_t part = 0; part < nproc; part++){
+      try {
+        build_rows_<duplicated_points>(
+          points_a, points_b, cache.nbins, binner, bounds[part],
+          bounds[part+1], part_runs[part],
+          cache.row_run_offsets.data() + 1,
+          cache.row_pair_offsets.data() + 1);
+      } catch (...) {
+        #pragma omp critical
+        {
+          if (first_exception == nullptr) {
+            first_exception = std::current_exception();
+          }
+        }
+      }
+    }
+
+    if (first_exception != nullptr) { std::rethrow_exception(first_exception); }
+
+    for (std::size_t i = 0; i < n_rows; i++){
+      cache.row_run_offsets[i+1] += cache.row_run_offsets[i];
+      cache.row_pair_offsets[i+1] += cache.row_pair_offsets[i];
+    }
+
+    cache.runs.reserve(cache.row_run_offsets[n_rows]);
+    for (std::vector<PairRun>& cur : part_runs){
+      cache.runs.insert(cache.runs.end(), cur.begin(), cur.end());
+      std::vector<PairRun>().swap(cur); // release the memory right away
+    }
+  }
+
+  /// Accumulates the quantity differences of the pairs in the rows
+  /// [row_start, row_stop)
+  template<class AccumCollection, class QuanDiffer>
+  void accumulate_rows_(const PairBinCache& cache,
+                        const double* quan_a, std::size_t stride_a,
+                        const double* quan_b, std::size_t stride_b,
+                        const QuanDiffer& differ,
+                        std::size_t row_start, std::size_t row_stop,
+                        AccumCollection& accumulators)
+  {
+    const std::uint64_t* row_run_offsets = cache.row_run_offsets.data();
+    const PairRun* runs = cache.runs.data();
+
+    for (std::size_t i_a = row_start; i_a < row_stop; i_a++){
+      const typename QuanDiffer::Loaded q_a =
+        differ.load(quan_a, i_a, stride_a);
+
+      const std::uint64_t run_stop = row_run_offsets[i_a + 1];
+      for (std::uint64_t r = row_run_offsets[i_a]; r < run_stop; r++){
+        const PairRun run = runs[r];
+        const std::size_t bin_ind = run.bin;
+        const std::size_t i_b_stop = run.start + run.length;
+        for (std::size_t i_b = run.start; i_b < i_b_stop; i_b++){
+          accumulators.add_entry(bin_ind, differ(q_a, quan_b, i_b, stride_b));
+        }
+      }
+    }
+  }
+
+  template<class AccumCollection, class QuanDiffer>
+  void calc_cached_sf_props_(const PairBinCache& cache,
+                             const double* quan_a, std::size_t stride_a,
+                             const double* quan_b, std::size_t stride_b,
+                             const QuanDiffer& differ,
+                             const ParallelSpec parallel_spec,
+                             AccumCollection& accumulators)
+  {
+    const std::size_t n_rows = cache.n_points_a;
+    const std::size_t nproc = std::max<std::size_t>(
+      1, std::min<std::size_t>(get_nominal_nproc(parallel_spec), n_rows));
+
+    if (nproc == 1){
+      accumulate_rows_(cache, quan_a, stride_a, quan_b, stride_b, differ,
+                       0, n_rows, accumulators);
+      return;
+    }
+
+    const bool use_parallel = !parallel_spec.force_sequential;
+    const std::vector<std::size_t> bounds = balanced_row_bounds_(
+      n_rows, nproc,
+      [&](std::size_t r) { return cache.row_pair_offsets[r]; });
+
+    // (This assumes that accumulators hasn't been used yet - we just clone it)
+    std::vector<AccumCollection> partition_dest(nproc, accumulators);
+
+    std::exception_ptr first_exception = nullptr;
+
+    #pragma omp parallel for schedule(static, 1) num_threads(nproc) if (use_parallel)
+    for (std::size_t part = 0; part < nproc; part++){
+      try {
+        // make a local copy so that the heap allocation is fast for the
+        // current process to access
+        AccumCollection local_accums(partition_dest[part]);
+        accumulate_rows_(cache, quan_a, stride_a, quan_b, stride_b, differ,
+                         bounds[part], bounds[part+1], local_accums);
+        partition_dest[part] = local_accums;
+      } catch (...) {
+        #pragma omp critical
+        {
+          if (first_exception == nullptr) {
+            first_exception = std::current_exception();
+          }
+        }
+      }
+    }
+
+    if (first_exception != nullptr) { std::rethrow_exception(first_exception); }
+
+    accumulators = partition_dest[0];
+    for (std::size_t i = 1; i < nproc; i++){
+      accumulators.consolidate_with_other(partition_dest[i]);
+    }
+  }
+
+}
+
+void* pairbincache_create(const PointProps points_a, const PointProps points_b,
+                          const double *bin_edges, std::size_t nbins,
+                          const ParallelSpec parallel_spec,
+                          VsfErrorInfo* err_info) noexcept
+{
+  PairBinCache* out = nullptr;
+  auto impl = [&]()
+  {
+    const bool duplicated_points = (points_b.positions == nullptr);
+    const PointProps my_points_b = (duplicated_points) ? points_a : points_b;
+
+    if (bin_edges == nullptr){
+      error("bin_edges must not be a nullptr", VSF_INVALID_ARG);
+    } else if (nbins == 0){
+      error("nbins must be positive", VSF_INVALID_ARG);
+    } else if (nbins > MAX_NBINS){
+      error("nbins is too large", VSF_INVALID_ARG);
+    } else if (points_a.n_spatial_dims != 3){
+      error("points_a must have 3 spatial dimensions", VSF_NOT_IMPLEMENTED);
+    } else if (my_points_b.n_spatial_dims != 3){
+      error("points_b must have 3 spatial dimensions", VSF_NOT_IMPLEMENTED);
+    } else if (points_a.positions == nullptr) {
+      error("the positions of points_a must not be a nullptr",
+            VSF_INVALID_ARG);
+    } else if ((points_a.spatial_dim_stride < points_a.n_points) ||
+               (my_points_b.spatial_dim_stride < my_points_b.n_points)){
+      error("spatial_dim_stride must be at least as large as the number of "
+            "points", VSF_INVALID_ARG);
+    }
+
+    const std::vector<double> dist_sqr_bin_edges =
+      build_dist_sqr_bin_edges(bin_edges, nbins);
+    const double* edges = dist_sqr_bin_edges.data();
+
+    out = new PairBinCache{points_a.n_points, my_points_b.n_points,
+                           duplicated_points, nbins, {}, {}, {}};
+
+    // like calc_vsf_props, the tuning parameters determine the search
+    auto build = [&](const auto& binner)
+      {
+        if (duplicated_points){
+          build_cache_<true>(points_a, my_points_b, binner, parallel_spec,
+                             *out);
+        } else {
+          build_cache_<false>(points_a, my_points_b, binner, parallel_spec,
+                              *out);
+        }
+      };
+    if (nbins <= get_active_vsf_tuning().linear_search_max_nbins){
+      build([=](double dist_sqr)
+            { return identify_bin_index_linear(dist_sqr, edges, nbins); });
+    } else {
+      build([=](double dist_sqr)
+            { return identify_bin_index(dist_sqr, edges, nbins); });
+    }
+  };
+
+  if (catch_vsf_errors(err_info, impl) != VSF_SUCCESS) {
+    delete out;
+    return nullptr;
+  }
+  return static_cast<void*>(out);
+}
+
+void pairbincache_destroy(void* handle) noexcept {
+  delete static_cast<PairBinCache*>(handle);
+}
+
+PairBinCacheProps pairbincache_props(const void* handle) noexcept {
+  if (handle == nullptr) { return {0, 0, false, 0, 0, 0, 0}; }
+  const PairBinCache& cache = *static_cast<const PairBinCache*>(handle);
+  PairBinCacheProps out;
+  out.n_points_a = cache.n_points_a;
+  out.n_points_b = cache.n_points_b;
+  out.duplicated_points = cache.duplicated_points;
+  out.nbins = cache.nbins;
+  out.n_runs = cache.runs.size();
+  out.n_pairs = cache.row_pair_offsets.back();
+  out.nbytes = (sizeof(PairBinCache) +
+                cache.row_run_offsets.capacity() * sizeof(std::uint64_t) +
+                cache.row_pair_offsets.capacity() * sizeof(std::uint64_t) +
+                cache.runs.capacity() * sizeof(PairRun));
+  return out;
+}
+
+int pairbincache_calc_sf_props(const void* handle,
+                               const double *quan_a, std::size_t quan_stride_a,
+                               const double *quan_b, std::size_t quan_stride_b,
+                               const StatListItem* stat_list,
+                               std::size_t stat_list_len,
+                               const QuanDiffSpec quan_spec,
+                               const ParallelSpec parallel_spec,
+                               double *out_flt_vals, int64_t *out_i64_vals,
+                               VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if (handle == nullptr){
+      error("handle must not be a nullptr", VSF_INVALID_ARG);
+    }
+    const PairBinCache& cache = *static_cast<const PairBinCache*>(handle);
+
+    if (cache.duplicated_points != (quan_b == nullptr)){
+      error("quan_b must be a nullptr if (and only if) the cache was built "
+            "for a single set of points", VSF_INVALID_ARG);
+    } else if (quan_a == nullptr){
+      error("quan_a must not be a nullptr", VSF_INVALID_ARG);
+    } else if ((out_flt_vals == nullptr) || (out_i64_vals == nullptr)) {
+      error("the output buffers must not be nullptrs", VSF_INVALID_ARG);
+    }
+
+    const double* my_quan_b = (cache.duplicated_points) ? quan_a : quan_b;
+    const std::size_t my_stride_b =
+      (cache.duplicated_points) ? quan_stride_a : quan_stride_b;
+    if ((quan_spec.n_components > 1) &&
+        ((quan_stride_a < cache.n_points_a) ||
+         (my_stride_b < cache.n_points_b))){
+      error("the quantity strides must be at least as large as the number of "
+            "points", VSF_INVALID_ARG);
+    }
+
+    AccumColVariant accumulators = build_accum_collection(stat_list,
+                                                          stat_list_len,
+                                                          cache.nbins);
+
+    with_quan_differ(quan_spec)([&](const auto& differ)
+      {
+        std::visit([&](auto& accums)
+                   {
+                     calc_cached_sf_props_(cache, quan_a, quan_stride_a,
+                                           my_quan_b, my_stride_b, differ,
+                                           parallel_spec, accums);
+                   },
+                   accumulators);
+      });
+
+    std::visit([=](auto &accums){ accums.copy_flt_vals(out_flt_vals); },
+               accumulators);
+    std::visit([=](auto &accums){ accums.copy_i64_vals(out_i64_vals); },
+               accumulators);
+  };
+  return catch_vsf_errors(err_info, impl);
+}
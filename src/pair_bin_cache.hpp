@@ -0,0 +1,101 @@
+#ifndef PAIR_BIN_CACHE_H
+#define PAIR_BIN_CACHE_H
+
+// Define the C interface for a precomputed index of the distance bin of every
+// pair of points
+//
+// When the positions don't change between calculations (e.g. the cells of a
+// fixed grid evaluated for many snapshots, or for many quantity fields), the
+// distance bin of each pair never changes. A pair-bin cache records the bins
+// once. For each point in the first set (a "row"), it stores a sequence of
+// runs: each run covers consecutive points of the second set that lie in the
+// same bin (pairs that don't lie in any bin are omitted). Later calculations
+// only evaluate the differences in the quantity and accumulate them.
+
+#include "vsf.hpp"
+
+/// Summarizes the contents of a pair-bin cache
+struct PairBinCacheProps{
+  size_t n_points_a;
+  size_t n_points_b;
+  bool duplicated_points;
+  size_t nbins;
+  uint64_t n_runs;
+  uint64_t n_pairs;
+  size_t nbytes;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Builds a pair-bin cache and returns a handle to it
+///
+/// Only the positions of the points are used (the velocities may be
+/// nullptrs). The pairs are binned exactly like calc_vsf_props bins them.
+///
+/// @param[in]  points_a Specifies the positions of the first set of points
+/// @param[in]  points_b Specifies the positions of the second set of points.
+///     When its positions are a nullptr, the cache holds the unique pairs of
+///     points_a (like an auto-structure function).
+/// @param[in]  bin_edges Array of monotonically increasing distance bin edges
+/// @param[in]  nbins The number of distance bins
+/// @param[in]  parallel_spec Specifies the parallelism arguments. The rows
+///     are divided between the processes.
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns The handle. A nullptr is returned if there was an error.
+void* pairbincache_create(const PointProps points_a, const PointProps points_b,
+                          const double *bin_edges, size_t nbins,
+                          const ParallelSpec parallel_spec,
+                          VsfErrorInfo* err_info) noexcept;
+
+/// Deallocates the pair-bin cache associated with the handle
+void pairbincache_destroy(void* handle) noexcept;
+
+/// Returns a summary of the pair-bin cache's contents (every member is zero
+/// when handle is a nullptr)
+PairBinCacheProps pairbincache_props(const void* handle) noexcept;
+
+/// Computes structure function properties for the pairs recorded in a
+/// pair-bin cache
+///
+/// The pairs are visited in the same order as in calc_quan_sf_props, so the
+/// results are identical to those computed from the original positions when
+/// a single process is used.
+///
+/// @param[in]  handle The pair-bin cache
+/// @param[in]  quan_a The quantity of the first set of points. The ith
+///     component of the jth point is located at an index of
+///     ``j + i*quan_stride_a``.
+/// @param[in]  quan_stride_a Stride between components of quan_a
+/// @param[in]  quan_b, quan_stride_b The quantity of the second set of points.
+///     This must be a nullptr if (and only if) the cache was built for a
+///     single set of points.
+/// @param[in]  stat_list Array of statistics to compute
+/// @param[in]  stat_list_len The length of stat_list
+/// @param[in]  quan_spec Specifies how the differences in the quantity are
+///     computed
+/// @param[in]  parallel_spec Specifies the parallelism arguments
+/// @param[out] out_flt_vals, out_i64_vals Preallocated output buffers (with
+///     the same layout as in calc_vsf_props)
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns VSF_SUCCESS or an error code.
+int pairbincache_calc_sf_props(const void* handle,
+                               const double *quan_a, size_t quan_stride_a,
+                               const double *quan_b, size_t quan_stride_b,
+                               const StatListItem* stat_list,
+                               size_t stat_list_len,
+                               const QuanDiffSpec quan_spec,
+                               const ParallelSpec parallel_spec,
+                               double *out_flt_vals, int64_t *out_i64_vals,
+                               VsfErrorInfo* err_info) noexcept;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PAIR_BIN_CACHE_H */
@@ -1,15 +1,22 @@
 // routines to assist with partitioning structure function calculations
 
+#ifndef PARTITION_H
+#define PARTITION_H
+
 #include <algorithm> // std::min
 #include <array>
 #include <cstdint>
+#include <cstdlib> // std::getenv, std::atoi
 #include <limits>       // std::numeric_limits
+#include <string>
 #include <variant>
 
+#include "vsf.hpp" // ParallelSpec
+#include "tuning.hpp" // VsfTuning
 #include "utils.hpp" // for error function
 
 template<typename Tend, typename Tstart>
-inline Tend safe_cast(Tstart val) noexcept {
+inline Tend safe_cast(Tstart val) {
   if (val < std::numeric_limits<Tend>::lowest()){
     if (std::numeric_limits<Tend>::is_signed){
       error("val is too small to be represented by destination type");
@@ -29,13 +36,12 @@ struct SlcStruct{ std::uint64_t start, stop; };
 /// This supports cases where (array_len % num_chunks) != 0
 inline SlcStruct calc_chunk_slice(std::size_t chunk_index,
                                   std::size_t array_len, std::size_t num_chunks)
-  noexcept
 {
   if ((array_len < num_chunks) | (num_chunks <= chunk_index)){
-    printf("chunk_index = %zu, array_len = %zu, num_chunks = %zu\n",
-           chunk_index, array_len, num_chunks);
-    fflush(stdout);
-    error("something is very wrong");
+    error("something is very wrong: chunk_index = " +
+          std::to_string(chunk_index) + ", array_len = " +
+          std::to_string(array_len) + ", num_chunks = " +
+          std::to_string(num_chunks));
   }
 
   auto calc_chunk_size = [=](std::size_t chunk_index)
@@ -137,7 +143,7 @@ inline SlcStruct calc_chunk_slice(std::size_t chunk_index,
 
 
 
-std::size_t num_dist_array_chunks_auto(std::size_t segments){
+inline std::size_t num_dist_array_chunks_auto(std::size_t segments){
   // this is a triangle number!
   std::size_t num_triangles = segments;
   std::size_t num_rect = (segments - 1) * segments / 2;
@@ -167,7 +173,6 @@ struct AutoSFPartitionStrat{
   }
 
   StatTask build_StatTask(const std::array<std::uint64_t,2>& index_2D) const
-    noexcept
   {
     // there's a fairly good chance we have some off-by-1 errors here, we
     // should check that this works
@@ -210,19 +215,23 @@ struct AutoSFPartitionStrat{
   /// @param skip_small_prob_check when true, this skips a performance check
   ///     that prevents the user from subdividing the problem into partitions
   ///     that are too small
+  /// @param tuning specifies the small problem threshold and the number of
+  ///     partitions per process
   static AutoSFPartitionStrat create(std::size_t nproc, std::size_t n_points,
-                                     bool skip_small_prob_check) noexcept{
+                                     bool skip_small_prob_check,
+                                     const VsfTuning& tuning) {
     if (nproc == 0){
-      error("nproc can't be zero");
+      error("nproc can't be zero", VSF_INVALID_ARG);
     } else if (n_points <= 1){
-      error("n_points must exceed 1");
+      error("n_points must exceed 1", VSF_INVALID_ARG);
     } else if (nproc > 30){
-      error("Probably want to rethink partitioning strategy for so many proc");
+      error("Probably want to rethink partitioning strategy for so many proc",
+            VSF_INVALID_ARG);
     }
 
 
-    // our definition of a small problem could be improved
-    bool is_small_problem = (!skip_small_prob_check) & (n_points <= 1000);
+    bool is_small_problem =
+      (!skip_small_prob_check) & (n_points <= tuning.small_auto_n_points);
 
     if (is_small_problem | (nproc == 1)){
       return {safe_cast<std::uint64_t>(n_points), 1};
@@ -234,11 +243,13 @@ struct AutoSFPartitionStrat{
   
     // determine the number of segments to break each axis of the distance
     // matrix into. The choice of algorithm is fairly arbitrary...
+    const std::size_t chunks_per_proc =
+      std::max<std::size_t>(1, tuning.auto_chunks_per_proc);
     std::size_t num_segments = 0;
     for (std::size_t cur_num_segments = 2; ; cur_num_segments++){
       // compute number of chunks for cur_segments
       std::size_t num_chunks = num_dist_array_chunks_auto(cur_num_segments);
-      if (num_chunks >= (3 * nproc)){
+      if (num_chunks >= (chunks_per_proc * nproc)){
         num_segments = cur_num_segments;
         break;
       }
@@ -272,13 +283,12 @@ struct CrossSFPartitionStrat{
   }
 
   StatTask build_StatTask(const std::array<std::uint64_t,2>& index_2D) const
-    noexcept
   {
     if ((index_2D[0] >= num_segments_A) | (index_2D[1] >= num_segments_B)){
-      printf("2D index: (%zu, %zu); effective_shape = (%zu, %zu)\n",
-             (std::size_t)index_2D[0], (std::size_t)index_2D[1],
-             (std::size_t)num_segments_A, (std::size_t)num_segments_B);
-      error("index_2D contains a value that is too large");
+      error("index_2D contains a value that is too large. 2D index: (" +
+            std::to_string(index_2D[0]) + ", " + std::to_string(index_2D[1]) +
+            "); effective_shape = (" + std::to_string(num_segments_A) + ", " +
+            std::to_string(num_segments_B) + ")");
     }
     SlcStruct slice_A = calc_chunk_slice(index_2D[0], this->n_points_A,
                                          this->num_segments_A);
@@ -292,16 +302,18 @@ struct CrossSFPartitionStrat{
   /// @param skip_small_prob_check when true, this skips a performance check
   ///     that prevents the user from subdividing the problem into partitions
   ///     that are too small
+  /// @param tuning specifies the small problem threshold
   static CrossSFPartitionStrat create(std::size_t nproc,
                                       std::size_t n_points_A,
                                       std::size_t n_points_B,
-                                      bool skip_small_problem_check) noexcept{
-    if (nproc == 0){error("nproc can't be zero");}
+                                      bool skip_small_problem_check,
+                                      const VsfTuning& tuning) {
+    if (nproc == 0){error("nproc can't be zero", VSF_INVALID_ARG);}
 
     // we could definitely use a better algorithm to partition the work more
     // equally (and more conciously of the cache)
 
-    const std::size_t small_npairs = 1000;
+    const std::size_t small_npairs = tuning.small_cross_npairs;
     bool exceed_small_npairs = // try to work around an overflow
       ( ((n_points_A * n_points_B) > small_npairs) |
         ((n_points_A >= small_npairs) & (n_points_B > 0)) |
@@ -353,7 +365,7 @@ public:
 
   template<typename StratT>
   TaskIt(std::uint64_t index_start_1D, std::uint64_t index_stop_1D,
-         StratT partition_strat) noexcept
+         StratT partition_strat)
     : index_stop_1D_(index_stop_1D),
       partition_strat_(partition_strat),
       next_index_1D_(),
@@ -371,7 +383,7 @@ public:
 
   bool has_next() const noexcept { return next_index_1D_ < index_stop_1D_; }
 
-  StatTask next() noexcept{
+  StatTask next() {
     auto func = [&](const auto& strat)
                 { return strat.build_StatTask(next_index_2D_); };
     
@@ -420,11 +432,13 @@ public:
   /// Pass n_points_other = 0 to indicate an auto structure function calculation
   TaskItFactory(std::size_t nproc, std::size_t n_points,
                 std::size_t n_points_other,
-                bool skip_small_prob_check = false) noexcept
+                bool skip_small_prob_check = false,
+                const VsfTuning& tuning = default_vsf_tuning())
     : nproc_(nproc),
       partition_strat_(TaskItFactory::build_strat_(nproc, n_points,
                                                    n_points_other,
-                                                   skip_small_prob_check))
+                                                   skip_small_prob_check,
+                                                   tuning))
   {}
 
   /// gives total number of chunks the problem is broken into
@@ -433,12 +447,12 @@ public:
                       partition_strat_);
   }
 
-  std::size_t effective_nproc() const noexcept {
+  std::size_t effective_nproc() const {
     return std::min(nproc_, safe_cast<std::size_t>(n_partitions()));
   }
 
   /// Constructs the TaskIt for the given process id
-  TaskIt build_TaskIt(std::size_t proc_id) const noexcept {
+  TaskIt build_TaskIt(std::size_t proc_id) const {
     if (proc_id >= nproc_){ error("proc_id is too large"); }
 
     //printf("Compute slc before constructing TaskIt\n");
@@ -452,7 +466,7 @@ public:
   }
 
   /// purely for testing with Cython
-  TaskIt* build_TaskIt_ptr(std::size_t proc_id) const noexcept {
+  TaskIt* build_TaskIt_ptr(std::size_t proc_id) const {
     return new TaskIt(build_TaskIt(proc_id));
   }
 
@@ -460,13 +474,14 @@ private:
 
   static partition_variant build_strat_(std::size_t nproc, std::size_t n_points,
                                         std::size_t n_points_other,
-                                        bool skip_small_prob_check) noexcept {
+                                        bool skip_small_prob_check,
+                                        const VsfTuning& tuning) {
     if (n_points_other == 0){
       return AutoSFPartitionStrat::create(nproc, n_points,
-                                          skip_small_prob_check);
+                                          skip_small_prob_check, tuning);
     } else {
       return CrossSFPartitionStrat::create(nproc, n_points, n_points_other,
-                                           skip_small_prob_check);
+                                           skip_small_prob_check, tuning);
     }
   }
 
@@ -476,3 +491,28 @@ private:
   std::size_t nproc_;
   partition_variant partition_strat_;
 };
+
+/// Determine the nominal number of processes specified by parallel_spec
+///
+/// A value of 0 for parallel_spec.nproc falls back to OMP_NUM_THREADS
+inline std::size_t get_nominal_nproc(const ParallelSpec& parallel_spec)
+{
+  if (parallel_spec.nproc == 0) {
+    // this approach is crude. OMP_NUM_THREADS doesn't need to be an int
+    char* var_val = std::getenv("OMP_NUM_THREADS");
+    if (var_val == nullptr){
+      return 1;
+    } else {
+      int tmp = std::atoi(var_val);
+      if (tmp <= 0){
+        error("OMP_NUM_THREADS has an invalid value", VSF_INVALID_ARG);
+      } else {
+        return tmp;
+      }
+    }
+  } else {
+    return parallel_spec.nproc;
+  }
+}
+
+#endif /* PARTITION_H */
@@ -0,0 +1,136 @@
+#include <cstdint>
+#include <cstring> // std::memcpy
+
+#include <new> // std::align_val_t
+
+#include "point_set.hpp"
+#include "utils.hpp"
+
+namespace{
+
+  /// A block of doubles that starts on a VSF_POINTSET_ALIGNMENT-byte
+  /// boundary
+  class AlignedBuffer{
+  public:
+    AlignedBuffer() = delete;
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    explicit AlignedBuffer(std::size_t length)
+      : ptr_(nullptr)
+    {
+      if (length > 0){
+        ptr_ = static_cast<double*>
+          (::operator new(length * sizeof(double),
+                          std::align_val_t(VSF_POINTSET_ALIGNMENT)));
+        std::memset(ptr_, 0, length * sizeof(double));
+      }
+    }
+
+    ~AlignedBuffer() {
+      if (ptr_ != nullptr){
+        ::operator delete(ptr_, std::align_val_t(VSF_POINTSET_ALIGNMENT));
+      }
+    }
+
+    double* data() const noexcept { return ptr_; }
+
+  private:
+    double* ptr_;
+  };
+
+  /// Rounds n_points up so that each component array occupies a multiple of
+  /// VSF_POINTSET_ALIGNMENT bytes
+  std::size_t padded_length_(std::size_t n_points) noexcept {
+    const std::size_t vals_per_block =
+      VSF_POINTSET_ALIGNMENT / sizeof(double);
+    return ((n_points + vals_per_block - 1) / vals_per_block) *
+      vals_per_block;
+  }
+
+  struct PointSet{
+    PointSet(std::size_t n_points, std::size_t n_spatial_dims)
+      : n_points(n_points), n_spatial_dims(n_spatial_dims),
+        stride(padded_length_(n_points)),
+        positions(stride * n_spatial_dims),
+        velocities(stride * n_spatial_dims)
+    { }
+
+    const std::size_t n_points;
+    const std::size_t n_spatial_dims;
+    const std::size_t stride;
+    AlignedBuffer positions;
+    AlignedBuffer velocities;
+  };
+
+}
+
+void* pointset_create(std::size_t n_points, std::size_t n_spatial_dims,
+                      VsfErrorInfo* err_info) noexcept
+{
+  PointSet* out = nullptr;
+  auto impl = [&]()
+  {
+    if (n_spatial_dims == 0){
+      error("n_spatial_dims must be positive", VSF_INVALID_ARG);
+    }
+    out = new PointSet(n_points, n_spatial_dims);
+  };
+
+  if (catch_vsf_errors(err_info, impl) != VSF_SUCCESS) { return nullptr; }
+  return static_cast<void*>(out);
+}
+
+void pointset_destroy(void* handle) noexcept {
+  delete static_cast<PointSet*>(handle);
+}
+
+int pointset_assign(void* handle, const double* positions,
+                    const double* velocities, std::size_t spatial_dim_stride,
+                    VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if (handle == nullptr){
+      error("handle must not be a nullptr", VSF_INVALID_ARG);
+    }
+    PointSet& point_set = *static_cast<PointSet*>(handle);
+    const std::size_t n_points = point_set.n_points;
+    if (n_points == 0) { return; }
+
+    if ((positions == nullptr) || (velocities == nullptr)){
+      error("positions and velocities must not be nullptrs",
+            VSF_INVALID_ARG);
+    } else if (spatial_dim_stride < n_points){
+      error("spatial_dim_stride must be at least as large as the number of "
+            "points", VSF_INVALID_ARG);
+    }
+
+    for (std::size_t dim = 0; dim < point_set.n_spatial_dims; dim++){
+      std::memcpy(point_set.positions.data() + dim * point_set.stride,
+                  positions + dim * spatial_dim_stride,
+                  n_points * sizeof(double));
+      std::memcpy(point_set.velocities.data() + dim * point_set.stride,
+                  velocities + dim * spatial_dim_stride,
+                  n_points * sizeof(double));
+    }
+  };
+  return catch_vsf_errors(err_info, impl);
+}
+
+PointProps pointset_props(const void* handle) noexcept {
+  if (handle == nullptr) { return {nullptr, nullptr, 0, 0, 0}; }
+  const PointSet& point_set = *static_cast<const PointSet*>(handle);
+  return {point_set.positions.data(), point_set.velocities.data(),
+          point_set.n_points, point_set.n_spatial_dims, point_set.stride};
+}
+
+double* pointset_positions(void* handle) noexcept {
+  if (handle == nullptr) { return nullptr; }
+  return static_cast<PointSet*>(handle)->positions.data();
+}
+
+double* pointset_velocities(void* handle) noexcept {
+  if (handle == nullptr) { return nullptr; }
+  return static_cast<PointSet*>(handle)->velocities.data();
+}
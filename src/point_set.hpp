@@ -0,0 +1,68 @@
+#ifndef POINT_SET_H
+#define POINT_SET_H
+
+// Define the C interface for a library-owned container of points
+//
+// A point set stores each component of the positions and velocities in a
+// separate array. Every array starts on a 64-byte boundary and is padded to a
+// multiple of 64 bytes. The point set can be described by a PointProps (with
+// ``spatial_dim_stride`` equal to the padded length), so it can be passed to
+// calc_vsf_props as many times as is necessary without copying the data
+// again.
+
+#include "vsf.hpp"
+
+/// The alignment (in bytes) of each component array in a point set
+#define VSF_POINTSET_ALIGNMENT 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Allocates a point set and returns a handle to it
+///
+/// The contents of the arrays (including the padding) are initialized to 0.
+///
+/// @param[in]  n_points The number of points
+/// @param[in]  n_spatial_dims The number of spatial dimensions
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns The handle. A nullptr is returned if there was an error.
+void* pointset_create(size_t n_points, size_t n_spatial_dims,
+                      VsfErrorInfo* err_info) noexcept;
+
+/// Deallocates the point set associated with the handle
+void pointset_destroy(void* handle) noexcept;
+
+/// Copies positions and velocities into a point set
+///
+/// @param[in,out] handle The previously allocated point set
+/// @param[in]     positions, velocities The ith component of the jth point is
+///     located at an index of ``j + i*spatial_dim_stride``.
+/// @param[in]     spatial_dim_stride Stride between components of the source
+///     arrays. This must be at least as large as the number of points.
+/// @param[out]    err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns VSF_SUCCESS or an error code.
+int pointset_assign(void* handle, const double* positions,
+                    const double* velocities, size_t spatial_dim_stride,
+                    VsfErrorInfo* err_info) noexcept;
+
+/// Returns a PointProps that refers to the contents of a point set
+///
+/// The PointProps remains valid until the point set is destroyed.
+PointProps pointset_props(const void* handle) noexcept;
+
+/// Returns pointers to the (writable) position and velocity buffers of a
+/// point set. The ith component of the jth point is stored at an index of
+/// ``j + i*pointset_props(handle).spatial_dim_stride``.
+double* pointset_positions(void* handle) noexcept;
+double* pointset_velocities(void* handle) noexcept;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POINT_SET_H */
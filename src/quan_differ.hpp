@@ -0,0 +1,126 @@
+#ifndef QUAN_DIFFER_H
+#define QUAN_DIFFER_H
+
+// Define the differs shared by the pair-counting kernels. This is an internal
+// header (it isn't part of the C interface).
+
+#include <cmath>
+#include <cstddef>
+
+#include "vsf.hpp" // QuanDiffSpec
+#include "utils.hpp" // error
+
+#if defined(__GNUC__)
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#else
+#define FORCE_INLINE inline
+#endif
+
+// Differs compute the difference in the quantity (usually velocity) between
+// the points in a pair. The quantity of the first point in a pair is loaded
+// once (outside of the inner loop) with load()
+
+/// Computes the magnitude of the difference of a vector quantity with a
+/// compile-time number of components (this is used for 3D velocities and
+/// scalar quantities)
+template<std::size_t N>
+struct FixedAbsDiffer{
+  struct Loaded{ double vals[N]; };
+
+  FORCE_INLINE Loaded load(const double* quan, std::size_t i,
+                           std::size_t stride) const noexcept {
+    Loaded out;
+    for (std::size_t j = 0; j < N; j++) { out.vals[j] = quan[i + j*stride]; }
+    return out;
+  }
+
+  FORCE_INLINE double operator()(const Loaded& a, const double* quan_b,
+                                 std::size_t i_b, std::size_t stride_b)
+    const noexcept
+  {
+    if constexpr (N == 1) {
+      return std::fabs(a.vals[0] - quan_b[i_b]);
+    } else {
+      double sum = 0.0;
+      for (std::size_t j = 0; j < N; j++){
+        const double diff = a.vals[j] - quan_b[i_b + j*stride_b];
+        sum += diff * diff;
+      }
+      return std::sqrt(sum);
+    }
+  }
+};
+
+/// Computes the signed difference (a - b) of a scalar quantity
+struct SignedScalarDiffer{
+  struct Loaded{ double val; };
+
+  FORCE_INLINE Loaded load(const double* quan, std::size_t i,
+                           std::size_t stride) const noexcept {
+    return {quan[i]};
+  }
+
+  FORCE_INLINE double operator()(const Loaded& a, const double* quan_b,
+                                 std::size_t i_b, std::size_t stride_b)
+    const noexcept
+  { return a.val - quan_b[i_b]; }
+};
+
+/// Computes the magnitude of the difference of a vector quantity with an
+/// arbitrary number of components
+struct VectorAbsDiffer{
+  std::size_t n_components;
+
+  struct Loaded{ const double* ptr; std::size_t stride; };
+
+  FORCE_INLINE Loaded load(const double* quan, std::size_t i,
+                           std::size_t stride) const noexcept {
+    return {quan + i, stride};
+  }
+
+  FORCE_INLINE double operator()(const Loaded& a, const double* quan_b,
+                                 std::size_t i_b, std::size_t stride_b)
+    const noexcept
+  {
+    double sum = 0.0;
+    for (std::size_t j = 0; j < n_components; j++){
+      const double diff = a.ptr[j*a.stride] - quan_b[i_b + j*stride_b];
+      sum += diff * diff;
+    }
+    return std::sqrt(sum);
+  }
+};
+
+/// The differ used for 3D velocities
+using VelocityDiffer = FixedAbsDiffer<3>;
+
+/// Returns a callable that builds the differ described by quan_spec & invokes
+/// the callable it is passed with the differ
+inline auto with_quan_differ(const QuanDiffSpec quan_spec){
+  return [=](auto&& func)
+    {
+      const std::size_t n = quan_spec.n_components;
+      if (n == 0){
+        error("quan_spec.n_components must be positive", VSF_INVALID_ARG);
+      } else if (quan_spec.kind == VSF_QUAN_ABS_DIFF){
+        // specialize the most common cases
+        if (n == 1){
+          func(FixedAbsDiffer<1>{});
+        } else if (n == 3){
+          func(VelocityDiffer{});
+        } else {
+          func(VectorAbsDiffer{n});
+        }
+      } else if (quan_spec.kind == VSF_QUAN_SIGNED_DIFF){
+        if (n != 1){
+          error("signed differences require a quantity with 1 component",
+                VSF_INVALID_ARG);
+        }
+        func(SignedScalarDiffer{});
+      } else {
+        error("quan_spec.kind has an unrecognized value", VSF_INVALID_ARG);
+      }
+    };
+}
+
+#endif /* QUAN_DIFFER_H */
@@ -0,0 +1,398 @@
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <exception> // std::exception_ptr
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "sampling.hpp"
+#include "accumulators.hpp"
+#include "compound_accumulator.hpp"
+#include "accum_col_variant.hpp"
+#include "partition.hpp" // get_nominal_nproc
+#include "utils.hpp"
+
+namespace{
+
+  /// A uniform grid of cubic cells used to look up points near a location.
+  ///
+  /// The point indices are sorted by cell (with a counting sort). For each
+  /// cell, box_counts_ tracks the number of points in the 3x3x3 block of
+  /// cells centered on that cell.
+  class CellGrid{
+
+  public:
+    CellGrid(const PointProps& points, double min_width)
+    {
+      const std::size_t n_points = points.n_points;
+      const std::size_t stride = points.spatial_dim_stride;
+      const double* pos = points.positions;
+
+      double right_edge[3];
+      for (int dim = 0; dim < 3; dim++){
+        left_edge_[dim] = std::numeric_limits<double>::infinity();
+        right_edge[dim] = -std::numeric_limits<double>::infinity();
+        for (std::size_t i = 0; i < n_points; i++){
+          left_edge_[dim] = std::min(left_edge_[dim], pos[i + dim*stride]);
+          right_edge[dim] = std::max(right_edge[dim], pos[i + dim*stride]);
+        }
+      }
+
+      // pick the cell width. Cells must be at least as wide as min_width so
+      // that all points within min_width of a location lie in the 3x3x3
+      // block of cells around it. We also cap the number of cells at a
+      // small multiple of the number of points.
+      double max_extent = 0.0;
+      for (int dim = 0; dim < 3; dim++){
+        max_extent = std::max(max_extent, right_edge[dim] - left_edge_[dim]);
+      }
+      width_ = std::max({min_width, max_extent / 256.0,
+                         std::numeric_limits<double>::min()});
+      const double max_cells = std::max<double>(64.0, 8.0 * n_points);
+      while (true) {
+        double total_cells = 1.0;
+        for (int dim = 0; dim < 3; dim++){
+          n_cells_[dim] = static_cast<std::int64_t>(
+            std::floor((right_edge[dim] - left_edge_[dim]) / width_)) + 1;
+          total_cells *= n_cells_[dim];
+        }
+        if (total_cells <= max_cells) { break; }
+        width_ *= 2.0;
+      }
+      const std::size_t total_cells = n_cells_[0] * n_cells_[1] * n_cells_[2];
+
+      // counting sort of the point indices
+      std::vector<std::uint64_t> point_cell(n_points);
+      cell_start_.assign(total_cells + 1, 0);
+      for (std::size_t i = 0; i < n_points; i++){
+        std::int64_t cell[3];
+        cell_coords(pos[i], pos[i + stride], pos[i + 2*stride], cell);
+        point_cell[i] = flat_index_(cell[0], cell[1], cell[2]);
+        cell_start_[point_cell[i] + 1]++;
+      }
+      for (std::size_t c = 0; c < total_cells; c++){
+        cell_start_[c+1] += cell_start_[c];
+      }
+      sorted_ids_.resize(n_points);
+      std::vector<std::uint64_t> next(cell_start_.begin(),
+                                      cell_start_.end() - 1);
+      for (std::size_t i = 0; i < n_points; i++){
+        sorted_ids_[next[point_cell[i]]++] = i;
+      }
+
+      // compute the box counts with 3 separable passes
+      box_counts_.resize(total_cells);
+      for (std::size_t c = 0; c < total_cells; c++){
+        box_counts_[c] = cell_start_[c+1] - cell_start_[c];
+      }
+      const std::int64_t strides[3] = {n_cells_[1] * n_cells_[2],
+                                       n_cells_[2], 1};
+      std::vector<std::uint64_t> tmp(total_cells);
+      for (int dim = 0; dim < 3; dim++){
+        for (std::size_t c = 0; c < total_cells; c++){
+          const std::int64_t coord = (c / strides[dim]) % n_cells_[dim];
+          std::uint64_t sum = box_counts_[c];
+          if (coord > 0) { sum += box_counts_[c - strides[dim]]; }
+          if ((coord + 1) < n_cells_[dim]) {
+            sum += box_counts_[c + strides[dim]];
+          }
+          tmp[c] = sum;
+        }
+        box_counts_.swap(tmp);
+      }
+    }
+
+    /// Computes the (unclipped) coordinates of the cell containing a location
+    void cell_coords(double x, double y, double z,
+                     std::int64_t *out) const noexcept
+    {
+      out[0] = static_cast<std::int64_t>(std::floor((x-left_edge_[0])/width_));
+      out[1] = static_cast<std::int64_t>(std::floor((y-left_edge_[1])/width_));
+      out[2] = static_cast<std::int64_t>(std::floor((z-left_edge_[2])/width_));
+    }
+
+    /// Number of points in the 3x3x3 block of cells around cell
+    std::uint64_t num_candidates(const std::int64_t *cell) const noexcept
+    {
+      bool inside = true;
+      for (int dim = 0; dim < 3; dim++){
+        inside = inside && (cell[dim] >= 0) && (cell[dim] < n_cells_[dim]);
+      }
+      if (inside) { return box_counts_[flat_index_(cell[0], cell[1],
+                                                   cell[2])]; }
+
+      std::uint64_t out = 0;
+      for_each_block_cell_(cell, [&](std::size_t c){
+          out += cell_start_[c+1] - cell_start_[c];
+          return false;
+        });
+      return out;
+    }
+
+    /// Returns the index of the ith point in the 3x3x3 block of cells around
+    /// cell (i must be smaller than num_candidates(cell))
+    std::uint64_t get_candidate(const std::int64_t *cell,
+                                std::uint64_t i) const noexcept
+    {
+      std::uint64_t out = 0;
+      for_each_block_cell_(cell, [&](std::size_t c){
+          const std::uint64_t count = cell_start_[c+1] - cell_start_[c];
+          if (i < count) {
+            out = sorted_ids_[cell_start_[c] + i];
+            return true;
+          }
+          i -= count;
+          return false;
+        });
+      return out;
+    }
+
+  private:
+    std::size_t flat_index_(std::int64_t ix, std::int64_t iy,
+                            std::int64_t iz) const noexcept
+    { return (ix * n_cells_[1] + iy) * n_cells_[2] + iz; }
+
+    /// Calls func on the flat index of each cell in the 3x3x3 block around
+    /// cell (that lies within the grid). Stops early if func returns true.
+    template<typename Func>
+    void for_each_block_cell_(const std::int64_t *cell,
+                              Func&& func) const noexcept
+    {
+      std::int64_t start[3], stop[3];
+      for (int dim = 0; dim < 3; dim++){
+        start[dim] = std::max<std::int64_t>(cell[dim] - 1, 0);
+        stop[dim] = std::min<std::int64_t>(cell[dim] + 2, n_cells_[dim]);
+      }
+      for (std::int64_t ix = start[0]; ix < stop[0]; ix++){
+        for (std::int64_t iy = start[1]; iy < stop[1]; iy++){
+          for (std::int64_t iz = start[2]; iz < stop[2]; iz++){
+            if (func(flat_index_(ix, iy, iz))) { return; }
+          }
+        }
+      }
+    }
+
+    double left_edge_[3];
+    double width_;
+    std::int64_t n_cells_[3];
+    std::vector<std::uint64_t> cell_start_;
+    std::vector<std::uint64_t> sorted_ids_;
+    std::vector<std::uint64_t> box_counts_;
+  };
+
+  /// Holds the samples drawn for a single distance bin
+  struct BinSamples{
+    std::vector<double> abs_vdiffs;
+    std::uint64_t draws = 0;
+    std::uint64_t max_candidates = 0;
+  };
+
+  void sample_bin_(const PointProps& points_a, const PointProps& points_b,
+                   bool duplicated_points,
+                   const std::vector<double>& dist_sqr_bin_edges,
+                   std::size_t nbins, std::size_t bin_ind,
+                   const SamplingSpec& sampling_spec, BinSamples& out)
+  {
+    const double outer_edge = std::sqrt(
+      std::max(0.0, dist_sqr_bin_edges[bin_ind+1]));
+    const CellGrid grid(points_b, outer_edge);
+
+    const std::size_t n_a = points_a.n_points;
+    const std::size_t stride_a = points_a.spatial_dim_stride;
+    const std::size_t stride_b = points_b.spatial_dim_stride;
+    const double *pos_a = points_a.positions;
+    const double *vel_a = points_a.velocities;
+    const double *pos_b = points_b.positions;
+    const double *vel_b = points_b.velocities;
+
+    // the number of candidate partners for each point in points_a. The
+    // largest value is used for rejection sampling
+    std::vector<std::int64_t> cell_a(3*n_a);
+    std::vector<std::uint64_t> n_cand_a(n_a);
+    for (std::size_t i = 0; i < n_a; i++){
+      grid.cell_coords(pos_a[i], pos_a[i + stride_a], pos_a[i + 2*stride_a],
+                       &cell_a[3*i]);
+      n_cand_a[i] = grid.num_candidates(&cell_a[3*i]);
+      out.max_candidates = std::max(out.max_candidates, n_cand_a[i]);
+    }
+    if (out.max_candidates == 0) { return; }
+    const double max_candidates = static_cast<double>(out.max_candidates);
+
+    // seed the generator from the seed and bin index
+    std::seed_seq seq{
+      static_cast<std::uint32_t>(sampling_spec.seed),
+      static_cast<std::uint32_t>(sampling_spec.seed >> 32),
+      static_cast<std::uint32_t>(bin_ind),
+      static_cast<std::uint32_t>(static_cast<std::uint64_t>(bin_ind) >> 32)
+    };
+    std::mt19937_64 rng(seq);
+    std::uniform_int_distribution<std::uint64_t> choose_a(0, n_a - 1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    const std::uint64_t max_draws = (sampling_spec.max_draws_per_bin == 0)
+      ? 64 * sampling_spec.pairs_per_bin : sampling_spec.max_draws_per_bin;
+    out.abs_vdiffs.reserve(sampling_spec.pairs_per_bin);
+
+    while ((out.abs_vdiffs.size() < sampling_spec.pairs_per_bin) &&
+           (out.draws < max_draws)) {
+      out.draws++;
+
+      // pick a point from points_a. Then accept it with a probability
+      // proportional to its number of candidates (so that every pair is
+      // equally likely to be drawn)
+      const std::uint64_t i_a = choose_a(rng);
+      const std::uint64_t n_cand = n_cand_a[i_a];
+      if ((n_cand == 0) ||
+          ((n_cand < out.max_candidates) &&
+           ((uniform(rng) * max_candidates) >= n_cand))) {
+        continue;
+      }
+
+      // pick a candidate partner
+      std::uniform_int_distribution<std::uint64_t> choose_b(0, n_cand - 1);
+      const std::uint64_t i_b = grid.get_candidate(&cell_a[3*i_a],
+                                                   choose_b(rng));
+      if (duplicated_points && (i_a == i_b)) { continue; }
+
+      double dist_sqr = 0.0;
+      double vdiff_sqr = 0.0;
+      for (std::size_t dim = 0; dim < 3; dim++){
+        const double dx = pos_a[i_a + dim*stride_a] - pos_b[i_b + dim*stride_b];
+        const double dv = vel_a[i_a + dim*stride_a] - vel_b[i_b + dim*stride_b];
+        dist_sqr += dx*dx;
+        vdiff_sqr += dv*dv;
+      }
+      if (identify_bin_index(dist_sqr, dist_sqr_bin_edges.data(), nbins)
+          == bin_ind) {
+        out.abs_vdiffs.push_back(std::sqrt(vdiff_sqr));
+      }
+    }
+  }
+
+}
+
+int calc_vsf_props_sampled(const PointProps points_a,
+                           const PointProps points_b,
+                           const StatListItem* stat_list,
+                           std::size_t stat_list_len,
+                           const double *bin_edges, std::size_t nbins,
+                           const SamplingSpec sampling_spec,
+                           const ParallelSpec parallel_spec,
+                           double *out_flt_vals, int64_t *out_i64_vals,
+                           double *out_std_err, double *out_pair_count_est,
+                           VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    const bool duplicated_points = ((points_b.positions == nullptr) &&
+                                    (points_b.velocities == nullptr));
+    const PointProps my_points_b = (duplicated_points) ? points_a : points_b;
+
+    if (nbins == 0){
+      error("nbins must be positive", VSF_INVALID_ARG);
+    } else if (bin_edges == nullptr){
+      error("bin_edges must not be a nullptr", VSF_INVALID_ARG);
+    } else if ((points_a.n_spatial_dims != 3) ||
+               (my_points_b.n_spatial_dims != 3)){
+      error("points must have 3 spatial dimensions", VSF_NOT_IMPLEMENTED);
+    } else if ((points_a.positions == nullptr) ||
+               (points_a.velocities == nullptr) ||
+               (my_points_b.positions == nullptr) ||
+               (my_points_b.velocities == nullptr)) {
+      error("the positions and velocities of points_a must not be nullptrs "
+            "and those of points_b must both be nullptrs or both be "
+            "non-nullptrs", VSF_INVALID_ARG);
+    } else if ((out_flt_vals == nullptr) || (out_i64_vals == nullptr)) {
+      error("the output buffers must not be nullptrs", VSF_INVALID_ARG);
+    }
+
+    const std::vector<double> dist_sqr_bin_edges =
+      build_dist_sqr_bin_edges(bin_edges, nbins);
+
+    AccumColVariant accumulators = build_accum_collection(stat_list,
+                                                          stat_list_len,
+                                                          nbins);
+
+    // draw the samples for each bin
+    std::vector<BinSamples> samples(nbins);
+    const bool can_sample = ((points_a.n_points > 0) &&
+                             (my_points_b.n_points > 0));
+    if (can_sample) {
+      const std::size_t nproc = std::min(get_nominal_nproc(parallel_spec),
+                                         nbins);
+      const bool use_parallel = (nproc > 1) && !parallel_spec.force_sequential;
+      std::exception_ptr first_exception = nullptr;
+
+      #pragma omp parallel for schedule(dynamic,1) num_threads(nproc) \
+        if (use_parallel)
+      for (std::size_t bin_ind = 0; bin_ind < nbins; bin_ind++){
+        try {
+          sample_bin_(points_a, my_points_b, duplicated_points,
+                      dist_sqr_bin_edges, nbins, bin_ind, sampling_spec,
+                      samples[bin_ind]);
+        } catch (...) {
+          #pragma omp critical
+          {
+            if (first_exception == nullptr) {
+              first_exception = std::current_exception();
+            }
+          }
+        }
+      }
+
+      if (first_exception != nullptr) {
+        std::rethrow_exception(first_exception);
+      }
+    }
+
+    // update the accumulators in a fixed order (so that the results don't
+    // depend on the number of threads)
+    std::visit([&](auto& accums){
+        for (std::size_t bin_ind = 0; bin_ind < nbins; bin_ind++){
+          for (double val : samples[bin_ind].abs_vdiffs){
+            accums.add_entry(bin_ind, val);
+          }
+        }
+      }, accumulators);
+
+    std::visit([=](auto &accums){ accums.copy_flt_vals(out_flt_vals); },
+               accumulators);
+    std::visit([=](auto &accums){ accums.copy_i64_vals(out_i64_vals); },
+               accumulators);
+
+    for (std::size_t bin_ind = 0; bin_ind < nbins; bin_ind++){
+      const BinSamples& cur = samples[bin_ind];
+      const std::size_t n = cur.abs_vdiffs.size();
+
+      if (out_std_err != nullptr) {
+        if (n < 2) {
+          out_std_err[bin_ind] = std::numeric_limits<double>::quiet_NaN();
+        } else {
+          VarAccum accum;
+          for (double val : cur.abs_vdiffs) { accum.add_entry(val); }
+          // the 2nd value is the sum of squared deviations from the mean
+          const double variance = accum.get_flt_val(1) / (n - 1);
+          out_std_err[bin_ind] = std::sqrt(variance / n);
+        }
+      }
+
+      if (out_pair_count_est != nullptr) {
+        // each draw selects a particular (ordered) pair with a probability
+        // of 1 / (n_points_a * max_candidates)
+        double est = 0.0;
+        if (cur.draws > 0) {
+          est = (static_cast<double>(n) / cur.draws) * points_a.n_points *
+            static_cast<double>(cur.max_candidates);
+        }
+        out_pair_count_est[bin_ind] = (duplicated_points) ? 0.5 * est : est;
+      }
+    }
+  };
+
+  return catch_vsf_errors(err_info, impl);
+}
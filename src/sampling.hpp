@@ -0,0 +1,80 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+// Define the C interface for estimating structure function properties from
+// randomly sampled pairs of points
+
+#include "vsf.hpp"
+
+/// Specifies how pairs of points are randomly sampled
+struct SamplingSpec{
+  /// The number of pairs to sample from each distance bin.
+  uint64_t pairs_per_bin;
+  /// The maximum number of random draws made for each distance bin. (Most
+  /// draws are rejected when a distance bin holds few pairs). A value of 0
+  /// indicates a default of ``64 * pairs_per_bin``.
+  uint64_t max_draws_per_bin;
+  /// Seed for the random number generator. The sequence of random numbers
+  /// used for each distance bin is derived from this seed and the bin index
+  /// (so results don't depend on the number of threads).
+  uint64_t seed;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Estimates properties related to the velocity structure function from
+/// randomly sampled pairs of points.
+///
+/// Sampling is stratified by distance bin. For each bin, pairs are drawn
+/// uniformly (with replacement) from the set of all pairs with separations
+/// in that bin. A uniform cell-grid spatial index (with cells at least as
+/// wide as the bin's outer edge) is used to propose candidate partners, and
+/// rejection sampling corrects for the varying number of candidates.
+///
+/// The accumulators are updated with the sampled pairs. Thus, the reported
+/// counts are the numbers of sampled pairs (not the total number of pairs).
+///
+/// @param[in]  points_a Struct holding first set of positions and velocities
+/// @param[in]  points_b Struct holding second set of positions and velocities.
+///     In the event that the positions and velocities pointers are each
+///     nullptrs, then pairs are just sampled from points_a.
+/// @param[in]  stat_list Pointer to an array of 1 or more StatListItems that
+///     provide details about the statistics that will be computed.
+/// @param[in]  stat_list_len Specifies the number of entries in stat_list.
+/// @param[in]  bin_edges An array of ``nbins + 1`` monotonically increasing
+///     distance bin edges.
+/// @param[in]  nbins The number of distance bins
+/// @param[in]  sampling_spec Specifies the sampling parameters
+/// @param[in]  parallel_spec Specifies the parallelism arguments. Distance
+///     bins are divided between threads.
+/// @param[out] out_flt_vals Preallocated arrays to hold the output floating
+///     point values.
+/// @param[out] out_i64_vals Preallocated array to store the output int64_t
+///     values.
+/// @param[out] out_std_err Optional array of ``nbins`` entries. Used to
+///     store the standard error of the mean magnitude of the velocity
+///     difference in each bin (NaN when fewer than 2 pairs were sampled).
+/// @param[out] out_pair_count_est Optional array of ``nbins`` entries. Used to
+///     store an estimate of the total number of (unique) pairs in each bin.
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns VSF_SUCCESS or an error code.
+int calc_vsf_props_sampled(const PointProps points_a,
+                           const PointProps points_b,
+                           const StatListItem* stat_list,
+                           size_t stat_list_len,
+                           const double *bin_edges, size_t nbins,
+                           const SamplingSpec sampling_spec,
+                           const ParallelSpec parallel_spec,
+                           double *out_flt_vals, int64_t *out_i64_vals,
+                           double *out_std_err, double *out_pair_count_est,
+                           VsfErrorInfo* err_info) noexcept;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLING_H */
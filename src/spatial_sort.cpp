@@ -0,0 +1,306 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring> // std::memcpy
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <vector>
+
+#include <omp.h>
+
+#include "spatial_sort.hpp"
+#include "point_set.hpp"
+#include "partition.hpp" // get_nominal_nproc
+#include "utils.hpp"
+
+namespace{
+
+  /// number of bits used to quantize each axis
+  const int KEY_BITS_PER_AXIS = 21;
+  const std::uint32_t KEY_AXIS_MAX = (1u << KEY_BITS_PER_AXIS) - 1;
+
+  /// Spreads the lowest 21 bits of val so that there are 2 zero-bits between
+  /// each of them
+  inline std::uint64_t spread_bits_(std::uint64_t val) noexcept {
+    val &= 0x1fffff;
+    val = (val | (val << 32)) & 0x1f00000000ffffULL;
+    val = (val | (val << 16)) & 0x1f0000ff0000ffULL;
+    val = (val | (val << 8))  & 0x100f00f00f00f00fULL;
+    val = (val | (val << 4))  & 0x10c30c30c30c30c3ULL;
+    val = (val | (val << 2))  & 0x1249249249249249ULL;
+    return val;
+  }
+
+  /// Interleaves the bits of the 3 coordinates (coords[0] holds the most
+  /// significant bit of each triplet)
+  inline std::uint64_t interleave_(const std::array<std::uint32_t,3>& coords)
+    noexcept
+  {
+    return ((spread_bits_(coords[0]) << 2) | (spread_bits_(coords[1]) << 1) |
+            spread_bits_(coords[2]));
+  }
+
+  /// Converts coordinates into the "transposed" Hilbert index, using the
+  /// algorithm from Skilling (2004), "Programming the Hilbert curve", AIP
+  /// Conference Proceedings 707, 381.
+  inline void axes_to_transpose_(std::array<std::uint32_t,3>& x) noexcept {
+    const std::uint32_t m = 1u << (KEY_BITS_PER_AXIS - 1);
+
+    // inverse undo. When bit q of x[i] is set, the low bits of x[0] are
+    // inverted. Otherwise, the low bits of x[0] and x[i] are exchanged. (This
+    // is written without branches, which are very unpredictable here)
+    for (std::uint32_t q = m; q > 1; q >>= 1){
+      const std::uint32_t p = q - 1;
+      for (int i = 0; i < 3; i++){
+        const std::uint32_t invert = 0u - static_cast<std::uint32_t>
+          ((x[i] & q) != 0);
+        const std::uint32_t t = (x[0] ^ x[i]) & p & ~invert;
+        x[0] ^= (p & invert) | t;
+        x[i] ^= t;
+      }
+    }
+
+    // gray encode
+    for (int i = 1; i < 3; i++){ x[i] ^= x[i-1]; }
+    std::uint32_t t = 0;
+    for (std::uint32_t q = m; q > 1; q >>= 1){
+      if (x[2] & q) { t ^= q - 1; }
+    }
+    for (int i = 0; i < 3; i++){ x[i] ^= t; }
+  }
+
+  template<int curve>
+  inline std::uint64_t compute_key_(std::array<std::uint32_t,3> coords)
+    noexcept
+  {
+    if constexpr (curve == VSF_CURVE_HILBERT) { axes_to_transpose_(coords); }
+    return interleave_(coords);
+  }
+
+  struct QuantizationBox{ double min[3]; double inv_width; };
+
+  QuantizationBox build_box_(const PointProps& points, const double* box_min,
+                             double box_width)
+  {
+    QuantizationBox out;
+    if (box_min != nullptr){
+      if (!(std::isfinite(box_width) && (box_width > 0))){
+        error("box_width must be positive & finite", VSF_INVALID_ARG);
+      }
+      for (int i = 0; i < 3; i++){ out.min[i] = box_min[i]; }
+      out.inv_width = 1.0 / box_width;
+      return out;
+    }
+
+    double max_extent = 0.0;
+    for (int dim = 0; dim < 3; dim++){
+      const double* vals = points.positions + dim * points.spatial_dim_stride;
+      double lo = std::numeric_limits<double>::infinity();
+      double hi = -std::numeric_limits<double>::infinity();
+      for (std::size_t i = 0; i < points.n_points; i++){
+        lo = std::min(lo, vals[i]);
+        hi = std::max(hi, vals[i]);
+      }
+      out.min[dim] = lo;
+      max_extent = std::max(max_extent, hi - lo);
+    }
+    if (!std::isfinite(max_extent)){
+      error("positions must all be finite", VSF_INVALID_ARG);
+    }
+    // slightly widen the box so that the largest value maps inside of it
+    out.inv_width = (max_extent > 0) ? (1.0 / (max_extent * (1.0 + 1e-12)))
+                                     : 1.0;
+    return out;
+  }
+
+  inline std::uint32_t quantize_(double val, double min, double inv_width)
+    noexcept
+  {
+    const double scaled = (val - min) * inv_width * (KEY_AXIS_MAX + 1.0);
+    // the comparisons are written so that NaNs map to 0
+    if (!(scaled > 0)) { return 0; }
+    if (scaled >= KEY_AXIS_MAX) { return KEY_AXIS_MAX; }
+    return static_cast<std::uint32_t>(scaled);
+  }
+
+  template<int curve>
+  void compute_keys_(const PointProps& points, const QuantizationBox& box,
+                     std::size_t nproc, std::uint64_t* keys)
+  {
+    const double* x = points.positions;
+    const double* y = points.positions + points.spatial_dim_stride;
+    const double* z = points.positions + 2*points.spatial_dim_stride;
+    const std::int64_t n = static_cast<std::int64_t>(points.n_points);
+
+    #pragma omp parallel for num_threads(nproc) if (nproc > 1)
+    for (std::int64_t i = 0; i < n; i++){
+      std::array<std::uint32_t,3> coords =
+        {quantize_(x[i], box.min[0], box.inv_width),
+         quantize_(y[i], box.min[1], box.inv_width),
+         quantize_(z[i], box.min[2], box.inv_width)};
+      keys[i] = compute_key_<curve>(coords);
+    }
+  }
+
+  /// Performs a stable LSD radix sort of keys (8 bits per pass). The values
+  /// are permuted alongside the keys.
+  ///
+  /// Each pass divides the arrays into nchunks contiguous chunks. A histogram
+  /// of digits is computed for each chunk in parallel. The output offsets
+  /// are ordered by digit and then by chunk (which keeps the sort stable)
+  /// before each chunk is scattered in parallel.
+  void radix_sort_(std::vector<std::uint64_t>& keys,
+                   std::vector<std::uint64_t>& vals, std::size_t nproc)
+  {
+    const std::size_t n = keys.size();
+    if (n <= 1) { return; }
+
+    std::uint64_t max_key = 0;
+    for (std::uint64_t key : keys) { max_key |= key; }
+
+    const std::size_t nchunks = std::max<std::size_t>(
+      1, std::min(nproc, n / 4096 + 1));
+    std::vector<std::array<std::size_t,256>> offsets(nchunks);
+    std::vector<std::uint64_t> tmp_keys(n), tmp_vals(n);
+
+    auto chunk_start = [=](std::size_t chunk){ return (n * chunk) / nchunks; };
+
+    for (int shift = 0; shift < 64; shift += 8){
+      if ((max_key >> shift) == 0) { break; } // remaining digits are all 0
+
+      const std::int64_t nchunks_i64 = static_cast<std::int64_t>(nchunks);
+
+      #pragma omp parallel num_threads(nchunks) if (nchunks > 1)
+      {
+        #pragma omp for schedule(static,1)
+        for (std::int64_t chunk = 0; chunk < nchunks_i64; chunk++){
+          std::array<std::size_t,256>& counts = offsets[chunk];
+          counts.fill(0);
+          for (std::size_t i = chunk_start(chunk);
+               i < chunk_start(chunk + 1); i++){
+            counts[(keys[i] >> shift) & 0xff]++;
+          }
+        }
+
+        #pragma omp single
+        {
+          std::size_t total = 0;
+          for (std::size_t digit = 0; digit < 256; digit++){
+            for (std::size_t chunk = 0; chunk < nchunks; chunk++){
+              const std::size_t count = offsets[chunk][digit];
+              offsets[chunk][digit] = total;
+              total += count;
+            }
+          }
+        }
+
+        #pragma omp for schedule(static,1)
+        for (std::int64_t chunk = 0; chunk < nchunks_i64; chunk++){
+          std::array<std::size_t,256>& dest = offsets[chunk];
+          for (std::size_t i = chunk_start(chunk);
+               i < chunk_start(chunk + 1); i++){
+            const std::size_t j = dest[(keys[i] >> shift) & 0xff]++;
+            tmp_keys[j] = keys[i];
+            tmp_vals[j] = vals[i];
+          }
+        }
+      }
+
+      keys.swap(tmp_keys);
+      vals.swap(tmp_vals);
+    }
+  }
+
+  void compute_permutation_(const PointProps& points, int curve,
+                            const double* box_min, double box_width,
+                            const ParallelSpec& parallel_spec,
+                            std::uint64_t* out_perm)
+  {
+    if (points.n_spatial_dims != 3){
+      error("points must have 3 spatial dimensions", VSF_NOT_IMPLEMENTED);
+    } else if ((points.n_points > 0) && (points.positions == nullptr)){
+      error("points.positions must not be a nullptr", VSF_INVALID_ARG);
+    } else if ((points.n_points > 0) && (out_perm == nullptr)){
+      error("out_perm must not be a nullptr", VSF_INVALID_ARG);
+    } else if (points.spatial_dim_stride < points.n_points){
+      error("points.spatial_dim_stride must be at least as large as the "
+            "number of points", VSF_INVALID_ARG);
+    }
+
+    const std::size_t nproc = (parallel_spec.force_sequential)
+      ? 1 : get_nominal_nproc(parallel_spec);
+    const std::size_t n = points.n_points;
+    if (n == 0) { return; }
+
+    const QuantizationBox box = build_box_(points, box_min, box_width);
+    std::vector<std::uint64_t> keys(n);
+    if (curve == VSF_CURVE_MORTON){
+      compute_keys_<VSF_CURVE_MORTON>(points, box, nproc, keys.data());
+    } else if (curve == VSF_CURVE_HILBERT){
+      compute_keys_<VSF_CURVE_HILBERT>(points, box, nproc, keys.data());
+    } else {
+      error("curve must be VSF_CURVE_MORTON or VSF_CURVE_HILBERT",
+            VSF_INVALID_ARG);
+    }
+
+    std::vector<std::uint64_t> perm(n);
+    for (std::size_t i = 0; i < n; i++){ perm[i] = i; }
+    radix_sort_(keys, perm, nproc);
+    std::memcpy(out_perm, perm.data(), n * sizeof(std::uint64_t));
+  }
+
+}
+
+int compute_spatial_sort_permutation(const PointProps points, int curve,
+                                     const double* box_min, double box_width,
+                                     const ParallelSpec parallel_spec,
+                                     uint64_t* out_perm,
+                                     VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    compute_permutation_(points, curve, box_min, box_width, parallel_spec,
+                         out_perm);
+  };
+  return catch_vsf_errors(err_info, impl);
+}
+
+int pointset_spatial_sort(void* handle, int curve,
+                          const ParallelSpec parallel_spec,
+                          uint64_t* out_perm, VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if (handle == nullptr){
+      error("handle must not be a nullptr", VSF_INVALID_ARG);
+    }
+    const PointProps props = pointset_props(handle);
+    const std::size_t n = props.n_points;
+    const std::size_t stride = props.spatial_dim_stride;
+    if (n == 0) { return; }
+
+    std::vector<std::uint64_t> perm(n);
+    compute_permutation_(props, curve, nullptr, 0.0, parallel_spec,
+                         perm.data());
+
+    // apply the permutation to each component (one at a time to limit the
+    // size of the scratch buffer)
+    std::vector<double> scratch(n);
+    for (double* buffer : {pointset_positions(handle),
+                           pointset_velocities(handle)}){
+      for (std::size_t dim = 0; dim < props.n_spatial_dims; dim++){
+        double* component = buffer + dim * stride;
+        for (std::size_t i = 0; i < n; i++){
+          scratch[i] = component[perm[i]];
+        }
+        std::memcpy(component, scratch.data(), n * sizeof(double));
+      }
+    }
+
+    if (out_perm != nullptr){
+      std::memcpy(out_perm, perm.data(), n * sizeof(std::uint64_t));
+    }
+  };
+  return catch_vsf_errors(err_info, impl);
+}
@@ -0,0 +1,71 @@
+#ifndef SPATIAL_SORT_H
+#define SPATIAL_SORT_H
+
+// Define the C interface for ordering points along a space-filling curve
+//
+// Points that are close together along a space-filling curve tend to be close
+// together in space. Sorting points in this way, improves the locality of
+// memory accesses in calculations that visit spatially adjacent points
+// together.
+
+#include "vsf.hpp"
+
+/// The space-filling curves that points can be sorted along
+enum VsfCurveKind{
+  VSF_CURVE_MORTON = 0,  // Z-order curve (cheap to compute)
+  VSF_CURVE_HILBERT = 1  // Hilbert curve (better locality)
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Computes the permutation that sorts points along a space-filling curve
+///
+/// Positions are quantized to 21 bits per axis within a cubic box (so each
+/// key fits in 63 bits). The keys are sorted with a stable, parallel LSD
+/// radix sort, so the result doesn't depend on the number of processes.
+///
+/// @param[in]  points The points to sort (only the positions are accessed).
+///     This must have 3 spatial dimensions.
+/// @param[in]  curve A VsfCurveKind value
+/// @param[in]  box_min An array of 3 values specifying the lower corner of
+///     the box used for quantization. When this is a nullptr, the bounding
+///     box of the points is used.
+/// @param[in]  box_width The width of the (cubic) box. This is ignored when
+///     box_min is a nullptr. Positions outside of the box are clamped.
+/// @param[in]  parallel_spec Specifies the number of processes
+/// @param[out] out_perm Array of ``points.n_points`` entries. The ith entry
+///     is set to the original index of the ith sorted point.
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns VSF_SUCCESS or an error code.
+int compute_spatial_sort_permutation(const PointProps points, int curve,
+                                     const double* box_min, double box_width,
+                                     const ParallelSpec parallel_spec,
+                                     uint64_t* out_perm,
+                                     VsfErrorInfo* err_info) noexcept;
+
+/// Sorts the contents of a point set (see point_set.hpp) in place along a
+/// space-filling curve (using the bounding box of the points)
+///
+/// @param[in,out] handle The point set
+/// @param[in]     curve A VsfCurveKind value
+/// @param[in]     parallel_spec Specifies the number of processes
+/// @param[out]    out_perm Optional array of ``n_points`` entries where the
+///     permutation is recorded (see compute_spatial_sort_permutation). This
+///     can be used to reorder associated data, like weights.
+/// @param[out]    err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns VSF_SUCCESS or an error code.
+int pointset_spatial_sort(void* handle, int curve,
+                          const ParallelSpec parallel_spec,
+                          uint64_t* out_perm, VsfErrorInfo* err_info) noexcept;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPATIAL_SORT_H */
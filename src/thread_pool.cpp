@@ -0,0 +1,209 @@
+#include <chrono>
+#include <exception> // std::exception_ptr
+#include <string>
+#include <thread>
+
+#include "thread_pool.hpp"
+#include "partition.hpp" // get_nominal_nproc
+#include "utils.hpp"
+
+namespace{
+
+  /// How long an idle thread polls for new work before it blocks. Polling
+  /// avoids the latency of waking the threads for back-to-back calls.
+  const std::chrono::microseconds SPIN_DURATION(100);
+
+  /// Polls pred until it returns true or SPIN_DURATION elapses. Returns the
+  /// final value of pred.
+  template<typename Pred>
+  bool spin_until_(Pred&& pred) noexcept {
+    const auto start = std::chrono::steady_clock::now();
+    while (!pred()){
+      if ((std::chrono::steady_clock::now() - start) > SPIN_DURATION) {
+        return false;
+      }
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+}
+
+VsfThreadPool::VsfThreadPool(std::size_t nthreads)
+  : threads_(),
+    scratch_(),
+    call_mutex_(),
+    mutex_(),
+    work_cv_(),
+    done_cv_(),
+    generation_(0),
+    stop_(false),
+    n_busy_(0),
+    task_(nullptr),
+    n_tasks_(0),
+    next_task_(0),
+    first_exception_(nullptr)
+{
+  if (nthreads == 0) { error("nthreads must be positive", VSF_INVALID_ARG); }
+
+  threads_.reserve(nthreads - 1);
+  try {
+    for (std::size_t i = 1; i < nthreads; i++){
+      threads_.emplace_back([this](){ worker_loop_(); });
+    }
+  } catch (...) {
+    // the destructor isn't called when the constructor throws
+    shutdown_();
+    throw;
+  }
+}
+
+VsfThreadPool::~VsfThreadPool() { shutdown_(); }
+
+void VsfThreadPool::shutdown_() noexcept {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stop_ = true;
+    generation_++;
+  }
+  work_cv_.notify_all();
+  for (std::thread& thread : threads_) { thread.join(); }
+  threads_.clear();
+}
+
+void VsfThreadPool::worker_loop_() {
+  std::uint64_t seen_generation = 0;
+  while (true) {
+    auto has_new_batch = [&]() { return generation_ != seen_generation; };
+    spin_until_(has_new_batch);
+    {
+      // even after a successful spin, we acquire the mutex so that the
+      // description of the batch is visible to this thread
+      std::unique_lock<std::mutex> guard(mutex_);
+      work_cv_.wait(guard, has_new_batch);
+      seen_generation = generation_;
+      if (stop_) { return; }
+    }
+
+    claim_tasks_();
+
+    // run() doesn't start another batch until every thread has checked in,
+    // so a thread never misses a batch
+    if (n_busy_.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> guard(mutex_);
+      done_cv_.notify_one();
+    }
+  }
+}
+
+void VsfThreadPool::claim_tasks_() noexcept {
+  const std::size_t n_tasks = n_tasks_;
+  for (std::size_t i = next_task_++; i < n_tasks; i = next_task_++){
+    try {
+      (*task_)(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (first_exception_ == nullptr) {
+        first_exception_ = std::current_exception();
+      }
+    }
+  }
+}
+
+void VsfThreadPool::run(std::size_t n_tasks, bool use_parallel,
+                        const std::function<void(std::size_t)>& task)
+{
+  if (scratch_.size() < n_tasks) { scratch_.resize(n_tasks); }
+
+  if ((!use_parallel) || threads_.empty() || (n_tasks <= 1)) {
+    std::exception_ptr first_exception = nullptr;
+    for (std::size_t i = 0; i < n_tasks; i++){
+      try {
+        task(i);
+      } catch (...) {
+        if (first_exception == nullptr) {
+          first_exception = std::current_exception();
+        }
+      }
+    }
+    if (first_exception != nullptr) {
+      std::rethrow_exception(first_exception);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    task_ = &task;
+    n_tasks_ = n_tasks;
+    next_task_ = 0;
+    first_exception_ = nullptr;
+    n_busy_ = threads_.size();
+    generation_++;
+  }
+  work_cv_.notify_all();
+
+  // the calling thread participates
+  claim_tasks_();
+
+  auto batch_done = [&]() { return n_busy_ == 0; };
+  if (!spin_until_(batch_done)) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    done_cv_.wait(guard, batch_done);
+  }
+
+  std::exception_ptr first_exception = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    task_ = nullptr;
+    std::swap(first_exception, first_exception_);
+  }
+  if (first_exception != nullptr) { std::rethrow_exception(first_exception); }
+}
+
+void* vsfpool_create(size_t nthreads, VsfErrorInfo* err_info) noexcept {
+  VsfThreadPool* out = nullptr;
+
+  auto impl = [&]()
+  {
+    const std::size_t n = (nthreads == 0)
+      ? get_nominal_nproc(ParallelSpec{0, false, nullptr}) : nthreads;
+    out = new VsfThreadPool(n);
+  };
+
+  if (catch_vsf_errors(err_info, impl) != VSF_SUCCESS) {
+    delete out;
+    return nullptr;
+  }
+  return static_cast<void*>(out);
+}
+
+void vsfpool_destroy(void* handle) noexcept {
+  delete static_cast<VsfThreadPool*>(handle);
+}
+
+size_t vsfpool_nthreads(const void* handle) noexcept {
+  if (handle == nullptr) { return 0; }
+  return static_cast<const VsfThreadPool*>(handle)->nthreads();
+}
+
+int vsfpool_run_test_tasks(void* handle, size_t n_tasks, size_t failing_task,
+                           uint64_t* counts, VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if ((handle == nullptr) || (counts == nullptr)) {
+      error("handle and counts must not be nullptrs", VSF_INVALID_ARG);
+    }
+    VsfThreadPool& pool = *static_cast<VsfThreadPool*>(handle);
+    std::unique_lock<std::mutex> pool_lock = pool.lock();
+    pool.run(n_tasks, true, [&](std::size_t i)
+      {
+        counts[i]++;
+        if (i == failing_task) {
+          error("task " + std::to_string(i) + " failed", VSF_INVALID_ARG);
+        }
+      });
+  };
+  return catch_vsf_errors(err_info, impl);
+}
@@ -0,0 +1,139 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Define the C interface for a persistent pool of worker threads
+//
+// Without a pool, every calculation that uses multiple processes launches an
+// OpenMP team and clones the accumulators for each process. For small
+// calculations (like the many cross terms computed by small_dist_sf_props),
+// that fixed overhead can rival the actual work. A pool keeps its threads and
+// the accumulators of each process alive between calls (the accumulators are
+// reset, rather than reallocated, when the next call uses the same
+// statistics and bins). A pool is used by passing its handle as the pool
+// member of ParallelSpec.
+
+#include "vsf.hpp"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Creates a pool and returns a handle to it
+///
+/// @param[in]  nthreads The number of threads (including the calling thread)
+///     that evaluate each calculation. A value of 0 falls back to
+///     OMP_NUM_THREADS.
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+///
+/// @returns The handle. A nullptr is returned if there was an error.
+void* vsfpool_create(size_t nthreads, VsfErrorInfo* err_info) noexcept;
+
+/// Stops the threads of the pool and deallocates it. This must not be called
+/// while a calculation is using the pool.
+void vsfpool_destroy(void* handle) noexcept;
+
+/// Returns the number of threads used by the pool (including the calling
+/// thread). A value of 0 is returned when handle is a nullptr.
+size_t vsfpool_nthreads(const void* handle) noexcept;
+
+/// Runs a batch of n_tasks trivial tasks on the pool. This exists purely for
+/// testing how the pool handles errors raised inside of its tasks.
+///
+/// Task i increments counts[i]. The task with index failing_task raises an
+/// error (after incrementing its count) that is reported through err_info.
+/// Pass a failing_task that is at least n_tasks to run a batch without errors.
+int vsfpool_run_test_tasks(void* handle, size_t n_tasks, size_t failing_task,
+                           uint64_t* counts, VsfErrorInfo* err_info) noexcept;
+
+#ifdef __cplusplus
+}
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception> // std::exception_ptr
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "accum_col_variant.hpp"
+
+/// A persistent team of threads that evaluates batches of tasks.
+///
+/// Each batch consists of the tasks ``[0, n_tasks)``. The calling thread
+/// participates, and the other threads take the next unclaimed task until
+/// none remain. A batch may only be submitted by a thread that holds the lock
+/// returned by ``lock()`` (calls from different threads are serialized).
+class VsfThreadPool{
+public:
+  explicit VsfThreadPool(std::size_t nthreads);
+  ~VsfThreadPool();
+
+  VsfThreadPool(const VsfThreadPool&) = delete;
+  VsfThreadPool& operator=(const VsfThreadPool&) = delete;
+
+  std::size_t nthreads() const noexcept { return threads_.size() + 1; }
+
+  /// Reserves the pool (including its scratch space) for a single caller
+  std::unique_lock<std::mutex> lock() {
+    return std::unique_lock<std::mutex>(call_mutex_);
+  }
+
+  /// Calls task(i) for each i in [0, n_tasks) and waits for them to finish.
+  ///
+  /// When use_parallel is false, every task is evaluated by the calling
+  /// thread. The first exception raised by a task is rethrown (after all of
+  /// the other tasks complete).
+  void run(std::size_t n_tasks, bool use_parallel,
+           const std::function<void(std::size_t)>& task);
+
+  /// Returns the cached accumulator collections of the ith task (where i is
+  /// less than the n_tasks of the latest call to run). The lock must be held.
+  std::vector<AccumColVariant>& scratch(std::size_t i) { return scratch_[i]; }
+
+private:
+  void worker_loop_();
+  void claim_tasks_() noexcept;
+  void shutdown_() noexcept;
+
+private:
+  std::vector<std::thread> threads_;
+  std::vector<std::vector<AccumColVariant>> scratch_;
+
+  std::mutex call_mutex_;
+
+  // the following describe the current batch (they're modified while mutex_
+  // is held)
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::atomic<std::uint64_t> generation_;
+  bool stop_;
+  std::atomic<std::size_t> n_busy_; // threads still working on the batch
+  const std::function<void(std::size_t)>* task_;
+  std::size_t n_tasks_;
+  std::atomic<std::size_t> next_task_;
+  std::exception_ptr first_exception_;
+};
+
+/// Resets slot to a copy of proto and returns a reference to it.
+///
+/// When slot already holds an AccumCollection with the same shape, the copy
+/// reuses its existing heap allocations.
+template<typename AccumCollection>
+AccumCollection& reset_cached_accum(AccumColVariant& slot,
+                                    const AccumCollection& proto)
+{
+  if (AccumCollection* ptr = std::get_if<AccumCollection>(&slot)) {
+    *ptr = proto;
+    return *ptr;
+  }
+  slot = proto;
+  return std::get<AccumCollection>(slot);
+}
+
+#endif
+
+#endif /* THREAD_POOL_H */
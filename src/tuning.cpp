@@ -0,0 +1,503 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "tuning.hpp"
+#include "utils.hpp"
+
+namespace{
+
+  std::mutex& tuning_mutex_(){
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  // a function-local static avoids issues with the order of static
+  // initialization
+  VsfTuning& active_tuning_(){
+    static VsfTuning tuning = default_vsf_tuning();
+    return tuning;
+  }
+
+  void validate_tuning_(const VsfTuning& tuning){
+    const double vals[4] = {tuning.pair_ns, tuning.hist_pair_ns,
+                            tuning.team_overhead_ns, tuning.proc_overhead_ns};
+    for (double val : vals){
+      if (!(std::isfinite(val) && (val >= 0))){
+        error("the floating point tuning parameters must be finite and "
+              "non-negative", VSF_INVALID_ARG);
+      }
+    }
+    if (tuning.auto_chunks_per_proc == 0){
+      error("auto_chunks_per_proc must be positive", VSF_INVALID_ARG);
+    }
+  }
+
+  void set_active_tuning_(const VsfTuning& tuning){
+    validate_tuning_(tuning);
+    std::lock_guard<std::mutex> lock(tuning_mutex_());
+    active_tuning_() = tuning;
+  }
+
+  const int TUNING_FORMAT_VERSION = 1;
+
+  // --------------------------------------------------------------------
+  // machinery for calibration
+  // --------------------------------------------------------------------
+
+  /// Points with uniformly distributed positions and velocities
+  struct CalibrationPoints{
+    std::vector<double> positions;
+    std::vector<double> velocities;
+    std::size_t n_points;
+
+    CalibrationPoints(std::size_t n, std::uint64_t seed)
+      : positions(3*n), velocities(3*n), n_points(n)
+    {
+      // xorshift64 is plenty for generating benchmark inputs
+      std::uint64_t state = 0x9E3779B97F4A7C15ULL ^
+        (seed * 0xBF58476D1CE4E5B9ULL);
+      auto next = [&]()
+        {
+          state ^= state << 13;
+          state ^= state >> 7;
+          state ^= state << 17;
+          return static_cast<double>(state >> 11) * 0x1.0p-53;
+        };
+      for (auto& val : positions){ val = next(); }
+      for (auto& val : velocities){ val = next(); }
+    }
+
+    PointProps props(std::size_t n) const noexcept {
+      return {positions.data(), velocities.data(), std::min(n, n_points), 3,
+              n_points};
+    }
+  };
+
+  class CalibrationProblem{
+  public:
+    CalibrationProblem(std::size_t nbins, bool histogram)
+      : bin_edges_(nbins+1), val_bin_edges_(33), nbins_(nbins),
+        hist_bins_{}, stat_list_{}
+    {
+      // the separations between points in the unit cube don't exceed sqrt(3)
+      for (std::size_t i = 0; i <= nbins; i++){
+        bin_edges_[i] = 1.75 * double(i) / double(nbins);
+      }
+      for (std::size_t i = 0; i < val_bin_edges_.size(); i++){
+        val_bin_edges_[i] = 2.0 * double(i) / double(val_bin_edges_.size()-1);
+      }
+      hist_bins_ = {val_bin_edges_.data(), val_bin_edges_.size() - 1};
+      if (histogram){
+        stat_list_ = {"histogram", static_cast<void*>(&hist_bins_)};
+      } else {
+        stat_list_ = {"variance", nullptr};
+      }
+      flt_vals_.resize(8*nbins);
+      i64_vals_.resize(val_bin_edges_.size()*nbins);
+    }
+
+    /// Returns the minimum duration of the calculation (in nanoseconds)
+    /// when it uses the specified tuning parameters
+    double time_ns(const VsfTuning& tuning, const PointProps& points_a,
+                   const PointProps& points_b, std::size_t nproc, int reps){
+      const ParallelSpec parallel_spec = {nproc, false};
+      double best = std::numeric_limits<double>::infinity();
+      for (int i = 0; i < reps; i++){
+        const auto start = std::chrono::steady_clock::now();
+        VsfErrorInfo err_info;
+        int code = calc_vsf_props_with_tuning(tuning, points_a, points_b,
+                                              &stat_list_, 1,
+                                              bin_edges_.data(), nbins_,
+                                              parallel_spec, flt_vals_.data(),
+                                              i64_vals_.data(), nullptr,
+                                              &err_info);
+        const auto stop = std::chrono::steady_clock::now();
+        if (code != VSF_SUCCESS) { error(err_info.message, code); }
+        best = std::min(best, std::chrono::duration<double, std::nano>
+                                (stop - start).count());
+      }
+      return best;
+    }
+
+    /// Returns the minimum duration of an auto-structure function
+    /// calculation (in nanoseconds). Unlike calc_vsf_props,
+    /// calc_sf_props_batched partitions auto-structure functions between
+    /// processes
+    double time_auto_ns(const VsfTuning& tuning, const PointProps& points,
+                        std::size_t nproc, int reps){
+      const ParallelSpec parallel_spec = {nproc, false};
+      const QuanDiffSpec quan_spec = {VSF_QUAN_ABS_DIFF, 3};
+      const VsfBatchTerm term = {0, VSF_BATCH_AUTO, 0};
+      double* flt_vals = flt_vals_.data();
+      std::int64_t* i64_vals = i64_vals_.data();
+      double best = std::numeric_limits<double>::infinity();
+      for (int i = 0; i < reps; i++){
+        const auto start = std::chrono::steady_clock::now();
+        VsfErrorInfo err_info;
+        int code = calc_sf_props_batched_with_tuning(tuning, &points, 1,
+                                                     &term, 1, &stat_list_, 1,
+                                                     bin_edges_.data(), nbins_,
+                                                     quan_spec, parallel_spec,
+                                                     1, &flt_vals, &i64_vals,
+                                                     nullptr, &err_info);
+        const auto stop = std::chrono::steady_clock::now();
+        if (code != VSF_SUCCESS) { error(err_info.message, code); }
+        best = std::min(best, std::chrono::duration<double, std::nano>
+                                (stop - start).count());
+      }
+      return best;
+    }
+
+  private:
+    std::vector<double> bin_edges_;
+    std::vector<double> val_bin_edges_;
+    std::size_t nbins_;
+    BinSpecification hist_bins_;
+    StatListItem stat_list_;
+    std::vector<double> flt_vals_;
+    std::vector<std::int64_t> i64_vals_;
+  };
+
+  /// Measures the largest number of distance bins for which the linear
+  /// search is faster than the binary search
+  std::uint64_t calibrate_linear_search_(const CalibrationPoints& points_a,
+                                         const CalibrationPoints& points_b,
+                                         VsfTuning tuning){
+    const std::size_t n = 512;
+    std::uint64_t out = 0;
+    for (std::uint64_t nbins = 2; nbins <= 128; nbins *= 2){
+      CalibrationProblem problem(nbins, false);
+
+      tuning.linear_search_max_nbins = nbins;
+      const double linear_ns = problem.time_ns(tuning, points_a.props(n),
+                                               points_b.props(n), 1, 3);
+      tuning.linear_search_max_nbins = 0;
+      const double binary_ns = problem.time_ns(tuning, points_a.props(n),
+                                               points_b.props(n), 1, 3);
+      if (linear_ns >= binary_ns) { break; }
+      out = nbins;
+    }
+    return out;
+  }
+
+  /// Measures the number of partitions per process that minimizes the
+  /// duration of an auto-structure function calculation with nproc processes
+  std::uint64_t calibrate_auto_chunks_(const CalibrationPoints& points,
+                                       std::size_t nproc, VsfTuning tuning){
+    const std::size_t n = 1024;
+    CalibrationProblem problem(32, false);
+
+    std::uint64_t out = tuning.auto_chunks_per_proc;
+    double best_ns = std::numeric_limits<double>::infinity();
+    for (std::uint64_t chunks_per_proc : {1, 2, 3, 4, 6, 8}){
+      tuning.auto_chunks_per_proc = chunks_per_proc;
+      const double t = problem.time_auto_ns(tuning, points.props(n), nproc,
+                                            5);
+      if (t < best_ns){
+        best_ns = t;
+        out = chunks_per_proc;
+      }
+    }
+    return out;
+  }
+
+}
+
+void vsf_default_tuning(VsfTuning* out) noexcept {
+  if (out != nullptr) { *out = default_vsf_tuning(); }
+}
+
+VsfTuning get_active_vsf_tuning() noexcept {
+  std::lock_guard<std::mutex> lock(tuning_mutex_());
+  return active_tuning_();
+}
+
+std::size_t choose_nproc(const VsfTuning& tuning, std::size_t max_nproc,
+                         double npairs, bool computes_histogram) noexcept
+{
+  if ((tuning.pair_ns <= 0) || (max_nproc <= 1)) {
+    return std::max<std::size_t>(max_nproc, 1);
+  }
+
+  const double pair_ns = tuning.pair_ns +
+    ((computes_histogram) ? tuning.hist_pair_ns : 0.0);
+  const double work_ns = npairs * pair_ns;
+
+  std::size_t best_nproc = 1;
+  double best_cost = work_ns;
+  for (std::size_t p = 2; p <= max_nproc; p++){
+    const double cost = (work_ns / p) + tuning.team_overhead_ns +
+      p * tuning.proc_overhead_ns;
+    if (cost < best_cost){
+      best_cost = cost;
+      best_nproc = p;
+    }
+  }
+  return best_nproc;
+}
+
+int vsf_get_tuning(VsfTuning* out, VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if (out == nullptr) { error("out must not be a nullptr", VSF_INVALID_ARG); }
+    *out = get_active_vsf_tuning();
+  };
+  return catch_vsf_errors(err_info, impl);
+}
+
+int vsf_set_tuning(const VsfTuning* tuning, VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if (tuning == nullptr) {
+      error("tuning must not be a nullptr", VSF_INVALID_ARG);
+    }
+    set_active_tuning_(*tuning);
+  };
+  return catch_vsf_errors(err_info, impl);
+}
+
+int vsf_calibrate(std::size_t max_nproc, VsfTuning* out,
+                  VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if (out == nullptr) { error("out must not be a nullptr", VSF_INVALID_ARG); }
+    if (max_nproc == 0) {
+      max_nproc = static_cast<std::size_t>(omp_get_max_threads());
+    }
+
+    // the measurements explicitly use these parameters (the active ones are
+    // never modified): the defaults, with the cost model & small problem
+    // checks disabled (so that the calculations do exactly what we ask)
+    VsfTuning bench_tuning = default_vsf_tuning();
+    bench_tuning.small_auto_n_points = 0;
+    bench_tuning.small_cross_npairs = 0;
+
+    VsfTuning tuning = bench_tuning;
+
+    const CalibrationPoints points_a(1024, 1);
+    const CalibrationPoints points_b(1024, 2);
+
+    // 1. measure the cost per pair
+    const std::size_t n_large = 1024;
+    const double npairs_large = double(n_large) * double(n_large);
+    CalibrationProblem var_problem(32, false);
+    CalibrationProblem hist_problem(32, true);
+    tuning.pair_ns = var_problem.time_ns(bench_tuning,
+                                         points_a.props(n_large),
+                                         points_b.props(n_large), 1, 3)
+      / npairs_large;
+    tuning.hist_pair_ns = std::max(
+      0.0, hist_problem.time_ns(bench_tuning, points_a.props(n_large),
+                                points_b.props(n_large), 1, 3)
+      / npairs_large - tuning.pair_ns);
+
+    // 2. choose the kernel variant
+    tuning.linear_search_max_nbins =
+      calibrate_linear_search_(points_a, points_b, bench_tuning);
+
+    // 3. measure the overhead of using a team of processes. We use a problem
+    //    so small that the time is dominated by overhead. We fit
+    //    ``overhead = team_overhead_ns + p * proc_overhead_ns``
+    tuning.team_overhead_ns = 0.0;
+    tuning.proc_overhead_ns = 0.0;
+    if (max_nproc > 1){
+      const std::size_t n_small = 64;
+      const double small_work_ns = double(n_small) * double(n_small) *
+        tuning.pair_ns;
+
+      std::vector<double> p_vals, overhead_vals;
+      for (std::size_t p = 2; p <= max_nproc; p = (p < 8) ? p + 1 : 2 * p){
+        const double t = var_problem.time_ns(bench_tuning,
+                                             points_a.props(n_small),
+                                             points_b.props(n_small), p, 50);
+        p_vals.push_back(double(p));
+        overhead_vals.push_back(std::max(0.0, t - small_work_ns / p));
+      }
+
+      if (p_vals.size() == 1){
+        tuning.team_overhead_ns = overhead_vals[0];
+      } else {
+        // ordinary least squares
+        const double n = double(p_vals.size());
+        double sum_p = 0, sum_o = 0, sum_pp = 0, sum_po = 0;
+        for (std::size_t i = 0; i < p_vals.size(); i++){
+          sum_p += p_vals[i];
+          sum_o += overhead_vals[i];
+          sum_pp += p_vals[i] * p_vals[i];
+          sum_po += p_vals[i] * overhead_vals[i];
+        }
+        const double slope = (n * sum_po - sum_p * sum_o) /
+          (n * sum_pp - sum_p * sum_p);
+        tuning.proc_overhead_ns = std::max(0.0, slope);
+        tuning.team_overhead_ns = std::max(
+          0.0, (sum_o - tuning.proc_overhead_ns * sum_p) / n);
+      }
+    }
+
+    // 4. derive the small problem thresholds. Below these, using 2 processes
+    //    is predicted to be slower than using 1
+    const double breakeven_npairs = (tuning.pair_ns > 0)
+      ? 2.0 * (tuning.team_overhead_ns + 2.0 * tuning.proc_overhead_ns) /
+        tuning.pair_ns
+      : 0.0;
+    tuning.small_cross_npairs =
+      static_cast<std::uint64_t>(std::ceil(breakeven_npairs));
+    tuning.small_auto_n_points =
+      static_cast<std::uint64_t>(std::ceil(std::sqrt(2.0 * breakeven_npairs)))
+      + 1;
+
+    // 5. choose how finely auto-structure function calculations are
+    //    partitioned (this only matters when multiple processes are used)
+    if (max_nproc > 1){
+      tuning.auto_chunks_per_proc =
+        calibrate_auto_chunks_(points_a, max_nproc, bench_tuning);
+    }
+
+    validate_tuning_(tuning);
+    *out = tuning;
+  };
+  return catch_vsf_errors(err_info, impl);
+}
+
+int vsf_save_tuning(const VsfTuning* tuning, const char* path,
+                    VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if ((tuning == nullptr) || (path == nullptr)) {
+      error("tuning and path must not be nullptrs", VSF_INVALID_ARG);
+    }
+    validate_tuning_(*tuning);
+
+    std::FILE* f = std::fopen(path, "w");
+    if (f == nullptr) {
+      error(std::string("unable to open \"") + path + "\" for writing",
+            VSF_INVALID_ARG);
+    }
+    std::fprintf(f, "# libvsf tuning parameters\n");
+    std::fprintf(f, "format_version = %d\n", TUNING_FORMAT_VERSION);
+    std::fprintf(f, "pair_ns = %.17g\n", tuning->pair_ns);
+    std::fprintf(f, "hist_pair_ns = %.17g\n", tuning->hist_pair_ns);
+    std::fprintf(f, "team_overhead_ns = %.17g\n", tuning->team_overhead_ns);
+    std::fprintf(f, "proc_overhead_ns = %.17g\n", tuning->proc_overhead_ns);
+    std::fprintf(f, "small_auto_n_points = %llu\n",
+                 (unsigned long long)tuning->small_auto_n_points);
+    std::fprintf(f, "small_cross_npairs = %llu\n",
+                 (unsigned long long)tuning->small_cross_npairs);
+    std::fprintf(f, "auto_chunks_per_proc = %llu\n",
+                 (unsigned long long)tuning->auto_chunks_per_proc);
+    std::fprintf(f, "linear_search_max_nbins = %llu\n",
+                 (unsigned long long)tuning->linear_search_max_nbins);
+    if (std::fclose(f) != 0) {
+      error(std::string("problem writing to \"") + path + "\"",
+            VSF_INTERNAL_ERROR);
+    }
+  };
+  return catch_vsf_errors(err_info, impl);
+}
+
+int vsf_load_tuning(const char* path, VsfTuning* out,
+                    VsfErrorInfo* err_info) noexcept
+{
+  auto impl = [&]()
+  {
+    if ((path == nullptr) || (out == nullptr)) {
+      error("path and out must not be nullptrs", VSF_INVALID_ARG);
+    }
+    std::ifstream f(path);
+    if (!f.is_open()) {
+      error(std::string("unable to open \"") + path + "\"", VSF_INVALID_ARG);
+    }
+
+    auto strip = [](const std::string& str)
+      {
+        const std::size_t start = str.find_first_not_of(" \t\r");
+        if (start == std::string::npos) { return std::string(); }
+        const std::size_t stop = str.find_last_not_of(" \t\r");
+        return str.substr(start, stop - start + 1);
+      };
+
+    VsfTuning tuning = default_vsf_tuning();
+    bool found_version = false;
+    std::string line;
+    std::size_t line_num = 0;
+    while (std::getline(f, line)){
+      line_num++;
+      line = strip(line.substr(0, line.find('#')));
+      if (line.empty()) { continue; }
+
+      const std::size_t sep = line.find('=');
+      if (sep == std::string::npos) {
+        error("line " + std::to_string(line_num) + " of \"" + path +
+              "\" isn't a \"key = value\" pair", VSF_INVALID_ARG);
+      }
+      const std::string key = strip(line.substr(0, sep));
+      const std::string val = strip(line.substr(sep + 1));
+
+      std::istringstream stream(val);
+      double dbl_val = 0.0;
+      unsigned long long int_val = 0;
+      const bool is_int_key = ((key == "format_version") ||
+                               (key == "small_auto_n_points") ||
+                               (key == "small_cross_npairs") ||
+                               (key == "auto_chunks_per_proc") ||
+                               (key == "linear_search_max_nbins"));
+      if (is_int_key) { stream >> int_val; } else { stream >> dbl_val; }
+      if (stream.fail() || !stream.eof()) {
+        error("invalid value for \"" + key + "\" on line " +
+              std::to_string(line_num) + " of \"" + path + "\"",
+              VSF_INVALID_ARG);
+      }
+
+      if (key == "format_version") {
+        if (int_val != TUNING_FORMAT_VERSION) {
+          error("unsupported tuning file format_version: " + val,
+                VSF_INVALID_ARG);
+        }
+        found_version = true;
+      } else if (key == "pair_ns") {
+        tuning.pair_ns = dbl_val;
+      } else if (key == "hist_pair_ns") {
+        tuning.hist_pair_ns = dbl_val;
+      } else if (key == "team_overhead_ns") {
+        tuning.team_overhead_ns = dbl_val;
+      } else if (key == "proc_overhead_ns") {
+        tuning.proc_overhead_ns = dbl_val;
+      } else if (key == "small_auto_n_points") {
+        tuning.small_auto_n_points = int_val;
+      } else if (key == "small_cross_npairs") {
+        tuning.small_cross_npairs = int_val;
+      } else if (key == "auto_chunks_per_proc") {
+        tuning.auto_chunks_per_proc = int_val;
+      } else if (key == "linear_search_max_nbins") {
+        tuning.linear_search_max_nbins = int_val;
+      } else {
+        error("unknown key, \"" + key + "\", in \"" + path + "\"",
+              VSF_INVALID_ARG);
+      }
+    }
+
+    if (!found_version) {
+      error(std::string("\"") + path + "\" doesn't specify format_version",
+            VSF_INVALID_ARG);
+    }
+    validate_tuning_(tuning);
+    *out = tuning;
+  };
+  return catch_vsf_errors(err_info, impl);
+}
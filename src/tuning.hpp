@@ -0,0 +1,145 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+// Define the C interface for the machine-specific cost model that guides
+// how calc_vsf_props parallelizes (and bins) a calculation
+
+#include "vsf.hpp"
+
+/// Holds the parameters of a simple cost model for calc_vsf_props.
+///
+/// The predicted time (in nanoseconds) to evaluate ``npairs`` pairs with
+/// ``p`` processes is
+///
+///     npairs * pair_ns / p + (p > 1) * (team_overhead_ns + p * proc_overhead_ns)
+///
+/// (``hist_pair_ns`` is added to ``pair_ns`` when a histogram is computed).
+/// When ``pair_ns`` is 0, the cost model is disabled and the nominal number
+/// of processes is always used (this is the default).
+///
+/// The values are normally measured by vsf_calibrate and persisted with
+/// vsf_save_tuning.
+struct VsfTuning{
+  /// Time to evaluate a single pair with a single process
+  double pair_ns;
+  /// Additional time per pair when a histogram is accumulated
+  double hist_pair_ns;
+  /// Fixed cost of launching a team of processes (and merging the results)
+  double team_overhead_ns;
+  /// Additional cost of each process in a team (mostly from cloning and
+  /// consolidating accumulators)
+  double proc_overhead_ns;
+  /// Auto-structure function calculations with no more points than this are
+  /// never partitioned
+  uint64_t small_auto_n_points;
+  /// Cross-structure function calculations with no more pairs than this are
+  /// never partitioned
+  uint64_t small_cross_npairs;
+  /// Each axis of the distance matrix of an auto-structure function is split
+  /// into enough segments that there are at least this many partitions per
+  /// process
+  uint64_t auto_chunks_per_proc;
+  /// When the number of distance bins doesn't exceed this value, a linear
+  /// search is used to identify the distance bin (rather than a binary
+  /// search)
+  uint64_t linear_search_max_nbins;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Writes the default tuning parameters to out. These reproduce the
+/// historical (hard-coded) behavior of the library.
+void vsf_default_tuning(VsfTuning* out) noexcept;
+
+/// Copies the tuning parameters that are currently used by the library
+int vsf_get_tuning(VsfTuning* out, VsfErrorInfo* err_info) noexcept;
+
+/// Replaces the tuning parameters used by the library.
+///
+/// This should not be called while another thread is executing calc_vsf_props
+int vsf_set_tuning(const VsfTuning* tuning, VsfErrorInfo* err_info) noexcept;
+
+/// Measures the tuning parameters for the current machine.
+///
+/// This takes a few seconds. The parameters used by the library are not
+/// modified (pass the result to vsf_set_tuning).
+///
+/// @param[in]  max_nproc The largest number of processes that will be used
+/// @param[out] out Where the measured parameters are written
+/// @param[out] err_info Records details about any errors. This can be a
+///     nullptr.
+int vsf_calibrate(size_t max_nproc, VsfTuning* out,
+                  VsfErrorInfo* err_info) noexcept;
+
+/// Writes tuning parameters to a text file (as ``key = value`` lines)
+int vsf_save_tuning(const VsfTuning* tuning, const char* path,
+                    VsfErrorInfo* err_info) noexcept;
+
+/// Reads tuning parameters from a file written by vsf_save_tuning. Keys that
+/// are missing from the file retain their default values.
+int vsf_load_tuning(const char* path, VsfTuning* out,
+                    VsfErrorInfo* err_info) noexcept;
+
+#ifdef __cplusplus
+}
+
+/// Returns the default tuning parameters (this is usable from header-only
+/// code that doesn't link against the library)
+inline VsfTuning default_vsf_tuning() noexcept {
+  VsfTuning out{};
+  out.pair_ns = 0.0;
+  out.hist_pair_ns = 0.0;
+  out.team_overhead_ns = 0.0;
+  out.proc_overhead_ns = 0.0;
+  out.small_auto_n_points = 1000;
+  out.small_cross_npairs = 1000;
+  out.auto_chunks_per_proc = 3;
+  out.linear_search_max_nbins = 0;
+  return out;
+}
+
+/// Returns a copy of the tuning parameters currently used by the library
+VsfTuning get_active_vsf_tuning() noexcept;
+
+/// Same as calc_vsf_props, except that the calculation uses tuning (instead
+/// of the parameters currently used by the library)
+int calc_vsf_props_with_tuning(const VsfTuning& tuning,
+                               const PointProps points_a,
+                               const PointProps points_b,
+                               const StatListItem* stat_list,
+                               std::size_t stat_list_len,
+                               const double *bin_edges, std::size_t nbins,
+                               const ParallelSpec parallel_spec,
+                               double *out_flt_vals, int64_t *out_i64_vals,
+                               VsfInstrumentation* instrumentation,
+                               VsfErrorInfo* err_info) noexcept;
+
+/// Same as calc_sf_props_batched, except that the calculation uses tuning
+/// (instead of the parameters currently used by the library)
+int calc_sf_props_batched_with_tuning(const VsfTuning& tuning,
+                                      const PointProps* point_sets,
+                                      std::size_t n_point_sets,
+                                      const VsfBatchTerm* terms,
+                                      std::size_t n_terms,
+                                      const StatListItem* stat_list,
+                                      std::size_t stat_list_len,
+                                      const double *bin_edges,
+                                      std::size_t nbins,
+                                      const QuanDiffSpec quan_spec,
+                                      const ParallelSpec parallel_spec,
+                                      std::size_t n_outputs,
+                                      double * const *out_flt_vals,
+                                      int64_t * const *out_i64_vals,
+                                      VsfInstrumentation* instrumentation,
+                                      VsfErrorInfo* err_info) noexcept;
+
+/// Uses the cost model to choose the number of processes (between 1 and
+/// max_nproc) to evaluate npairs pairs with.
+std::size_t choose_nproc(const VsfTuning& tuning, std::size_t max_nproc,
+                         double npairs, bool computes_histogram) noexcept;
+
+#endif
+
+#endif /* TUNING_H */
@@ -2,25 +2,81 @@
 #define UTILS_H
 
 #include <cstdio>
-#include <execinfo.h>
+#include <cstring> // std::strncpy
+#include <exception>
+#include <new> // std::bad_alloc
+#include <stdexcept>
+#include <string>
 
-[[noreturn]] inline void error(const char* message){
+#include "vsf.hpp" // VsfErrorCode, VsfErrorInfo
+
+/// Exception used to report errors from within the library.
+///
+/// These should never escape the C interface. Each entry point catches them
+/// and translates them into a VsfErrorInfo (see catch_vsf_errors)
+class VsfError : public std::runtime_error{
+public:
+  VsfError(const std::string& message, int code)
+    : std::runtime_error(message), code_(code)
+  { }
+
+  int code() const noexcept { return code_; }
+
+private:
+  int code_;
+};
+
+[[noreturn]] inline void error(const char* message,
+                               int code = VSF_INTERNAL_ERROR){
   if (message == nullptr){
-    std::printf("ERROR\n");
+    throw VsfError("unspecified error", code);
   } else {
-    std::printf("ERROR: %s\n", message);
+    throw VsfError(message, code);
   }
+}
 
-  std::printf("\nPrinting backtrace:\n");
-  void* callstack_arr[256];
-  int n_frames = backtrace(callstack_arr, 256);
-  char** strings = backtrace_symbols(callstack_arr, n_frames);
-  for (int i = 0; i < n_frames; ++i) {
-    std::printf("%s\n", strings[i]);
+[[noreturn]] inline void error(const std::string& message,
+                               int code = VSF_INTERNAL_ERROR){
+  throw VsfError(message, code);
+}
+
+/// Records an error code and message in err_info (if it isn't a nullptr)
+inline int record_vsf_error(VsfErrorInfo* err_info, int code,
+                            const char* message) noexcept
+{
+  if (err_info != nullptr){
+    err_info->code = code;
+    if (message == nullptr) {
+      err_info->message[0] = '\0';
+    } else {
+      std::strncpy(err_info->message, message, VSF_ERR_MSG_LEN - 1);
+      err_info->message[VSF_ERR_MSG_LEN - 1] = '\0';
+    }
   }
-  std::free(strings);
+  return code;
+}
 
-  exit(1);
+/// Executes func and translates any exception that it throws into an error
+/// code (the error message is written to err_info, if it isn't a nullptr).
+///
+/// This is intended to wrap the body of each function in the C interface.
+/// Nothing is ever allowed to terminate the calling process.
+template<typename Func>
+inline int catch_vsf_errors(VsfErrorInfo* err_info, Func&& func) noexcept {
+  try {
+    func();
+    return record_vsf_error(err_info, VSF_SUCCESS, nullptr);
+  } catch (const VsfError& err) {
+    return record_vsf_error(err_info, err.code(), err.what());
+  } catch (const std::bad_alloc& err) {
+    return record_vsf_error(err_info, VSF_ALLOC_ERROR,
+                            "memory allocation failed");
+  } catch (const std::exception& err) {
+    return record_vsf_error(err_info, VSF_INTERNAL_ERROR, err.what());
+  } catch (...) {
+    return record_vsf_error(err_info, VSF_INTERNAL_ERROR,
+                            "an unknown exception was raised");
+  }
 }
 
 #endif /* UTILS_H */
@@ -1,26 +1,27 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdint>
-#include <cstdlib> // std::getenv
 
 #include <algorithm>
+#include <chrono>
+#include <exception> // std::exception_ptr
+#include <limits>
 #include <string>
+#include <type_traits> // std::integral_constant
+#include <utility> // std::move
 #include <vector>
 
 #include <omp.h>
 
 #include "vsf.hpp"
 
-#if defined(__GNUC__)
-#define FORCE_INLINE __attribute__((always_inline)) inline
-#else
-#define FORCE_INLINE inline
-#endif
-
 #include "accumulators.hpp"
 #include "compound_accumulator.hpp"
 #include "accum_col_variant.hpp"
 #include "partition.hpp"
+#include "quan_differ.hpp"
+#include "thread_pool.hpp"
+#include "tuning.hpp"
 
 
 
@@ -29,21 +30,15 @@
 // in the local compilation unit (facillitating more optimizations)
 namespace{
 
-  FORCE_INLINE double calc_dist_sqr(double x0, double x1,
-                                    double y0, double y1,
-                                    double z0, double z1) noexcept{
-    double dx = x0 - x1;
-    double dy = y0 - y1;
-    double dz = z0 - z1;
-    return dx*dx + dy*dy + dz*dz;
-  }
-
-  struct dist_rslt{ double dist_sqr; double abs_vdiff; };
+  /// Holds the separation vector of a pair & the difference in the quantity
+  struct pair_rslt{ double dx, dy, dz; double quan_diff; };
 
-  FORCE_INLINE dist_rslt calc_dist_rslt(double x_a, double y_a, double z_a,
-                                        double vx_a, double vy_a, double vz_a,
+  template<class QuanDiffer>
+  FORCE_INLINE pair_rslt calc_pair_rslt(double x_a, double y_a, double z_a,
+                                        const QuanDiffer& differ,
+                                        const typename QuanDiffer::Loaded& q_a,
                                         const double* pos_b,
-                                        const double* vel_b,
+                                        const double* quan_b,
                                         std::size_t i_b,
                                         std::size_t spatial_dim_stride_b)
     noexcept
@@ -52,27 +47,131 @@ namespace{
     const double y_b = pos_b[i_b + spatial_dim_stride_b];
     const double z_b = pos_b[i_b + 2*spatial_dim_stride_b];
 
-    const double vx_b = vel_b[i_b];
-    const double vy_b = vel_b[i_b + spatial_dim_stride_b];
-    const double vz_b = vel_b[i_b + 2*spatial_dim_stride_b];
-
-    double dist_sqr = calc_dist_sqr(x_a, x_b,
-                                    y_a, y_b,
-                                    z_a, z_b);
-    double abs_vdiff = std::sqrt(calc_dist_sqr(vx_a, vx_b,
-                                               vy_a, vy_b,
-                                               vz_a, vz_b));
-    return {dist_sqr, abs_vdiff};
+    return {x_a - x_b, y_a - y_b, z_a - z_b,
+            differ(q_a, quan_b, i_b, spatial_dim_stride_b)};
+  };
+
+  // Binners map the separation vector of a pair to a (flattened) spatial bin
+  // index. They return nbins when the pair doesn't lie in any bin.
+
+  /// Identifies distance bins with a binary search
+  struct BinarySearchDistBinner{
+    const double *dist_sqr_bin_edges;
+    std::size_t nbins;
+
+    FORCE_INLINE std::size_t operator()(double dx, double dy, double dz)
+      const noexcept
+    {
+      return identify_bin_index(dx*dx + dy*dy + dz*dz, dist_sqr_bin_edges,
+                                nbins);
+    }
+  };
+
+  /// Identifies distance bins with a linear search (faster for few bins)
+  struct LinearSearchDistBinner{
+    const double *dist_sqr_bin_edges;
+    std::size_t nbins;
+
+    FORCE_INLINE std::size_t operator()(double dx, double dy, double dz)
+      const noexcept
+    {
+      return identify_bin_index_linear(dx*dx + dy*dy + dz*dz,
+                                       dist_sqr_bin_edges, nbins);
+    }
   };
 
-  
+  /// Bins pairs on 2 coordinates derived from the separation vector and a
+  /// (unit) reference axis. The flattened index is ``i0 * nbins_1 + i1``.
+  ///
+  /// For VSF_BIN2D_PARALLEL_PERP, the coordinates are the squared components
+  /// of the separation that are parallel and perpendicular to the axis. For
+  /// VSF_BIN2D_DIST_COSTHETA, they are the squared distance & the squared
+  /// cosine of the angle with the axis. (Squaring lets us skip square roots.
+  /// The bin edges must be squared in the same way)
+  ///
+  /// Unlike the other bins, the lowest bin of each coordinate includes its
+  /// lower edge. Otherwise, when the first edge is 0, we would skip every
+  /// pair that lies in a plane perpendicular to the axis (or that's parallel
+  /// to it), which is common for gridded data. Pairs with 0 separation are
+  /// always skipped (like in the 1D case).
+  template<int kind>
+  struct Cartesian2DBinner{
+    const double *sqr_bin_edges_0;
+    std::size_t nbins_0;
+    const double *sqr_bin_edges_1;
+    std::size_t nbins_1;
+    double axis[3];
+    std::size_t nbins; // = nbins_0 * nbins_1
 
-  template<class AccumCollection, bool duplicated_points>
+    FORCE_INLINE std::size_t operator()(double dx, double dy, double dz)
+      const noexcept
+    {
+      const double proj = dx*axis[0] + dy*axis[1] + dz*axis[2];
+      const double proj_sqr = proj*proj;
+      const double dist_sqr = dx*dx + dy*dy + dz*dz;
+
+      // (the angle is undefined for pairs with 0 separation)
+      if (!(dist_sqr > 0.0)) { return nbins; }
+
+      double coord_0, coord_1;
+      if constexpr (kind == VSF_BIN2D_PARALLEL_PERP) {
+        coord_0 = proj_sqr;
+        coord_1 = std::max(dist_sqr - proj_sqr, 0.0); // guard round-off
+      } else {
+        coord_0 = dist_sqr;
+        coord_1 = std::min(proj_sqr / dist_sqr, 1.0);
+      }
+
+      const std::size_t i0 = bin_coord_(coord_0, sqr_bin_edges_0, nbins_0);
+      const std::size_t i1 = bin_coord_(coord_1, sqr_bin_edges_1, nbins_1);
+      return ((i0 < nbins_0) && (i1 < nbins_1)) ? (i0 * nbins_1 + i1)
+                                                 : nbins;
+    }
+
+  private:
+    static FORCE_INLINE std::size_t bin_coord_(double x, const double *edges,
+                                               std::size_t n) noexcept
+    {
+      return (x == edges[0]) ? 0 : identify_bin_index(x, edges, n);
+    }
+  };
+
+  /// Counters tracked for each (nominal) process when instrumentation is
+  /// enabled
+  struct ProcCounters{
+    std::uint64_t pairs_evaluated = 0;
+    std::uint64_t pairs_binned = 0;
+    std::uint64_t tasks = 0;
+  };
+
+  using InstrClock = std::chrono::steady_clock;
+
+  double elapsed_ns_(InstrClock::time_point start) noexcept {
+    return std::chrono::duration<double, std::nano>(InstrClock::now() -
+                                                    start).count();
+  }
+
+  void record_proc_(VsfInstrumentation* instr, std::size_t proc_id,
+                    const ProcCounters& counters, double wall_ns) noexcept
+  {
+    const std::size_t i = std::min<std::size_t>(proc_id,
+                                                VSF_INSTR_MAX_PROCS - 1);
+    instr->proc_wall_ns[i] += wall_ns;
+    instr->proc_tasks[i] += counters.tasks;
+    instr->proc_pairs_evaluated[i] += counters.pairs_evaluated;
+    instr->proc_pairs_binned[i] += counters.pairs_binned;
+  }
+
+  // when instrumented is false, counters is never touched (and the compiler
+  // generates the same loop as it would without any instrumentation)
+  template<class AccumCollection, bool duplicated_points, bool instrumented,
+           class DistBinner, class QuanDiffer>
   void process_data(const PointProps points_a,
                     const PointProps points_b,
-                    const double *dist_sqr_bin_edges,
-                    std::size_t nbins,
-                    AccumCollection& accumulators)
+                    const DistBinner& binner,
+                    const QuanDiffer& differ,
+                    AccumCollection& accumulators,
+                    ProcCounters& counters)
   {
 
     // this assumes 3D
@@ -87,248 +186,888 @@ namespace{
     const double *pos_b = points_b.positions;
     const double *vel_b = points_b.velocities;
 
+    const std::size_t nbins = binner.nbins;
+
+    // use a local counter (rather than counters.pairs_binned) to avoid
+    // inhibiting optimizations in the inner loop
+    std::uint64_t pairs_binned = 0;
+
     for (std::size_t i_a = 0; i_a < n_points_a; i_a++){
       // When duplicated_points is true, points_a is the same as points_b. In
       // that case, take some care to avoid duplicating pairs
       std::size_t i_b_start = (duplicated_points) ? i_a + 1 : 0;
+      if constexpr (instrumented) {
+        counters.pairs_evaluated += n_points_b - std::min(i_b_start,
+                                                          n_points_b);
+      }
 
       const double x_a = pos_a[i_a];
       const double y_a = pos_a[i_a + spatial_dim_stride_a];
       const double z_a = pos_a[i_a + 2*spatial_dim_stride_a];
 
-      const double vx_a = vel_a[i_a];
-      const double vy_a = vel_a[i_a + spatial_dim_stride_a];
-      const double vz_a = vel_a[i_a + 2*spatial_dim_stride_a];
+      const typename QuanDiffer::Loaded q_a =
+        differ.load(vel_a, i_a, spatial_dim_stride_a);
 
       for (std::size_t i_b = i_b_start; i_b < n_points_b; i_b++){
 
-        dist_rslt tmp = calc_dist_rslt(x_a, y_a, z_a,
-                                       vx_a, vy_a, vz_a,
+        pair_rslt tmp = calc_pair_rslt(x_a, y_a, z_a, differ, q_a,
                                        pos_b, vel_b, i_b,
                                        spatial_dim_stride_b);
 
-	std::size_t bin_ind = identify_bin_index(tmp.dist_sqr,
-                                                 dist_sqr_bin_edges,
-                                                 nbins);
+	std::size_t bin_ind = binner(tmp.dx, tmp.dy, tmp.dz);
 	if (bin_ind < nbins){
-          accumulators.add_entry(bin_ind, tmp.abs_vdiff);
+          accumulators.add_entry(bin_ind, tmp.quan_diff);
+          if constexpr (instrumented) { pairs_binned++; }
 	}
       }
     }
+    if constexpr (instrumented) { counters.pairs_binned += pairs_binned; }
   }
 
-  template<typename AccumCollection>
+  template<typename AccumCollection, bool instrumented, class DistBinner,
+           class QuanDiffer>
   void calc_vsf_props_helper_(const PointProps points_a,
 			      const PointProps points_b,
-			      const double *dist_sqr_bin_edges,
-                              std::size_t nbins,
+                              const DistBinner& binner,
+                              const QuanDiffer& differ,
                               AccumCollection& accumulators,
-			      bool duplicated_points){
+			      bool duplicated_points,
+                              ProcCounters& counters){
+
+    if (duplicated_points){
+      process_data<AccumCollection, true, instrumented>
+        (points_a, points_b, binner, differ, accumulators, counters);
+    } else {
+      process_data<AccumCollection, false, instrumented>
+        (points_a, points_b, binner, differ, accumulators, counters);
+    }
+    if constexpr (instrumented) { counters.tasks++; }
+  }
+
+  /// Processes the pairs described by a single StatTask
+  template<typename AccumCollection, bool instrumented, class DistBinner,
+           class QuanDiffer>
+  void process_StatTask_(const PointProps points_a,
+                         const PointProps points_b,
+                         const DistBinner& binner,
+                         const QuanDiffer& differ,
+                         AccumCollection& accumulators,
+                         bool duplicated_points, const StatTask stat_task,
+                         ProcCounters& counters)
+  {
+    if constexpr (instrumented) { counters.tasks++; }
+
+    const PointProps cur_points_a =
+      {points_a.positions + stat_task.start_A,
+       points_a.velocities + stat_task.start_A,
+       stat_task.stop_A - stat_task.start_A, // = n_points
+       points_a.n_spatial_dims,
+       points_a.spatial_dim_stride};
+
+    const PointProps cur_points_b =
+          {points_b.positions + stat_task.start_B,
+           points_b.velocities + stat_task.start_B,
+           stat_task.stop_B - stat_task.start_B, // = n_points
+           points_b.n_spatial_dims,
+           points_b.spatial_dim_stride};
 
     if (duplicated_points){
-      process_data<AccumCollection, true>(points_a, points_b,
-                                          dist_sqr_bin_edges, nbins, 
-                                          accumulators);
+      if ((stat_task.start_B == stat_task.stop_B) & (stat_task.stop_B == 0)){
+        // not a typo, use cur_points_a twice
+        process_data<AccumCollection, true, instrumented>
+          (cur_points_a, cur_points_a, binner, differ, accumulators,
+           counters);
+      } else {
+        process_data<AccumCollection, false, instrumented>
+          (cur_points_a, cur_points_b, binner, differ, accumulators,
+           counters);
+      }
     } else {
-      process_data<AccumCollection, false>(points_a, points_b,
-                                           dist_sqr_bin_edges, nbins,
-                                           accumulators);
+      process_data<AccumCollection, false, instrumented>
+        (cur_points_a, cur_points_b, binner, differ, accumulators,
+         counters);
     }
   }
 
-  template<typename AccumCollection>
+  template<typename AccumCollection, bool instrumented, class DistBinner,
+           class QuanDiffer>
   void process_TaskIt_(const PointProps points_a,
                        const PointProps points_b,
-                       const double *dist_sqr_bin_edges,
-                       std::size_t nbins, AccumCollection& accumulators,
-                       bool duplicated_points, TaskIt task_iter) noexcept
+                       const DistBinner& binner,
+                       const QuanDiffer& differ,
+                       AccumCollection& accumulators,
+                       bool duplicated_points, TaskIt task_iter,
+                       ProcCounters& counters)
   {
     while (task_iter.has_next()){
-      const StatTask stat_task = task_iter.next();
-
-      const PointProps cur_points_a =
-        {points_a.positions + stat_task.start_A,
-         points_a.velocities + stat_task.start_A,
-         stat_task.stop_A - stat_task.start_A, // = n_points
-         points_a.n_spatial_dims,
-         points_a.spatial_dim_stride};
-
-      const PointProps cur_points_b =
-            {points_b.positions + stat_task.start_B,
-             points_b.velocities + stat_task.start_B,
-             stat_task.stop_B - stat_task.start_B, // = n_points
-             points_b.n_spatial_dims,
-             points_b.spatial_dim_stride};
- 
-      if (duplicated_points){ // this branch is largely untested
-        if ((stat_task.start_B == stat_task.stop_B) & (stat_task.stop_B == 0)){
-          // not a typo, use cur_points_a twice
-          process_data<AccumCollection, true>(cur_points_a, cur_points_a,
-                                              dist_sqr_bin_edges, nbins, 
-                                              accumulators);
-        } else {
-          process_data<AccumCollection, false>(cur_points_a, cur_points_b,
-                                               dist_sqr_bin_edges, nbins,
-                                               accumulators);
-        }
-      } else {
-        process_data<AccumCollection, false>(cur_points_a, cur_points_b,
-                                             dist_sqr_bin_edges, nbins,
-                                             accumulators);
-      }
+      process_StatTask_<AccumCollection, instrumented>
+        (points_a, points_b, binner, differ, accumulators, duplicated_points,
+         task_iter.next(), counters);
     }
   }
 
-  std::size_t get_nominal_nproc_(const ParallelSpec& parallel_spec) noexcept
+  /// Determine the nominal number of processes (this is like
+  /// get_nominal_nproc, except that a value of 0 for parallel_spec.nproc
+  /// uses all of the threads of parallel_spec.pool, when it's specified)
+  std::size_t nominal_nproc_(const ParallelSpec& parallel_spec){
+    if (parallel_spec.nproc == 1){
+      return 1;
+    } else if ((parallel_spec.nproc == 0) && (parallel_spec.pool != nullptr)){
+      return static_cast<const VsfThreadPool*>(parallel_spec.pool)->nthreads();
+    }
+    return get_nominal_nproc(parallel_spec);
+  }
+
+  /// Evaluates func(proc_id, accums, counters) for each nominal process and
+  /// consolidates the accumulators of every process into outputs.
+  ///
+  /// accums points to an array of outputs.size() pointers to accumulator
+  /// collections that are initialized as copies of the (unused) outputs. The
+  /// results of each process are always consolidated in order of proc_id (so
+  /// they don't depend on the thread that handled a process).
+  ///
+  /// When parallel_spec.pool isn't a nullptr, the processes are evaluated by
+  /// the pool's threads, and each process reuses the pool's cached
+  /// accumulators. Otherwise, an OpenMP team is launched and the accumulators
+  /// are cloned.
+  ///
+  /// The counters of each process are recorded in instr after all processes
+  /// finish (when there are more than VSF_INSTR_MAX_PROCS processes, several
+  /// of them share an entry of instr).
+  template<typename AccumCollection, bool instrumented, typename Func>
+  void run_procs_(std::size_t nproc, const ParallelSpec parallel_spec,
+                  std::vector<AccumCollection>& outputs,
+                  VsfInstrumentation* instr, Func&& func)
   {
-    if (parallel_spec.nproc == 0) {
-      // this approach is crude. OMP_NUM_THREADS doesn't need to be an int
-      char* var_val = std::getenv("OMP_NUM_THREADS");
-      if (var_val == nullptr){
-        return 1;
-      } else {
-        int tmp = std::atoi(var_val);
-        if (tmp <= 0){
-          error("OMP_NUM_THREADS has an invalid value");
-        } else {
-          return tmp;
+    const std::size_t n_outputs = outputs.size();
+    const bool use_parallel = ((!parallel_spec.force_sequential) && (nproc>1));
+    if constexpr (instrumented) { instr->n_procs = nproc; }
+
+    // each process only writes to its own entries (they're folded into instr
+    // afterwards, since several processes may share an entry of instr)
+    std::vector<ProcCounters> proc_counters(instrumented ? nproc : 0);
+    std::vector<double> proc_wall_ns(instrumented ? nproc : 0, 0.0);
+    auto record_procs = [&]()
+      {
+        if constexpr (instrumented) {
+          for (std::size_t i = 0; i < nproc; i++){
+            record_proc_(instr, i, proc_counters[i], proc_wall_ns[i]);
+          }
+        }
+      };
+
+    if (parallel_spec.pool != nullptr){
+      VsfThreadPool& pool = *static_cast<VsfThreadPool*>(parallel_spec.pool);
+      std::unique_lock<std::mutex> pool_lock = pool.lock();
+
+      pool.run(nproc, use_parallel, [&](std::size_t proc_id)
+        {
+          const InstrClock::time_point proc_start = InstrClock::now();
+          std::vector<AccumColVariant>& slots = pool.scratch(proc_id);
+          if (slots.size() < n_outputs) { slots.resize(n_outputs); }
+
+          std::vector<AccumCollection*> accums(n_outputs);
+          for (std::size_t o = 0; o < n_outputs; o++){
+            accums[o] = &reset_cached_accum(slots[o], outputs[o]);
+          }
+
+          // (the counters are updated in the inner loop, so we use a local
+          // copy to avoid false sharing)
+          ProcCounters counters;
+          func(proc_id, accums.data(), counters);
+          if constexpr (instrumented) {
+            proc_counters[proc_id] = counters;
+            proc_wall_ns[proc_id] = elapsed_ns_(proc_start);
+          }
+        });
+      record_procs();
+
+      const InstrClock::time_point merge_start = InstrClock::now();
+      for (std::size_t o = 0; o < n_outputs; o++){
+        outputs[o] = std::get<AccumCollection>(pool.scratch(0)[o]);
+        for (std::size_t i = 1; i < nproc; i++){
+          outputs[o].consolidate_with_other
+            (std::get<AccumCollection>(pool.scratch(i)[o]));
         }
       }
-    } else {
-      return parallel_spec.nproc;
+      if constexpr (instrumented) {
+        instr->merge_ns += elapsed_ns_(merge_start);
+      }
+      return;
     }
+
+    omp_set_num_threads(nproc);
+    omp_set_dynamic(0);
+
+    // initialize vector where the accumulator collections that are used to
+    // process each partition will be stored.
+    std::vector<std::vector<AccumCollection>> partition_dest(nproc, outputs);
+
+    //printf("About to enter parallel region.\n"
+    //       "  use_parallel: %d, nproc = %zu\n", (int)use_parallel, nproc);
+
+    // exceptions can't propagate out of a parallel region. We record the
+    // first one that gets raised & rethrow it after the region ends
+    std::exception_ptr first_exception = nullptr;
+
+    // now actually compute the number of statistics
+    #pragma omp parallel if (use_parallel)
+    {
+      // the proc_id value probably won't align with the actual process id
+      #pragma omp for schedule(static,1)
+      for (std::size_t proc_id = 0; proc_id < nproc; proc_id++){
+        try {
+          // make a local copy. Do this so that the heap allocation
+          // corresponds to a location that is fast for the current process
+          // to access.
+          const InstrClock::time_point proc_start = InstrClock::now();
+          std::vector<AccumCollection> local_accums(partition_dest[proc_id]);
+          std::vector<AccumCollection*> accums(n_outputs);
+          for (std::size_t o = 0; o < n_outputs; o++){
+            accums[o] = &local_accums[o];
+          }
+
+          ProcCounters counters;
+          func(proc_id, accums.data(), counters);
+
+          partition_dest[proc_id] = std::move(local_accums);
+          if constexpr (instrumented) {
+            // each proc_id is only handled by a single thread
+            proc_counters[proc_id] = counters;
+            proc_wall_ns[proc_id] = elapsed_ns_(proc_start);
+          }
+        } catch (...) {
+          #pragma omp critical
+          {
+            if (first_exception == nullptr) {
+              first_exception = std::current_exception();
+            }
+          }
+        }
+      }
+
+      #pragma omp barrier // I think the barrier may be implied
+    }
+
+    if (first_exception != nullptr) { std::rethrow_exception(first_exception); }
+    record_procs();
+
+    // lastly, let's consolidate the values
+    const InstrClock::time_point merge_start = InstrClock::now();
+    for (std::size_t o = 0; o < n_outputs; o++){
+      outputs[o] = partition_dest[0][o];
+      for (std::size_t i = 1; i < nproc; i++){
+        outputs[o].consolidate_with_other(partition_dest[i][o]);
+      }
+    }
+    if constexpr (instrumented) { instr->merge_ns += elapsed_ns_(merge_start); }
   }
 
-  template<typename AccumCollection>
+  template<typename AccumCollection, bool instrumented, class DistBinner,
+           class QuanDiffer>
   void calc_vsf_props_parallel_(const PointProps points_a,
                                 const PointProps points_b,
-                                const double *dist_sqr_bin_edges,
-                                std::size_t nbins,
+                                const DistBinner& binner,
+                                const QuanDiffer& differ,
+                                std::size_t nominal_nproc,
                                 const ParallelSpec parallel_spec,
+                                const VsfTuning& tuning,
                                 AccumCollection& accumulators,
-                                bool duplicated_points) noexcept
+                                bool duplicated_points,
+                                VsfInstrumentation* instr)
   {
-    std::size_t nominal_nproc = get_nominal_nproc_(parallel_spec);
+    const InstrClock::time_point setup_start = InstrClock::now();
 
     if (duplicated_points) {
-      error("partitioning strategy for auto-vsf is untested");
+      error("partitioning strategy for auto-vsf is untested",
+            VSF_NOT_IMPLEMENTED);
     }
  
     const TaskItFactory factory(nominal_nproc, points_a.n_points,
-                                (duplicated_points) ? 0 : points_b.n_points);
+                                (duplicated_points) ? 0 : points_b.n_points,
+                                false, tuning);
 
     // this may be less than the value from parallel_spec.nproc
     const std::size_t nproc = factory.effective_nproc();
 
-    omp_set_num_threads(nproc);
-    omp_set_dynamic(0);
-
-    // initialize vector where the accumulator collection that is used to
-    // process each partition will be stored.
     // (This assumes that accumulators hasn't been used yet - we just clone it)
-    std::vector<AccumCollection> partition_dest;
-    partition_dest.reserve(nproc);
-    for (std::size_t i = 0; i < nproc; i++){
-      AccumCollection copy = accumulators;
-      partition_dest.push_back(copy);
+    std::vector<AccumCollection> outputs{accumulators};
+
+    if constexpr (instrumented) { instr->setup_ns += elapsed_ns_(setup_start); }
+
+    run_procs_<AccumCollection, instrumented>
+      (nproc, parallel_spec, outputs, instr,
+       [&](std::size_t proc_id, AccumCollection* const* accums,
+           ProcCounters& counters)
+       {
+         process_TaskIt_<AccumCollection, instrumented>
+           (points_a, points_b, binner, differ, *accums[0],
+            duplicated_points, factory.build_TaskIt(proc_id), counters);
+       });
+
+    accumulators = std::move(outputs[0]);
+  }
+
+  template<bool instrumented, typename AccumCollection, class DistBinner,
+           class QuanDiffer>
+  void calc_vsf_props_dispatch_(const PointProps points_a,
+                                const PointProps points_b,
+                                const DistBinner& binner,
+                                const QuanDiffer& differ,
+                                const ParallelSpec parallel_spec,
+                                const VsfTuning& tuning,
+                                bool computes_histogram,
+                                AccumCollection& accumulators,
+                                bool duplicated_points,
+                                VsfInstrumentation* instr)
+  {
+    std::size_t nominal_nproc = nominal_nproc_(parallel_spec);
+
+    // the cost model may tell us that launching a team of processes costs
+    // more than it saves (we always honor nproc when force_sequential is
+    // set, since that's used to test the partitioning logic)
+    if ((nominal_nproc > 1) && !parallel_spec.force_sequential){
+      const double n_a = static_cast<double>(points_a.n_points);
+      const double npairs = (duplicated_points)
+        ? 0.5 * n_a * (n_a - 1.0)
+        : n_a * static_cast<double>(points_b.n_points);
+      nominal_nproc = choose_nproc(tuning, nominal_nproc, npairs,
+                                   computes_histogram);
     }
 
-    const bool use_parallel = ((!parallel_spec.force_sequential) && (nproc>1));
+    if (nominal_nproc == 1){
+      const InstrClock::time_point proc_start = InstrClock::now();
+      ProcCounters counters;
+      calc_vsf_props_helper_<AccumCollection, instrumented>
+        (points_a, points_b, binner, differ, accumulators,
+         duplicated_points, counters);
+      if constexpr (instrumented) {
+        instr->n_procs = 1;
+        record_proc_(instr, 0, counters, elapsed_ns_(proc_start));
+      }
+    } else {
+      calc_vsf_props_parallel_<AccumCollection, instrumented>
+        (points_a, points_b, binner, differ, nominal_nproc, parallel_spec,
+         tuning, accumulators, duplicated_points, instr);
+    }
+  }
 
-    //printf("About to enter parallel region.\n"
-    //       "  use_parallel: %d, nproc = %zu, n_partitions = %zu\n",
-    //       (int)use_parallel, nproc, (std::size_t)factory.n_partitions());
 
-    // now actually compute the number of statistics
-    #pragma omp parallel if (use_parallel)
-    {
-      // the proc_id value probably won't align with the actual process id
-      #pragma omp for schedule(static,1)
-      for (std::size_t proc_id = 0; proc_id < nproc; proc_id++){
-        // make a local copy. Do this so that the heap allocation corresponds
-        // to a location that is fast for the current process to access.
-        AccumCollection local_accums(partition_dest[proc_id]);
+  /// A chunk of the pairs from a single term of a batched calculation
+  struct BatchWorkItem{
+    std::size_t term_index;
+    StatTask stat_task;
+    double npairs;
+  };
+
+  /// Returns the number of pairs in a StatTask
+  double count_task_pairs_(const StatTask& t) noexcept {
+    const double n_a = static_cast<double>(t.stop_A - t.start_A);
+    if ((t.start_B == t.stop_B) & (t.stop_B == 0)) {
+      return 0.5 * n_a * (n_a - 1.0);
+    }
+    return n_a * static_cast<double>(t.stop_B - t.start_B);
+  }
+
+  /// Evaluates every term of a batched calculation with a single team of
+  /// processes.
+  ///
+  /// Each term is split into chunks with the same TaskItFactory used by
+  /// calc_vsf_props_parallel_. The chunks from all of the terms are sorted
+  /// by decreasing size & dealt out to the processes in a round-robin
+  /// fashion. Because each chunk is always assigned to the same nominal
+  /// process (regardless of how the threads get scheduled), the results are
+  /// reproducible for a given nproc.
+  ///
+  /// @param outputs Holds n_outputs accumulator collections that haven't been
+  ///     used yet
+  template<typename AccumCollection, bool instrumented, class DistBinner,
+           class QuanDiffer>
+  void calc_sf_props_batched_(const PointProps* point_sets,
+                              const VsfBatchTerm* terms, std::size_t n_terms,
+                              const DistBinner& binner,
+                              const QuanDiffer& differ,
+                              const ParallelSpec parallel_spec,
+                              const VsfTuning& tuning,
+                              bool computes_histogram,
+                              std::vector<AccumCollection>& outputs,
+                              VsfInstrumentation* instr)
+  {
+    const InstrClock::time_point setup_start = InstrClock::now();
 
-        process_TaskIt_(points_a, points_b, dist_sqr_bin_edges, nbins,
-                        local_accums, duplicated_points,
-                        factory.build_TaskIt(proc_id));
+    std::size_t nominal_nproc = nominal_nproc_(parallel_spec);
 
-        partition_dest[proc_id] = local_accums;
+    if ((nominal_nproc > 1) && !parallel_spec.force_sequential){
+      double total_npairs = 0.0;
+      for (std::size_t i = 0; i < n_terms; i++){
+        const double n_a = static_cast<double>
+          (point_sets[terms[i].index_a].n_points);
+        total_npairs += (terms[i].index_b == VSF_BATCH_AUTO)
+          ? 0.5 * n_a * (n_a - 1.0)
+          : n_a * static_cast<double>(point_sets[terms[i].index_b].n_points);
       }
+      nominal_nproc = choose_nproc(tuning, nominal_nproc, total_npairs,
+                                   computes_histogram);
+    }
 
-      #pragma omp barrier // I think the barrier may be implied
+    // split up each term
+    std::vector<BatchWorkItem> items;
+    for (std::size_t i = 0; i < n_terms; i++){
+      const bool is_auto = (terms[i].index_b == VSF_BATCH_AUTO);
+      const std::size_t n_a = point_sets[terms[i].index_a].n_points;
+      const std::size_t n_b =
+        (is_auto) ? 0 : point_sets[terms[i].index_b].n_points;
+      if ((is_auto) ? (n_a < 2) : ((n_a == 0) || (n_b == 0))) { continue; }
+
+      // AutoSFPartitionStrat can't divide the work between more than 30
+      // processes
+      const std::size_t term_nproc =
+        (is_auto) ? std::min<std::size_t>(nominal_nproc, 30) : nominal_nproc;
+      const TaskItFactory factory(term_nproc, n_a, n_b, false, tuning);
+      for (std::size_t proc_id = 0; proc_id < factory.effective_nproc();
+           proc_id++){
+        TaskIt task_iter = factory.build_TaskIt(proc_id);
+        while (task_iter.has_next()){
+          const StatTask stat_task = task_iter.next();
+          items.push_back({i, stat_task, count_task_pairs_(stat_task)});
+        }
+      }
     }
+    std::stable_sort(items.begin(), items.end(),
+                     [](const BatchWorkItem& a, const BatchWorkItem& b)
+                     { return a.npairs > b.npairs; });
 
-    // lastly, let's consolidate the values
-    accumulators = partition_dest[0];
-    for (std::size_t i = 1; i < nproc; i++){
-      accumulators.consolidate_with_other(partition_dest[i]);
+    const std::size_t nproc = std::max<std::size_t>
+      (1, std::min(nominal_nproc, items.size()));
+
+    if constexpr (instrumented) { instr->setup_ns += elapsed_ns_(setup_start); }
+
+    run_procs_<AccumCollection, instrumented>
+      (nproc, parallel_spec, outputs, instr,
+       [&](std::size_t proc_id, AccumCollection* const* accums,
+           ProcCounters& counters)
+       {
+         for (std::size_t j = proc_id; j < items.size(); j += nproc){
+           const VsfBatchTerm& term = terms[items[j].term_index];
+           const bool is_auto = (term.index_b == VSF_BATCH_AUTO);
+           const PointProps& points_a = point_sets[term.index_a];
+           const PointProps& points_b =
+             (is_auto) ? points_a : point_sets[term.index_b];
+           process_StatTask_<AccumCollection, instrumented>
+             (points_a, points_b, binner, differ, *accums[term.out_index],
+              is_auto, items[j].stat_task, counters);
+         }
+       });
+  }
+
+  /// Returns a callable for calc_vsf_props_common_ that builds the binner for
+  /// 1D distance bins
+  auto with_dist_binner_(const double *bin_edges, std::size_t nbins){
+    return [=](const VsfTuning& tuning, auto&& func)
+      {
+        if (bin_edges == nullptr){
+          error("bin_edges must not be a nullptr", VSF_INVALID_ARG);
+        }
+
+        // recompute the bin edges so that they are stored as squared
+        // distances
+        const std::vector<double> dist_sqr_bin_edges_vec =
+          build_dist_sqr_bin_edges(bin_edges, nbins);
+
+        // the tuning parameters determine which variant of the kernel is used
+        if (nbins <= tuning.linear_search_max_nbins){
+          func(LinearSearchDistBinner{dist_sqr_bin_edges_vec.data(), nbins});
+        } else {
+          func(BinarySearchDistBinner{dist_sqr_bin_edges_vec.data(), nbins});
+        }
+      };
+  }
+
+  /// Callable for calc_vsf_props_common_ that provides the differ for 3D
+  /// velocities
+  struct WithVelocityDiffer{
+    template<typename Func>
+    void operator()(Func&& func) const { func(VelocityDiffer{}); }
+  };
+
+  /// Returns whether stat_list includes the histogram statistic (this is an
+  /// input to the cost model)
+  bool computes_histogram_(const StatListItem* stat_list,
+                           std::size_t stat_list_len){
+    bool out = false;
+    for (std::size_t i = 0; i < stat_list_len; i++){
+      out |= ((stat_list[i].statistic != nullptr) &&
+              (std::string(stat_list[i].statistic) == "histogram"));
     }
+    return out;
+  }
+
+  /// Implements the functionality shared by calc_vsf_props,
+  /// calc_vsf_props_2D & calc_quan_sf_props (everything except for the
+  /// construction of the binner and the differ)
+  ///
+  /// @param nbins The total number of (flattened) spatial bins
+  /// @param tuning The tuning parameters used by the calculation
+  /// @param with_binner Callable that validates the binning arguments &
+  ///     invokes the callable it is passed with the binner
+  /// @param with_differ Callable that invokes the callable it is passed with
+  ///     the differ
+  template<typename WithBinner, typename WithDiffer>
+  void calc_vsf_props_common_(const PointProps points_a,
+                              const PointProps points_b,
+                              const StatListItem* stat_list,
+                              std::size_t stat_list_len, std::size_t nbins,
+                              const ParallelSpec parallel_spec,
+                              const VsfTuning& tuning,
+                              double *out_flt_vals, int64_t *out_i64_vals,
+                              VsfInstrumentation* instrumentation,
+                              InstrClock::time_point call_start,
+                              WithBinner&& with_binner,
+                              WithDiffer&& with_differ)
+  {
+    const bool duplicated_points = ((points_b.positions == nullptr) &&
+                                    (points_b.velocities == nullptr));
+
+    const PointProps my_points_b = (duplicated_points) ? points_a : points_b;
+
+    if (nbins == 0){
+      error("nbins must be positive", VSF_INVALID_ARG);
+    } else if (points_a.n_spatial_dims != 3){
+      error("points_a must have 3 spatial dimensions", VSF_NOT_IMPLEMENTED);
+    } else if (my_points_b.n_spatial_dims != 3){
+      error("points_b must have 3 spatial dimensions", VSF_NOT_IMPLEMENTED);
+    } else if ((points_a.positions == nullptr) ||
+               (points_a.velocities == nullptr)) {
+      error("the positions and velocities of points_a must not be nullptrs",
+            VSF_INVALID_ARG);
+    } else if ((my_points_b.positions == nullptr) ||
+               (my_points_b.velocities == nullptr)) {
+      error("the positions and velocities of points_b must both be nullptrs "
+            "or both be non-nullptrs", VSF_INVALID_ARG);
+    } else if ((out_flt_vals == nullptr) || (out_i64_vals == nullptr)) {
+      error("the output buffers must not be nullptrs", VSF_INVALID_ARG);
+    }
+
+    // construct accumulators (they're stored in a std::variant for
+    // convenience)
+    AccumColVariant accumulators = build_accum_collection(stat_list,
+                                                          stat_list_len,
+                                                          nbins);
+
+    const bool computes_histogram = computes_histogram_(stat_list,
+                                                        stat_list_len);
+
+    // now actually use the accumulators to compute that statistics
+    auto func = [&](auto& accumulators, const auto& binner,
+                    const auto& differ)
+      {
+        if (instrumentation == nullptr){
+          calc_vsf_props_dispatch_<false>(points_a, my_points_b, binner,
+                                          differ, parallel_spec, tuning,
+                                          computes_histogram, accumulators,
+                                          duplicated_points, nullptr);
+        } else {
+          calc_vsf_props_dispatch_<true>(points_a, my_points_b, binner,
+                                         differ, parallel_spec, tuning,
+                                         computes_histogram, accumulators,
+                                         duplicated_points, instrumentation);
+        }
+      };
+
+    with_binner(tuning, [&](const auto& binner)
+      {
+        with_differ([&](const auto& differ)
+          {
+            if (instrumentation != nullptr) {
+              instrumentation->setup_ns += elapsed_ns_(call_start);
+            }
+            std::visit([&](auto& accums){ func(accums, binner, differ); },
+                       accumulators);
+          });
+      });
+
+    // now copy the results from the accumulators to the output array
+    std::visit([=](auto &accums){ accums.copy_flt_vals(out_flt_vals); },
+               accumulators);
+    std::visit([=](auto &accums){ accums.copy_i64_vals(out_i64_vals); },
+               accumulators);
   }
 
 }
 
 
-bool calc_vsf_props(const PointProps points_a, const PointProps points_b,
-		    const StatListItem* stat_list, std::size_t stat_list_len,
-                    const double *bin_edges, std::size_t nbins,
-                    const ParallelSpec parallel_spec,
-                    double *out_flt_vals, int64_t *out_i64_vals) noexcept
+int calc_vsf_props(const PointProps points_a, const PointProps points_b,
+                   const StatListItem* stat_list, std::size_t stat_list_len,
+                   const double *bin_edges, std::size_t nbins,
+                   const ParallelSpec parallel_spec,
+                   double *out_flt_vals, int64_t *out_i64_vals,
+                   VsfInstrumentation* instrumentation,
+                   VsfErrorInfo* err_info) noexcept
 {
-  const bool duplicated_points = ((points_b.positions == nullptr) &&
-				  (points_b.velocities == nullptr));
-
-  const PointProps my_points_b = (duplicated_points) ? points_a : points_b;
-
-  if (nbins == 0){
-    return false;
-  } else if (points_a.n_spatial_dims != 3){
-    return false;
-  } else if (my_points_b.n_spatial_dims != 3){
-    return false;
-  } else if ((points_a.positions == nullptr) ||
-	     (points_a.velocities == nullptr)) {
-    return false;
-  }
+  return calc_vsf_props_with_tuning(get_active_vsf_tuning(), points_a,
+                                    points_b, stat_list, stat_list_len,
+                                    bin_edges, nbins, parallel_spec,
+                                    out_flt_vals, out_i64_vals,
+                                    instrumentation, err_info);
+}
 
-  // recompute the bin edges so that they are stored as squared distances
-  std::vector<double> dist_sqr_bin_edges_vec(nbins+1);
-  for (std::size_t i=0; i < (nbins+1); i++){
-    if (bin_edges[i] < 0){
-      // It doesn't really matter how we handle negative bin edges (since
-      // distances are non-negative), as long as dist_sqr_bin_edges
-      // monotonically increases.
-      dist_sqr_bin_edges_vec[i] = bin_edges[i];
-    } else {
-      dist_sqr_bin_edges_vec[i] = bin_edges[i]*bin_edges[i];
-    }
+int calc_vsf_props_with_tuning(const VsfTuning& tuning,
+                               const PointProps points_a,
+                               const PointProps points_b,
+                               const StatListItem* stat_list,
+                               std::size_t stat_list_len,
+                               const double *bin_edges, std::size_t nbins,
+                               const ParallelSpec parallel_spec,
+                               double *out_flt_vals, int64_t *out_i64_vals,
+                               VsfInstrumentation* instrumentation,
+                               VsfErrorInfo* err_info) noexcept
+{
+  const InstrClock::time_point call_start = InstrClock::now();
+  if (instrumentation != nullptr) { *instrumentation = VsfInstrumentation{}; }
+
+  auto impl = [&]()
+  {
+    calc_vsf_props_common_(points_a, points_b, stat_list, stat_list_len,
+                           nbins, parallel_spec, tuning, out_flt_vals,
+                           out_i64_vals, instrumentation, call_start,
+                           with_dist_binner_(bin_edges, nbins),
+                           WithVelocityDiffer{});
+  };
+
+  const int code = catch_vsf_errors(err_info, impl);
+  if (instrumentation != nullptr) {
+    instrumentation->total_ns = elapsed_ns_(call_start);
   }
+  return code;
+}
 
-  // construct accumulators (they're stored in a std::variant for convenience)
-  AccumColVariant accumulators = build_accum_collection(stat_list,
-                                                        stat_list_len, nbins);
+int calc_vsf_props_2D(const PointProps points_a, const PointProps points_b,
+                      const StatListItem* stat_list, std::size_t stat_list_len,
+                      const Bin2DSpec bin_spec,
+                      const ParallelSpec parallel_spec,
+                      double *out_flt_vals, int64_t *out_i64_vals,
+                      VsfInstrumentation* instrumentation,
+                      VsfErrorInfo* err_info) noexcept
+{
+  const InstrClock::time_point call_start = InstrClock::now();
+  if (instrumentation != nullptr) { *instrumentation = VsfInstrumentation{}; }
 
-  // now actually use the accumulators to compute that statistics
-  auto func = [=](auto& accumulators)
+  auto with_binner = [&](const VsfTuning& tuning, auto&& func)
     {
-      if (parallel_spec.nproc == 1){
-        calc_vsf_props_helper_(points_a, my_points_b,
-                               dist_sqr_bin_edges_vec.data(), nbins,
-                               accumulators, duplicated_points);
+      if ((bin_spec.bin_edges_0 == nullptr) ||
+          (bin_spec.bin_edges_1 == nullptr)){
+        error("the bin edges must not be nullptrs", VSF_INVALID_ARG);
+      } else if ((bin_spec.nbins_0 == 0) || (bin_spec.nbins_1 == 0)){
+        error("nbins_0 and nbins_1 must be positive", VSF_INVALID_ARG);
+      }
+
+      // normalize the reference axis
+      const double* axis = bin_spec.reference_axis;
+      const double norm = std::sqrt(axis[0]*axis[0] + axis[1]*axis[1] +
+                                    axis[2]*axis[2]);
+      if (!(std::isfinite(norm) && (norm > 0))){
+        error("reference_axis must have a finite, non-zero magnitude",
+              VSF_INVALID_ARG);
+      }
+
+      // both sets of coordinates are binned as squared values
+      const std::vector<double> sqr_bin_edges_0 =
+        build_dist_sqr_bin_edges(bin_spec.bin_edges_0, bin_spec.nbins_0);
+      const std::vector<double> sqr_bin_edges_1 =
+        build_dist_sqr_bin_edges(bin_spec.bin_edges_1, bin_spec.nbins_1);
+
+      auto build = [&](auto kind_constant)
+        {
+          return Cartesian2DBinner<decltype(kind_constant)::value>
+            {sqr_bin_edges_0.data(), bin_spec.nbins_0,
+             sqr_bin_edges_1.data(), bin_spec.nbins_1,
+             {axis[0]/norm, axis[1]/norm, axis[2]/norm},
+             bin_spec.nbins_0 * bin_spec.nbins_1};
+        };
+
+      if (bin_spec.kind == VSF_BIN2D_PARALLEL_PERP){
+        func(build(std::integral_constant<int, VSF_BIN2D_PARALLEL_PERP>{}));
+      } else if (bin_spec.kind == VSF_BIN2D_DIST_COSTHETA){
+        func(build(std::integral_constant<int, VSF_BIN2D_DIST_COSTHETA>{}));
       } else {
-        calc_vsf_props_parallel_(points_a, my_points_b,
-                                 dist_sqr_bin_edges_vec.data(), nbins,
-                                 parallel_spec, accumulators,
-                                 duplicated_points);
+        error("bin_spec.kind has an unrecognized value", VSF_INVALID_ARG);
       }
     };
-  std::visit(func, accumulators);
 
-  // now copy the results from the accumulators to the output array
-  std::visit([=](auto &accums){ accums.copy_flt_vals(out_flt_vals); },
-             accumulators);
-  std::visit([=](auto &accums){ accums.copy_i64_vals(out_i64_vals); },
-             accumulators);
+  auto impl = [&]()
+  {
+    // guard against overflow in the total number of bins
+    if ((bin_spec.nbins_0 != 0) &&
+        (bin_spec.nbins_1 > std::numeric_limits<std::size_t>::max() /
+                            bin_spec.nbins_0)) {
+      error("too many bins", VSF_INVALID_ARG);
+    }
+    calc_vsf_props_common_(points_a, points_b, stat_list, stat_list_len,
+                           bin_spec.nbins_0 * bin_spec.nbins_1, parallel_spec,
+                           get_active_vsf_tuning(), out_flt_vals,
+                           out_i64_vals, instrumentation, call_start,
+                           with_binner, WithVelocityDiffer{});
+  };
 
-  return true;
+  const int code = catch_vsf_errors(err_info, impl);
+  if (instrumentation != nullptr) {
+    instrumentation->total_ns = elapsed_ns_(call_start);
+  }
+  return code;
+}
+
+int calc_quan_sf_props(const PointProps points_a, const PointProps points_b,
+                       const StatListItem* stat_list,
+                       std::size_t stat_list_len,
+                       const double *bin_edges, std::size_t nbins,
+                       const QuanDiffSpec quan_spec,
+                       const ParallelSpec parallel_spec,
+                       double *out_flt_vals, int64_t *out_i64_vals,
+                       VsfInstrumentation* instrumentation,
+                       VsfErrorInfo* err_info) noexcept
+{
+  const InstrClock::time_point call_start = InstrClock::now();
+  if (instrumentation != nullptr) { *instrumentation = VsfInstrumentation{}; }
+
+  auto impl = [&]()
+  {
+    calc_vsf_props_common_(points_a, points_b, stat_list, stat_list_len,
+                           nbins, parallel_spec, get_active_vsf_tuning(),
+                           out_flt_vals, out_i64_vals, instrumentation,
+                           call_start, with_dist_binner_(bin_edges, nbins),
+                           with_quan_differ(quan_spec));
+  };
+
+  const int code = catch_vsf_errors(err_info, impl);
+  if (instrumentation != nullptr) {
+    instrumentation->total_ns = elapsed_ns_(call_start);
+  }
+  return code;
+}
+
+int calc_sf_props_batched(const PointProps* point_sets,
+                          std::size_t n_point_sets,
+                          const VsfBatchTerm* terms, std::size_t n_terms,
+                          const StatListItem* stat_list,
+                          std::size_t stat_list_len,
+                          const double *bin_edges, std::size_t nbins,
+                          const QuanDiffSpec quan_spec,
+                          const ParallelSpec parallel_spec,
+                          std::size_t n_outputs,
+                          double * const *out_flt_vals,
+                          int64_t * const *out_i64_vals,
+                          VsfInstrumentation* instrumentation,
+                          VsfErrorInfo* err_info) noexcept
+{
+  return calc_sf_props_batched_with_tuning(get_active_vsf_tuning(),
+                                           point_sets, n_point_sets, terms,
+                                           n_terms, stat_list, stat_list_len,
+                                           bin_edges, nbins, quan_spec,
+                                           parallel_spec, n_outputs,
+                                           out_flt_vals, out_i64_vals,
+                                           instrumentation, err_info);
+}
+
+int calc_sf_props_batched_with_tuning(const VsfTuning& tuning,
+                                      const PointProps* point_sets,
+                                      std::size_t n_point_sets,
+                                      const VsfBatchTerm* terms,
+                                      std::size_t n_terms,
+                                      const StatListItem* stat_list,
+                                      std::size_t stat_list_len,
+                                      const double *bin_edges,
+                                      std::size_t nbins,
+                                      const QuanDiffSpec quan_spec,
+                                      const ParallelSpec parallel_spec,
+                                      std::size_t n_outputs,
+                                      double * const *out_flt_vals,
+                                      int64_t * const *out_i64_vals,
+                                      VsfInstrumentation* instrumentation,
+                                      VsfErrorInfo* err_info) noexcept
+{
+  const InstrClock::time_point call_start = InstrClock::now();
+  if (instrumentation != nullptr) { *instrumentation = VsfInstrumentation{}; }
+
+  auto impl = [&]()
+  {
+    if (nbins == 0){
+      error("nbins must be positive", VSF_INVALID_ARG);
+    } else if ((point_sets == nullptr) && (n_point_sets > 0)){
+      error("point_sets must not be a nullptr", VSF_INVALID_ARG);
+    } else if ((terms == nullptr) && (n_terms > 0)){
+      error("terms must not be a nullptr", VSF_INVALID_ARG);
+    } else if ((out_flt_vals == nullptr) || (out_i64_vals == nullptr)){
+      error("the output buffers must not be nullptrs", VSF_INVALID_ARG);
+    }
+
+    for (std::size_t i = 0; i < n_outputs; i++){
+      if ((out_flt_vals[i] == nullptr) || (out_i64_vals[i] == nullptr)){
+        error("the output buffers must not be nullptrs", VSF_INVALID_ARG);
+      }
+    }
+
+    for (std::size_t i = 0; i < n_point_sets; i++){
+      if (point_sets[i].n_spatial_dims != 3){
+        error("each point set must have 3 spatial dimensions",
+              VSF_NOT_IMPLEMENTED);
+      } else if ((point_sets[i].n_points > 0) &&
+                 ((point_sets[i].positions == nullptr) ||
+                  (point_sets[i].velocities == nullptr))){
+        error("the positions and velocities of each non-empty point set "
+              "must not be nullptrs", VSF_INVALID_ARG);
+      }
+    }
+
+    for (std::size_t i = 0; i < n_terms; i++){
+      if (terms[i].index_a >= n_point_sets){
+        error("a term has an invalid index_a", VSF_INVALID_ARG);
+      } else if ((terms[i].index_b != VSF_BATCH_AUTO) &&
+                 (terms[i].index_b >= n_point_sets)){
+        error("a term has an invalid index_b", VSF_INVALID_ARG);
+      } else if (terms[i].out_index >= n_outputs){
+        error("a term has an invalid out_index", VSF_INVALID_ARG);
+      }
+    }
+
+    AccumColVariant prototype = build_accum_collection(stat_list,
+                                                       stat_list_len, nbins);
+    const bool computes_histogram = computes_histogram_(stat_list,
+                                                        stat_list_len);
+
+    auto with_binner = with_dist_binner_(bin_edges, nbins);
+    with_binner(tuning, [&](const auto& binner)
+      {
+        with_quan_differ(quan_spec)([&](const auto& differ)
+          {
+            std::visit([&](const auto& proto)
+              {
+                using AccumCollection = std::decay_t<decltype(proto)>;
+                std::vector<AccumCollection> outputs(n_outputs, proto);
+                if (instrumentation == nullptr){
+                  calc_sf_props_batched_<AccumCollection, false>
+                    (point_sets, terms, n_terms, binner, differ,
+                     parallel_spec, tuning, computes_histogram, outputs,
+                     nullptr);
+                } else {
+                  instrumentation->setup_ns += elapsed_ns_(call_start);
+                  calc_sf_props_batched_<AccumCollection, true>
+                    (point_sets, terms, n_terms, binner, differ,
+                     parallel_spec, tuning, computes_histogram, outputs,
+                     instrumentation);
+                }
+
+                for (std::size_t i = 0; i < n_outputs; i++){
+                  outputs[i].copy_flt_vals(out_flt_vals[i]);
+                  outputs[i].copy_i64_vals(out_i64_vals[i]);
+                }
+              }, prototype);
+          });
+      });
+  };
+
+  const int code = catch_vsf_errors(err_info, impl);
+  if (instrumentation != nullptr) {
+    instrumentation->total_ns = elapsed_ns_(call_start);
+  }
+  return code;
 }
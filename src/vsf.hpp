@@ -29,6 +29,102 @@ struct ParallelSpec{
   size_t nproc; // a value of 0 should probably fall back to OMP_NUM_THREADS
   bool force_sequential; // when true, only 1 process is used, but it should
                          // partition the problem as though there were nproc
+  void* pool; // optional handle from vsfpool_create. When it isn't a nullptr,
+              // the pool's threads (rather than an OpenMP team) do the work
+              // and a value of 0 for nproc uses all of the pool's threads.
+              // This is currently only used by the functions in this header
+};
+
+/// Error codes reported by the functions in the C interface
+enum VsfErrorCode{
+  VSF_SUCCESS = 0,
+  VSF_INVALID_ARG = 1,      // an argument has an invalid value
+  VSF_NOT_IMPLEMENTED = 2,  // the requested functionality isn't supported
+  VSF_ALLOC_ERROR = 3,      // a memory allocation failed
+  VSF_INTERNAL_ERROR = 4    // something went wrong inside the library
+};
+
+#define VSF_ERR_MSG_LEN 512
+
+/// Holds details about an error encountered by a function in the C interface.
+///
+/// Functions that accept a pointer to this struct always overwrite its
+/// contents (code is set to VSF_SUCCESS when nothing went wrong). A nullptr
+/// can always be passed in place of a pointer to this struct.
+struct VsfErrorInfo{
+  int code;
+  char message[VSF_ERR_MSG_LEN];
+};
+
+#define VSF_INSTR_MAX_PROCS 32
+
+/// Optional diagnostics recorded by calc_vsf_props.
+///
+/// The per-process arrays are indexed by the (nominal) process id used to
+/// partition the work. Only the first ``n_procs`` entries are meaningful (if
+/// the work were ever split among more than VSF_INSTR_MAX_PROCS processes,
+/// the extra processes are folded into the last entry). The number of
+/// discarded pairs (those that don't lie in any distance bin) is
+/// ``proc_pairs_evaluated[i] - proc_pairs_binned[i]``.
+struct VsfInstrumentation{
+  size_t n_procs;
+  double total_ns;  // wall time of the full call
+  double setup_ns;  // building accumulators, bin edges & the partitioning
+  double merge_ns;  // consolidating the accumulators of each process
+  double proc_wall_ns[VSF_INSTR_MAX_PROCS];
+  uint64_t proc_tasks[VSF_INSTR_MAX_PROCS];
+  uint64_t proc_pairs_evaluated[VSF_INSTR_MAX_PROCS];
+  uint64_t proc_pairs_binned[VSF_INSTR_MAX_PROCS];
+};
+
+/// The pairs of coordinates that can be used for 2D binning
+enum VsfBin2DKind{
+  VSF_BIN2D_PARALLEL_PERP = 0,  // (|r_par|, r_perp) relative to an axis
+  VSF_BIN2D_DIST_COSTHETA = 1   // (|r|, |cos(theta)|) relative to an axis
+};
+
+/// Specifies a 2D Cartesian product of bins.
+///
+/// The first coordinate is binned with bin_edges_0 and the second coordinate
+/// with bin_edges_1. Each array of edges must monotonically increase and
+/// hold ``nbins_i + 1`` entries. The reference axis doesn't need to be
+/// normalized.
+struct Bin2DSpec{
+  int kind; // a VsfBin2DKind value
+  double reference_axis[3];
+  const double* bin_edges_0;
+  size_t nbins_0;
+  const double* bin_edges_1;
+  size_t nbins_1;
+};
+
+/// The ways that the difference in a quantity can be computed for a pair
+enum VsfQuanDiffKind{
+  VSF_QUAN_ABS_DIFF = 0,   // magnitude of the difference (any # components)
+  VSF_QUAN_SIGNED_DIFF = 1 // signed difference, a - b (1 component only)
+};
+
+/// Describes the quantity that is differenced for each pair of points.
+///
+/// The quantity is stored in the ``velocities`` array of a PointProps (the
+/// components are still separated by ``spatial_dim_stride``).
+struct QuanDiffSpec{
+  int kind; // a VsfQuanDiffKind value
+  size_t n_components;
+};
+
+/// Sentinel value for VsfBatchTerm::index_b that denotes an auto term
+#define VSF_BATCH_AUTO ((size_t)-1)
+
+/// Describes a single term of a batched calculation (see
+/// calc_sf_props_batched).
+///
+/// A term either covers the pairs between 2 point sets or (when index_b is
+/// VSF_BATCH_AUTO) the unique pairs within a single point set.
+struct VsfBatchTerm{
+  size_t index_a;   // index of the first point set
+  size_t index_b;   // index of the second point set or VSF_BATCH_AUTO
+  size_t out_index; // index of the output that the pairs are added to
 };
 
 /// This is used to specify the statistics that will be computed.
@@ -66,13 +162,107 @@ extern "C" {
 ///     point values.
 /// @param[out] out_i64_vals Preallocated array to store the output int64_t
 ///     values. 
+/// @param[out] instrumentation Optional pointer to a struct where timers and
+///     counters are recorded. When this is a nullptr, a version of the pair
+///     loop without any instrumentation is used (so there is no overhead).
+/// @param[out] err_info Optional pointer to a struct where details about
+///     any error are recorded. This can be a nullptr.
+///
+/// @returns This returns ``VSF_SUCCESS`` on success and one of the other
+///     ``VsfErrorCode`` values on failure. This never terminates the program.
+int calc_vsf_props(const PointProps points_a, const PointProps points_b,
+                   const StatListItem* stat_list, size_t stat_list_len,
+                   const double *bin_edges, size_t nbins,
+                   const ParallelSpec parallel_spec,
+                   double *out_flt_vals, int64_t *out_i64_vals,
+                   VsfInstrumentation* instrumentation,
+                   VsfErrorInfo* err_info) noexcept;
+
+/// Computes the same properties as calc_vsf_props, except that the pairs are
+/// binned in 2D.
+///
+/// For a separation vector ``r`` and a unit reference axis ``n``, the
+/// VSF_BIN2D_PARALLEL_PERP coordinates are ``|r.n|`` and ``|r - (r.n)n|``,
+/// while the VSF_BIN2D_DIST_COSTHETA coordinates are ``|r|`` and
+/// ``|r.n|/|r|`` (pairs with zero separation are never binned in this case).
+/// The absolute value is used because the ordering of the points in a pair
+/// is arbitrary.
+///
+/// The output arrays have the same layout as the outputs of calc_vsf_props
+/// for ``nbins = bin_spec.nbins_0 * bin_spec.nbins_1``, where the bin with
+/// indices ``(i, j)`` has a flattened index of ``i * bin_spec.nbins_1 + j``.
+///
+/// @param[in]  bin_spec Specifies the binning.
+///
+/// See calc_vsf_props for a description of all of the other arguments.
+int calc_vsf_props_2D(const PointProps points_a, const PointProps points_b,
+                      const StatListItem* stat_list, size_t stat_list_len,
+                      const Bin2DSpec bin_spec,
+                      const ParallelSpec parallel_spec,
+                      double *out_flt_vals, int64_t *out_i64_vals,
+                      VsfInstrumentation* instrumentation,
+                      VsfErrorInfo* err_info) noexcept;
+
+/// Computes the same properties as calc_vsf_props for an arbitrary quantity
+/// (e.g. a scalar field like density or temperature) rather than velocity.
+///
+/// The quantity is passed in place of the velocities of points_a and
+/// points_b (it has ``quan_spec.n_components`` components rather than 3).
+/// Each pair contributes ``|q_a - q_b|`` (the Euclidean norm for multiple
+/// components) or, when ``quan_spec.kind`` is VSF_QUAN_SIGNED_DIFF,
+/// ``q_a - q_b``. Note that when points_b is omitted, the ordering within a
+/// pair is arbitrary, so signed differences are mostly meaningful between 2
+/// separate sets of points.
+///
+/// @param[in]  quan_spec Describes the quantity and how it's differenced.
+///
+/// See calc_vsf_props for a description of all of the other arguments.
+int calc_quan_sf_props(const PointProps points_a, const PointProps points_b,
+                       const StatListItem* stat_list, size_t stat_list_len,
+                       const double *bin_edges, size_t nbins,
+                       const QuanDiffSpec quan_spec,
+                       const ParallelSpec parallel_spec,
+                       double *out_flt_vals, int64_t *out_i64_vals,
+                       VsfInstrumentation* instrumentation,
+                       VsfErrorInfo* err_info) noexcept;
+
+/// Evaluates several terms (auto and cross structure function
+/// calculations) with a single team of processes.
+///
+/// This is intended for callers that would otherwise make a series of calls
+/// to calc_quan_sf_props (like the auto term of a subvolume and the cross
+/// terms with each of its neighbors). All of the pairs from all of the terms
+/// are split into chunks that are divided among the processes, which keeps
+/// the whole team busy (even when the individual terms are small) and only
+/// launches the team once. Pairs from terms that share an ``out_index`` are
+/// accumulated into the same output.
+///
+/// @param[in]  point_sets Array of the point sets that the terms refer to
+/// @param[in]  n_point_sets The length of point_sets
+/// @param[in]  terms Array of the terms to evaluate
+/// @param[in]  n_terms The length of terms
+/// @param[in]  n_outputs The number of outputs
+/// @param[out] out_flt_vals Array of n_outputs pointers. Each points to a
+///     preallocated buffer with the same layout as the out_flt_vals argument
+///     of calc_vsf_props.
+/// @param[out] out_i64_vals Array of n_outputs pointers. Each points to a
+///     preallocated buffer with the same layout as the out_i64_vals argument
+///     of calc_vsf_props.
 ///
-/// @returns This returns ``true`` on success and ``false`` on failure.
-bool calc_vsf_props(const PointProps points_a, const PointProps points_b,
-                    const StatListItem* stat_list, size_t stat_list_len,
-                    const double *bin_edges, size_t nbins,
-                    const ParallelSpec parallel_spec,
-                    double *out_flt_vals, int64_t *out_i64_vals) noexcept;
+/// See calc_quan_sf_props for a description of all of the other arguments.
+/// The results for a given ``parallel_spec.nproc`` don't depend on how the
+/// threads are scheduled.
+int calc_sf_props_batched(const PointProps* point_sets, size_t n_point_sets,
+                          const VsfBatchTerm* terms, size_t n_terms,
+                          const StatListItem* stat_list, size_t stat_list_len,
+                          const double *bin_edges, size_t nbins,
+                          const QuanDiffSpec quan_spec,
+                          const ParallelSpec parallel_spec,
+                          size_t n_outputs,
+                          double * const *out_flt_vals,
+                          int64_t * const *out_i64_vals,
+                          VsfInstrumentation* instrumentation,
+                          VsfErrorInfo* err_info) noexcept;
 
 #ifdef __cplusplus
 }
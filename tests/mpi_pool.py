@@ -0,0 +1,118 @@
+# this tests the machinery that TypedResultCommunication uses to send results
+# without pickling their arrays (it doesn't require MPI) and MPIPool.map
+# (test_mpi_map launches this file with mpiexec)
+
+import subprocess
+import sys
+
+import numpy as np
+
+from pyvsf._ArrayDict_cy import ArrayMap
+from pyvsf._MPIPool import _pack_result, _unpack_result
+
+def _assert_equal(ref, actual):
+    assert type(ref) is type(actual)
+    if isinstance(ref, dict):
+        assert list(ref.keys()) == list(actual.keys())
+        for key in ref:
+            _assert_equal(ref[key], actual[key])
+    elif isinstance(ref, (list, tuple)):
+        assert len(ref) == len(actual)
+        for ref_elem, actual_elem in zip(ref, actual):
+            _assert_equal(ref_elem, actual_elem)
+    elif isinstance(ref, np.ndarray):
+        assert ref.dtype == actual.dtype
+        assert ref.shape == actual.shape
+        np.testing.assert_array_equal(actual, ref)
+    else:
+        assert ref == actual
+
+def _transfer(packed):
+    # mimic the transfer: the receiver allocates a new ArrayMap with the same
+    # layout and fills its buffer
+    skeleton, array_map = packed
+    if array_map is None:
+        return skeleton, None
+    received = ArrayMap(array_map.entry_spec)
+    received.data_buffer[...] = array_map.data_buffer
+    return skeleton, received
+
+def test_pack_result():
+    rng = np.random.default_rng(seed = 12)
+    shared = rng.integers(-100, 100, size = (4,), dtype = np.int64)
+    results = [
+        # a result like the ones from small_dist_sf_props
+        (3, [[{'mean' : rng.random(7),
+               'counts' : np.arange(7, dtype = np.int64)},
+              {'2D_counts' : np.arange(12, dtype = np.int64).reshape(3, 4)}]]),
+        # nested dicts with mixed dtypes, empty arrays & non-array leaves
+        {
+            'i64' : rng.integers(-2**62, 2**62, size = (5,), dtype = np.int64),
+            'u64' : np.array([0, 2**63, 2**64 - 1], dtype = np.uint64),
+            'nested' : {
+                'f64' : rng.random((2, 3)),
+                'empty_f64' : np.empty((0,)),
+                'empty_i64' : np.empty((3, 0), dtype = np.int64),
+                'deeper' : {'u64' : np.arange(6, dtype = np.uint64),
+                            'label' : 'abc', 'none' : None}
+            },
+            # int32 arrays aren't stored in the ArrayMap
+            'i32' : np.arange(3, dtype = np.int32),
+            'scalar_arr' : np.array(2.5),
+            'scalar' : np.float64(-1.0),
+            'int' : 7,
+            'tuple' : (shared, 'x', 1.5),
+            'shared' : shared,
+        },
+        # results without any typed arrays
+        {'a' : None, 'b' : [1, 2.0, 'three'], 'c' : np.empty((0,))},
+        None,
+    ]
+
+    for result in results:
+        skeleton, array_map = _transfer(_pack_result(result))
+        _assert_equal(result, _unpack_result(skeleton, array_map))
+
+    # the arrays aren't pickled
+    _, array_map = _pack_result(results[1])
+    assert len(array_map) == 6
+    _, array_map = _pack_result(results[2])
+    assert array_map is None
+
+def _mpi_map_task(i):
+    # results hold typed arrays, arrays of other dtypes & plain objects. The
+    # sizes differ between tasks
+    return {'taskid' : i,
+            'f64' : np.arange(i + 1, dtype = np.float64) * 0.5,
+            'counts' : np.full((2, i + 1), i, dtype = np.int64),
+            'i32' : np.arange(3, dtype = np.int32),
+            'empty' : np.empty((0,))}
+
+def _check_mpi_map(n_tasks = 25):
+    # executed by every MPI process (the workers never return from MPIPool())
+    from pyvsf._MPIPool import MPIPool, TypedResultCommunication
+
+    pool = MPIPool()
+    assert isinstance(pool.result_comm_routines, TypedResultCommunication)
+
+    callback_taskids = []
+    results = pool.map(_mpi_map_task, range(n_tasks),
+                       callback = lambda result: \
+                       callback_taskids.append(result['taskid']))
+    pool.close()
+
+    assert sorted(callback_taskids) == list(range(n_tasks))
+    assert len(results) == n_tasks
+    for i, result in enumerate(results):
+        _assert_equal(_mpi_map_task(i), result)
+
+def test_mpi_map():
+    subprocess.run(['mpiexec', '-n', '3', sys.executable, __file__,
+                    '--mpi-map'], check = True)
+
+if __name__ == '__main__':
+    if '--mpi-map' in sys.argv[1:]:
+        _check_mpi_map()
+    else:
+        test_pack_result()
+        test_mpi_map()
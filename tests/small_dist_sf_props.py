@@ -5,6 +5,7 @@ import yt
 
 from pyvsf import vsf_props
 from pyvsf.small_dist_sf_props import BoxSelector, small_dist_sf_props
+from pyvsf.time_series import small_dist_sf_props_series, load_sf_series
 from pyvsf._kernels import BulkAverage, BulkVariance
 
 from bulk_statistics import (
@@ -336,6 +337,279 @@ def test_64_subvol(statistic):
 
 
 
+def _small_run_kwargs(**overrides):
+    # the small_dist_sf_props arguments shared by the tests of options that
+    # must not change the result: the histogram & variance of the central
+    # region, which is decomposed into 2x2x2 subvolumes. When statistic is
+    # overridden, the default kwargs (for the histogram) are dropped
+    out = dict(
+        dist_bin_edges = np.arange(step*0.5, 1.5 + step, step),
+        cut_regions = [None],
+        pos_units = "cloud_radius", quantity_units = "wind_velocity",
+        geometric_selector = BoxSelector(
+            left_edge = [-2.0,-2.0,-2.0], right_edge = [2.0,2.0,2.0],
+            length_unit = 'code_length',
+        ),
+        statistic = ['histogram', 'variance'],
+        kwargs = [{'val_bin_edges' : np.linspace(0.0, 2.0, num = 21)}, {}],
+        force_subvols_per_ax = (2,2,2)
+    )
+    if 'statistic' in overrides:
+        del out['kwargs']
+    out.update(overrides)
+    return out
+
+class _InterruptedRun(Exception):
+    pass
+
+class _CheckpointTestPool:
+    # processes the tasks in order and records the subvolumes of each task.
+    # When stop_after is specified, the run is interrupted right after the
+    # callback of that many tasks (with checkpoint_interval = 0, every
+    # callback writes a checkpoint)
+    def __init__(self, size, stop_after = None):
+        self.size = size
+        self.stop_after = stop_after
+        self.subvols = []
+
+    def map(self, func, iterable, callback = None):
+        for n_tasks, task in enumerate(iterable, start = 1):
+            self.subvols.extend(tuple(e) for e in task)
+            rslt = func(task)
+            if callback is not None:
+                callback(rslt)
+            if n_tasks == self.stop_after:
+                raise _InterruptedRun()
+            yield rslt
+
+def test_checkpoint():
+    # a calculation that is interrupted and then resumed from its checkpoint
+    # must reproduce the uninterrupted result, without recomputing the
+    # subvolumes that were completed before the interruption
+    import os, tempfile
+
+    kwargs = _small_run_kwargs()
+    ref = small_dist_sf_props(ds, **kwargs)[0]
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        path = os.path.join(tmp_dir, 'checkpoint.bin')
+        ckpt_kwargs = dict(checkpoint_path = path, checkpoint_interval = 0,
+                           max_subvols_per_chunk = 1, **kwargs)
+
+        pool = _CheckpointTestPool(8, stop_after = 3)
+        try:
+            small_dist_sf_props(lambda: ds, pool = pool, **ckpt_kwargs)
+        except _InterruptedRun:
+            pass
+        else:
+            raise AssertionError("the run wasn't interrupted")
+        completed = set(pool.subvols)
+        assert len(completed) == 3 and os.path.isfile(path)
+
+        pool = _CheckpointTestPool(8)
+        actual = small_dist_sf_props(lambda: ds, pool = pool,
+                                     **ckpt_kwargs)[0]
+        assert completed.isdisjoint(pool.subvols)
+        assert len(completed) + len(pool.subvols) == 8
+        assert (actual[0][0]['2D_counts'] == ref[0][0]['2D_counts']).all()
+        # (the order in which results are consolidated changes)
+        compare_variance(ref[1][0], actual[1][0], mean_rtol = 1e-13,
+                         variance_rtol = 1e-13)
+
+        # a checkpoint written by a calculation with different parameters
+        # can't be resumed
+        try:
+            small_dist_sf_props(
+                ds, **dict(ckpt_kwargs, cut_regions = [my_cut_regions[0]])
+            )
+        except ValueError:
+            pass
+        else:
+            raise AssertionError("a mismatched checkpoint was resumed")
+
+
+def test_time_series():
+    # a time-series where every snapshot is the same dataset should reproduce
+    # the result of small_dist_sf_props for every snapshot
+    import os, tempfile
+
+    cur_cut_regions = [None, my_cut_regions[0]]
+    kwargs = _small_run_kwargs(
+        cut_regions = cur_cut_regions,
+        geometric_selector = BoxSelector(
+            left_edge = [-2.0,-2.0,-1.0], right_edge = [2.0,2.0,1.0],
+            length_unit = 'code_length',
+        ),
+        force_subvols_per_ax = None
+    )
+    ref = small_dist_sf_props(ds, **kwargs)[0]
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        path = os.path.join(tmp_dir, 'series.bin')
+        file_sizes = []
+        for n_snaps in [2, 3]: # the second call resumes from the file
+            prop_ls, points_l, _, _ = small_dist_sf_props_series(
+                [ds] * n_snaps, output_path = path, positions_fixed = True,
+                **kwargs
+            )
+            assert len(prop_ls) == n_snaps
+            for prop_l in prop_ls:
+                for cr_index in range(len(cur_cut_regions)):
+                    assert (prop_l[0][cr_index]['2D_counts'] ==
+                            ref[0][cr_index]['2D_counts']).all()
+                    compare_variance(ref[1][cr_index], prop_l[1][cr_index])
+            file_sizes.append(os.path.getsize(path))
+        records = load_sf_series(path)
+        assert [record['snapshot'] for record in records] == [0, 1, 2]
+        for record in records:
+            compare_variance(ref[1][0], record['rslts'][1][0])
+
+        # a job killed while appending the last record leaves part of it
+        # behind. The partial record is discarded (rather than appended to)
+        # when the calculation resumes
+        os.truncate(path, (file_sizes[0] + file_sizes[1]) // 2)
+        assert len(load_sf_series(path)) == 2
+        small_dist_sf_props_series(
+            [ds] * 3, output_path = path, positions_fixed = True, **kwargs
+        )
+        assert os.path.getsize(path) == file_sizes[1]
+        records = load_sf_series(path)
+        assert [record['snapshot'] for record in records] == [0, 1, 2]
+        for record in records:
+            compare_variance(ref[1][0], record['rslts'][1][0])
+
+        # resuming with snapshots that differ from the recorded ones fails
+        try:
+            small_dist_sf_props_series(
+                [ds] * 3, output_path = path, positions_fixed = True,
+                snapshot_labels = ['1', '2', '3'], **kwargs
+            )
+        except ValueError:
+            pass
+        else:
+            raise AssertionError("mismatched snapshot_labels were accepted")
+
+    # the results don't change when the pair-bin caches are evicted (or are
+    # disabled)
+    for max_nbytes in [2**10, None]:
+        prop_ls = small_dist_sf_props_series(
+            [ds] * 2, positions_fixed = True,
+            max_pair_bin_cache_nbytes = max_nbytes, **kwargs
+        )[0]
+        for prop_l in prop_ls:
+            for cr_index in range(len(cur_cut_regions)):
+                assert (prop_l[0][cr_index]['2D_counts'] ==
+                        ref[0][cr_index]['2D_counts']).all()
+                compare_variance(ref[1][cr_index], prop_l[1][cr_index])
+
+
+def test_shared_subvol_cache():
+    # loading the subvolume data through a (tiny) shared cache must not change
+    # the result
+    import os, tempfile
+
+    kwargs = _small_run_kwargs(statistic = 'variance')
+    ref = small_dist_sf_props(ds, **kwargs)[0]
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        # the limit is small enough that entries get evicted
+        actual = small_dist_sf_props(ds, shared_subvol_cache_nbytes = 2**16,
+                                     shared_subvol_cache_root = tmp_dir,
+                                     **kwargs)[0]
+        assert os.listdir(tmp_dir) == [] # the cache was removed
+    compare_variance(ref[0], actual[0])
+
+
+def test_batch_ordering():
+    # every ordering must cover each subvolume exactly once, and reusing the
+    # loaded subvolumes between tasks must not change the result
+    from pyvsf.small_dist_sf_props import subvol_index_batch_generator
+
+    # (the central region is too small to hold 4x4x4 subvolumes)
+    kwargs = _small_run_kwargs(
+        statistic = 'variance',
+        geometric_selector = BoxSelector(
+            left_edge = [-4.0,-4.0,-4.0], right_edge = [4.0,4.0,4.0],
+            length_unit = 'code_length',
+        ),
+        force_subvols_per_ax = (4,4,4)
+    )
+    ref, _, _, subvol_decomp, _ = small_dist_sf_props(ds, **kwargs)
+
+    expected = sorted((x, y, z) for x in range(4) for y in range(4)
+                      for z in range(4))
+    for ordering in ['row', 'morton', 'slab']:
+        batches = list(subvol_index_batch_generator(subvol_decomp,
+                                                    n_workers = 4,
+                                                    ordering = ordering))
+        assert sorted(ind for batch in batches for ind in batch) == expected
+        if ordering == 'morton': # each batch is a 2x2x2 block
+            assert all(len(batch) == 8 for batch in batches)
+
+        actual = small_dist_sf_props(ds, batch_ordering = ordering,
+                                     max_reused_subvols = 16, **kwargs)[0]
+        # (the order in which results are consolidated changes)
+        compare_variance(ref[0], actual[0], mean_rtol = 1e-13,
+                         variance_rtol = 1e-13)
+
+
+class _SerialPool:
+    # processes the tasks in order, but reports multiple workers (so that
+    # small_dist_sf_props is willing to split subvolumes)
+    def __init__(self, size):
+        self.size = size
+
+    def map(self, func, iterable, callback = None):
+        for task in iterable:
+            rslt = func(task)
+            if callback is not None:
+                callback(rslt)
+            yield rslt
+
+def test_load_balance():
+    # splitting the expensive subvolumes into parts (and reordering the
+    # tasks) must not change the result
+    kwargs = _small_run_kwargs()
+    ref = small_dist_sf_props(ds, **kwargs)[0]
+    actual = small_dist_sf_props(lambda: ds, load_balance = True,
+                                 pool = _SerialPool(16), **kwargs)[0]
+    assert (actual[0][0]['2D_counts'] == ref[0][0]['2D_counts']).all()
+    compare_variance(ref[1][0], actual[1][0], mean_rtol = 1e-13,
+                     variance_rtol = 1e-13)
+
+
+def test_threads_per_worker():
+    # evaluating all of the structure function terms of a subvolume with a
+    # single batched call must not change the result (this also checks the
+    # batched path for a split subvolume)
+    kwargs = _small_run_kwargs()
+    ref = small_dist_sf_props(ds, **kwargs)[0]
+    for threads_per_worker, load_balance in [(1, False), (3, False),
+                                              (2, True)]:
+        actual = small_dist_sf_props(lambda: ds, load_balance = load_balance,
+                                     pool = _SerialPool(4),
+                                     threads_per_worker = threads_per_worker,
+                                     **kwargs)[0]
+        assert (actual[0][0]['2D_counts'] == ref[0][0]['2D_counts']).all()
+        compare_variance(ref[1][0], actual[1][0], mean_rtol = 1e-13,
+                         variance_rtol = 1e-13)
+
+def test_prefetch_depth():
+    # loading the neighboring subvolumes on a background thread must not
+    # change the result
+    kwargs = _small_run_kwargs(geometric_selector = None)
+    for threads_per_worker in [None, 2]:
+        ref = small_dist_sf_props(ds, threads_per_worker = threads_per_worker,
+                                  **kwargs)[0]
+        for prefetch_depth in [1, 3, 20]:
+            actual = small_dist_sf_props(
+                ds, threads_per_worker = threads_per_worker,
+                prefetch_depth = prefetch_depth, **kwargs
+            )[0]
+            assert (actual[0][0]['2D_counts'] == ref[0][0]['2D_counts']).all()
+            compare_variance(ref[1][0], actual[1][0])
+
+
 if __name__ == '__main__':
 
     # NOTE: I think there's need to directly invoke the kernel when it comes to
@@ -352,4 +626,24 @@ if __name__ == '__main__':
     print('\nconsidering multiple stats')
     # perform a test where we consider multiple statistics at the same time
     test_64_subvol(['histogram', 'variance', 'bulkvariance'])
-    
+
+    print('\nconsidering checkpointing')
+    test_checkpoint()
+
+    print('\nconsidering a time-series')
+    test_time_series()
+
+    print('\nconsidering a shared subvolume cache')
+    test_shared_subvol_cache()
+
+    print('\nconsidering the subvolume batch orderings')
+    test_batch_ordering()
+
+    print('\nconsidering load balancing')
+    test_load_balance()
+
+    print('\nconsidering multiple threads per worker')
+    test_threads_per_worker()
+
+    print('\nconsidering prefetching of neighboring subvolumes')
+    test_prefetch_depth()
@@ -1,5 +1,9 @@
 from collections.abc import Sequence
+import ctypes
 from functools import partial
+import os
+import threading
+import time
 
 from more_itertools import always_iterable, zip_equal
 import numpy as np
@@ -237,6 +241,24 @@ def _generate_vals(shape, generator):
     vel = generator.rand(*shape)*2 - 1.0
     return pos,vel
 
+def _pair_eval_stat_inputs():
+    # the distance bin edges & (variance, histogram) stat_kw_pairs shared by
+    # the tests of the alternative ways to evaluate pairs (PairBinCache,
+    # batched_sf_props & ThreadPool)
+    bin_edges = np.array([0.0, 0.05, 0.2, 0.3, 0.6, 1.0])
+    val_bin_edges = np.linspace(0.0, 2.0, 21)
+    var_kw_pairs = [('variance', {})]
+    hist_kw_pairs = [('histogram', {'val_bin_edges' : val_bin_edges})]
+    return bin_edges, var_kw_pairs, hist_kw_pairs
+
+def _assert_rslts_close(ref, other, rtol):
+    # compares 2 lists of result dicts (rtol = 0 requires identical values)
+    for ref_rslt, other_rslt in zip_equal(ref, other):
+        assert ref_rslt.keys() == other_rslt.keys()
+        for key in ref_rslt:
+            np.testing.assert_allclose(ref_rslt[key], other_rslt[key],
+                                       rtol = rtol, atol = 0)
+
 # now define the actual tests!
     
 def test_vsf_two_collections():
@@ -417,7 +439,148 @@ def extra_multiple_stats_test(alt_implementation_key = 'individual-stats',
             alt_implementation_key = alt_implementation_key
         )
 
-import time
+def test_error_reporting():
+    # errors detected by libvsf are reported through the VsfErrorInfo struct
+    # (rather than terminating the process)
+    pos_a, vel_a = _generate_vals((3,100), np.random.RandomState(seed = 10))
+
+    # call the C interface directly with 0 distance bins (the python wrapper
+    # would reject this before reaching the library)
+    points_a = pyvsf.pyvsf.POINTPROPS.construct(pos_a, vel_a,
+                                                dtype = np.float64,
+                                                allow_null_pair = False)
+    points_b = pyvsf.pyvsf.POINTPROPS.construct(None, None,
+                                                dtype = np.float64,
+                                                allow_null_pair = True)
+    stat_list, rslt_container = pyvsf.pyvsf._process_statistic_args(
+        [('variance', {})], np.array([0.0, 1.0]))
+    err_info = pyvsf.pyvsf.VSFERRORINFO()
+    code = pyvsf.pyvsf._lib.calc_vsf_props(
+        points_a, points_b,
+        stat_list.get_STATLISTITEM_ptr(), len(stat_list),
+        np.array([0.0, 1.0]), 0,
+        pyvsf.pyvsf._parallel_spec(1, False, None),
+        rslt_container.get_flt_vals_arr(),
+        rslt_container.get_i64_vals_arr(),
+        pyvsf.pyvsf._VSFINSTRUMENTATION_ptr(),
+        ctypes.byref(err_info)
+    )
+    assert code == err_info.code != 0
+    assert err_info.message == b'nbins must be positive'
+    try:
+        err_info.raise_if_error(code)
+    except ValueError as err:
+        assert str(err) == 'nbins must be positive'
+    else:
+        raise AssertionError('expected a ValueError')
+
+    # an invalid argument that is only validated by the library
+    try:
+        pyvsf.vsf_props_2D(pos_a, None, vel_a, None,
+                           bin_edges_0 = np.array([0.0, 1.0]),
+                           bin_edges_1 = np.array([0.0, 1.0]),
+                           reference_axis = [0.0, 0.0, 0.0])
+    except ValueError as err:
+        assert 'reference_axis must have a finite, non-zero magnitude' \
+            in str(err)
+    else:
+        raise AssertionError('expected a ValueError')
+
+def test_grid_vsf_props():
+    # compare pyvsf.grid_vsf_props against pyvsf.vsf_props evaluated on the
+    # cell-centers of the grid
+    generator = np.random.RandomState(seed = 2562)
+    shape, cell_widths = (6,5,7), (0.5, 0.7, 0.6)
+    vel = generator.rand(3, *shape)*2 - 1.0
+    pos = np.stack([(ind + 0.5)*width for ind, width
+                    in zip(np.indices(shape), cell_widths)])
+    # avoid bin edges that coincide with separations between cells
+    dist_bin_edges = np.array([0.05, 0.41, 1.03, 1.77, 2.93])
+
+    val_bin_edges = np.linspace(0.0, 3.0, num = 11)
+    stat_kw_pairs_l = [[('variance', {})],
+                       [('histogram', {'val_bin_edges' : val_bin_edges})]]
+
+    for mask in [None, generator.rand(*shape) > 0.3]:
+        selected = np.ones(shape, dtype = bool) if mask is None else mask
+        for stat_kw_pairs in stat_kw_pairs_l:
+            ref = pyvsf.vsf_props(pos[:,selected], None, vel[:,selected],
+                                  None, dist_bin_edges,
+                                  stat_kw_pairs = stat_kw_pairs)[0]
+            for nproc in [1,3]:
+                actual = pyvsf.grid_vsf_props(
+                    vel, dist_bin_edges, cell_widths, mask = mask,
+                    stat_kw_pairs = stat_kw_pairs, nproc = nproc)[0]
+                for key in ref:
+                    np.testing.assert_allclose(actual[key], ref[key],
+                                               rtol = 1e-12, atol = 0.0)
+
+def test_sampled_vsf_props():
+    generator = np.random.RandomState(seed = 4123)
+    pos_a, vel_a = _generate_vals((3,2000), generator)
+    pos_b, vel_b = _generate_vals((3,1500), generator)
+    dist_bin_edges = np.array([0.0, 0.05, 0.1, 0.2, 0.4, 0.8])
+
+    for pos_b_arg, vel_b_arg in [(None, None), (pos_b, vel_b)]:
+        ref = pyvsf.vsf_props(pos_a, pos_b_arg, vel_a, vel_b_arg,
+                              dist_bin_edges)[0]
+        rslts = []
+        for nproc in [1,3]:
+            rslt, info = pyvsf.sampled_vsf_props(
+                pos_a, pos_b_arg, vel_a, vel_b_arg, dist_bin_edges,
+                pairs_per_bin = 5000, seed = 42, nproc = nproc)
+            rslts.append(rslt[0])
+        # results shouldn't depend on the number of threads
+        for key in rslts[0]:
+            np.testing.assert_array_equal(rslts[0][key], rslts[1][key])
+
+        assert (rslts[0]['counts'] == 5000).all()
+        # the sampled means should agree with the actual values within a few
+        # standard errors (this is generous to avoid spurious failures)
+        z_scores = (rslts[0]['mean'] - ref['mean']) / info['std_err']
+        assert (np.abs(z_scores) < 5.0).all()
+        np.testing.assert_allclose(info['pair_count_estimate'],
+                                   ref['counts'], rtol = 0.15)
+
+def _periodic_sf2_direct(vel, dist_bin_edges, cell_widths):
+    # direct summation over all pairs of cells (with np.roll)
+    shape = vel.shape[1:]
+    n_cells = np.prod(shape)
+    counts = np.zeros((dist_bin_edges.size - 1,), dtype = np.int64)
+    total = np.zeros((dist_bin_edges.size - 1,), dtype = np.float64)
+    for offset in np.ndindex(*shape):
+        if offset == (0,0,0):
+            continue
+        dist = np.sqrt(sum(
+            (min(o, n - o) * width)**2
+            for o, n, width in zip(offset, shape, cell_widths)
+        ))
+        bin_ind = np.searchsorted(dist_bin_edges, dist, side = 'left') - 1
+        if (bin_ind < 0) or (bin_ind >= counts.size):
+            continue
+        shifted = np.roll(vel, shift = offset, axis = (1,2,3))
+        counts[bin_ind] += n_cells
+        total[bin_ind] += np.square(shifted - vel).sum()
+    # each unique pair was counted twice
+    mean = np.full_like(total, np.nan)
+    mean[counts > 0] = total[counts > 0] / counts[counts > 0]
+    return {'counts' : counts // 2, 'mean' : mean}
+
+def test_fft_sf2_props():
+    generator = np.random.RandomState(seed = 7325)
+    dist_bin_edges = np.array([0.0, 0.3, 0.61, 1.05, 1.6, 5.0])
+    for shape, cell_widths in [((6,5,4), (0.2, 0.25, 0.3)),
+                               ((5,5,5), (0.2, 0.2, 0.2))]:
+        vel = generator.rand(3, *shape)*2 - 1.0
+        ref = _periodic_sf2_direct(vel, dist_bin_edges, cell_widths)
+        actual = pyvsf.fft_sf2_props(vel, dist_bin_edges, cell_widths)
+        np.testing.assert_array_equal(actual['counts'], ref['counts'])
+        # the sum of counts should be the total number of unique pairs
+        n_cells = np.prod(shape)
+        assert actual['counts'].sum() == n_cells * (n_cells - 1) // 2
+        np.testing.assert_allclose(actual['mean'], ref['mean'],
+                                   rtol = 1e-12, atol = 0.0)
+
 def benchmark(shape_a, shape_b = None, seed = 156, skip_python_version = False,
               nproc = 1, **kwargs):
     generator = np.random.RandomState(seed = seed)
@@ -453,6 +616,825 @@ def benchmark(shape_a, shape_b = None, seed = 156, skip_python_version = False,
         dt = t1 - t0
         print(f"Scipy/Numpy version: {dt} seconds")
 
+def test_instrumentation():
+    # the counters reported through the instrumentation dict should be
+    # consistent with the computed statistics
+    pos_a, vel_a = _generate_vals((3,300), np.random.RandomState(seed = 11))
+    pos_b, vel_b = _generate_vals((3,200), np.random.RandomState(seed = 12))
+    bin_edges = np.array([0.0, 0.2, 0.4, 0.6])
+
+    for nproc in [1, 3]:
+        instrumentation = {}
+        rslt = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                               stat_kw_pairs = [('variance', {})],
+                               nproc = nproc,
+                               instrumentation = instrumentation)
+        assert instrumentation['n_procs'] == nproc
+        assert instrumentation['proc_pairs_evaluated'].sum() == 300*200
+        assert (instrumentation['proc_pairs_binned'].sum() ==
+                rslt[0]['counts'].sum())
+        assert (instrumentation['proc_wall_ns'] >= 0).all()
+        assert instrumentation['total_ns'] > 0
+
+    # with more processes than entries in the per-process arrays, the extra
+    # processes are folded into the last entry
+    with pyvsf.ThreadPool(4) as pool:
+        for cur_pool in [None, pool]:
+            instrumentation = {}
+            rslt = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                                   stat_kw_pairs = [('variance', {})],
+                                   nproc = 40, pool = cur_pool,
+                                   instrumentation = instrumentation)
+            assert instrumentation['proc_pairs_evaluated'].sum() == 300*200
+            assert (instrumentation['proc_pairs_binned'].sum() ==
+                    rslt[0]['counts'].sum())
+
+    instrumentation = {}
+    rslt = pyvsf.vsf_props(pos_a, None, vel_a, None, bin_edges,
+                           stat_kw_pairs = [('variance', {})],
+                           instrumentation = instrumentation)
+    assert instrumentation['proc_pairs_evaluated'].sum() == (300*299)//2
+    assert (instrumentation['proc_pairs_binned'].sum() ==
+            rslt[0]['counts'].sum())
+
+def test_tuning():
+    import tempfile
+    pos_a, vel_a = _generate_vals((3,300), np.random.RandomState(seed = 13))
+    pos_b, vel_b = _generate_vals((3,200), np.random.RandomState(seed = 14))
+    bin_edges = np.array([0.0, 0.1, 0.2, 0.4, 0.6])
+    stat_kw_pairs = [('variance', {})]
+
+    try:
+        # the linear & binary search variants of the kernel should agree
+        ref = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                              stat_kw_pairs = stat_kw_pairs)
+        pyvsf.set_tuning({'linear_search_max_nbins' : 8})
+        other = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                                stat_kw_pairs = stat_kw_pairs)
+        assert (ref[0]['counts'] == other[0]['counts']).all()
+        np.testing.assert_array_equal(ref[0]['mean'], other[0]['mean'])
+
+        # when the cost model predicts that team overhead dominates, only a
+        # single process should be used
+        pyvsf.set_tuning({'pair_ns' : 1.0, 'team_overhead_ns' : 1e9})
+        instrumentation = {}
+        pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                        stat_kw_pairs = stat_kw_pairs, nproc = 3,
+                        instrumentation = instrumentation)
+        assert instrumentation['n_procs'] == 1
+
+        # check that the parameters survive a round trip through a file. We
+        # only calibrate once (with a single process, which skips the
+        # measurements of the team overhead) to keep this test fast.
+        # Calibration must never modify the active parameters (not even
+        # while the measurements are in progress)
+        active_tuning = pyvsf.get_tuning()
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            path = os.path.join(tmp_dir, 'tuning.txt')
+            calibrated = []
+            thread = threading.Thread(target = lambda: calibrated.append(
+                pyvsf.calibrate_tuning(path = path, max_nproc = 1,
+                                       apply = False)
+            ))
+            thread.start()
+            while thread.is_alive():
+                assert pyvsf.get_tuning() == active_tuning
+            thread.join()
+            tuning = calibrated[0]
+            assert pyvsf.get_tuning() == active_tuning
+            assert all(val >= 0 for val in tuning.values())
+            with open(path, 'r') as f:
+                contents = f.read()
+
+            # loading the file is deterministic and doesn't modify it
+            assert pyvsf.load_tuning(path, apply = False) == tuning
+            assert pyvsf.load_tuning(path) == tuning
+            assert pyvsf.get_tuning() == tuning
+            with open(path, 'r') as f:
+                assert f.read() == contents
+
+            with open(path, 'a') as f:
+                f.write('not_a_key = 5\n')
+            try:
+                pyvsf.load_tuning(path)
+            except ValueError:
+                pass
+            else:
+                raise AssertionError('expected a ValueError')
+    finally:
+        pyvsf.set_tuning() # restore the defaults
+
+def test_point_set():
+    import pickle
+    from pyvsf.pyvsf import PointSet
+    pos_a, vel_a = _generate_vals((3,301), np.random.RandomState(seed = 15))
+    pos_b, vel_b = _generate_vals((3,77), np.random.RandomState(seed = 16))
+    bin_edges = np.array([0.0, 0.1, 0.2, 0.4, 0.6])
+    stat_kw_pairs = [('variance', {})]
+
+    points_a, points_b = PointSet(pos_a, vel_a), PointSet(pos_b, vel_b)
+    for point_set in [points_a, points_b]:
+        # each component should start on a 64-byte boundary
+        for arr in [point_set.pos, point_set.vel]:
+            assert all((arr[i].ctypes.data % 64) == 0 for i in range(3))
+    np.testing.assert_array_equal(points_a.pos, pos_a)
+    np.testing.assert_array_equal(points_b.vel, vel_b)
+
+    # results should be bitwise identical to the results from passing arrays.
+    # (A PointSet can be reused across calls)
+    for pair in [(pos_b, vel_b, points_b), (None, None, None)]:
+        ref = pyvsf.vsf_props(pos_a, pair[0], vel_a, pair[1], bin_edges,
+                              stat_kw_pairs = stat_kw_pairs)
+        other = pyvsf.vsf_props(points_a, pair[2], None, None, bin_edges,
+                                stat_kw_pairs = stat_kw_pairs)
+        assert (ref[0]['counts'] == other[0]['counts']).all()
+        np.testing.assert_array_equal(ref[0]['mean'], other[0]['mean'])
+        np.testing.assert_array_equal(ref[0]['variance'],
+                                      other[0]['variance'])
+
+    points_copy = pickle.loads(pickle.dumps(points_a))
+    np.testing.assert_array_equal(points_copy.vel, vel_a)
+
+def test_spatial_sort():
+    rng = np.random.RandomState(seed = 17)
+
+    # cell centers of an 8x8x8 grid (in a random order)
+    grid = np.stack(np.meshgrid(*[np.arange(8) + 0.5]*3, indexing = 'ij'))
+    grid = grid.reshape(3, -1)[:, rng.permutation(512)]
+
+    for curve in ['hilbert', 'morton']:
+        perm = pyvsf.spatial_sort_permutation(grid, curve = curve,
+                                              box_min = [0.0, 0.0, 0.0],
+                                              box_width = 8.0)
+        assert (np.sort(perm) == np.arange(512)).all()
+        steps = np.abs(np.diff(grid[:, perm], axis = 1)).sum(axis = 0)
+        if curve == 'hilbert':
+            # consecutive cells along a hilbert curve are always adjacent
+            assert (steps == 1.0).all()
+
+    # the permutation shouldn't depend on the number of processes
+    pos, vel = _generate_vals((3,20000), rng)
+    perm = pyvsf.spatial_sort_permutation(pos, nproc = 1)
+    assert (perm == pyvsf.spatial_sort_permutation(pos, nproc = 3)).all()
+
+    weights = rng.rand(20000)
+    perm2, (s_pos, s_vel, s_weights) = pyvsf.spatially_sort_points(
+        pos, vel, weights)
+    assert (perm2 == perm).all()
+    assert (s_weights == weights[perm]).all()
+
+    point_set = pyvsf.PointSet(pos[:, :500], vel[:, :500])
+    perm3 = point_set.spatial_sort()
+    np.testing.assert_array_equal(point_set.pos, pos[:, :500][:, perm3])
+    np.testing.assert_array_equal(point_set.vel, vel[:, :500][:, perm3])
+
+    # reordering points doesn't change the structure function (aside from
+    # round-off)
+    bin_edges = np.array([0.0, 0.1, 0.2, 0.4, 0.6])
+    ref = pyvsf.vsf_props(pos[:, :500], None, vel[:, :500], None, bin_edges)
+    other = pyvsf.vsf_props(point_set, None, None, None, bin_edges)
+    assert (ref[0]['counts'] == other[0]['counts']).all()
+    np.testing.assert_allclose(ref[0]['mean'], other[0]['mean'],
+                               rtol = 1e-13, atol = 0)
+
+def test_vsf_props_2D():
+    rng = np.random.RandomState(seed = 23)
+    pos_a, vel_a = _generate_vals((3,300), rng)
+    pos_b, vel_b = _generate_vals((3,200), rng)
+    axis = np.array([1.0, 2.0, -0.5])
+    unit_axis = axis / np.linalg.norm(axis)
+
+    val_bin_edges = np.array([0.0, 0.25, 0.5, 1.0, 2.0])
+    stat_kw_pairs = [('variance', {}),
+                     ('histogram', {'val_bin_edges' : val_bin_edges})]
+
+    def brute_force(pos_a, pos_b, vel_a, vel_b, mode, edges_0, edges_1):
+        if pos_b is None:
+            i, j = np.triu_indices(pos_a.shape[1], k = 1)
+            pos_b, vel_b = pos_a, vel_a
+        else:
+            i, j = [arr.ravel() for arr in np.meshgrid(
+                np.arange(pos_a.shape[1]), np.arange(pos_b.shape[1]),
+                indexing = 'ij')]
+        sep = pos_a[:, i] - pos_b[:, j]
+        vdiff = np.linalg.norm(vel_a[:, i] - vel_b[:, j], axis = 0)
+        proj = np.abs(unit_axis @ sep)
+        dist = np.linalg.norm(sep, axis = 0)
+        if mode == 'parallel_perp':
+            coords = (proj, np.sqrt(np.maximum(dist**2 - proj**2, 0.0)))
+        else:
+            coords = (dist, proj / dist)
+        # bins include their upper edge (the first bin also includes its
+        # lower edge)
+        inds = [np.where(coord == edges[0], 0,
+                         np.searchsorted(edges, coord, side = 'left') - 1)
+                for edges, coord in zip((edges_0, edges_1), coords)]
+        valid = ((inds[0] >= 0) & (inds[0] < edges_0.size - 1) &
+                 (inds[1] >= 0) & (inds[1] < edges_1.size - 1) & (dist > 0))
+        shape = (edges_0.size - 1, edges_1.size - 1)
+        counts = np.zeros(shape, dtype = np.int64)
+        mean = np.zeros(shape)
+        hist = np.zeros(shape + (val_bin_edges.size - 1,), dtype = np.int64)
+        for i0, i1, v in zip(inds[0][valid], inds[1][valid], vdiff[valid]):
+            counts[i0, i1] += 1
+            mean[i0, i1] += v
+            k = np.searchsorted(val_bin_edges, v, side = 'left') - 1
+            if 0 <= k < val_bin_edges.size - 1:
+                hist[i0, i1, k] += 1
+        with np.errstate(invalid = 'ignore'):
+            mean /= counts
+        return counts, mean, hist
+
+    cases = [('parallel_perp', np.array([0.0, 0.1, 0.3, 0.6, 1.0]),
+              np.array([0.0, 0.2, 0.5, 1.5])),
+             ('dist_costheta', np.array([0.0, 0.2, 0.4, 0.8, 1.5]),
+              np.array([0.0, 0.3, 0.6, 0.9, 1.0]))]
+    for mode, edges_0, edges_1 in cases:
+        # (multiple processes aren't supported yet for auto-sf calculations)
+        for pb, vb, nproc in [(None, None, 1), (pos_b, vel_b, 1),
+                              (pos_b, vel_b, 3)]:
+            rslts = pyvsf.vsf_props_2D(
+                pos_a, pb, vel_a, vb, edges_0, edges_1,
+                reference_axis = axis, mode = mode,
+                stat_kw_pairs = stat_kw_pairs, nproc = nproc)
+            counts, mean, hist = brute_force(pos_a, pb, vel_a, vb, mode,
+                                             edges_0, edges_1)
+            assert rslts[0]['counts'].shape == counts.shape
+            assert (rslts[0]['counts'] == counts).all()
+            np.testing.assert_allclose(rslts[0]['mean'], mean,
+                                       rtol = 1e-12, atol = 0)
+            assert rslts[1]['2D_counts'].shape == hist.shape
+            assert (rslts[1]['2D_counts'] == hist).all()
+
+    # the pool & instrumentation kwargs behave like they do for vsf_props
+    mode, edges_0, edges_1 = cases[0]
+    ref = pyvsf.vsf_props_2D(pos_a, pos_b, vel_a, vel_b, edges_0, edges_1,
+                             reference_axis = axis, mode = mode,
+                             stat_kw_pairs = stat_kw_pairs, nproc = 3)
+    with pyvsf.ThreadPool(3) as pool:
+        instrumentation = {}
+        out = pyvsf.vsf_props_2D(pos_a, pos_b, vel_a, vel_b, edges_0, edges_1,
+                                 reference_axis = axis, mode = mode,
+                                 stat_kw_pairs = stat_kw_pairs, nproc = 3,
+                                 pool = pool,
+                                 instrumentation = instrumentation)
+    for ref_rslt, out_rslt in zip_equal(ref, out):
+        for key in ref_rslt:
+            assert np.array_equal(ref_rslt[key], out_rslt[key])
+    assert instrumentation['n_procs'] == 3
+    assert instrumentation['proc_pairs_evaluated'].sum() == 300*200
+    assert (instrumentation['proc_pairs_binned'].sum() ==
+            ref[0]['counts'].sum())
+
+    # with a single bin along the second axis, 'dist_costheta' reduces to 1D
+    # binning by distance
+    edges = np.array([0.0, 0.2, 0.4, 0.8])
+    ref = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, edges)
+    other = pyvsf.vsf_props_2D(pos_a, pos_b, vel_a, vel_b, edges, [0.0, 1.0],
+                               mode = 'dist_costheta')
+    assert (ref[0]['counts'] == other[0]['counts'][:, 0]).all()
+
+    # on a grid, many pairs have a coordinate of exactly 0 (e.g. pairs in the
+    # same plane perpendicular to the axis). The first bin includes them
+    grid_pos = np.array(np.meshgrid(*[np.arange(4.0)]*3, indexing = 'ij'))
+    grid_pos = grid_pos.reshape(3, -1)
+    grid_vel = rng.rand(*grid_pos.shape)
+    n_pairs = grid_pos.shape[1] * (grid_pos.shape[1] - 1) // 2
+    for mode, edges_0, edges_1 in [('parallel_perp', [0.0, 0.5, 5.0],
+                                    [0.0, 0.5, 5.0]),
+                                   ('dist_costheta', [0.0, 6.0],
+                                    [0.0, 0.5, 1.0])]:
+        rslts = pyvsf.vsf_props_2D(grid_pos, None, grid_vel, None, edges_0,
+                                   edges_1, mode = mode)
+        counts = rslts[0]['counts']
+        assert counts.sum() == n_pairs
+        # 4 planes with 16 points (& 16 lines along the axis with 4 points)
+        if mode == 'parallel_perp':
+            assert counts[0, :].sum() == 4 * (16 * 15 // 2)
+            assert counts[:, 0].sum() == 16 * (4 * 3 // 2)
+        else:
+            i, j = np.triu_indices(grid_pos.shape[1], k = 1)
+            sep = grid_pos[:, i] - grid_pos[:, j]
+            costheta = np.abs(sep[2]) / np.linalg.norm(sep, axis = 0)
+            assert counts[0, 0] == (costheta <= 0.5).sum()
+
+    for kwargs in [dict(mode = 'unknown'), dict(reference_axis = [0,0,0])]:
+        try:
+            pyvsf.vsf_props_2D(pos_a, None, vel_a, None, edges, edges,
+                               **kwargs)
+        except ValueError:
+            pass
+        else:
+            raise AssertionError("expected a ValueError")
+
+def test_quan_sf_props():
+    rng = np.random.RandomState(seed = 31)
+    pos_a, vel_a = _generate_vals((3,400), rng)
+    pos_b, vel_b = _generate_vals((3,300), rng)
+    bin_edges = np.array([0.0, 0.1, 0.3, 0.6, 1.0])
+
+    # a scalar quantity matches a velocity with 2 components set to zero
+    pad = lambda arr: np.concatenate([arr[:1], np.zeros_like(arr[1:])])
+    for pb, vb in [(None, None), (pos_b, vel_b)]:
+        ref = pyvsf.vsf_props(pos_a, pb, pad(vel_a),
+                              None if vb is None else pad(vb), bin_edges)
+        other = pyvsf.quan_sf_props(pos_a, pb, vel_a[0],
+                                    None if vb is None else vb[0], bin_edges)
+        assert (ref[0]['counts'] == other[0]['counts']).all()
+        np.testing.assert_allclose(ref[0]['mean'], other[0]['mean'],
+                                   rtol = 1e-14, atol = 0)
+        np.testing.assert_allclose(ref[0]['variance'], other[0]['variance'],
+                                   rtol = 1e-12, atol = 0)
+
+    # compare signed scalar & generic N-component differences against a
+    # brute-force calculation
+    quan_a, quan_b = rng.rand(5, 400), rng.rand(5, 300)
+    sep = np.linalg.norm(pos_a[:, :, None] - pos_b[:, None, :], axis = 0)
+    bin_ind = np.searchsorted(bin_edges, sep, side = 'left') - 1
+    for quan_a_, quan_b_, signed in [(quan_a[0], quan_b[0], True),
+                                     (quan_a, quan_b, False),
+                                     (quan_a[:3], quan_b[:3], False)]:
+        diff = np.atleast_2d(quan_a_)[:, :, None] - \
+            np.atleast_2d(quan_b_)[:, None, :]
+        diff = diff[0] if signed else np.linalg.norm(diff, axis = 0)
+        rslt = pyvsf.quan_sf_props(pos_a, pos_b, quan_a_, quan_b_, bin_edges,
+                                   signed = signed, nproc = 2)[0]
+        for i in range(bin_edges.size - 1):
+            w = (bin_ind == i)
+            assert rslt['counts'][i] == w.sum()
+            np.testing.assert_allclose(rslt['mean'][i], diff[w].mean(),
+                                       rtol = 1e-12, atol = 0)
+
+    for kwargs in [dict(quan_a = quan_a, signed = True),
+                   dict(quan_a = quan_a[:2], quan_b = quan_b[:3])]:
+        kwargs.setdefault('quan_b', quan_b[:kwargs['quan_a'].shape[0]])
+        try:
+            pyvsf.quan_sf_props(pos_a, pos_b, dist_bin_edges = bin_edges,
+                                **kwargs)
+        except ValueError:
+            pass
+        else:
+            raise AssertionError("expected a ValueError")
+
+def test_streaming_vsf_props():
+    import tempfile
+    rng = np.random.RandomState(seed = 47)
+    pos_a, vel_a = _generate_vals((3,300), rng)
+    pos_b, vel_b = _generate_vals((3,1000), rng)
+    bin_edges = np.array([0.0, 0.1, 0.3, 0.6, 1.0])
+    val_bin_edges = np.array([0.0, 0.25, 0.5, 1.0, 2.0])
+    stat_kw_pairs = [('variance', {}),
+                     ('histogram', {'val_bin_edges' : val_bin_edges})]
+    ref = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                          stat_kw_pairs = stat_kw_pairs)
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        path = os.path.join(tmp_dir, 'points.bin')
+        pyvsf.write_raw_points(path, pos_b, vel_b)
+        mm_pos, mm_vel = pyvsf.open_raw_points(path)
+        assert (mm_pos == pos_b).all() and (mm_vel == vel_b).all()
+
+        for chunk_size, prefetch in [(128, True), (333, False), (5000, True)]:
+            rslts = pyvsf.streaming_vsf_props(
+                pos_a, vel_a, mm_pos, mm_vel, bin_edges,
+                stat_kw_pairs = stat_kw_pairs, chunk_size = chunk_size,
+                prefetch = prefetch)
+            assert (rslts[0]['counts'] == ref[0]['counts']).all()
+            np.testing.assert_allclose(rslts[0]['mean'], ref[0]['mean'],
+                                       rtol = 1e-13, atol = 0)
+            np.testing.assert_allclose(rslts[0]['variance'],
+                                       ref[0]['variance'],
+                                       rtol = 1e-12, atol = 0)
+            assert (rslts[1]['2D_counts'] == ref[1]['2D_counts']).all()
+        del mm_pos, mm_vel
+
+        # h5py datasets are read directly into the chunk buffers (1000 isn't
+        # a multiple of the chunk sizes, so the final chunks are partial)
+        import h5py
+        h5_path = os.path.join(tmp_dir, 'points.h5')
+        with h5py.File(h5_path, 'w') as f:
+            f['pos'], f['vel'] = pos_b, vel_b
+        with h5py.File(h5_path, 'r') as f:
+            for chunk_size, prefetch in [(128, True), (333, False)]:
+                rslts = pyvsf.streaming_vsf_props(
+                    pos_a, vel_a, f['pos'], f['vel'], bin_edges,
+                    stat_kw_pairs = stat_kw_pairs, chunk_size = chunk_size,
+                    prefetch = prefetch)
+                assert (rslts[0]['counts'] == ref[0]['counts']).all()
+                np.testing.assert_allclose(rslts[0]['mean'], ref[0]['mean'],
+                                           rtol = 1e-13, atol = 0)
+                assert (rslts[1]['2D_counts'] == ref[1]['2D_counts']).all()
+
+def test_serialize_sf_rslt():
+    import tempfile
+    from pyvsf._kernels import get_kernel
+    from pyvsf._kernels_cy import (serialize_sf_rslt, deserialize_sf_rslt,
+                                   append_sf_rslt_records,
+                                   load_sf_rslt_records)
+    rng = np.random.RandomState(seed = 21)
+    pos_a, vel_a = _generate_vals((3,200), rng)
+    bin_edges = np.array([0.0, 0.1, 0.3, 0.6, 1.0])
+    val_bin_edges = np.array([0.0, 0.25, 0.5, 1.0, 2.0])
+    stat_kw_pairs = [('variance', {}),
+                     ('histogram', {'val_bin_edges' : val_bin_edges})]
+    rslts = pyvsf.vsf_props(pos_a, None, vel_a, None, bin_edges,
+                            stat_kw_pairs = stat_kw_pairs,
+                            postprocess_stat = False)
+
+    def check(stat_kw_pair, rslt, loaded):
+        assert loaded[0] == stat_kw_pair[0]
+        assert loaded[1].keys() == stat_kw_pair[1].keys()
+        for key, val in stat_kw_pair[1].items():
+            assert (loaded[1][key] == val).all()
+        assert loaded[2].keys() == rslt.keys()
+        for key in rslt: # the round-trip must be exact
+            assert (loaded[2][key] == rslt[key]).all()
+        assert (loaded[3] == bin_edges).all()
+
+    records = [serialize_sf_rslt(get_kernel(name), kw, rslt, bin_edges)
+               for (name, kw), rslt in zip(stat_kw_pairs, rslts)]
+    for stat_kw_pair, rslt, record in zip(stat_kw_pairs, rslts, records):
+        assert record.dtype == np.uint8 and record.size % 8 == 0
+        loaded = deserialize_sf_rslt(record)
+        assert loaded[4] == record.size
+        check(stat_kw_pair, rslt, loaded)
+
+    # records can be concatenated
+    buf = np.concatenate(records)
+    loaded = deserialize_sf_rslt(buf, offset = records[0].size)
+    check(stat_kw_pairs[1], rslts[1], loaded)
+
+    # corrupted or truncated buffers are detected
+    for bad_buf in [records[0][:-8], records[0][:12]]:
+        try:
+            deserialize_sf_rslt(bad_buf)
+        except ValueError:
+            pass
+        else:
+            raise AssertionError("a truncated record wasn't detected")
+    bad_buf = records[0].copy()
+    bad_buf[0] = ord('X')
+    try:
+        deserialize_sf_rslt(bad_buf)
+    except ValueError:
+        pass
+    else:
+        raise AssertionError("a corrupted record wasn't detected")
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        path = os.path.join(tmp_dir, 'checkpoint.bin')
+        append_sf_rslt_records(path, records[:1])
+        append_sf_rslt_records(path, records[1:])
+        # simulate an interrupted write
+        with open(path, 'ab') as f:
+            f.write(records[0][:40].tobytes())
+        loaded = load_sf_rslt_records(path)
+        assert len(loaded) == 2
+        for stat_kw_pair, rslt, entry in zip(stat_kw_pairs, rslts, loaded):
+            check(stat_kw_pair, rslt, entry)
+
+def test_checkpoint_file():
+    import tempfile
+    from pyvsf._checkpoint import (checkpoint_fingerprint, save_checkpoint,
+                                   load_checkpoint)
+    rng = np.random.RandomState(seed = 5)
+    pos_a, vel_a = _generate_vals((3,100), rng)
+    bin_edges = np.array([0.0, 0.2, 0.5, 1.0])
+    val_bin_edges = np.array([0.0, 0.5, 1.0, 2.0])
+    stat_kw_pairs = [('variance', {}),
+                     ('histogram', {'val_bin_edges' : val_bin_edges})]
+    rslts = pyvsf.vsf_props(pos_a, None, vel_a, None, bin_edges,
+                            stat_kw_pairs = stat_kw_pairs,
+                            postprocess_stat = False)
+    entries = [((i, 0, 7), name, kw, rslt)
+               for i, ((name, kw), rslt) in enumerate(zip(stat_kw_pairs,
+                                                          rslts))]
+    entries.append(((0, 1, 3), 'variance', {}, {}))
+    fingerprint = checkpoint_fingerprint(bin_edges, stat_kw_pairs)
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        path = os.path.join(tmp_dir, 'checkpoint')
+        assert load_checkpoint(path, fingerprint) == (None, {})
+        save_checkpoint(path, fingerprint, {'completed' : [7]}, entries,
+                        bin_edges)
+        state, loaded = load_checkpoint(path, fingerprint)
+        assert state == {'completed' : [7]}
+        assert loaded.keys() == {e[0] for e in entries}
+        for key, _, _, rslt in entries:
+            assert loaded[key].keys() == rslt.keys()
+            for k in rslt:
+                assert (loaded[key][k] == rslt[k]).all()
+
+        try:
+            load_checkpoint(path, checkpoint_fingerprint(bin_edges))
+        except ValueError:
+            pass
+        else:
+            raise AssertionError("a mismatched fingerprint wasn't detected")
+
+        # a truncated file (whether it ends in the header or in a blob) is
+        # detected
+        nbytes = os.path.getsize(path)
+        with open(path, 'rb') as f:
+            contents = f.read()
+        for stop in [12, 20, nbytes - 8]:
+            with open(path, 'wb') as f:
+                f.write(contents[:stop])
+            try:
+                load_checkpoint(path, fingerprint)
+            except ValueError as e:
+                assert 'truncated' in str(e)
+            else:
+                raise AssertionError("a truncated checkpoint wasn't detected")
+
+def _neighbor_vdiff_hists_python(vel, cs, masks, bin_edges_l, n_ghost):
+    # straightforward numpy implementation
+    active = tuple(slice(0, -g) if g > 0 else slice(None) for g in n_ghost)
+    out = [np.zeros((len(masks), edges.size - 1), dtype = np.int64)
+           for edges in bin_edges_l]
+    for axis in range(3):
+        slc0, slc1 = list(active), list(active)
+        slc0[axis], slc1[axis] = slice(0, -1), slice(1, None)
+        slc0, slc1 = tuple(slc0), tuple(slc1)
+        dv = [comp[slc1] - comp[slc0] for comp in vel]
+        max_cs = np.maximum(cs[slc0], cs[slc1])
+        t0, t1 = (axis + 1) % 3, (axis + 2) % 3
+        vals = [dv[axis] / max_cs,
+                np.sqrt(np.square(dv[t0]) + np.square(dv[t1])) / max_cs,
+                np.sqrt(np.square(dv[0]) + np.square(dv[1]) +
+                        np.square(dv[2])) / max_cs]
+        for i, mask in enumerate(masks):
+            idx = np.logical_and(mask[slc0], mask[slc1])
+            for k in range(3):
+                out[k][i] += np.histogram(vals[k][idx],
+                                          bins = bin_edges_l[k])[0]
+    return out
+
+def test_grid_neighbor_vdiff_hists():
+    rng = np.random.RandomState(seed = 11)
+    shape = (9, 7, 8)
+    vel = [rng.uniform(-1.0, 1.0, size = shape) for _ in range(3)]
+    cs = rng.uniform(0.5, 1.5, size = shape)
+    cs[2,3,4] = np.nan
+    masks = [np.ones(shape, dtype = bool), rng.rand(*shape) > 0.3]
+    bin_edges_l = [np.linspace(-2.0, 2.0, 9), np.linspace(0.0, 2.0, 5),
+                   np.array([0.0, 0.5, 1.0, 2.0, 4.0])]
+
+    for n_ghost in [(0,0,0), (1,0,1), (1,1,1)]:
+        ref = _neighbor_vdiff_hists_python(vel, cs, masks, bin_edges_l,
+                                           n_ghost)
+        for nproc, order in [(1, 'C'), (3, 'C'), (2, 'F')]:
+            actual = pyvsf.grid_neighbor_vdiff_hists(
+                [np.asarray(comp, order = order) for comp in vel],
+                np.asarray(cs, order = order),
+                [np.asarray(mask, order = order) for mask in masks],
+                bin_edges_l, n_trailing_ghost = n_ghost, nproc = nproc)
+            for k in range(3):
+                assert (actual[k] == ref[k]).all()
+
+def test_bulk_moments():
+    from pyvsf._kernels import get_kernel
+    from pyvsf._kernels_nonsf import _weighted_variance
+
+    rng = np.random.RandomState(seed = 5)
+    n_points = 5000
+    quan = rng.normal(loc = 3.0, scale = 2.0, size = (3, n_points))
+    weights = {('gas', 'mass') : rng.uniform(0.5, 2.0, size = n_points),
+               ('index', 'volume') : np.ones(n_points)}
+    kw = {'weight_field' : [(('gas', 'mass'), 'g'),
+                            (('index', 'volume'), 'cm**3')]}
+
+    def reference(quan):
+        out = {'weight_total' : [], 'average' : [], 'variance' : []}
+        for field, _ in kw['weight_field']:
+            var, avg, wsum = _weighted_variance(
+                quan, axis = 1, weights = weights[field][:quan.shape[1]],
+                returned = True)
+            out['weight_total'].append(wsum[:1])
+            out['average'].append(avg)
+            out['variance'].append(var)
+        return dict((k, np.array(v)) for k,v in out.items())
+
+    ref = reference(quan)
+    for name in ['bulkaverage', 'bulkvariance']:
+        kernel = get_kernel(name)
+        rslt = kernel.non_vsf_func(quan, weights, kw)
+        assert sorted(rslt.keys()) == sorted(kernel.output_keys)
+        for k in kernel.output_keys:
+            np.testing.assert_allclose(rslt[k], ref[k], rtol = 1e-13)
+
+        # consolidate results computed for disjoint subsets
+        splits = [0, 17, 17, 1900, n_points]
+        parts = []
+        for start, stop in zip(splits[:-1], splits[1:]):
+            if start == stop:
+                parts.append({})
+                continue
+            sub_weights = dict((f, w[start:stop]) for f,w in weights.items())
+            parts.append(kernel.non_vsf_func(quan[:, start:stop],
+                                             sub_weights, kw))
+        consolidated = kernel.consolidate_stats(*parts)
+        for k in kernel.output_keys:
+            np.testing.assert_allclose(consolidated[k], ref[k], rtol = 1e-12)
+
+    # the result shouldn't depend on the number of processes
+    args = (quan, list(weights.values()))
+    serial = pyvsf.pyvsf.bulk_moments(*args)
+    parallel = pyvsf.pyvsf.bulk_moments(*args, nproc = 3)
+    for serial_arr, parallel_arr in zip(serial, parallel):
+        assert (serial_arr == parallel_arr).all()
+
+    # a weight total of zero
+    weight_total, avg, var = pyvsf.pyvsf.bulk_moments(
+        quan, [np.zeros(n_points)])
+    assert (weight_total == 0.0).all()
+    assert np.isnan(avg).all() and np.isnan(var).all()
+
+def test_pair_bin_cache():
+    rng = np.random.RandomState(seed = 17)
+    pos_a, vel_a = _generate_vals((3,500), rng)
+    pos_b, vel_b = _generate_vals((3,350), rng)
+    bin_edges, var_kw_pairs, hist_kw_pairs = _pair_eval_stat_inputs()
+    stat_kw_pairs = var_kw_pairs + hist_kw_pairs
+
+    for pb, vb in [(None, None), (pos_b, vel_b)]:
+        cache = pyvsf.PairBinCache(pos_a, pb, bin_edges, nproc = 2)
+        props = cache.props
+        assert props['duplicated_points'] == (pb is None)
+        assert 0 < props['n_runs'] <= props['n_pairs']
+
+        # velocities (with a single process, the results are identical)
+        ref = pyvsf.vsf_props(pos_a, pb, vel_a, vb, bin_edges,
+                              stat_kw_pairs = stat_kw_pairs)
+        assert props['n_pairs'] == ref[0]['counts'].sum()
+        _assert_rslts_close(ref, cache.sf_props(vel_a, vb,
+                                                stat_kw_pairs = stat_kw_pairs),
+                            rtol = 0)
+        _assert_rslts_close(ref, cache.sf_props(vel_a, vb, nproc = 3,
+                                                stat_kw_pairs = stat_kw_pairs),
+                            rtol = 1e-12)
+
+        # other quantities (reusing the same cache)
+        for n_components, signed in [(1, True), (1, False), (5, False)]:
+            quan_a = rng.rand(n_components, pos_a.shape[1])
+            quan_b = None if pb is None else rng.rand(n_components,
+                                                      pb.shape[1])
+            ref = pyvsf.quan_sf_props(pos_a, pb, quan_a, quan_b, bin_edges,
+                                      signed = signed)
+            other = cache.sf_props(quan_a, quan_b, signed = signed)
+            _assert_rslts_close(ref, other, rtol = 0)
+
+        try:
+            cache.sf_props(vel_a, vel_a if pb is None else None)
+        except ValueError:
+            pass
+        else:
+            raise AssertionError("a mismatched quan_b wasn't detected")
+
+    # the C interface tolerates a nullptr handle
+    assert pyvsf.pyvsf._lib.pairbincache_props(None).nbytes == 0
+    pyvsf.pyvsf._lib.pairbincache_destroy(None)
+
+def test_batched_sf_props():
+    # evaluating several terms with a single batched call must match the
+    # results of separate calls
+    rng = np.random.RandomState(seed = 23)
+    pos_a, vel_a = _generate_vals((3,600), rng)
+    pos_b, vel_b = _generate_vals((3,250), rng)
+    pos_c, vel_c = _generate_vals((3,1), rng)
+    bin_edges, var_kw_pairs, hist_kw_pairs = _pair_eval_stat_inputs()
+    stat_kw_pairs = var_kw_pairs + hist_kw_pairs
+
+    # the terms of output 0 cover every pair of the combined points
+    ref_combined = pyvsf.vsf_props(
+        np.concatenate([pos_a, pos_b], axis = 1), None,
+        np.concatenate([vel_a, vel_b], axis = 1), None, bin_edges,
+        stat_kw_pairs = stat_kw_pairs)
+    ref_cross = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                                stat_kw_pairs = stat_kw_pairs)
+
+    point_sets = [pyvsf.PointSet(pos_a, vel_a), (pos_b, vel_b),
+                  (pos_c, vel_c)]
+    terms = [(0, None, 0), (0, 1, 0), (1, None, 0), (0, 1, 1), (2, None, 2)]
+    for nproc, force_sequential in [(1, False), (3, True), (3, False)]:
+        out = pyvsf.batched_sf_props(point_sets, terms, bin_edges,
+                                     stat_kw_pairs = stat_kw_pairs,
+                                     nproc = nproc,
+                                     force_sequential = force_sequential)
+        assert len(out) == 3
+        _assert_rslts_close(ref_combined, out[0], rtol = 1e-12)
+        _assert_rslts_close(ref_cross, out[1], rtol = 1e-12)
+        assert out[2][1]['2D_counts'].sum() == 0
+
+    # the results don't depend on how the threads are scheduled
+    first, second = [pyvsf.batched_sf_props(point_sets, terms, bin_edges,
+                                            stat_kw_pairs = stat_kw_pairs,
+                                            nproc = 3) for _ in range(2)]
+    _assert_rslts_close(first[0], second[0], rtol = 0)
+
+    # scalar quantities (compared against quan_sf_props)
+    quan_a, quan_b = rng.rand(pos_a.shape[1]), rng.rand(pos_b.shape[1])
+    ref = pyvsf.quan_sf_props(pos_a, pos_b, quan_a, quan_b, bin_edges,
+                              signed = True, stat_kw_pairs = stat_kw_pairs)
+    out = pyvsf.batched_sf_props([(pos_a, quan_a), (pos_b, quan_b)],
+                                 [(0, 1, 0)], bin_edges, signed = True,
+                                 stat_kw_pairs = stat_kw_pairs, nproc = 2)
+    _assert_rslts_close(ref, out[0], rtol = 1e-12)
+
+    try:
+        pyvsf.batched_sf_props(point_sets, [(0, 3, 0)], bin_edges)
+    except ValueError:
+        pass
+    else:
+        raise AssertionError("an invalid term wasn't detected")
+
+def test_thread_pool():
+    # computing with a persistent ThreadPool must give results that are
+    # bitwise identical to the same calculation with a new OpenMP team
+    rng = np.random.RandomState(seed = 29)
+    pos_a, vel_a = _generate_vals((3,400), rng)
+    pos_b, vel_b = _generate_vals((3,150), rng)
+    bin_edges, var_kw_pairs, hist_kw_pairs = _pair_eval_stat_inputs()
+
+    with pyvsf.ThreadPool(3) as pool:
+        assert pool.nthreads == 3
+        # the pool's cached accumulators get reused (and replaced, when the
+        # statistics change) between calls
+        for stat_kw_pairs in [var_kw_pairs, var_kw_pairs, hist_kw_pairs,
+                              hist_kw_pairs + var_kw_pairs, var_kw_pairs]:
+            for nproc in [1, 2, 3, 5]:
+                ref = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                                      stat_kw_pairs = stat_kw_pairs,
+                                      nproc = nproc)
+                out = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                                      stat_kw_pairs = stat_kw_pairs,
+                                      nproc = nproc, pool = pool)
+                _assert_rslts_close(ref, out, rtol = 0)
+
+        # nproc = 0 uses all of the pool's threads
+        ref = pyvsf.quan_sf_props(pos_a, pos_b, vel_a[0], vel_b[0], bin_edges,
+                                  signed = True, nproc = 3)
+        out = pyvsf.quan_sf_props(pos_a, pos_b, vel_a[0], vel_b[0], bin_edges,
+                                  signed = True, nproc = 0, pool = pool)
+        _assert_rslts_close(ref, out, rtol = 0)
+
+        terms = [(0, None, 0), (0, 1, 0), (0, 1, 1)]
+        point_sets = [(pos_a, vel_a), (pos_b, vel_b)]
+        ref = pyvsf.batched_sf_props(point_sets, terms, bin_edges, nproc = 3)
+        out = pyvsf.batched_sf_props(point_sets, terms, bin_edges, nproc = 3,
+                                     pool = pool)
+        for ref_rslts, out_rslts in zip_equal(ref, out):
+            _assert_rslts_close(ref_rslts, out_rslts, rtol = 0)
+
+        # errors raised by the pool's threads are reported & the pool remains
+        # usable afterwards
+        try:
+            pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                            stat_kw_pairs = [('mean', {})], nproc = 3,
+                            pool = pool)
+        except NotImplementedError:
+            pass
+        else:
+            raise AssertionError("an error wasn't reported")
+        out = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                              nproc = 3, pool = pool)
+        _assert_rslts_close(pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b,
+                                            bin_edges, nproc = 3),
+                            out, rtol = 0)
+
+        # an error raised inside of one of the pool's tasks is reported
+        # without stopping the other tasks, and the pool remains usable
+        import ctypes
+        from pyvsf.pyvsf import _lib, VSFERRORINFO
+        n_tasks = 50
+        for failing_task in [0, 17, n_tasks - 1, n_tasks]:
+            counts = np.zeros((n_tasks,), dtype = np.uint64)
+            err_info = VSFERRORINFO()
+            code = _lib.vsfpool_run_test_tasks(
+                pool._get_handle(), n_tasks, failing_task,
+                counts.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64)),
+                ctypes.byref(err_info)
+            )
+            assert (counts == 1).all()
+            if failing_task < n_tasks:
+                assert code != 0
+                assert err_info.message.decode() == f"task {failing_task} failed"
+            else:
+                assert code == 0
+        out = pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges,
+                              nproc = 3, pool = pool)
+        _assert_rslts_close(pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b,
+                                            bin_edges, nproc = 3),
+                            out, rtol = 0)
+
+    try:
+        pyvsf.vsf_props(pos_a, pos_b, vel_a, vel_b, bin_edges, nproc = 3,
+                        pool = pool)
+    except ValueError:
+        pass
+    else:
+        raise AssertionError("a closed pool was used")
+
 if __name__ == '__main__':
     print('running tests against python implementation')
     test_vsf_single_collection()
@@ -475,6 +1457,24 @@ if __name__ == '__main__':
         skip_auto_sf = True,
         use_tol = True
     )
+    test_error_reporting()
+    test_grid_vsf_props()
+    test_fft_sf2_props()
+    test_sampled_vsf_props()
+    test_instrumentation()
+    test_tuning()
+    test_point_set()
+    test_spatial_sort()
+    test_vsf_props_2D()
+    test_quan_sf_props()
+    test_streaming_vsf_props()
+    test_serialize_sf_rslt()
+    test_checkpoint_file()
+    test_grid_neighbor_vdiff_hists()
+    test_bulk_moments()
+    test_pair_bin_cache()
+    test_batched_sf_props()
+    test_thread_pool()
 
     print('running a short benchmark. This takes ~20 s')
     val_bin_edges = np.geomspace(start = 1e-16, stop = 2.0, num = 100,